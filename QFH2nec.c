@@ -18,6 +18,19 @@
 #include<stdlib.h>
 #include<math.h>
 #include<ctype.h>
+#include<string.h>
+#include<limits.h>
+#include<time.h>
+#include<pthread.h>
+#include<unistd.h>
+#include<errno.h>
+#include<signal.h>
+#include<spawn.h>
+#include<fcntl.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/wait.h>
+#include "qfh.h"
 
 
 #define VERSION 0.1
@@ -40,96 +53,172 @@
  *    The last line specifies the start frequency, end frequency, and frequency increment, in MHz. 
  */
 
-/* This defines how small segments to use in the produced NEC2 code */
-#define radialsegments 5
-#define cornersegments 5
-#define helixsegments 20
-
-/* This is the length of the feedpoint */
-#define epsilon 2
-
-/* Mmmmm... pi */
-// actual better way to get the value
-const double pi = 4.0 * atan(1.0);
-
-typedef struct {
-    double H; //height
-    double D; //diameter
-    double R; //corner radius
-    double turns; //number of turns
-    double offset; //distance from origin
-    double Theta; //initial theta angle
-    double wire; //radius of wire
-    char feed; //O=open, S=short, T=terminated to 50 ohms
-    int feedpoint; //tag of feed segment
-} helix;
+#define MAXFORMATS 5
 
+/* Where write_design() puts the decks */
 typedef struct {
-    double freq; // Design frequency in MHz
-    double turns; // Number of turns (twist)
-    double length; // Length of one turn in wavelengths
-    double radius; // Bending radius in mm
-    double diam; // Conductor diameter in mm
-    double ratio; // Width/height ratio
-} design_req;
+    const char *dir; // directory of the deck files, NULL for the current one
+    qfh_archive *archive; // if set the decks are appended to it instead
+    qfh_membuf buf; // deck on its way to the archive
+    double span, fstep; // FR card width and step in MHz, 0 for 10 and 0.25
+    const qfh_grid *rp; // RP card, NULL for the whole sphere
+    qfh_stats *stats; // design, build and writing accounted here, or NULL
+    int check; // validate the geometry first, see check_model()
+} deck_output;
 
-void make_helix(FILE *, helix);
-void compute_design(design_req *requirements, helix *helixes);
-
-int ITG=1; // Tag increment
-int feedpointhack;
+void design_filename(char *filename, size_t len, const char *dir,
+                     design_req *req, const char *ext);
+int parse_formats(const char *list, const qfh_emitter **formats);
+int write_design(design_req *req, qfh_model *m, const qfh_emitter **formats,
+                 int nformats, deck_output *out, double spw, int verbose);
+int check_model(const qfh_model *m, qfh_stats *st, int verbose);
+double wall_time(void);
+int sweep_main(int argc, char *argv[]);
+int bench_writer(int argc, char *argv[]);
+int bench_geometry(int argc, char *argv[]);
+int bench_design(int argc, char *argv[]);
+int solve_main(int argc, char *argv[]);
+int optimize_main(int argc, char *argv[]);
+int tolerance_main(int argc, char *argv[]);
+int converge_main(int argc, char *argv[]);
+int bench_compact(int argc, char *argv[]);
+int bench_symmetric(int argc, char *argv[]);
+int bench_fast(int argc, char *argv[]);
+int pattern_main(int argc, char *argv[]);
+int serve_main(int argc, char *argv[]);
+int bench_serve(int argc, char *argv[]);
 
 int main(int argc, char*argv[])
 {
-    FILE *outfile;
-    int feed=0;
-    helix h[2];
     design_req req;
-    double fstart, fstop, fstep;
-    fstep = 0.25;
+    qfh_model m;
+    const qfh_emitter *formats[MAXFORMATS];
+    deck_output out={NULL, NULL, {NULL, 0, 0}, 0, 0, NULL, NULL, 0};
+    qfh_archive archive;
+    qfh_grid rp;
+    qfh_stats stats;
+    const char *archive_path=NULL, *json=NULL;
+    int nformats=1, failed, print_stats=0;
+    double spw=0, t0=wall_time();
+    char err[100];
+    
+    if(argc>1 && strcmp(argv[1],"--sweep")==0)
+        return sweep_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-writer")==0)
+        return bench_writer(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-geometry")==0)
+        return bench_geometry(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-design")==0)
+        return bench_design(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--solve")==0)
+        return solve_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--optimize")==0)
+        return optimize_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--tolerance")==0)
+        return tolerance_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--converge")==0)
+        return converge_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-compact")==0)
+        return bench_compact(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-symmetric")==0)
+        return bench_symmetric(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-fast")==0)
+        return bench_fast(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--pattern")==0)
+        return pattern_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--serve")==0)
+        return serve_main(argc-1, argv+1);
+    if(argc>1 && strcmp(argv[1],"--bench-serve")==0)
+        return bench_serve(argc-1, argv+1);
+    
+    qfh_stats_init(&stats);
+    formats[0]=qfh_find_emitter("nec");
+    while(argc>2 && argv[1][0]=='-' && !isdigit((unsigned char)argv[1][1])) {
+        if(strcmp(argv[1],"--stats")==0) {
+            print_stats=1;
+            argc-=1;
+            argv+=1;
+            continue;
+        }
+        if(strcmp(argv[1],"--check")==0) {
+            out.check=1;
+            argc-=1;
+            argv+=1;
+            continue;
+        }
+        if(strcmp(argv[1],"--format")==0) {
+            if((nformats=parse_formats(argv[2], formats))==0) {
+                printf("Invalid output format list %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"--spw")==0) {
+            if((spw=atof(argv[2]))<=0) {
+                printf("Invalid segments per wavelength %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"--archive")==0)
+            archive_path=argv[2];
+        else if(strcmp(argv[1],"--span")==0) {
+            if((out.span=atof(argv[2]))<=0) {
+                printf("Invalid frequency span %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"--fstep")==0) {
+            if((out.fstep=atof(argv[2]))<=0) {
+                printf("Invalid frequency step %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"--rp")==0) {
+            if(qfh_grid_parse(&rp, argv[2])) {
+                printf("Invalid radiation pattern grid %s\n",argv[2]);
+                exit(1);
+            }
+            out.rp=&rp;
+        } else if(strcmp(argv[1],"--stats-json")==0)
+            json=argv[2];
+        else
+            break;
+        argc-=2;
+        argv+=2;
+    }
     
     if(argc!=6+1) {
-        printf("Usage:\nQFH2nec <Design frequency in MHz> <Number of turns> <Length of one turn in wavelengths> <Bending radius> <Conductor diameter> <Width/height ratio>\n");
+        printf("Usage:\nQFH2nec [--format nec,necgh,necgr,csv,bin] [--spw segments] [--archive file] [--span MHz] [--fstep MHz] [--rp grid] [--check] [--stats] [--stats-json file] <Design frequency in MHz> <Number of turns> <Length of one turn in wavelengths> <Bending radius> <Conductor diameter> <Width/height ratio>\n");
+        printf("QFH2nec --sweep [-j threads] [-o directory] [--archive file] [--format nec,necgh,necgr,csv,bin] [--spw segments] [--span MHz] [--fstep MHz] [--rp grid] [--check] [--stats] [--stats-json file] [--bench] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        printf("  In sweep mode every value is either a number, a list a,b,c or a range start:stop:step\n");
+        printf("  --archive appends the decks to one archive file, see qfharc\n");
+        printf("  --spw chooses the segmentation for that many segments per wavelength at the top of the sweep\n");
+        printf("  --check rejects designs with touching wires before writing them\n");
+        printf("QFH2nec --bench-writer [designs]\n");
+        printf("QFH2nec --bench-geometry [designs] [helical segments]\n");
+        printf("QFH2nec --bench-design [designs]\n");
+        printf("QFH2nec --bench-compact [designs]\n");
+        printf("QFH2nec --bench-symmetric [-j threads] [--spw segments] [<frequency> <turns> <length> <radius> <diameter> <ratio>]\n");
+        printf("QFH2nec --bench-fast [-j threads] [--spw segments] [--span MHz] [--fstep MHz] [--tol tolerance] [<frequency> <turns> <length> <radius> <diameter> <ratio>]\n");
+        printf("QFH2nec --pattern [-j threads] [--spw segments] [--symmetric] [--grid full|zenith|elevation|horizon|ntheta,nphi,theta0,phi0,dtheta,dphi] [--freq MHz] [--axial] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        printf("QFH2nec --serve [--socket path] [--format name] [--spw segments]\n");
+        printf("  Answers JSON line design requests on stdin, or on each connection to the socket\n");
+        printf("QFH2nec --bench-serve [-c clients] [-n requests] [--spawn requests]\n");
+        printf("QFH2nec --solve [-j threads] [--spw segments] [--symmetric] [--cache directory] [--span MHz] [--fstep MHz] [--fast tolerance] [--stats] [--stats-json file] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        printf("QFH2nec --optimize [-j threads] [--band MHz] [--points n] [--swr max] [--axial dB] [--gain dBi] [--turns lo:hi] [--length lo:hi] [--radius lo:hi] [--ratio lo:hi] [--spw segments] [-p population] [-g generations] [--seed n] [--cache directory] <frequency> <diameter>\n");
+        printf("QFH2nec --tolerance [-j threads] [-n samples] [--batch n] [--band MHz] [--points n] [--swr max] [--height mm] [--diameter mm] [--bend mm] [--wire mm] [--spw segments] [--seed n] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        printf("  Tolerances are [normal:|uniform:]mm, a standard deviation or a half width\n");
+        printf("QFH2nec --converge [-j threads] [--spw segments] [--ratio r] [--levels n] [--tol tolerance] [--freq MHz] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
         // TODO add more explanation about input
         exit(1);
     }
     
-    // Design frequency validation
     sscanf(argv[1],"%lf",&req.freq);
-    if(req.freq < 10 || req.freq > 5000) {
-        printf("Design frequency %f is not in the range 10-5000MHz",req.freq);
-        exit(1);
-    }
-    // Turn number validation
     sscanf(argv[2],"%lf",&req.turns);
-    if(req.turns < 0.1 || req.turns > 50) {
-        printf("Turn number %f is not in the range 0.1-50",req.turns);
-        exit(1);
-    }
-    // One turn wavelength validation
     sscanf(argv[3],"%lf",&req.length);
-    if(req.length < 0.1 || req.length > 5) {
-        printf("One turn length %f is not in the range 0.1-5",req.length);
-        exit(1);
-    }
-    // Bending radius validation
     sscanf(argv[4],"%lf",&req.radius);
-    if(req.radius < 1 || req.radius > 1000) {
-        printf("Bending radius %f is not in the range 1-1000",req.radius);
-        exit(1);
-    }
-    // Conductor diameter validation
     sscanf(argv[5],"%lf",&req.diam);
-    if(req.diam < 1 || req.diam > 50) {
-        printf("Conductor diameter %f is not in the range 1-50",req.diam);
-        exit(1);
-    }
-    // Width/height ratio validation
     sscanf(argv[6],"%lf",&req.ratio);
-    if(req.ratio < 0.1 || req.ratio > 2) {
-        printf("Width/height ratio %f is not in the range 0.1-2",req.ratio);
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
         exit(1);
     }
+    qfh_stats_stop(&stats, QFH_PHASE_PARSE, t0);
     /*printf("Here is what was scanned:\n");
     printf("Frequency %f\n",req.freq);
     printf("Turn number %f\n",req.turns);
@@ -138,311 +227,2690 @@ int main(int argc, char*argv[])
     printf("Conductor diameter %f\n",req.diam);
     printf("Width/height ratio %f\n",req.ratio);*/
     
-    char filename[50];
-    sprintf(filename, "QFH %4.1f_%.1f_%.2f_%.1f_%.1f_%.1f.nec",req.freq, req.turns, req.ratio, req.length, req.radius, req.diam);
+    memset(&m, 0, sizeof(m));
+    if(archive_path) {
+        if(qfh_archive_open(&archive, archive_path)) {
+            printf("Could not open archive %s\n",archive_path);
+            exit(1);
+        }
+        out.archive=&archive;
+    }
+    if(print_stats || json)
+        out.stats=&stats;
+    failed=write_design(&req, &m, formats, nformats, &out, spw, 1);
+    if(archive_path && qfh_archive_close(&archive)) {
+        printf("Error writing archive %s\n",archive_path);
+        failed++;
+    }
+    if(out.stats)
+        failed+=qfh_stats_write(&stats, wall_time()-t0, print_stats, json);
+    qfh_model_free(&m);
+    qfh_membuf_free(&out.buf);
+    return failed ? 1 : 0;
+}
+
+/* Builds the output filename of a design, optionally inside directory dir */
+void design_filename(char *filename, size_t len, const char *dir,
+                     design_req *req, const char *ext)
+{
+    snprintf(filename, len, "%s%sQFH %4.1f_%.1f_%.2f_%.1f_%.1f_%.1f.%s",
+             dir ? dir : "", dir ? "/" : "",
+             req->freq, req->turns, req->ratio, req->length,
+             req->radius, req->diam, ext);
+}
+
+/* Parses a comma separated list of output formats, returns how many
+ * there are or 0 if one of them is unknown */
+int parse_formats(const char *list, const qfh_emitter **formats)
+{
+    char name[16];
+    int n=0;
+    size_t len;
+    
+    while(*list) {
+        len=strcspn(list, ",");
+        if(len>=sizeof(name) || n==MAXFORMATS)
+            return 0;
+        memcpy(name, list, len);
+        name[len]='\0';
+        if((formats[n++]=qfh_find_emitter(name))==NULL)
+            return 0;
+        list+=len;
+        if(*list==',')
+            list++;
+    }
+    return n;
+}
+
+/* Checks the loops of a built model with qfh_check_helix() and its
+ * wires with qfh_check_geometry() up to the top of its sweep, accounted
+ * in st, printing what was found if verbose. Returns 1 if the design has
+ * to be rejected. */
+int check_model(const qfh_model *m, qfh_stats *st, int verbose)
+{
+    qfh_check_result r;
+    char err[100];
+    double t0;
+    int i, failed;
+
+    for(i=0;i<m->nhelix;i++)
+        if(qfh_check_helix(&m->h[2*i], err, sizeof(err))) {
+            if(verbose)
+                printf("%s\n",err);
+            return 1;
+        }
+    t0=qfh_stats_start(st);
+    failed=qfh_check_geometry(&m->geom, m->fstop, &r);
+    qfh_stats_stop(st, QFH_PHASE_CHECK, t0);
+    if(failed) {
+        printf("Error allocating memory for the geometry check\n");
+        return 1;
+    }
+    if(verbose)
+        qfh_check_print(&r, stdout);
+    return r.errors>0;
+}
+
+/* Whether the formats a and b are written from the same build */
+static int same_build(const qfh_emitter *a, const qfh_emitter *b)
+{
+    return a->compact==b->compact && a->symmetric==b->symmetric;
+}
+
+/* Writes the deck of req in format to its own file or to the archive of
+ * out. Returns 1 if it could not be written. */
+static int write_deck(design_req *req, qfh_ctx *ctx, qfh_model *m,
+                      const qfh_emitter *format, deck_output *out,
+                      int verbose)
+{
+    FILE *outfile;
+    char filename[4096];
+    double t0;
+    int err;
+
+    ctx->error=0;
+    if(out->archive) {
+        ctx->write=qfh_membuf_sink;
+        ctx->opaque=&out->buf;
+        out->buf.len=0;
+        t0=qfh_stats_start(out->stats);
+        err=format->emit(ctx, m) ||
+            qfh_archive_append(out->archive, req, format->name,
+                               out->buf.data, out->buf.len);
+        qfh_stats_stop(out->stats, QFH_PHASE_EMIT, t0);
+        if(err)
+            printf("Error archiving the %s deck\n",format->name);
+        else if(verbose)
+            printf("Archived the %s deck\n",format->name);
+        return err;
+    }
+    design_filename(filename, sizeof(filename), out->dir, req, format->ext);
     if((outfile=fopen(filename,"w"))==NULL) {
         printf("Could not open output file %s\n",filename);
-        exit(1);
+        return 1;
     }
-    printf("The output filename is %s\n",filename);
-    
-    compute_design(&req, h);
-    
-    fprintf(outfile, "CM NEC2 Input File produced by helix2nec\n");
-    fprintf(outfile, "CM Parameters:\n");
-    fprintf(outfile, "CM Helix 1:"
-    " H1=%.5E D1=%.5E H2=%.5E D2=%.5E\n",
-    h[0].H, h[0].D, h[1].H, h[1].D);
-    fprintf(outfile, "CM turns=%.5E R=%.5E, wire=%.5E\n",
-            h[0].turns, h[0].R, h[0].wire);
-    fprintf(outfile, "CM offset=%.5E theta=%.5E ",
-            h[0].offset, h[0].Theta);
-    h[1].wire=(h[0].wire/=2); //diameter to radius
-    h[0].Theta=h[0].Theta/360*2*pi; //degrees to radians
-    h[1].Theta=h[0].Theta+pi/2;
-    switch(toupper(h[0].feed)) {
-        case 'O':
-            fprintf(outfile,"open\n");
-            break;
-        case 'S':
-            fprintf(outfile,"shorted\n");
-            break;
-        case 'T':
-            fprintf(outfile,"terminated\n");
+    if(verbose)
+        printf("The output filename is %s\n",filename);
+    ctx->write=qfh_file_sink;
+    ctx->opaque=outfile;
+    t0=qfh_stats_start(out->stats);
+    err=format->emit(ctx, m) | fclose(outfile);
+    qfh_stats_stop(out->stats, QFH_PHASE_EMIT, t0);
+    if(err)
+        printf("Error writing output file %s\n",filename);
+    return err!=0;
+}
+
+/* Sizes a design once and writes it in every requested format, to its
+ * own file or to the archive of out. The geometry is built once for the
+ * formats that take the plain model and once more for each compact or
+ * symmetric flavour they ask for, so every deck is the one a run with
+ * that format alone writes. The model m and the buffer of out are reused
+ * between calls so that they are only allocated once. With spw>0 the
+ * segmentation is chosen for that many segments per wavelength. Returns
+ * the number of failed decks, or -1 if out->check is set and the design
+ * is rejected. */
+int write_design(design_req *req, qfh_model *m, const qfh_emitter **formats,
+                 int nformats, deck_output *out, double spw, int verbose)
+{
+    helix h[2];
+    qfh_ctx ctx;
+    char err[100];
+    double t0=qfh_stats_start(out->stats);
+    int i, j, failed=0;
+    
+    qfh_design_model(req, h, m);
+    if(qfh_design_band(m, req->freq, out->span, out->fstep, err,
+                       sizeof(err))) {
+        if(verbose)
+            printf("%s\n",err);
+        return nformats;
+    }
+    m->rp=out->rp;
+    qfh_stats_stop(out->stats, QFH_PHASE_DESIGN, t0);
+    qfh_init(&ctx, NULL, qfh_file_sink, NULL);
+    ctx.stats=out->stats;
+    if(spw>0)
+        qfh_adaptive_segmentation(m, spw, &ctx.seg);
+    for(i=0;i<nformats;i++) {
+        for(j=0;j<i && !same_build(formats[j], formats[i]);j++)
+            ;
+        if(j<i) // written from the build of an earlier format
+            continue;
+        ctx.compact=formats[i]->compact;
+        ctx.symmetric=formats[i]->symmetric;
+        if(qfh_build_model(&ctx, m)) {
+            printf("Error building the geometry\n");
+            return nformats;
+        }
+        if(verbose)
+            printf("Segmentation: %d radial, %d per bend, %d helical, "
+                   "%d segments in total\n", ctx.seg.radial, ctx.seg.corner,
+                   ctx.seg.helix, qfh_model_segments(m));
+        if(out->check && check_model(m, out->stats, verbose))
+            return -1;
+        for(j=i;j<nformats;j++)
+            if(same_build(formats[j], formats[i]))
+                failed+=write_deck(req, &ctx, m, formats[j], out, verbose);
+    }
+    return failed;
+}
+
+
+/*
+ * Parameter sweep mode.
+ * Every design_req field is given as a single value, a comma separated
+ * list or an inclusive start:stop:step range. The cartesian product of
+ * all fields is generated by a pool of worker threads, each point is
+ * written to its own deck file, or all of them are appended to one
+ * archive. Points outside the valid design range are skipped and counted,
+ * and so are those check_model() rejects with --check.
+ * In benchmark mode the decks go to a memory buffer instead, and a
+ * checksum over all of them shows that every thread count produced
+ * exactly the same output.
+ */
+
+#define MAXSWEEPVALUES 100000
+#define MAXSWEEPPOINTS 1000000000L // combinations of all the axes
+
+typedef struct {
+    int n;
+    double *v;
+} sweep_axis;
+
+typedef struct {
+    sweep_axis axis[6]; // in argv order: freq, turns, length, radius, diam, ratio
+    long npoints;
+    const char *dir;
+    qfh_archive *archive; // instead of the deck files
+    const qfh_emitter *formats[MAXFORMATS];
+    int nformats;
+    double spw; // segments per wavelength, 0 for the fixed segmentation
+    double span, fstep; // FR card width and step in MHz, 0 for the defaults
+    qfh_grid rp; // RP card
+    int stats; // account the phases in st
+    qfh_stats st; // merged over the workers
+    int bench; // write to memory instead of the deck files
+    int generic_layout; // build without the specialized helix layouts
+    int check; // check_model() every design before writing it
+    long next; // next point to be claimed by a worker
+    long written;
+    long segments; // total over the written decks
+    long skipped;
+    long rejected; // by check_model()
+    long failed;
+    unsigned long long checksum; // sum of the deck hashes in benchmark mode
+    pthread_mutex_t lock;
+} sweep_job;
+
+/* Parses a value, list or range specification into an axis.
+ * Returns 0 on success. */
+int parse_axis(const char *spec, sweep_axis *a)
+{
+    double start, stop, step;
+    const char *p;
+    char *end;
+    int i, n;
+    
+    if(sscanf(spec, "%lf:%lf:%lf", &start, &stop, &step)==3
+       && strchr(spec, ':')!=NULL) {
+        // the count is checked as a double, converting a larger one to
+        // int is undefined
+        if(!(step>0) || !(stop>=start) ||
+           !((stop-start)/step+1e-9<MAXSWEEPVALUES))
+            return 1;
+        n=(int)((stop-start)/step+1e-9)+1;
+        if((a->v=(double*)malloc(n*sizeof(double)))==NULL)
+            return 1;
+        for(i=0;i<n;i++)
+            a->v[i]=start+i*step;
+        a->n=n;
+        return 0;
+    }
+    
+    for(n=1,p=spec;*p;p++)
+        if(*p==',')
+            n++;
+    if((a->v=(double*)malloc(n*sizeof(double)))==NULL)
+        return 1;
+    for(i=0,p=spec;i<n;i++) {
+        a->v[i]=strtod(p, &end);
+        if(end==p || (*end!=',' && *end!='\0'))
+            return 1;
+        p=end+1;
+    }
+    a->n=n;
+    return 0;
+}
+
+/* Fills req with the sweep point number idx (mixed radix over the axes) */
+void sweep_point(sweep_job *job, long idx, design_req *req)
+{
+    double v[6];
+    int k;
+    
+    for(k=5;k>=0;k--) {
+        v[k]=job->axis[k].v[idx%job->axis[k].n];
+        idx/=job->axis[k].n;
+    }
+    req->freq=v[0];
+    req->turns=v[1];
+    req->length=v[2];
+    req->radius=v[3];
+    req->diam=v[4];
+    req->ratio=v[5];
+}
+
+/* FNV-1a hash of a deck */
+unsigned long long deck_hash(const char *data, size_t len)
+{
+    unsigned long long h=14695981039346656037ULL;
+    size_t i;
+    
+    for(i=0;i<len;i++) {
+        h^=(unsigned char)data[i];
+        h*=1099511628211ULL;
+    }
+    return h;
+}
+
+/* Worker thread: claims batches of points until the sweep is exhausted */
+void *sweep_worker(void *arg)
+{
+    sweep_job *job=(sweep_job*)arg;
+    design_req req;
+    helix h[2];
+    qfh_model m;
+    qfh_ctx ctx;
+    qfh_membuf buf={NULL, 0, 0};
+    qfh_stats stats, *st=job->stats ? &stats : NULL;
+    deck_output out={job->dir, job->archive, {NULL, 0, 0}, job->span,
+                     job->fstep, &job->rp, st, job->check};
+    char err[100];
+    long idx, first, last, written=0, segments=0, skipped=0, failed=0;
+    long rejected=0;
+    unsigned long long checksum=0;
+    const long batch=64;
+    double t0;
+    int i, j, bad;
+    
+    memset(&m, 0, sizeof(m));
+    qfh_stats_init(&stats);
+    for(;;) {
+        pthread_mutex_lock(&job->lock);
+        first=job->next;
+        job->next+=batch;
+        pthread_mutex_unlock(&job->lock);
+        if(first>=job->npoints)
             break;
-        case 'F':
-            fprintf(outfile,"feed\n");
-            feed+=1;
+        last=first+batch;
+        if(last>job->npoints)
+            last=job->npoints;
+        for(idx=first;idx<last;idx++) {
+            sweep_point(job, idx, &req);
+            if(qfh_check_design(&req, err, sizeof(err))) {
+                skipped++;
+                continue;
+            }
+            if(!job->bench) {
+                i=write_design(&req, &m, job->formats, job->nformats, &out,
+                               job->spw, 0);
+                if(i<0)
+                    rejected++;
+                else if(i)
+                    failed++;
+                else {
+                    written++;
+                    segments+=qfh_model_segments(&m);
+                }
+                continue;
+            }
+            buf.len=0;
+            qfh_init(&ctx, NULL, qfh_membuf_sink, &buf);
+            ctx.generic_layout=job->generic_layout;
+            ctx.stats=st;
+            t0=qfh_stats_start(st);
+            qfh_design_model(&req, h, &m);
+            if(qfh_design_band(&m, req.freq, job->span, job->fstep, err,
+                               sizeof(err))) {
+                failed++;
+                continue;
+            }
+            m.rp=&job->rp;
+            qfh_stats_stop(st, QFH_PHASE_DESIGN, t0);
+            if(job->spw>0)
+                qfh_adaptive_segmentation(&m, job->spw, &ctx.seg);
+            for(i=0,bad=0;i<job->nformats && !bad;i++) {
+                for(j=0;j<i && !same_build(job->formats[j], job->formats[i]);
+                    j++)
+                    ;
+                if(j<i)
+                    continue;
+                ctx.compact=job->formats[i]->compact;
+                ctx.symmetric=job->formats[i]->symmetric;
+                if(qfh_build_model(&ctx, &m))
+                    bad=1;
+                else if(job->check && check_model(&m, st, 0))
+                    bad=-1;
+                else {
+                    t0=qfh_stats_start(st);
+                    for(j=i;j<job->nformats;j++)
+                        if(same_build(job->formats[j], job->formats[i]))
+                            job->formats[j]->emit(&ctx, &m);
+                    qfh_stats_stop(st, QFH_PHASE_EMIT, t0);
+                }
+            }
+            if(bad<0) {
+                rejected++;
+                continue;
+            }
+            if(bad || ctx.error) {
+                failed++;
+                continue;
+            }
+            checksum+=deck_hash(buf.data, buf.len);
+            written++;
+            segments+=qfh_model_segments(&m);
+        }
+    }
+    qfh_model_free(&m);
+    qfh_membuf_free(&buf);
+    qfh_membuf_free(&out.buf);
+    
+    pthread_mutex_lock(&job->lock);
+    if(st)
+        qfh_stats_merge(&job->st, st);
+    job->written+=written;
+    job->segments+=segments;
+    job->skipped+=skipped;
+    job->rejected+=rejected;
+    job->failed+=failed;
+    job->checksum+=checksum;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* Runs the whole sweep on nthreads workers, returns the elapsed seconds */
+double run_sweep(sweep_job *job, int nthreads)
+{
+    pthread_t *tid;
+    double t0;
+    int i;
+    
+    if((tid=(pthread_t*)malloc(nthreads*sizeof(pthread_t)))==NULL) {
+        printf("Error allocating memory for %d threads\n",nthreads);
+        exit(1);
+    }
+    job->next=job->written=job->segments=job->skipped=job->failed=0;
+    job->rejected=0;
+    job->checksum=0;
+    qfh_stats_init(&job->st);
+    t0=wall_time();
+    for(i=0;i<nthreads;i++)
+        if(pthread_create(&tid[i], NULL, sweep_worker, job)) {
+            printf("Could not start worker thread %d\n",i);
+            exit(1);
+        }
+    for(i=0;i<nthreads;i++)
+        pthread_join(tid[i], NULL);
+    free(tid);
+    return wall_time()-t0;
+}
+
+int sweep_main(int argc, char *argv[])
+{
+    sweep_job job;
+    qfh_archive archive;
+    const char *names[6]={"frequency", "turns", "length",
+        "radius", "diameter", "ratio"}, *archive_path=NULL, *json=NULL;
+    double t, tref;
+    unsigned long long reference=0;
+    int i, k, nthreads=0, differ=0, print_stats=0;
+    
+    memset(&job, 0, sizeof(job));
+    job.rp=qfh_rp_default;
+    for(i=1;i<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i++) {
+        if(strcmp(argv[i],"-j")==0 && i+1<argc)
+            nthreads=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-o")==0 && i+1<argc)
+            job.dir=argv[++i];
+        else if(strcmp(argv[i],"--archive")==0 && i+1<argc)
+            archive_path=argv[++i];
+        else if(strcmp(argv[i],"--format")==0 && i+1<argc) {
+            if((job.nformats=parse_formats(argv[++i], job.formats))==0) {
+                printf("Invalid output format list %s\n",argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--spw")==0 && i+1<argc) {
+            if((job.spw=atof(argv[++i]))<=0) {
+                printf("Invalid segments per wavelength %s\n",argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--span")==0 && i+1<argc) {
+            if((job.span=atof(argv[++i]))<=0) {
+                printf("Invalid frequency span %s\n",argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--fstep")==0 && i+1<argc) {
+            if((job.fstep=atof(argv[++i]))<=0) {
+                printf("Invalid frequency step %s\n",argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--rp")==0 && i+1<argc) {
+            if(qfh_grid_parse(&job.rp, argv[++i])) {
+                printf("Invalid radiation pattern grid %s\n",argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--stats")==0)
+            job.stats=print_stats=1;
+        else if(strcmp(argv[i],"--stats-json")==0 && i+1<argc) {
+            job.stats=1;
+            json=argv[++i];
+        }
+        else if(strcmp(argv[i],"--bench")==0)
+            job.bench=1;
+        else if(strcmp(argv[i],"--check")==0)
+            job.check=1;
+        else {
+            printf("Unknown sweep option %s\n",argv[i]);
+            exit(1);
+        }
+    }
+    if(job.nformats==0) {
+        job.formats[0]=qfh_find_emitter("nec");
+        job.nformats=1;
+    }
+    if(argc-i!=6) {
+        printf("Usage: QFH2nec --sweep [-j threads] [-o directory] [--archive file] [--format nec,necgh,necgr,csv,bin] [--spw segments] [--span MHz] [--fstep MHz] [--rp grid] [--check] [--stats] [--stats-json file] [--bench] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        exit(1);
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    
+    job.npoints=1;
+    for(k=0;k<6;k++) {
+        if(parse_axis(argv[i+k], &job.axis[k])) {
+            printf("Invalid %s specification %s\n",names[k],argv[i+k]);
+            exit(1);
+        }
+        if(job.axis[k].n>MAXSWEEPPOINTS/job.npoints) {
+            printf("Sweep of more than %ld points\n",MAXSWEEPPOINTS);
+            exit(1);
+        }
+        job.npoints*=job.axis[k].n;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    
+    if(job.bench) {
+        // Scaling benchmark: 1, 2, 4, ... threads up to the requested count
+        for(k=1;;k*=2) {
+            if(k>nthreads)
+                k=nthreads;
+            t=run_sweep(&job, k);
+            if(k==1)
+                reference=job.checksum;
+            printf("%3d threads: %ld points in %.3f s, %.0f points/s%s\n",
+                   k, job.written, t, job.written/t,
+                   job.checksum==reference ? "" : ", OUTPUT DIFFERS");
+            if(job.checksum!=reference)
+                differ=1;
+            if(k==nthreads)
+                break;
+        }
+        // The same sweep built by the generic helix layout
+        tref=t;
+        job.generic_layout=1;
+        t=run_sweep(&job, nthreads);
+        printf("generic layout: %ld points in %.3f s, %.0f points/s, "
+               "specialized layouts %.2fx%s\n", job.written, t,
+               job.written/t, t/tref,
+               job.checksum==reference ? "" : ", OUTPUT DIFFERS");
+        if(job.checksum!=reference)
+            differ=1;
+    } else {
+        if(archive_path) {
+            if(qfh_archive_open(&archive, archive_path)) {
+                printf("Could not open archive %s\n",archive_path);
+                exit(1);
+            }
+            job.archive=&archive;
+        }
+        t=run_sweep(&job, nthreads);
+        if(archive_path && qfh_archive_close(&archive)) {
+            printf("Error writing archive %s\n",archive_path);
+            job.failed++;
+        }
+        printf("Wrote %ld decks (%ld skipped, ", job.written, job.skipped);
+        if(job.check)
+            printf("%ld rejected, ", job.rejected);
+        printf("%ld failed) in %.3f s with %d threads, %.0f points/s\n",
+               job.failed, t, nthreads, job.written/t);
+        printf("%ld segments in total, %.1f per deck\n", job.segments,
+               job.written ? (double)job.segments/job.written : 0.0);
+    }
+    // of the last run, phases summed over the threads
+    if(job.stats && qfh_stats_write(&job.st, t, print_stats, json))
+        job.failed++;
+    
+    pthread_mutex_destroy(&job.lock);
+    for(k=0;k<6;k++)
+        free(job.axis[k].v);
+    return job.failed || differ ? 1 : 0;
+}
+
+/*
+ * Deck writer microbenchmark: the same set of designs is written with the
+ * printf based reference writer and with the buffered writer, both into
+ * memory. Every deck is compared byte for byte.
+ */
+int bench_writer(int argc, char *argv[])
+{
+    design_req req;
+    helix h[2];
+    qfh_model m;
+    qfh_ctx ctx;
+    qfh_membuf ref={NULL, 0, 0}, fast={NULL, 0, 0};
+    double t0, tref=0, tfast=0, bytes=0;
+    long i, n=2000, differ=0;
+    
+    if(argc>1)
+        n=atol(argv[1]);
+    if(n<=0) {
+        printf("Usage: QFH2nec --bench-writer [designs]\n");
+        exit(1);
+    }
+    memset(&m, 0, sizeof(m));
+    for(i=0;i<n;i++) {
+        // spread the designs over the whole valid range
+        req.freq=10+fmod(i*7.31, 4990);
+        req.turns=0.1+fmod(i*0.37, 49.9);
+        req.length=0.1+fmod(i*0.013, 4.9);
+        req.radius=1+fmod(i*3.7, 999);
+        req.diam=1+fmod(i*0.71, 49);
+        req.ratio=0.1+fmod(i*0.0093, 1.9);
+        qfh_design_model(&req, h, &m);
+        qfh_init(&ctx, NULL, qfh_membuf_sink, &ref);
+        if(qfh_build_model(&ctx, &m)) {
+            printf("Error building the geometry\n");
+            exit(1);
+        }
+        
+        ref.len=0;
+        t0=wall_time();
+        qfh_emit_nec_printf(&ctx, &m);
+        tref+=wall_time()-t0;
+        
+        ctx.opaque=&fast;
+        fast.len=0;
+        t0=wall_time();
+        qfh_emit_nec(&ctx, &m);
+        tfast+=wall_time()-t0;
+        
+        if(ctx.error) {
+            printf("Error writing deck %ld\n",i);
+            exit(1);
+        }
+        if(ref.len!=fast.len || memcmp(ref.data, fast.data, ref.len))
+            differ++;
+        bytes+=ref.len;
+    }
+    printf("printf writer:   %ld decks in %.3f s, %.0f decks/s, %.1f MB/s\n",
+           n, tref, n/tref, bytes/tref/1e6);
+    printf("buffered writer: %ld decks in %.3f s, %.0f decks/s, %.1f MB/s\n",
+           n, tfast, n/tfast, bytes/tfast/1e6);
+    printf("speedup %.1fx, %ld decks differ\n", tref/tfast, differ);
+    qfh_membuf_free(&ref);
+    qfh_membuf_free(&fast);
+    qfh_model_free(&m);
+    return differ ? 1 : 0;
+}
+
+/*
+ * Point generation benchmark: first the sine and cosine kernel against
+ * libm on its own, over the angles a helix can have, then whole
+ * geometry builds at a high segmentation with the points computed
+ * either way. Reports the largest difference in ulp and in metres.
+ */
+
+/* Distance in units in the last place between two doubles */
+static long long ulp_diff(double a, double b)
+{
+    long long ia, ib;
+    
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    if(ia<0)
+        ia=LLONG_MIN-ia;
+    if(ib<0)
+        ib=LLONG_MIN-ib;
+    return ia>ib ? ia-ib : ib-ia;
+}
+
+int bench_geometry(int argc, char *argv[])
+{
+    design_req req;
+    helix h[2];
+    qfh_model m[2];
+    qfh_ctx ctx;
+    double *x, *s, *c, *s2, *c2, t0, tref=0, tfast=0, d, maxd=0;
+    const double *col[2][7];
+    long i, n=2000, nx=1<<20, differ=0;
+    long long u, maxs=0, maxc=0;
+    int k, w, segs=200;
+    
+    if(argc>1)
+        n=atol(argv[1]);
+    if(argc>2)
+        segs=atoi(argv[2]);
+    if(argc>3 || n<=0 || segs<1) {
+        printf("Usage: QFH2nec --bench-geometry [designs] [helical segments]\n");
+        exit(1);
+    }
+    
+    x=(double*)malloc(5*nx*sizeof(double));
+    if(x==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    s=x+nx;
+    c=s+nx;
+    s2=c+nx;
+    c2=s2+nx;
+    // up to 50 turns, the largest angle of the design range
+    for(i=0;i<nx;i++)
+        x[i]=-2*pi*50+4*pi*50*(double)i/nx+1e-3*sin((double)i);
+    t0=wall_time();
+    for(i=0;i<nx;i++) {
+        s[i]=sin(x[i]);
+        c[i]=cos(x[i]);
+    }
+    tref=wall_time()-t0;
+    t0=wall_time();
+    qfh_sincos(x, s2, c2, nx);
+    tfast=wall_time()-t0;
+    for(i=0;i<nx;i++) {
+        if((u=ulp_diff(s[i], s2[i]))>maxs)
+            maxs=u;
+        if((u=ulp_diff(c[i], c2[i]))>maxc)
+            maxc=u;
+    }
+    printf("libm sin, cos:  %ld angles in %.3f s, %.1f M/s\n",
+           nx, tref, nx/tref/1e6);
+    printf("qfh_sincos %-5s %ld angles in %.3f s, %.1f M/s, speedup %.1fx\n",
+           qfh_sincos_kernel(), nx, tfast, nx/tfast/1e6, tref/tfast);
+    printf("largest difference: sin %lld ulp, cos %lld ulp\n", maxs, maxc);
+    free(x);
+    
+    memset(m, 0, sizeof(m));
+    tref=tfast=0;
+    for(i=0;i<n;i++) {
+        // spread the designs over the whole valid range
+        req.freq=10+fmod(i*7.31, 4990);
+        req.turns=0.1+fmod(i*0.37, 49.9);
+        req.length=0.1+fmod(i*0.013, 4.9);
+        req.radius=1+fmod(i*3.7, 999);
+        req.diam=1+fmod(i*0.71, 49);
+        req.ratio=0.1+fmod(i*0.0093, 1.9);
+        for(k=0;k<2;k++) {
+            qfh_design_model(&req, h, &m[k]);
+            qfh_init(&ctx, NULL, NULL, NULL);
+            ctx.seg.helix=segs;
+            ctx.seg.corner=segs/10>1 ? segs/10 : 1;
+            ctx.libm_trig=!k;
+            t0=wall_time();
+            if(qfh_build_model(&ctx, &m[k])) {
+                printf("Error building the geometry\n");
+                exit(1);
+            }
+            if(k)
+                tfast+=wall_time()-t0;
+            else
+                tref+=wall_time()-t0;
+            col[k][0]=m[k].geom.x1;
+            col[k][1]=m[k].geom.y1;
+            col[k][2]=m[k].geom.z1;
+            col[k][3]=m[k].geom.x2;
+            col[k][4]=m[k].geom.y2;
+            col[k][5]=m[k].geom.z2;
+            col[k][6]=m[k].geom.radius;
+        }
+        if(m[0].geom.n!=m[1].geom.n) {
+            differ++;
+            continue;
+        }
+        for(w=0;w<m[0].geom.n;w++) {
+            if(m[0].geom.tag[w]!=m[1].geom.tag[w] ||
+               m[0].geom.segs[w]!=m[1].geom.segs[w])
+                differ++;
+            for(k=0;k<7;k++)
+                if((d=fabs(col[0][k][w]-col[1][k][w]))>maxd)
+                    maxd=d;
+        }
+    }
+    printf("libm points:    %ld designs of %d wires in %.3f s, %.0f designs/s\n",
+           n, m[0].geom.n, tref, n/tref);
+    printf("qfh_sincos:     %ld designs in %.3f s, %.0f designs/s, speedup %.1fx\n",
+           n, tfast, n/tfast, tref/tfast);
+    printf("largest coordinate difference %.3g m, %ld wires differ\n",
+           maxd, differ);
+    qfh_model_free(&m[0]);
+    qfh_model_free(&m[1]);
+    return differ || maxs>1 || maxc>1 ? 1 : 0;
+}
+
+/*
+ * Solve mode: the design is analysed with the built-in method of moments
+ * solver over the same frequency sweep as the deck, and the feed point
+ * impedance, SWR and zenith gain are printed. No deck is written.
+ */
+int solve_main(int argc, char *argv[])
+{
+    design_req req;
+    helix h[2];
+    qfh_model m;
+    qfh_ctx ctx;
+    qfh_result *res;
+    qfh_cache cache;
+    qfh_cache_key key;
+    qfh_mbpe mb;
+    qfh_stats stats;
+    const char *cache_dir=NULL, *json=NULL;
+    char err[100];
+    double t, t0=wall_time(), spw=0, span=0, fstep=0, tol=0;
+    int i, f, nthreads=0, symmetric=0, hit=0, print_stats=0;
+    
+    qfh_stats_init(&stats);
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0) {
+            if((spw=atof(argv[i+1]))<=0) {
+                printf("Invalid segments per wavelength %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--span")==0) {
+            if((span=atof(argv[i+1]))<=0) {
+                printf("Invalid frequency span %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--fstep")==0) {
+            if((fstep=atof(argv[i+1]))<=0) {
+                printf("Invalid frequency step %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--fast")==0) {
+            if((tol=atof(argv[i+1]))<=0) {
+                printf("Invalid fast sweep tolerance %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--cache")==0)
+            cache_dir=argv[i+1];
+        else if(strcmp(argv[i],"--stats-json")==0)
+            json=argv[i+1];
+        else if(strcmp(argv[i],"--symmetric")==0) {
+            symmetric=1;
+            i--;
+        } else if(strcmp(argv[i],"--stats")==0) {
+            print_stats=1;
+            i--;
+        } else
             break;
-        default:
-            printf("Error somewhere in the program, "
-            "helix number 1 (termination type)\n");
+    }
+    if(argc-i!=6) {
+        printf("Usage: QFH2nec --solve [-j threads] [--spw segments] [--symmetric] [--cache directory] [--span MHz] [--fstep MHz] [--fast tolerance] [--stats] [--stats-json file] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        exit(1);
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    sscanf(argv[i],"%lf",&req.freq);
+    sscanf(argv[i+1],"%lf",&req.turns);
+    sscanf(argv[i+2],"%lf",&req.length);
+    sscanf(argv[i+3],"%lf",&req.radius);
+    sscanf(argv[i+4],"%lf",&req.diam);
+    sscanf(argv[i+5],"%lf",&req.ratio);
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
+        exit(1);
+    }
+    qfh_stats_stop(&stats, QFH_PHASE_PARSE, t0);
+    
+    memset(&m, 0, sizeof(m));
+    t=qfh_stats_start(&stats);
+    qfh_design_model(&req, h, &m);
+    if(qfh_design_band(&m, req.freq, span, fstep, err, sizeof(err))) {
+        printf("%s\n",err);
+        exit(1);
+    }
+    qfh_stats_stop(&stats, QFH_PHASE_DESIGN, t);
+    qfh_init(&ctx, NULL, NULL, NULL);
+    ctx.symmetric=symmetric;
+    if(print_stats || json) {
+        ctx.stats=&stats;
+        m.stats=&stats;
+    }
+    if(spw>0)
+        qfh_adaptive_segmentation(&m, spw, &ctx.seg);
+    if((res=(qfh_result*)malloc(qfh_nfreq(&m)*sizeof(qfh_result)))==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    // fitted results are not kept in the cache
+    if(tol>0)
+        cache_dir=NULL;
+    if(cache_dir) {
+        if(qfh_cache_open(&cache, cache_dir)) {
+            printf("Could not open cache %s\n",cache_dir);
+            exit(1);
+        }
+    }
+    t=wall_time();
+    if(cache_dir) {
+        qfh_cache_key_make(&key, &req, &ctx, &m, 0);
+        hit=qfh_cache_get(&cache, &key, res, qfh_nfreq(&m), &m.geom)==
+            qfh_nfreq(&m);
+    }
+    if(!hit) {
+        qfh_geom_free(&m.geom);
+        if(qfh_build_model(&ctx, &m)) {
+            printf("Error building the geometry\n");
             exit(1);
+        }
+        if(tol>0 ? qfh_solve_fast(&m, nthreads, 0, tol, res, &mb) :
+           qfh_solve_model(&m, nthreads, 0, res)) {
+            printf("Error solving the model\n");
+            exit(1);
+        }
+        if(cache_dir && qfh_cache_put(&cache, &key, &m.geom, res,
+                                      qfh_nfreq(&m), wall_time()-t))
+            printf("Could not store the results in the cache\n");
     }
-    //}
-    if(feed==0) {
-        printf("No feed helix in model???\n");
+    t=wall_time()-t;
+    
+    printf("  Freq MHz      R ohm      X ohm    SWR 50  Zenith dBi   AR dB\n");
+    for(f=0;f<qfh_nfreq(&m);f++)
+        printf("%10.3f %10.2f %10.2f %9.2f %11.2f %7.2f\n", res[f].freq,
+               creal(res[f].z), cimag(res[f].z), res[f].swr, res[f].gain,
+               res[f].axial);
+    if(hit)
+        printf("%d segments, %d frequencies from the cache in %.1f us, "
+               "%.3f s of solving saved\n", qfh_model_segments(&m),
+               qfh_nfreq(&m), t*1e6, cache.stats.saved);
+    else if(tol>0) {
+        printf("%d segments, %d frequencies fitted from %d solved in %.3f s "
+               "with %d threads, estimated error %.1e\n",
+               qfh_model_segments(&m), qfh_nfreq(&m), mb.nsamples, t,
+               nthreads, mb.error);
+        qfh_mbpe_free(&mb);
+    } else
+        printf("%d segments, %d frequencies solved in %.3f s with %d threads\n",
+               qfh_model_segments(&m), qfh_nfreq(&m), t, nthreads);
+    if(cache_dir)
+        qfh_cache_close(&cache);
+    i=m.stats && qfh_stats_write(&stats, wall_time()-t0, print_stats, json);
+    free(res);
+    qfh_model_free(&m);
+    return i;
+}
+
+/*
+ * Optimizer mode: searches turns, length, radius and ratio for a design
+ * meeting an SWR goal over a band, and optionally axial ratio and gain
+ * goals at the zenith, with qfh_optimize(). Every generation reports the
+ * best design so far and the rate at which designs are solved.
+ */
+
+static void print_cache_stats(qfh_cache *c)
+{
+    long n=c->stats.hits+c->stats.misses;
+    
+    printf("cache: %ld hits, %ld misses, %ld stored, %ld entries, "
+           "%.3f s of solving saved, %.1f us per lookup\n", c->stats.hits,
+           c->stats.misses, c->stats.stores, qfh_cache_entries(c),
+           c->stats.saved, n ? c->stats.lookup/n*1e6 : 0.0);
+}
+
+static void optimize_report(void *opaque, const qfh_optim_result *r)
+{
+    (void)opaque;
+    if(r->generation==0)
+        printf("  gen  evals  evals/s      cost   max SWR  max AR dB  min dBi  spread\n");
+    printf("%5d %6ld %8.1f %9.4f %9.3f %10.2f %8.2f %7.4f\n",
+           r->generation, r->evals, r->evals/r->seconds, r->cost, r->swr,
+           r->axial, r->gain, r->spread);
+    fflush(stdout);
+}
+
+/* Parses lo:hi into the bounds of parameter k */
+static int parse_bounds(const char *spec, qfh_goal *g, int k)
+{
+    return sscanf(spec, "%lf:%lf", &g->lo[k], &g->hi[k])!=2 ||
+        !(g->lo[k]<=g->hi[k]);
+}
+
+int optimize_main(int argc, char *argv[])
+{
+    static const char *bounds[4]={"--turns", "--length", "--radius", "--ratio"};
+    qfh_goal g;
+    qfh_optim_result r;
+    qfh_cache cache;
+    const char *cache_dir=NULL;
+    char err[100];
+    double freq, diam;
+    int i, k, nthreads=0, bad=0;
+    
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2)
+        ;
+    if(argc-i!=2 || sscanf(argv[i],"%lf",&freq)!=1 ||
+       sscanf(argv[i+1],"%lf",&diam)!=1) {
+        printf("Usage: QFH2nec --optimize [-j threads] [--band MHz] [--points n] [--swr max] [--axial dB] [--gain dBi] [--turns lo:hi] [--length lo:hi] [--radius lo:hi] [--ratio lo:hi] [--spw segments] [-p population] [-g generations] [--seed n] [--cache directory] <frequency> <diameter>\n");
         exit(1);
     }
-    if(feed>1) {
-        printf("Too many feed helices in model!!!\n");
+    qfh_goal_init(&g, freq, diam);
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        for(k=0;k<4 && strcmp(argv[i],bounds[k]);k++)
+            ;
+        if(k<4)
+            bad|=parse_bounds(argv[i+1], &g, k);
+        else if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--band")==0)
+            bad|=(g.band=atof(argv[i+1]))<0;
+        else if(strcmp(argv[i],"--points")==0)
+            bad|=(g.npoints=atoi(argv[i+1]))<1;
+        else if(strcmp(argv[i],"--swr")==0)
+            bad|=(g.swr=atof(argv[i+1]))<1;
+        else if(strcmp(argv[i],"--axial")==0)
+            bad|=(g.axial=atof(argv[i+1]))<=0;
+        else if(strcmp(argv[i],"--gain")==0)
+            g.gain=atof(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0)
+            bad|=(g.spw=atof(argv[i+1]))<=0;
+        else if(strcmp(argv[i],"-p")==0)
+            bad|=(g.population=atoi(argv[i+1]))<4;
+        else if(strcmp(argv[i],"-g")==0)
+            bad|=(g.generations=atoi(argv[i+1]))<0;
+        else if(strcmp(argv[i],"--seed")==0)
+            g.seed=strtoul(argv[i+1], NULL, 10);
+        else if(strcmp(argv[i],"--cache")==0)
+            cache_dir=argv[i+1];
+        else {
+            printf("Unknown optimizer option %s\n",argv[i]);
+            exit(1);
+        }
+        if(bad) {
+            printf("Invalid %s value %s\n",argv[i],argv[i+1]);
+            exit(1);
+        }
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    r.best.freq=freq;
+    r.best.turns=g.lo[0];
+    r.best.length=g.lo[1];
+    r.best.radius=g.lo[2];
+    r.best.diam=diam;
+    r.best.ratio=g.lo[3];
+    if(qfh_check_design(&r.best, err, sizeof(err))) {
+        printf("%s",err);
         exit(1);
     }
     
-    // Frequency specification
-    fstart = req.freq - 5;
-    fstop = req.freq + 5;
-    fprintf(outfile, "CM %.5E - %.5E MHz in %.5E MHz steps\n",
-            fstart, fstop, fstep);
+    if(cache_dir) {
+        if(qfh_cache_open(&cache, cache_dir)) {
+            printf("Could not open cache %s\n",cache_dir);
+            exit(1);
+        }
+        g.cache=&cache;
+    }
     
-    fprintf(outfile, "CE\n");
+    printf("Optimizing for SWR %.2f over %.3f-%.3f MHz at %d points, "
+           "population %d, %d threads\n", g.swr, freq-g.band/2,
+           freq+g.band/2, g.npoints, g.population, nthreads);
+    if(qfh_optimize(&g, nthreads, optimize_report, NULL, &r)) {
+        printf("Error running the optimizer\n");
+        exit(1);
+    }
+    printf("%ld designs evaluated in %.3f s, %.1f designs/s, %ld ranges stolen\n",
+           r.evals, r.seconds, r.evals/r.seconds, r.steals);
+    if(cache_dir) {
+        print_cache_stats(&cache);
+        qfh_cache_close(&cache);
+    }
+    if(isinf(r.cost)) {
+        printf("No design within the bounds could be solved\n");
+        return 1;
+    }
+    printf("Best design: max SWR %.3f, max axial ratio %.2f dB, min zenith gain %.2f dBi\n",
+           r.swr, r.axial, r.gain);
+    printf("QFH2nec %g %.4f %.4f %.3f %g %.4f\n", r.best.freq, r.best.turns,
+           r.best.length, r.best.radius, r.best.diam, r.best.ratio);
+    return r.swr<=g.swr && (g.axial<=0 || r.axial<=g.axial) &&
+        r.gain>=g.gain ? 0 : 2;
+}
+
+/*
+ * Tolerance mode: the yield of a design built with random errors in its
+ * dimensions, and the spread of its resonance, with qfh_tol_run(). Every
+ * batch reports the statistics so far.
+ */
+
+static void tolerance_report(void *opaque, const qfh_tol_result *r)
+{
+    (void)opaque;
+    printf("%7ld %9.1f %7.2f%% %6.2f%% %9.3f %10.4f %8.4f\n", r->samples,
+           r->samples/r->seconds, 100*r->yield,
+           100*sqrt(r->yield*(1-r->yield)/r->samples), r->swr_mean,
+           r->res_mean, r->res_sd);
+    fflush(stdout);
+}
+
+int tolerance_main(int argc, char *argv[])
+{
+    static const char *dims[QFH_NTOL]={"--height", "--diameter", "--bend",
+                                       "--wire"};
+    qfh_tol_spec s;
+    qfh_tol_result r;
+    design_req req;
+    char err[100];
+    int i, k, nthreads=0, bad=0;
     
-    // do the helices
-    feedpointhack=1;
-    make_helix(outfile, h[0]);
-    feedpointhack=0;
-    make_helix(outfile, h[1]);
-    if(toupper(h[0].feed)!='O') {
-        fprintf(outfile, "GW %d %d %.5E %.5E %.5E "
-        "%.5E %.5E %.5E %.5E\n",
-        (h[0].feedpoint=ITG++), 1,
-                (epsilon/2)*cos(h[0].Theta+pi/4)/1000,
-                (epsilon/2)*sin(h[0].Theta+pi/4)/1000,
-                (h[0].offset)/1000,
-                -(epsilon/2)*cos(h[0].Theta+pi/4)/1000,
-                -(epsilon/2)*sin(h[0].Theta+pi/4)/1000,
-                (h[0].offset)/1000,
-                h[0].wire/1000);
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2)
+        ;
+    if(argc-i!=6) {
+        printf("Usage: QFH2nec --tolerance [-j threads] [-n samples] [--batch n] [--band MHz] [--points n] [--swr max] [--height mm] [--diameter mm] [--bend mm] [--wire mm] [--spw segments] [--seed n] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        exit(1);
+    }
+    sscanf(argv[i],"%lf",&req.freq);
+    sscanf(argv[i+1],"%lf",&req.turns);
+    sscanf(argv[i+2],"%lf",&req.length);
+    sscanf(argv[i+3],"%lf",&req.radius);
+    sscanf(argv[i+4],"%lf",&req.diam);
+    sscanf(argv[i+5],"%lf",&req.ratio);
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
+        exit(1);
+    }
+    qfh_tol_init(&s, &req);
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        for(k=0;k<QFH_NTOL && strcmp(argv[i],dims[k]);k++)
+            ;
+        if(k<QFH_NTOL)
+            bad|=qfh_tolerance_parse(&s.tol[k], argv[i+1]);
+        else if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"-n")==0)
+            bad|=(s.samples=atol(argv[i+1]))<1;
+        else if(strcmp(argv[i],"--batch")==0)
+            bad|=(s.batch=atoi(argv[i+1]))<1;
+        else if(strcmp(argv[i],"--band")==0)
+            bad|=(s.band=atof(argv[i+1]))<0;
+        else if(strcmp(argv[i],"--points")==0)
+            bad|=(s.npoints=atoi(argv[i+1]))<1;
+        else if(strcmp(argv[i],"--swr")==0)
+            bad|=(s.swr=atof(argv[i+1]))<1;
+        else if(strcmp(argv[i],"--spw")==0)
+            bad|=(s.spw=atof(argv[i+1]))<0;
+        else if(strcmp(argv[i],"--seed")==0)
+            s.seed=strtoul(argv[i+1], NULL, 10);
+        else {
+            printf("Unknown tolerance option %s\n",argv[i]);
+            exit(1);
+        }
+        if(bad) {
+            printf("Invalid %s value %s\n",argv[i],argv[i+1]);
+            exit(1);
+        }
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    
+    printf("%ld samples of the SWR over %.3f-%.3f MHz at %d points, "
+           "%d threads\n", s.samples, req.freq-s.band/2, req.freq+s.band/2,
+           s.npoints, nthreads);
+    printf("errors:");
+    for(k=0;k<QFH_NTOL;k++)
+        printf(" %s %s %g mm", dims[k]+2,
+               s.tol[k].dist=='u' ? "uniform" : "normal", s.tol[k].width);
+    printf("\nsamples samples/s    yield   +-err  mean SWR  resonance       sd\n");
+    if(qfh_tol_run(&s, nthreads, tolerance_report, NULL, &r)) {
+        printf("Error running the tolerance analysis\n");
+        exit(1);
+    }
+    printf("%ld samples solved in %.3f s, %.1f samples/s, %ld ranges stolen\n",
+           r.samples, r.seconds, r.samples/r.seconds, r.steals);
+    if(isinf(r.nominal_swr))
+        printf("Nominal design could not be solved\n");
+    else
+        printf("Nominal design: max SWR %.3f, resonance %.4f MHz\n",
+               r.nominal_swr, r.nominal_res);
+    printf("Yield %.2f%% (%ld of %ld below SWR %g over the band), "
+           "%ld could not be built or solved\n", 100*r.yield, r.pass,
+           r.samples, s.swr, r.failed);
+    if(r.resonant==0) {
+        printf("No sample resonates within the band\n");
+        return 0;
+    }
+    printf("Resonance of %ld samples within the band: mean %.4f MHz, "
+           "sd %.4f MHz\n", r.resonant, r.res_mean, r.res_sd);
+    printf("  min %.4f, 5%% %.4f, median %.4f, 95%% %.4f, max %.4f MHz\n",
+           r.res_lo, r.res_p5, r.res_p50, r.res_p95, r.res_hi);
+    return 0;
+}
+
+/*
+ * Convergence mode: solves the feed point impedance of a design at a
+ * ladder of segment densities with qfh_conv_run(), extrapolates it to
+ * infinitely fine segments and recommends the cheapest density that is
+ * close enough.
+ */
+
+static void print_level(const char *name, const qfh_conv_level *lv)
+{
+    printf("%-8s %5d %5d %5d %8d %10.3f %10.3f %8.4f%% %9.4f\n", name,
+           lv->seg.radial, lv->seg.corner, lv->seg.helix, lv->segments,
+           creal(lv->z), cimag(lv->z), 100*lv->error, lv->seconds);
+}
+
+int converge_main(int argc, char *argv[])
+{
+    qfh_conv_spec s;
+    qfh_conv_result r;
+    design_req req;
+    const qfh_conv_level *best;
+    char err[100], name[16];
+    int i, nthreads=0, bad=0;
+    
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2)
+        ;
+    if(argc-i!=6) {
+        printf("Usage: QFH2nec --converge [-j threads] [--spw segments] [--ratio r] [--levels n] [--tol tolerance] [--freq MHz] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        exit(1);
+    }
+    sscanf(argv[i],"%lf",&req.freq);
+    sscanf(argv[i+1],"%lf",&req.turns);
+    sscanf(argv[i+2],"%lf",&req.length);
+    sscanf(argv[i+3],"%lf",&req.radius);
+    sscanf(argv[i+4],"%lf",&req.diam);
+    sscanf(argv[i+5],"%lf",&req.ratio);
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
+        exit(1);
+    }
+    qfh_conv_init(&s, &req);
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0)
+            bad|=!((s.spw=atof(argv[i+1]))>0);
+        else if(strcmp(argv[i],"--ratio")==0)
+            bad|=!((s.ratio=atof(argv[i+1]))>1);
+        else if(strcmp(argv[i],"--levels")==0)
+            bad|=(s.levels=atoi(argv[i+1]))<3 || s.levels>QFH_CONV_MAX;
+        else if(strcmp(argv[i],"--tol")==0)
+            bad|=!((s.tol=atof(argv[i+1]))>0);
+        else if(strcmp(argv[i],"--freq")==0)
+            bad|=!((s.freq=atof(argv[i+1]))>0);
+        else {
+            printf("Unknown convergence option %s\n",argv[i]);
+            exit(1);
+        }
+        if(bad) {
+            printf("Invalid %s value %s\n",argv[i],argv[i+1]);
+            exit(1);
+        }
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    
+    if(qfh_conv_run(&s, nthreads, &r)) {
+        if(r.nlevels<3)
+            printf("Fewer than 3 distinct segmentations between %g and %g "
+                   "segments per wavelength\n", s.spw,
+                   s.spw*pow(s.ratio, s.levels-1));
+        else
+            printf("Error solving the design\n");
+        exit(1);
+    }
+    printf("Impedance at %.3f MHz, %d segmentations solved in %.3f s with "
+           "%d threads\n", s.freq, r.nlevels+1, r.seconds, nthreads);
+    printf("spw      radial corner helix segments          R          X     error   seconds\n");
+    for(i=0;i<r.nlevels;i++) {
+        snprintf(name, sizeof(name), "%.4g", r.level[i].spw);
+        print_level(name, &r.level[i]);
+    }
+    print_level("default", &r.dflt);
+    printf("Extrapolated %.3f%+.3fj ohms, order of convergence %.2f\n",
+           creal(r.z), cimag(r.z), r.order);
+    if(r.best<0) {
+        printf("No segmentation within %g%% of it, try more or finer rungs\n",
+               100*s.tol);
+        return 2;
+    }
+    best=&r.level[r.best];
+    printf("Recommended: --spw %.4g, %d segments, within %g%%, %.1f times "
+           "faster than the finest\n", best->spw, best->segments, 100*s.tol,
+           r.level[r.nlevels-1].seconds/best->seconds);
+    printf("QFH2nec --spw %.4g %g %g %g %g %g %g\n", best->spw, req.freq,
+           req.turns, req.length, req.radius, req.diam, req.ratio);
+    return 0;
+}
+
+static long count_lines(const qfh_membuf *buf)
+{
+    long n=0;
+    size_t i;
+    
+    for(i=0;i<buf->len;i++)
+        n+=buf->data[i]=='\n';
+    return n;
+}
+
+/* Builds a design into m, with GH/GM cards if compact is set, and
+ * writes its deck in the given format to buf */
+static void build_deck(design_req *req, helix *h, qfh_model *m, int compact,
+                       const qfh_emitter *format, qfh_membuf *buf)
+{
+    qfh_ctx ctx;
+    
+    qfh_design_model(req, h, m);
+    qfh_init(&ctx, NULL, qfh_membuf_sink, buf);
+    ctx.compact=compact;
+    buf->len=0;
+    if(qfh_build_model(&ctx, m) || format->emit(&ctx, m)) {
+        printf("Error building the geometry\n");
+        exit(1);
+    }
+}
+
+/* Time to read a deck back and find its connectivity, as a solver
+ * loading it would */
+static double load_time(const qfh_membuf *buf, qfh_geom *g)
+{
+    qfh_mesh ms;
+    double t0=wall_time();
+    
+    if(qfh_read_geometry(buf->data, buf->len, g) || qfh_mesh_build(&ms, g)) {
+        printf("Error reading back a deck\n");
+        exit(1);
+    }
+    qfh_mesh_free(&ms);
+    return wall_time()-t0;
+}
+
+/*
+ * Design batch benchmark: the loop sizes of many designs, one
+ * qfh_compute_design() call per design against one qfh_compute_designs()
+ * call for all of them. The diameters run past both ends of the
+ * correction table. Every field set must be the same bit for bit.
+ */
+int bench_design(int argc, char *argv[])
+{
+    design_req *req;
+    helix *ref, *fast;
+    double t0, tref=0, tfast=0;
+    long i, n=4096, differ=0;
+    int r, rounds=200;
+    
+    if(argc>1)
+        n=atol(argv[1]);
+    if(argc>2 || n<=0 || n>INT_MAX/2) {
+        printf("Usage: QFH2nec --bench-design [designs]\n");
+        exit(1);
+    }
+    req=(design_req*)malloc(n*sizeof(design_req));
+    ref=(helix*)calloc(2*n, sizeof(helix));
+    fast=(helix*)calloc(2*n, sizeof(helix));
+    if(req==NULL || ref==NULL || fast==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    for(i=0;i<n;i++) {
+        req[i].freq=10+fmod(i*7.31, 4990);
+        req[i].turns=0.1+fmod(i*0.37, 49.9);
+        req[i].length=0.1+fmod(i*0.013, 4.9);
+        req[i].radius=1+fmod(i*3.7, 999);
+        req[i].diam=-5+fmod(i*0.71, 30);
+        req[i].ratio=0.1+fmod(i*0.0093, 1.9);
+    }
+    for(r=0;r<rounds;r++) {
+        t0=wall_time();
+        for(i=0;i<n;i++)
+            qfh_compute_design(&req[i], &ref[2*i]);
+        tref+=wall_time()-t0;
+        t0=wall_time();
+        qfh_compute_designs(req, fast, (int)n);
+        tfast+=wall_time()-t0;
+    }
+    for(i=0;i<2*n;i++)
+        if(memcmp(&ref[i].H, &fast[i].H, 7*sizeof(double)) ||
+           ref[i].feed!=fast[i].feed)
+            differ++;
+    printf("qfh_compute_design:  %ld designs in %.1f us, %.1f M/s\n",
+           n, tref/rounds*1e6, n*rounds/tref/1e6);
+    printf("qfh_compute_designs: %ld designs in %.1f us, %.1f M/s, "
+           "speedup %.1fx\n", n, tfast/rounds*1e6, n*rounds/tfast/1e6,
+           tref/tfast);
+    printf("%ld loops differ\n", differ);
+    free(req);
+    free(ref);
+    free(fast);
+    return differ ? 1 : 0;
+}
+
+/*
+ * Compact deck benchmark: every design is written once with a GW card
+ * per wire and once with GH/GM cards. Both decks are read back and
+ * meshed, and the compact one must expand to the geometry it was built
+ * from. A few realistic designs are then solved both ways, and their
+ * feed impedances must agree within COMPACT_Z_TOL of the full model's.
+ */
+#define COMPACT_Z_TOL 1e-3
+
+int bench_compact(int argc, char *argv[])
+{
+    static const double solved[3][6]={
+        {137.5, 0.5, 1, 15, 5, 0.3},
+        {435, 0.5, 1, 10, 3, 0.44},
+        {2400, 0.5, 1, 3, 2, 0.44}
+    };
+    design_req req;
+    helix hf[2], hc[2];
+    qfh_model full, compact;
+    qfh_geom g={0, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    qfh_membuf buf={NULL, 0, 0};
+    qfh_result rfull, rcompact;
+    const qfh_emitter *nec=qfh_find_emitter("nec"), *necgh=qfh_find_emitter("necgh");
+    double tfull=0, tcompact=0, bfull=0, bcompact=0, cfull=0, ccompact=0;
+    double d, dmax=0;
+    long i, n=2000, real=0;
+    int w, differ=0;
+    
+    if(argc>1)
+        n=atol(argv[1]);
+    if(n<=0) {
+        printf("Usage: QFH2nec --bench-compact [designs]\n");
+        exit(1);
+    }
+    memset(&full, 0, sizeof(full));
+    memset(&compact, 0, sizeof(compact));
+    for(i=0;i<n;i++) {
+        req.freq=10+fmod(i*7.31, 4990);
+        req.turns=0.1+fmod(i*0.37, 49.9);
+        req.length=0.1+fmod(i*0.013, 4.9);
+        req.radius=1+fmod(i*3.7, 999);
+        req.diam=1+fmod(i*0.71, 49);
+        req.ratio=0.1+fmod(i*0.0093, 1.9);
+        
+        build_deck(&req, hf, &full, 0, nec, &buf);
+        bfull+=buf.len;
+        cfull+=count_lines(&buf);
+        tfull+=load_time(&buf, &g);
         
+        build_deck(&req, hc, &compact, 1, necgh, &buf);
+        bcompact+=buf.len;
+        ccompact+=count_lines(&buf);
+        tcompact+=load_time(&buf, &g);
+        
+        // The deck has six significant digits, compare relative to the
+        // size. Designs whose bends do not fit in the loops are left out.
+        if(hc[0].H<=2*hc[0].R || hc[0].D<=2*hc[0].R)
+            continue;
+        real++;
+        if(g.n!=compact.geom.n) {
+            printf("Design %ld: compact deck expands to %d wires instead of %d\n",
+                   i, g.n, compact.geom.n);
+            exit(1);
+        }
+        for(w=0;w<g.n;w++) {
+            d=fmax(fabs(g.x1[w]-compact.geom.x1[w]), fabs(g.y1[w]-compact.geom.y1[w]));
+            d=fmax(d, fabs(g.z1[w]-compact.geom.z1[w]));
+            d=fmax(d, fabs(g.x2[w]-compact.geom.x2[w]));
+            d=fmax(d, fabs(g.y2[w]-compact.geom.y2[w]));
+            d=fmax(d, fabs(g.z2[w]-compact.geom.z2[w]));
+            d/=fmax(hc[1].H, hc[1].D)/1000;
+            if(d>dmax)
+                dmax=d;
+        }
     }
+    printf("GW deck:       %.0f bytes, %.1f lines per deck, loaded in %.1f us\n",
+           bfull/n, cfull/n, tfull/n*1e6);
+    printf("GH/GM deck:    %.0f bytes, %.1f lines per deck, loaded in %.1f us\n",
+           bcompact/n, ccompact/n, tcompact/n*1e6);
+    printf("%.1fx smaller, loads %.1fx faster\n", bfull/bcompact, tfull/tcompact);
+    printf("largest expansion error %.1e of the antenna size "
+           "(%ld designs with room for their bends)\n", dmax, real);
     
-    fprintf(outfile, "GE 0\n");
+    for(i=0;i<3;i++) {
+        req.freq=solved[i][0];
+        req.turns=solved[i][1];
+        req.length=solved[i][2];
+        req.radius=solved[i][3];
+        req.diam=solved[i][4];
+        req.ratio=solved[i][5];
+        build_deck(&req, hf, &full, 0, nec, &buf);
+        build_deck(&req, hc, &compact, 1, necgh, &buf);
+        full.fstart=full.fstop=compact.fstart=compact.fstop=req.freq;
+        if(qfh_solve_model(&full, 1, 0, &rfull) ||
+           qfh_solve_model(&compact, 1, 0, &rcompact)) {
+            printf("Error solving the model\n");
+            exit(1);
+        }
+        d=cabs(rcompact.z-rfull.z)/cabs(rfull.z);
+        printf("%7.1f MHz: Z %.2f%+.2fj ohm full, %.2f%+.2fj ohm compact, "
+               "%.1e apart%s\n", req.freq, creal(rfull.z), cimag(rfull.z),
+               creal(rcompact.z), cimag(rcompact.z), d,
+               d>COMPACT_Z_TOL ? ", IMPEDANCE DIFFERS" : "");
+        if(!(d<=COMPACT_Z_TOL))
+            differ++;
+    }
+    qfh_geom_free(&g);
+    qfh_membuf_free(&buf);
+    qfh_model_free(&full);
+    qfh_model_free(&compact);
+    return differ ? 1 : 0;
+}
+
+/* Builds a design with ctx as given and solves it, returns the time */
+static double solve_deck(design_req *req, helix *h, qfh_model *m, qfh_ctx *ctx,
+                         int nthreads, int flags, qfh_result *res)
+{
+    double t;
     
-    // Frequency specification
-    fprintf(outfile, "FR 0 %d 0 0 %.5E %.5E\n",
-            (int)((fstop-fstart)/fstep)+1, fstart, fstep);
+    qfh_design_model(req, h, m);
+    if(qfh_build_model(ctx, m)) {
+        printf("Error building the geometry\n");
+        exit(1);
+    }
+    t=wall_time();
+    if(qfh_solve_model(m, nthreads, flags, res)) {
+        printf("Error solving the model\n");
+        exit(1);
+    }
+    return wall_time()-t;
+}
+
+/*
+ * Symmetry benchmark: one design is written as a GW deck and as half of
+ * itself plus a GR card, then solved three ways: the usual model, the
+ * symmetric model (feed wire and bottom radials split at the axis) as a
+ * whole, and the symmetric model by rotational modes. The last two
+ * must agree to well within the accuracy of the solver.
+ */
+int bench_symmetric(int argc, char *argv[])
+{
+    design_req req={137.5, 0.5, 1, 15, 5, 0.3};
+    helix h[2];
+    qfh_model m;
+    qfh_ctx ctx;
+    qfh_membuf buf={NULL, 0, 0};
+    qfh_result *rfull, *rwhole, *rsym;
+    const char *names[3]={"nec", "necgr", "necgh"};
+    char err[100];
+    double spw=0, t[3], d, dmax=0;
+    int i, f, nf, nthreads=0;
     
-    // LD impedance loading to 50 ohms resistive
-    if(toupper(h[0].feed)=='T') {
-        fprintf(outfile, "LD 4 %d 1 1 "
-        "5.00000E+01 0.00000E+00\n",
-        h[0].feedpoint);
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0)
+            spw=atof(argv[i+1]);
+        else
+            break;
     }
+    if(argc-i!=0 && argc-i!=6) {
+        printf("Usage: QFH2nec --bench-symmetric [-j threads] [--spw segments] [<frequency> <turns> <length> <radius> <diameter> <ratio>]\n");
+        exit(1);
+    }
+    if(argc-i==6) {
+        sscanf(argv[i],"%lf",&req.freq);
+        sscanf(argv[i+1],"%lf",&req.turns);
+        sscanf(argv[i+2],"%lf",&req.length);
+        sscanf(argv[i+3],"%lf",&req.radius);
+        sscanf(argv[i+4],"%lf",&req.diam);
+        sscanf(argv[i+5],"%lf",&req.ratio);
+    }
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
+        exit(1);
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
     
-    // Voltage excitation
-    if(toupper(h[0].feed)=='F') {
-        fprintf(outfile, "EX 0 %d 1 0 "
-        "1.00000E+00 0.00000E+00\n",
-        h[0].feedpoint);
+    memset(&m, 0, sizeof(m));
+    qfh_design_model(&req, h, &m);
+    nf=qfh_nfreq(&m);
+    rfull=(qfh_result*)malloc(nf*sizeof(qfh_result));
+    rwhole=(qfh_result*)malloc(nf*sizeof(qfh_result));
+    rsym=(qfh_result*)malloc(nf*sizeof(qfh_result));
+    if(rfull==NULL || rwhole==NULL || rsym==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
     }
     
-    // Compute radiation pattern with fixed increments
-    fprintf(outfile, "RP 0 37 37 1000 0.00000E+00 0.00000E+00 "
-    "5.00000E+00 1.00000E+01 0.00000E+00 0.00000E+00\n");
+    // deck sizes: GW, GW half + GR, GH/GM half + GR
+    for(i=0;i<3;i++) {
+        qfh_init(&ctx, NULL, qfh_membuf_sink, &buf);
+        ctx.symmetric=i>0;
+        ctx.compact=i==2;
+        if(spw>0)
+            qfh_adaptive_segmentation(&m, spw, &ctx.seg);
+        buf.len=0;
+        if(qfh_build_model(&ctx, &m) ||
+           qfh_find_emitter(names[i])->emit(&ctx, &m)) {
+            printf("Error building the geometry\n");
+            exit(1);
+        }
+        printf("%-24s %4ld lines, %6lu bytes\n",
+               i==0 ? "GW deck:" : i==1 ? "GW half + GR deck:" :
+               "GH/GM half + GR deck:", count_lines(&buf),
+               (unsigned long)buf.len);
+    }
     
-    // End of run
-    fprintf(outfile, "EN\n");
-    return 0;
+    qfh_init(&ctx, NULL, NULL, NULL);
+    if(spw>0)
+        qfh_adaptive_segmentation(&m, spw, &ctx.seg);
+    t[0]=solve_deck(&req, h, &m, &ctx, nthreads, 0, rfull);
+    printf("%d segments, %d frequencies, %d threads\n",
+           qfh_model_segments(&m), nf, nthreads);
+    ctx.symmetric=1;
+    t[1]=solve_deck(&req, h, &m, &ctx, nthreads, QFH_SOLVE_NOSYM, rwhole);
+    t[2]=solve_deck(&req, h, &m, &ctx, nthreads, 0, rsym);
+    printf("full model:                      %.3f s\n", t[0]);
+    printf("symmetric model, whole matrix:   %.3f s\n", t[1]);
+    printf("symmetric model, by modes:       %.3f s, %.1fx faster\n",
+           t[2], t[1]/t[2]);
+    for(f=0;f<nf;f++) {
+        d=cabs(rsym[f].z-rwhole[f].z);
+        if(d>dmax)
+            dmax=d;
+    }
+    f=nf/2;
+    printf("largest impedance difference between the symmetric solves %.1e ohm\n",
+           dmax);
+    printf("%.3f MHz: Z %.2f%+.2fj ohm full model, %.2f%+.2fj ohm symmetric model\n",
+           rfull[f].freq, creal(rfull[f].z), cimag(rfull[f].z),
+           creal(rsym[f].z), cimag(rsym[f].z));
+    // the halves take the moments of some segment pairs from the
+    // reciprocal pair, which only agrees to the quadrature error
+    i=dmax>1e-4*cabs(rwhole[f].z);
+    free(rfull);
+    free(rwhole);
+    free(rsym);
+    qfh_membuf_free(&buf);
+    qfh_model_free(&m);
+    return i;
 }
 
-/* This outputs NEC2 code to the output file, to produce the type of
- * bifilar helix loop defined by struct helix h. No checking is done
- * re the sanity of the parameters passed therein. */
-// TODO make the helixes inside one another centered in the middle
-void make_helix(FILE *outfile, helix h)
+/*
+ * Fast sweep benchmark: one design is solved at every frequency of its
+ * sweep and then with qfh_solve_fast(), which solves only where its fit
+ * needs samples. The fitted impedance, SWR, gain and axial ratio are
+ * compared with the solved ones, and the fit is evaluated on a 1 kHz
+ * grid to show what a dense sweep at that resolution would cost.
+ */
+int bench_fast(int argc, char *argv[])
 {
-    int i;
-    double x, y, z, alpha, theta, r;
-    double x1, y1, z1;
+    design_req req={137.5, 0.5, 1, 15, 5, 0.3};
+    helix h[2];
+    qfh_model m;
+    qfh_ctx ctx;
+    qfh_mbpe mb;
+    qfh_result *rdense, *rfast;
+    double complex v[3];
+    char err[100];
+    double spw=0, span=0, fstep=0, tol=1e-3, t[2], dz=0, dswr=0, dgain=0;
+    double dax=0, fstop;
+    int i, f, nf, nfine, nthreads=0;
     
-    // top radial wires
-    if(feedpointhack) {
-        x1=(epsilon/2)*cos(h.Theta+pi/4);
-        y1=(epsilon/2)*sin(h.Theta+pi/4);
-    } else {
-        x1=(epsilon/2)*cos(h.Theta-pi/4);
-        y1=(epsilon/2)*sin(h.Theta-pi/4);
-    }
-    z1=0;
-    x=(h.D/2-h.R)*cos(h.Theta);
-    y=(h.D/2-h.R)*sin(h.Theta);
-    z=0;
-    fprintf(outfile, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-            ITG++, radialsegments,
-            x1/1000, y1/1000, (z1+h.offset)/1000,
-            x/1000, y/1000, (z+h.offset)/1000,
-            h.wire/1000);
-    fprintf(outfile, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-            ITG++, radialsegments,
-            -x1/1000, -y1/1000, (z1+h.offset)/1000,
-            -x/1000, -y/1000, (z+h.offset)/1000,
-            h.wire/1000);
-    
-    // top bends
-    for(i=1;i<=cornersegments;i++) {
-        x1=x; y1=y; z1=z;
-        alpha=pi/2*(double)i/cornersegments;
-        z=-h.R+h.R*cos(alpha);
-        theta=z/h.H*h.turns*2*pi+h.Theta;
-        r=h.D/2-h.R+h.R*sin(alpha);
-        x=r*cos(theta);
-        y=r*sin(theta);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                x1/1000, y1/1000, (z1+h.offset)/1000,
-                x/1000, y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                -x1/1000, -y1/1000, (z1+h.offset)/1000,
-                -x/1000, -y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-    }
-    
-    // helical wires
-    r=h.D/2;
-    for(i=1;i<=helixsegments;i++) {
-        x1=x; y1=y; z1=z;
-        z=-h.R - (double)i/helixsegments*(h.H-2*h.R);
-        theta=z/h.H*h.turns*2*pi+h.Theta;
-        x=r*cos(theta);
-        y=r*sin(theta);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                x1/1000, y1/1000, (z1+h.offset)/1000,
-                x/1000, y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                -x1/1000, -y1/1000, (z1+h.offset)/1000,
-                -x/1000, -y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-    }
-    
-    // bottom bends
-    for(i=1;i<=cornersegments;i++) {
-        x1=x; y1=y; z1=z;
-        alpha=pi/2*(double)i/cornersegments;
-        z=-h.H+h.R - h.R*sin(alpha);
-        theta=z/h.H*h.turns*2*pi+h.Theta;
-        r=h.D/2-h.R+h.R*cos(alpha);
-        x=r*cos(theta);
-        y=r*sin(theta);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                x1/1000, y1/1000, (z1+h.offset)/1000,
-                x/1000, y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                -x1/1000, -y1/1000, (z1+h.offset)/1000,
-                -x/1000, -y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-    }
-    
-    // bottom radial wire
-    fprintf(outfile, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-            ITG++, radialsegments*2-1,
-            x/1000, y/1000, (z+h.offset)/1000,
-            -x/1000, -y/1000, (z+h.offset)/1000,
-            h.wire/1000);
-    
-    return;
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0) {
+            if((spw=atof(argv[i+1]))<=0) {
+                printf("Invalid segments per wavelength %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--span")==0) {
+            if((span=atof(argv[i+1]))<=0) {
+                printf("Invalid frequency span %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--fstep")==0) {
+            if((fstep=atof(argv[i+1]))<=0) {
+                printf("Invalid frequency step %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--tol")==0)
+            tol=atof(argv[i+1]);
+        else
+            break;
+    }
+    if((argc-i!=0 && argc-i!=6) || !(tol>0)) {
+        printf("Usage: QFH2nec --bench-fast [-j threads] [--spw segments] [--span MHz] [--fstep MHz] [--tol tolerance] [<frequency> <turns> <length> <radius> <diameter> <ratio>]\n");
+        exit(1);
+    }
+    if(argc-i==6) {
+        sscanf(argv[i],"%lf",&req.freq);
+        sscanf(argv[i+1],"%lf",&req.turns);
+        sscanf(argv[i+2],"%lf",&req.length);
+        sscanf(argv[i+3],"%lf",&req.radius);
+        sscanf(argv[i+4],"%lf",&req.diam);
+        sscanf(argv[i+5],"%lf",&req.ratio);
+    }
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
+        exit(1);
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    
+    memset(&m, 0, sizeof(m));
+    qfh_design_model(&req, h, &m);
+    if(qfh_design_band(&m, req.freq, span, fstep, err, sizeof(err))) {
+        printf("%s\n",err);
+        exit(1);
+    }
+    qfh_init(&ctx, NULL, NULL, NULL);
+    if(spw>0)
+        qfh_adaptive_segmentation(&m, spw, &ctx.seg);
+    if(qfh_build_model(&ctx, &m)) {
+        printf("Error building the geometry\n");
+        exit(1);
+    }
+    nf=qfh_nfreq(&m);
+    fstop=m.fstart+(nf-1)*m.fstep;
+    nfine=(int)((fstop-m.fstart)/0.001+0.5)+1;
+    rdense=(qfh_result*)malloc(nf*sizeof(qfh_result));
+    rfast=(qfh_result*)malloc((nf>nfine ? nf : nfine)*sizeof(qfh_result));
+    if(rdense==NULL || rfast==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    t[0]=wall_time();
+    if(qfh_solve_model(&m, nthreads, 0, rdense)) {
+        printf("Error solving the model\n");
+        exit(1);
+    }
+    t[0]=wall_time()-t[0];
+    t[1]=wall_time();
+    if(qfh_solve_fast(&m, nthreads, 0, tol, rfast, &mb)) {
+        printf("Error solving the model\n");
+        exit(1);
+    }
+    t[1]=wall_time()-t[1];
+    for(f=0;f<nf;f++) {
+        dz=fmax(dz, cabs(rfast[f].z-rdense[f].z)/cabs(rdense[f].z));
+        dswr=fmax(dswr, fabs(rfast[f].swr-rdense[f].swr));
+        dgain=fmax(dgain, fabs(rfast[f].gain-rdense[f].gain));
+        dax=fmax(dax, fabs(rfast[f].axial-rdense[f].axial));
+    }
+    printf("%d segments, %.3f to %.3f MHz, %d threads\n",
+           qfh_model_segments(&m), m.fstart, fstop, nthreads);
+    printf("dense sweep: %3d frequencies solved in %.3f s\n", nf, t[0]);
+    printf("fast sweep:  %3d solved, degree %d, in %.3f s, %.1fx faster, "
+           "estimated error %.1e\n", mb.nsamples, mb.degree, t[1],
+           t[0]/t[1], mb.error);
+    printf("largest difference: impedance %.1e relative, SWR %.4f, "
+           "gain %.4f dB, axial ratio %.4f dB\n", dz, dswr, dgain, dax);
+    
+    // the same fit at 1 kHz steps
+    t[1]=wall_time();
+    for(f=0;f<nfine;f++) {
+        qfh_mbpe_eval(&mb, m.fstart+f*0.001, v);
+        rfast[f].z=v[0];
+    }
+    t[1]=wall_time()-t[1];
+    printf("at 1 kHz steps: %d frequencies from the fit in %.1f ms, "
+           "a dense sweep would take %.0f s\n", nfine, t[1]*1e3,
+           t[0]/nf*nfine);
+    qfh_mbpe_free(&mb);
+    free(rdense);
+    free(rfast);
+    qfh_model_free(&m);
+    return dz>10*tol;
 }
 
+/*
+ * Pattern mode: one design is solved at one frequency and its far field
+ * evaluated over a grid of directions from the solved currents, by
+ * default RHCP gain against elevation in the phi=0 plane. The time of
+ * that grid is given next to that of the whole 37 x 37 sphere of the
+ * deck's RP card, and the zenith gain is checked against the solver's.
+ */
+int pattern_main(int argc, char *argv[])
+{
+    design_req req;
+    helix h[2];
+    qfh_model m;
+    qfh_ctx ctx;
+    qfh_result res;
+    qfh_mesh ms;
+    qfh_grid grid, zenith;
+    qfh_farpoint *pts, *full, zen;
+    double complex *cur;
+    char err[100];
+    double t[3], spw=0, freq=0, pin;
+    long d, nd;
+    int i, n, nthreads=0, symmetric=0, axial=0;
+    
+    qfh_grid_parse(&grid, "elevation");
+    for(i=1;i+1<argc && argv[i][0]=='-' && !isdigit((unsigned char)argv[i][1]);i+=2) {
+        if(strcmp(argv[i],"-j")==0)
+            nthreads=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0)
+            spw=atof(argv[i+1]);
+        else if(strcmp(argv[i],"--freq")==0)
+            freq=atof(argv[i+1]);
+        else if(strcmp(argv[i],"--grid")==0) {
+            if(qfh_grid_parse(&grid, argv[i+1])) {
+                printf("Invalid pattern grid %s\n",argv[i+1]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i],"--symmetric")==0) {
+            symmetric=1;
+            i--;
+        } else if(strcmp(argv[i],"--axial")==0) {
+            axial=1;
+            i--;
+        } else
+            break;
+    }
+    if(argc-i!=6) {
+        printf("Usage: QFH2nec --pattern [-j threads] [--spw segments] [--symmetric] [--grid full|zenith|elevation|horizon|ntheta,nphi,theta0,phi0,dtheta,dphi] [--freq MHz] [--axial] <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        exit(1);
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    sscanf(argv[i],"%lf",&req.freq);
+    sscanf(argv[i+1],"%lf",&req.turns);
+    sscanf(argv[i+2],"%lf",&req.length);
+    sscanf(argv[i+3],"%lf",&req.radius);
+    sscanf(argv[i+4],"%lf",&req.diam);
+    sscanf(argv[i+5],"%lf",&req.ratio);
+    if(qfh_check_design(&req, err, sizeof(err))) {
+        printf("%s",err);
+        exit(1);
+    }
+    if(freq<=0)
+        freq=req.freq;
+    
+    memset(&m, 0, sizeof(m));
+    qfh_design_model(&req, h, &m);
+    qfh_init(&ctx, NULL, NULL, NULL);
+    ctx.symmetric=symmetric;
+    if(spw>0)
+        qfh_adaptive_segmentation(&m, spw, &ctx.seg);
+    if(qfh_build_model(&ctx, &m)) {
+        printf("Error building the geometry\n");
+        exit(1);
+    }
+    t[0]=wall_time();
+    if(qfh_solve_currents(&m, freq, nthreads, 0, &res, &ms, &cur, &pin)) {
+        printf("Error solving the model\n");
+        exit(1);
+    }
+    t[0]=wall_time()-t[0];
+    nd=(long)grid.ntheta*grid.nphi;
+    pts=(qfh_farpoint*)malloc((nd>0 ? nd : 1)*sizeof(qfh_farpoint));
+    full=(qfh_farpoint*)malloc((size_t)qfh_rp_default.ntheta*
+                               qfh_rp_default.nphi*sizeof(qfh_farpoint));
+    if(pts==NULL || full==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    // the grid and the whole sphere, each repeated for at least 0.1 s
+    for(n=0,t[1]=wall_time();n==0 || wall_time()-t[1]<0.1;n++)
+        if(qfh_pattern(&ms, freq, cur, pin, &grid, nthreads, pts)) {
+            printf("Error evaluating the pattern\n");
+            exit(1);
+        }
+    t[1]=(wall_time()-t[1])/n;
+    for(n=0,t[2]=wall_time();n==0 || wall_time()-t[2]<0.1;n++)
+        qfh_pattern(&ms, freq, cur, pin, &qfh_rp_default, nthreads, full);
+    t[2]=(wall_time()-t[2])/n;
+    qfh_grid_parse(&zenith, "zenith");
+    qfh_pattern(&ms, freq, cur, pin, &zenith, 1, &zen);
+    
+    if(axial)
+        printf(" Theta   Phi   AR dB\n");
+    else
+        printf(" Theta   Phi  Gain dBi  RHCP dBic  LHCP dBic\n");
+    for(d=0;d<nd;d++) {
+        if(axial)
+            printf("%6.1f %5.1f %7.2f\n", pts[d].theta, pts[d].phi,
+                   pts[d].axial);
+        else
+            printf("%6.1f %5.1f %9.2f %10.2f %10.2f\n", pts[d].theta,
+                   pts[d].phi, pts[d].gain, pts[d].rhcp, pts[d].lhcp);
+    }
+    printf("%d segments at %.3f MHz, solved in %.3f s with %d threads\n",
+           qfh_model_segments(&m), freq, t[0], nthreads);
+    printf("pattern: %ld directions in %.3f ms, the whole sphere (%d) in "
+           "%.3f ms\n", nd, t[1]*1e3,
+           qfh_rp_default.ntheta*qfh_rp_default.nphi, t[2]*1e3);
+    printf("zenith: %.4f dBi, solver %.4f dBi, axial ratio %.4f dB, "
+           "solver %.4f dB\n", zen.gain, res.gain, zen.axial, res.axial);
+    i=fabs(zen.gain-res.gain)>1e-6 || fabs(zen.axial-res.axial)>1e-6;
+    free(pts);
+    free(full);
+    free(cur);
+    qfh_mesh_free(&ms);
+    qfh_model_free(&m);
+    return i;
+}
 
 /*
- * The following code has been adapted from the software published by 
- * John Coppens here: https://www.jcoppens.com/ant/qfh/calc.en.php
- * The following license was part of the original file.
- * 
- *    qfhcalc.js
- * 
- *    Copyright (C) 2000 John Coppens (jcoppens@usa.net)
- * 
- *    This program is free software; you can redistribute it and/or modify
- *    it under the terms of the GNU General Public License as published by
- *    the Free Software Foundation; either version 2 of the License, or
- *    (at your option) any later version.
- * 
- *    This program is distributed in the hope that it will be useful,
- *    but WITHOUT ANY WARRANTY; without even the implied warranty of
- *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *    GNU General Public License for more details.
- * 
- *    You should have received a copy of the GNU General Public License
- *    along with this program; if not, write to the Free Software
- *    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ * Server mode. Design requests arrive as JSON lines, one object per
+ * line, on stdin or on the connections to a Unix socket:
+ *    {"id": 7, "freq": 137.5, "turns": 0.5, "length": 1, "radius": 15,
+ *     "diam": 5, "ratio": 0.3, "format": "necgh", "spw": 20}
+ * id, format and spw are optional, unknown members are ignored. The
+ * numbers must be finite, spw at most MAXSPW and the deck is refused
+ * above MAXSEGMENTS segments, so that one line cannot ask for a deck of
+ * hundreds of megabytes. Each
+ * request is answered on the same stream with one line
+ *    {"id": 7, "ok": true, "segments": 159, "loops": [{"H": ..., "D": ...},
+ *     {"H": ..., "D": ...}], "deck": "CM NEC2 Input File..."}
+ * where the loops are the smaller and the larger one in mm, or
+ *    {"id": 7, "ok": false, "error": "..."}
+ * Nothing is written to disk. Each connection is served by its own
+ * thread, requests on one connection are answered in order.
  */
 
-double deltal(double diam) {
-    double tbl[17] = {1.045, 1.053, 1.060, 1.064, 1.068, 1.070, 1.070, 1.071, 
-    1.071, 1.070, 1.070, 1.070, 1.070, 1.069, 1.069, 1.068, 1.067};
-    int intv = (int)diam;
-    return (tbl[intv] + (tbl[intv+1]-tbl[intv])*(diam-intv));
+#define MAXREQUEST 4096
+#define MAXSPW 1000 // segments per wavelength a request may ask for
+#define MAXSEGMENTS 20000 // in the deck of one request
+
+typedef struct {
+    const qfh_emitter *format; // default output format
+    double spw; // default segments per wavelength, 0 for the fixed ones
+} serve_opts;
+
+/* State of one connection, reused from request to request */
+typedef struct {
+    const serve_opts *opts;
+    helix h[2];
+    qfh_model m;
+    qfh_membuf deck, out;
+} serve_conn;
+
+static const char *json_ws(const char *p)
+{
+    while(*p==' ' || *p=='\t' || *p=='\r')
+        p++;
+    return p;
+}
+
+/* Reads the JSON string at p (after its opening quote) into s, cut to
+ * len-1 characters. Returns the character after the closing quote, NULL
+ * if there is none or the string is not valid JSON (a control character
+ * or an unknown escape). */
+static const char *json_string(const char *p, char *s, size_t len)
+{
+    size_t n=0;
+    char c;
+    int k;
+    
+    while(*p && *p!='"') {
+        c=*p++;
+        if((unsigned char)c<0x20)
+            return NULL;
+        if(c=='\\') {
+            switch(c=*p++) {
+                case 'n': c='\n'; break;
+                case 't': c='\t'; break;
+                case 'r': c='\r'; break;
+                case 'b': c='\b'; break;
+                case 'f': c='\f'; break;
+                case 'u':
+                    // not needed by any member, keep a placeholder
+                    for(k=0;k<4;k++)
+                        if(!isxdigit((unsigned char)*p++))
+                            return NULL;
+                    c='?';
+                    break;
+                case '"': case '\\': case '/':
+                    break;
+                default:
+                    return NULL;
+            }
+        }
+        if(n+1<len)
+            s[n++]=c;
+    }
+    s[n]='\0';
+    return *p=='"' ? p+1 : NULL;
 }
 
-double deltaf(double diam) {
-    double tbl[17] = {1.013, 1.014, 1.015, 1.016, 1.017, 1.018, 1.020, 1.022, 
-    1.025, 1.027, 1.030, 1.033, 1.036, 1.041, 1.044, 1.049, 1.054};
-    int intv = (int)diam;
-    return (tbl[intv] + (tbl[intv+1]-tbl[intv])*(diam-intv));
+/* Returns the character after the JSON number at p, NULL if there is
+ * none: strtod() would also take hex, inf, nan or a leading '+' */
+static const char *json_number(const char *p)
+{
+    if(*p=='-')
+        p++;
+    if(*p=='0')
+        p++;
+    else if(*p>='1' && *p<='9')
+        while(isdigit((unsigned char)*p))
+            p++;
+    else
+        return NULL;
+    if(*p=='.') {
+        if(!isdigit((unsigned char)*++p))
+            return NULL;
+        while(isdigit((unsigned char)*p))
+            p++;
+    }
+    if(*p=='e' || *p=='E') {
+        if(*++p=='+' || *p=='-')
+            p++;
+        if(!isdigit((unsigned char)*p))
+            return NULL;
+        while(isdigit((unsigned char)*p))
+            p++;
+    }
+    return p;
 }
 
-void compute_design(design_req *requirements, helix *helixes) {
-    double freq = requirements->freq;
-    double wdiam = requirements->diam;
-    double wrad = requirements->radius;
-    double ratio = requirements->ratio;
-    double turns = requirements->turns;
-    double nrwavel = requirements->length;
+/* Parses one request line into req, the output format and segmentation,
+ * and the text of its id (empty if it has none). Returns NULL on
+ * success, otherwise what is wrong with it. */
+static const char *parse_request(const char *line, design_req *req,
+                                 const qfh_emitter **format, double *spw,
+                                 char *id, size_t idlen)
+{
+    const char *p=json_ws(line), *v, *end;
+    char key[32], str[32];
+    double *field, x;
+    int seen=0, bit, literal;
     
-    helixes[0].turns = -turns;
-    helixes[0].feed = 'F';
-    helixes[0].offset = 0;
-    helixes[0].R = wrad;
-    helixes[0].wire = wdiam / 2;
+    *id='\0';
+    if(*p++!='{')
+        return "request is not a JSON object";
+    p=json_ws(p);
+    if(*p=='}')
+        p++;
+    else for(;;) {
+        if(*p++!='"' || (p=json_string(p, key, sizeof(key)))==NULL)
+            return "malformed member name";
+        p=json_ws(p);
+        if(*p++!=':')
+            return "missing ':' after a member name";
+        v=p=json_ws(p);
+        literal=0;
+        x=0;
+        str[0]='\0';
+        if(*p=='"') {
+            if((p=json_string(p+1, str, sizeof(str)))==NULL)
+                return "malformed string";
+        } else if((end=json_number(p))!=NULL) {
+            x=strtod(p, NULL);
+            p=end;
+        } else {
+            // true, false or null: not used, but allowed
+            if(strncmp(p, "true", 4)==0 || strncmp(p, "null", 4)==0)
+                p+=4;
+            else if(strncmp(p, "false", 5)==0)
+                p+=5;
+            else
+                return "malformed value";
+            literal=1;
+        }
+        
+        field=NULL;
+        bit=0;
+        if(strcmp(key, "freq")==0) { field=&req->freq; bit=1; }
+        else if(strcmp(key, "turns")==0) { field=&req->turns; bit=2; }
+        else if(strcmp(key, "length")==0) { field=&req->length; bit=4; }
+        else if(strcmp(key, "radius")==0) { field=&req->radius; bit=8; }
+        else if(strcmp(key, "diam")==0) { field=&req->diam; bit=16; }
+        else if(strcmp(key, "ratio")==0) { field=&req->ratio; bit=32; }
+        else if(strcmp(key, "spw")==0)
+            field=spw;
+        else if(strcmp(key, "id")==0) {
+            if(literal)
+                return "id must be a string or a number";
+            if((size_t)(p-v)>=idlen)
+                return "id too long";
+            memcpy(id, v, p-v);
+            id[p-v]='\0';
+        } else if(strcmp(key, "format")==0) {
+            if((*format=qfh_find_emitter(str))==NULL)
+                return "unknown format";
+            if(strcmp(str, "bin")==0)
+                return "the bin format cannot be sent as JSON";
+        }
+        if(field) {
+            if(*v=='"')
+                return "numbers must not be quoted";
+            if(literal)
+                return "malformed number";
+            if(!isfinite(x))
+                return "numbers must be finite";
+            if(field==spw && x>MAXSPW)
+                return "spw is above 1000";
+            *field=x;
+            seen|=bit;
+        }
+        
+        p=json_ws(p);
+        if(*p=='}') {
+            p++;
+            break;
+        }
+        if(*p++!=',')
+            return "missing ',' between members";
+        p=json_ws(p);
+    }
+    if(*json_ws(p)!='\0')
+        return "trailing characters after the object";
+    if(seen!=63)
+        return "freq, turns, length, radius, diam and ratio are all required";
+    return NULL;
+}
+
+/* Appends n bytes to a buffer that has room reserved for them */
+static void out_raw(qfh_membuf *b, const char *s, size_t n)
+{
+    memcpy(b->data+b->len, s, n);
+    b->len+=n;
+}
+
+/* Appends s as a JSON string. Returns 0 on success. */
+static int out_json_string(qfh_membuf *b, const char *s, size_t n)
+{
+    static const char hex[]="0123456789abcdef";
+    char e[6];
+    size_t i, run;
     
-    helixes[1].turns = -turns;
-    helixes[1].feed = 'F';
-    helixes[1].offset = 0;
-    helixes[1].R = wrad;
-    helixes[1].wire = wdiam / 2;
+    // at most six bytes per character
+    if(qfh_membuf_reserve(b, 6*n+2))
+        return 1;
+    out_raw(b, "\"", 1);
+    for(i=0;i<n;i+=run) {
+        for(run=0;i+run<n && (unsigned char)s[i+run]>=0x20 &&
+            s[i+run]!='"' && s[i+run]!='\\';run++)
+            ;
+        out_raw(b, s+i, run);
+        if(i+run==n)
+            break;
+        e[0]='\\';
+        switch(s[i+run]) {
+            case '"': e[1]='"'; out_raw(b, e, 2); break;
+            case '\\': e[1]='\\'; out_raw(b, e, 2); break;
+            case '\n': e[1]='n'; out_raw(b, e, 2); break;
+            case '\r': e[1]='r'; out_raw(b, e, 2); break;
+            case '\t': e[1]='t'; out_raw(b, e, 2); break;
+            default:
+                e[1]='u';
+                e[2]=e[3]='0';
+                e[4]=hex[(unsigned char)s[i+run]>>4];
+                e[5]=hex[s[i+run]&15];
+                out_raw(b, e, 6);
+        }
+        run++;
+    }
+    out_raw(b, "\"", 1);
+    return 0;
+}
+
+/* Appends the response line to c->out: the error msg, or the deck built
+ * into c if msg is NULL */
+static void serve_reply(serve_conn *c, const char *id, const char *msg)
+{
+    char tmp[512];
+    int n;
+    
+    n=snprintf(tmp, sizeof(tmp), "{%s%s%s\"ok\": %s", *id ? "\"id\": " : "",
+               id, *id ? ", " : "", msg ? "false" : "true");
+    if(qfh_membuf_reserve(&c->out, n))
+        return;
+    out_raw(&c->out, tmp, n);
+    if(msg) {
+        if(qfh_membuf_reserve(&c->out, 16))
+            return;
+        out_raw(&c->out, ", \"error\": ", 11);
+        out_json_string(&c->out, msg, strlen(msg));
+    } else {
+        n=snprintf(tmp, sizeof(tmp), ", \"segments\": %d, \"loops\": "
+                   "[{\"H\": %.10g, \"D\": %.10g}, {\"H\": %.10g, \"D\": %.10g}], "
+                   "\"deck\": ", qfh_model_segments(&c->m),
+                   c->h[0].H, c->h[0].D, c->h[1].H, c->h[1].D);
+        if(qfh_membuf_reserve(&c->out, n))
+            return;
+        out_raw(&c->out, tmp, n);
+        out_json_string(&c->out, c->deck.data, c->deck.len);
+    }
+    if(qfh_membuf_reserve(&c->out, 2))
+        return;
+    out_raw(&c->out, "}\n", 2);
+}
+
+/* Answers one request line */
+static void serve_request(serve_conn *c, const char *line)
+{
+    design_req req;
+    qfh_ctx ctx;
+    const qfh_emitter *format=c->opts->format;
+    double spw=c->opts->spw;
+    char id[80], err[128];
+    const char *msg;
+    
+    msg=parse_request(line, &req, &format, &spw, id, sizeof(id));
+    if(msg==NULL && qfh_check_design(&req, err, sizeof(err)))
+        msg=err;
+    if(msg==NULL) {
+        qfh_design_model(&req, c->h, &c->m);
+        qfh_init(&ctx, NULL, qfh_membuf_sink, &c->deck);
+        ctx.compact=format->compact;
+        ctx.symmetric=format->symmetric;
+        if(spw>0)
+            qfh_adaptive_segmentation(&c->m, spw, &ctx.seg);
+        c->deck.len=0;
+        if(qfh_build_model(&ctx, &c->m))
+            msg="error building the geometry";
+        else if(qfh_model_segments(&c->m)>MAXSEGMENTS)
+            msg="more than 20000 segments";
+        else if(format->emit(&ctx, &c->m))
+            msg="error building the geometry";
+    }
+    serve_reply(c, id, msg);
+}
+
+/* Writes all of buf to fd, returns 0 on success */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+    
+    while(len) {
+        if((n=write(fd, buf, len))<0) {
+            if(errno==EINTR)
+                continue;
+            return 1;
+        }
+        buf+=n;
+        len-=n;
+    }
+    return 0;
+}
+
+/* Serves the requests read from fd in until it is closed, answering
+ * each line as soon as it is complete */
+static void serve_stream(int in, int out, const serve_opts *opts)
+{
+    serve_conn c;
+    char buf[MAXREQUEST+1];
+    size_t len=0, start;
+    ssize_t n;
+    char *nl;
+    int skip=0;
+    
+    memset(&c, 0, sizeof(c));
+    c.opts=opts;
+    for(;;) {
+        if((n=read(in, buf+len, MAXREQUEST-len))<0) {
+            if(errno==EINTR)
+                continue;
+            break;
+        }
+        if(n==0)
+            break;
+        len+=n;
+        buf[len]='\0';
+        c.out.len=0;
+        start=0;
+        while((nl=memchr(buf+start, '\n', len-start))!=NULL) {
+            *nl='\0';
+            if(skip)
+                skip=0; // the end of an overlong line
+            else if(*json_ws(buf+start))
+                serve_request(&c, buf+start);
+            start=nl-buf+1;
+        }
+        memmove(buf, buf+start, len-start);
+        len-=start;
+        if(len==MAXREQUEST) {
+            // answer overlong lines once and drop the rest of them
+            if(!skip)
+                serve_reply(&c, "", "request line too long");
+            skip=1;
+            len=0;
+        }
+        if(c.out.len && write_all(out, c.out.data, c.out.len))
+            break;
+    }
+    qfh_membuf_free(&c.deck);
+    qfh_membuf_free(&c.out);
+    qfh_model_free(&c.m);
+}
+
+typedef struct {
+    int fd;
+    const serve_opts *opts;
+} serve_client;
+
+static void *serve_client_thread(void *arg)
+{
+    serve_client *cl=(serve_client*)arg;
+    
+    serve_stream(cl->fd, cl->fd, cl->opts);
+    close(cl->fd);
+    free(cl);
+    return NULL;
+}
+
+/* Accepts connections on the listening socket fd forever */
+static void *serve_accept(void *arg)
+{
+    serve_client *listener=(serve_client*)arg, *cl;
+    pthread_attr_t attr;
+    pthread_t tid;
+    int fd;
     
-    double wavel = 299792/freq;
-    double wd_eff = wdiam;
-    if (wdiam > 15) wd_eff = 15;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for(;;) {
+        if((fd=accept(listener->fd, NULL, NULL))<0) {
+            if(errno==EINTR || errno==ECONNABORTED)
+                continue;
+            perror("accept");
+            break;
+        }
+        if((cl=(serve_client*)malloc(sizeof(*cl)))==NULL) {
+            close(fd);
+            continue;
+        }
+        cl->fd=fd;
+        cl->opts=listener->opts;
+        if(pthread_create(&tid, &attr, serve_client_thread, cl)) {
+            close(fd);
+            free(cl);
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return NULL;
+}
 
-    double wavelc = nrwavel * wavel * deltal(wd_eff);
+/* Whether the socket file at addr was left behind by a server that is
+ * gone: nothing accepts connections on it any more */
+static int stale_socket(const struct sockaddr_un *addr)
+{
+    int fd, stale;
+    
+    if((fd=socket(AF_UNIX, SOCK_STREAM, 0))<0)
+        return 0;
+    stale=connect(fd, (const struct sockaddr*)addr, sizeof(*addr))<0
+          && errno==ECONNREFUSED;
+    close(fd);
+    return stale;
+}
 
-    double bendcorr = 2*wrad - pi*wrad/2;
+/* Creates a Unix socket listening at path, replacing a stale socket
+ * file. Returns the descriptor or -1. */
+static int serve_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd, ok;
     
- //  double optdiam = 0.0088 * wavelc;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(strlen(path)>=sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long\n",path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if((fd=socket(AF_UNIX, SOCK_STREAM, 0))<0) {
+        perror("socket");
+        return -1;
+    }
+    ok=bind(fd, (struct sockaddr*)&addr, sizeof(addr))==0;
+    if(!ok && errno==EADDRINUSE && stale_socket(&addr)) {
+        unlink(path);
+        ok=bind(fd, (struct sockaddr*)&addr, sizeof(addr))==0;
+    }
+    if(!ok || listen(fd, 64)<0) {
+        printf("Could not listen on %s: %s\n",path,strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve_main(int argc, char *argv[])
+{
+    serve_opts opts;
+    serve_client listener;
+    const char *path=NULL;
+    int i;
     
-    double total1 = wavelc * 1.026;
-    double total1c = total1 + 4*bendcorr;
-    double rad1 = 0.5 * total1c / 
-    (1 + sqrt(1/pow(ratio,2) + pow(turns*pi,2)));
-    //double vert1 = (total1c - 2*rad1)/2;
-    double height1 = rad1 / ratio;
+    opts.format=qfh_find_emitter("nec");
+    opts.spw=0;
+    for(i=1;i+1<argc;i+=2) {
+        if(strcmp(argv[i],"--socket")==0)
+            path=argv[i+1];
+        else if(strcmp(argv[i],"--format")==0)
+            opts.format=qfh_find_emitter(argv[i+1]);
+        else if(strcmp(argv[i],"--spw")==0)
+            opts.spw=atof(argv[i+1]);
+        else
+            break;
+    }
+    if(i!=argc || opts.format==NULL || strcmp(opts.format->name, "bin")==0) {
+        printf("Usage: QFH2nec --serve [--socket path] [--format name] [--spw segments]\n");
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if(path==NULL) {
+        serve_stream(0, 1, &opts);
+        return 0;
+    }
+    if((listener.fd=serve_listen(path))<0)
+        exit(1);
+    listener.opts=&opts;
+    serve_accept(&listener);
+    return 1;
+}
+
+/*
+ * Server benchmark: a server is started on a socket in a temporary
+ * directory and loaded by clients threads, each sending its requests one
+ * after the other and timing every answer. For comparison the same
+ * kind of request is then made by starting QFH2nec once per design and
+ * reading back and deleting the deck file it writes, as a backend
+ * without the server has to.
+ */
+
+typedef struct {
+    const char *path;
+    int nreq, client;
+    double *lat; // seconds per request
+    long bytes;
+    int failed;
+} bench_client;
+
+/* A design request spread over typical antennas */
+static void bench_request(long i, design_req *req)
+{
+    req->freq=100+fmod(i*7.31, 2300);
+    req->turns=0.5+fmod(i*0.037, 1);
+    req->length=0.5+fmod(i*0.013, 1.5);
+    req->radius=5+fmod(i*3.7, 20);
+    req->diam=1+fmod(i*0.71, 9);
+    req->ratio=0.3+fmod(i*0.0093, 0.3);
+}
+
+static void *bench_client_thread(void *arg)
+{
+    bench_client *bc=(bench_client*)arg;
+    struct sockaddr_un addr;
+    design_req req;
+    char line[512], *resp=NULL, *p;
+    size_t cap=0, len;
+    ssize_t n;
+    double t0;
+    int fd, r;
     
-    helixes[1].D = rad1;
-    helixes[1].H = height1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    strcpy(addr.sun_path, bc->path);
+    if((fd=socket(AF_UNIX, SOCK_STREAM, 0))<0 ||
+       connect(fd, (struct sockaddr*)&addr, sizeof(addr))<0) {
+        bc->failed=bc->nreq;
+        return NULL;
+    }
+    for(r=0;r<bc->nreq;r++) {
+        bench_request((long)bc->client*bc->nreq+r, &req);
+        n=snprintf(line, sizeof(line), "{\"id\": %d, \"freq\": %.6g, "
+                   "\"turns\": %.6g, \"length\": %.6g, \"radius\": %.6g, "
+                   "\"diam\": %.6g, \"ratio\": %.6g}\n", r, req.freq,
+                   req.turns, req.length, req.radius, req.diam, req.ratio);
+        t0=wall_time();
+        if(write_all(fd, line, n)) {
+            bc->failed++;
+            break;
+        }
+        // the answer is one line
+        len=0;
+        for(;;) {
+            if(cap-len<65536) {
+                cap=cap ? 2*cap : 65536;
+                if((p=(char*)realloc(resp, cap))==NULL)
+                    break;
+                resp=p;
+            }
+            if((n=read(fd, resp+len, cap-len-1))<=0)
+                break;
+            len+=n;
+            if(resp[len-1]=='\n')
+                break;
+        }
+        bc->lat[r]=wall_time()-t0;
+        bc->bytes+=len;
+        if(resp)
+            resp[len]='\0';
+        if(len==0 || resp[len-1]!='\n' || strstr(resp, "\"ok\": true")==NULL)
+            bc->failed++;
+    }
+    free(resp);
+    close(fd);
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double d=*(const double*)a-*(const double*)b;
+    return d<0 ? -1 : d>0;
+}
+
+static void print_latency(const char *what, double *lat, long n, double t)
+{
+    qsort(lat, n, sizeof(double), cmp_double);
+    printf("%s: %ld requests, %.0f requests/s\n", what, n, n/t);
+    printf("  latency ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           lat[(long)(0.50*(n-1))]*1e3, lat[(long)(0.90*(n-1))]*1e3,
+           lat[(long)(0.99*(n-1))]*1e3, lat[n-1]*1e3);
+}
+
+int bench_serve(int argc, char *argv[])
+{
+    char dir[]="/tmp/qfh2necXXXXXX", path[64], exe[4096], args[6][32];
+    char filename[4096], deck[4096], *spawn_argv[8];
+    serve_opts opts;
+    serve_client listener;
+    bench_client *bc;
+    pthread_t tid, *ctid;
+    posix_spawn_file_actions_t fa;
+    design_req req;
+    extern char **environ;
+    double *lat, t0, t;
+    long failed=0, bytes=0, nlat;
+    int i, nclients=4, nreq=500, nspawn=50, status;
+    ssize_t n;
+    pid_t pid;
+    FILE *f;
     
+    for(i=1;i+1<argc;i+=2) {
+        if(strcmp(argv[i],"-c")==0)
+            nclients=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"-n")==0)
+            nreq=atoi(argv[i+1]);
+        else if(strcmp(argv[i],"--spawn")==0)
+            nspawn=atoi(argv[i+1]);
+        else
+            break;
+    }
+    if(i!=argc || nclients<1 || nreq<1 || nspawn<0) {
+        printf("Usage: QFH2nec --bench-serve [-c clients] [-n requests] [--spawn requests]\n");
+        exit(1);
+    }
+    if(mkdtemp(dir)==NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    snprintf(path, sizeof(path), "%s/sock", dir);
+    signal(SIGPIPE, SIG_IGN);
+    opts.format=qfh_find_emitter("nec");
+    opts.spw=0;
+    listener.opts=&opts;
+    if((listener.fd=serve_listen(path))<0 ||
+       pthread_create(&tid, NULL, serve_accept, &listener)) {
+        rmdir(dir);
+        exit(1);
+    }
+    pthread_detach(tid);
     
-    double total2 = wavelc * 0.975;
-    double total2c = total2 + 4*bendcorr;
-    double rad2 = 0.5 * total2c /
-    (1 + sqrt(1/pow(ratio,2) + pow(turns*pi,2)));
-    //double vert2 = (total2c - 2*rad2)/2;
-    double height2 = rad2 / ratio;
+    // the latencies of the clients, then those of the spawned processes
+    nlat=(long)nclients*nreq>nspawn ? (long)nclients*nreq : nspawn;
+    lat=(double*)malloc(nlat*sizeof(double));
+    bc=(bench_client*)calloc(nclients, sizeof(bench_client));
+    ctid=(pthread_t*)malloc(nclients*sizeof(pthread_t));
+    if(lat==NULL || bc==NULL || ctid==NULL) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    t0=wall_time();
+    for(i=0;i<nclients;i++) {
+        bc[i].path=path;
+        bc[i].nreq=nreq;
+        bc[i].client=i;
+        bc[i].lat=lat+(size_t)i*nreq;
+        if(pthread_create(&ctid[i], NULL, bench_client_thread, &bc[i])) {
+            printf("Could not start client thread %d\n",i);
+            exit(1);
+        }
+    }
+    for(i=0;i<nclients;i++) {
+        pthread_join(ctid[i], NULL);
+        failed+=bc[i].failed;
+        bytes+=bc[i].bytes;
+    }
+    t=wall_time()-t0;
+    unlink(path);
+    printf("server, %d clients: %.1f kB per answer\n", nclients,
+           bytes/1e3/((double)nclients*nreq));
+    print_latency("server", lat, (long)nclients*nreq, t);
     
-    helixes[0].D = rad2;
-    helixes[0].H = height2;
+    // one process per request, deck through a file
+    if(nspawn>0) {
+        if((n=readlink("/proc/self/exe", exe, sizeof(exe)-1))<0) {
+            perror("readlink");
+            rmdir(dir);
+            exit(1);
+        }
+        exe[n]='\0';
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+        if(chdir(dir)) {
+            perror("chdir");
+            exit(1);
+        }
+        t0=wall_time();
+        nlat=0;
+        for(i=0;i<nspawn;i++) {
+            bench_request(i, &req);
+            snprintf(args[0], sizeof(args[0]), "%.6g", req.freq);
+            snprintf(args[1], sizeof(args[1]), "%.6g", req.turns);
+            snprintf(args[2], sizeof(args[2]), "%.6g", req.length);
+            snprintf(args[3], sizeof(args[3]), "%.6g", req.radius);
+            snprintf(args[4], sizeof(args[4]), "%.6g", req.diam);
+            snprintf(args[5], sizeof(args[5]), "%.6g", req.ratio);
+            spawn_argv[0]=exe;
+            for(status=0;status<6;status++)
+                spawn_argv[status+1]=args[status];
+            spawn_argv[7]=NULL;
+            lat[nlat]=wall_time();
+            if(posix_spawn(&pid, exe, &fa, NULL, spawn_argv, environ) ||
+               waitpid(pid, &status, 0)<0 || !WIFEXITED(status) ||
+               WEXITSTATUS(status)!=0) {
+                failed++;
+                continue;
+            }
+            // the values the deck file is named after
+            sscanf(args[0], "%lf", &req.freq);
+            sscanf(args[1], "%lf", &req.turns);
+            sscanf(args[2], "%lf", &req.length);
+            sscanf(args[3], "%lf", &req.radius);
+            sscanf(args[4], "%lf", &req.diam);
+            sscanf(args[5], "%lf", &req.ratio);
+            design_filename(filename, sizeof(filename), NULL, &req, "nec");
+            if((f=fopen(filename, "r"))==NULL) {
+                failed++;
+                continue;
+            }
+            while(fread(deck, 1, sizeof(deck), f)>0)
+                ;
+            fclose(f);
+            unlink(filename);
+            // only the requests that succeeded count
+            lat[nlat]=wall_time()-lat[nlat];
+            nlat++;
+        }
+        t=wall_time()-t0;
+        posix_spawn_file_actions_destroy(&fa);
+        if(nlat>0)
+            print_latency("process per request", lat, nlat, t);
+    }
+    rmdir(dir);
+    if(failed)
+        printf("%ld requests failed\n", failed);
+    free(lat);
+    free(bc);
+    free(ctid);
+    return failed ? 1 : 0;
 }
@@ -2,6 +2,14 @@
 #include<stdlib.h>
 #include<math.h>
 #include<ctype.h>
+#include<string.h>
+#include<limits.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "qfh.h"
 
 /*
  *    The input file's structure is as follows:
@@ -29,284 +37,665 @@
 /* This is the length of the feedpoint */
 #define epsilon 10
 
-/* Mmmmm... pi */
-#define pi 3.14159265359
+/* Segmentation of the generated helices */
+const qfh_segmentation helix2nec_segmentation = {
+    radialsegments,
+    cornersegments,
+    helixsegments,
+    epsilon
+};
 
+/* Helices read, built and written at a time */
+#define CHUNK 256
+
+/*
+ * The input file is mapped into memory and read a chunk of helices at a
+ * time, so that memory use does not depend on the number of helices. The
+ * comments at the top of a NEC deck list every helix before the first
+ * geometry card, so the input is read twice for a NEC deck: once for the
+ * comments, checking every line, and once for the geometry. Only the
+ * feed wire tags of the terminated and fed helices are kept for the
+ * trailing LD and EX cards. With -s the segmentation, which depends on
+ * every helix and on the last line, takes one more pass. The csv and bin
+ * formats need the whole model and are built from all helices at once.
+ */
 typedef struct {
-    double H; //height
-    double D; //diameter
-    double R; //angle radius
-    double turns; //number of turns
-    double offset; //distance from origin
-    double Theta; //initial theta angle
-    double wire; //radius of wire
-    char feed; //O=open, S=short, T=terminated to 50 ohms
-    int feedpoint; //tag of feed segment
-} helix;
+    const char *data, *p, *end; // mapped input, next character, its end
+    const char *name; // file name for the error messages
+    int n; // number of helices
+    int next; // number of the next helix to be read
+    qfh_stats *stats; // parsing and the check accounted here, or NULL
+} helix_input;
 
-void make_helix(FILE *, helix);
+/* The next whitespace separated token, copied to tok. Returns its length,
+ * 0 at the end of the input. */
+static size_t next_token(helix_input *in, char *tok, size_t len)
+{
+    const char *start;
+    size_t n;
+    
+    while(in->p<in->end && isspace((unsigned char)*in->p))
+        in->p++;
+    start=in->p;
+    while(in->p<in->end && !isspace((unsigned char)*in->p))
+        in->p++;
+    n=in->p-start;
+    if(n==0 || n>=len)
+        return 0;
+    memcpy(tok, start, n);
+    tok[n]='\0';
+    return n;
+}
 
-int ITG=1;
-int feedpointhack;
+static int next_double(helix_input *in, double *v)
+{
+    char tok[64], *end;
+    
+    if(next_token(in, tok, sizeof(tok))==0)
+        return 1;
+    *v=strtod(tok, &end);
+    return *end!='\0';
+}
 
-int main(int argc, char*argv[])
+/* The next character that is not whitespace, as read by " %c" */
+static int next_char(helix_input *in, char *c)
 {
-    FILE *infile;
-    FILE *outfile;
-    int i, n, feed=0;
-    helix *h;
-    double fstart, fstop, fstep;
+    while(in->p<in->end && isspace((unsigned char)*in->p))
+        in->p++;
+    if(in->p==in->end)
+        return 1;
+    *c=*in->p++;
+    return 0;
+}
+
+/* Goes back to the first helix. Returns 0 on success. */
+static int input_rewind(helix_input *in)
+{
+    char tok[64], *end;
+    long n;
     
-    if(argc!=3) {
-        printf("Usage: helix2nec <inputfile> <outputfile>\n");
-        exit(1);
+    in->p=in->data;
+    in->next=0;
+    if(next_token(in, tok, sizeof(tok))==0)
+        return 1;
+    n=strtol(tok, &end, 10);
+    if(*end!='\0' || n<0 || n>INT_MAX/2)
+        return 1;
+    in->n=(int)n;
+    return 0;
+}
+
+/* Reads up to max helices into h, two loops each. Returns how many, or -1
+ * after printing an error. */
+static int parse_chunk(helix_input *in, helix *h, int max)
+{
+    int i, k;
+    
+    for(k=0;k<max && in->next<in->n;k++,in->next++) {
+        i=in->next;
+        if(next_double(in, &h[k*2].H) || next_double(in, &h[k*2].D) ||
+           next_double(in, &h[k*2+1].H) || next_double(in, &h[k*2+1].D) ||
+           next_double(in, &h[k*2].R) || next_double(in, &h[k*2].wire) ||
+           next_double(in, &h[k*2].turns) ||
+           next_double(in, &h[k*2].offset) ||
+           next_double(in, &h[k*2].Theta) || next_char(in, &h[k*2].feed)) {
+            printf("Error in input file %s, "
+            "helix number %d (helix data)\n",
+                   in->name, i);
+            return -1;
+        }
+        h[k*2+1].R=h[k*2].R;
+        h[k*2+1].wire=h[k*2].wire;
+        h[k*2+1].turns=h[k*2].turns;
+        h[k*2+1].offset=h[k*2].offset;
+        h[k*2+1].Theta=h[k*2].Theta;
+        h[k*2+1].feed=h[k*2].feed;
+        if(strchr("OSTF", toupper(h[k*2].feed))==NULL ||
+           h[k*2].feed=='\0') {
+            printf("Error in input file %s, "
+            "helix number %d (termination type)\n",
+                   in->name, i);
+            return -1;
+        }
     }
-    if((infile=fopen(argv[1],"r"))==NULL) {
-        printf("Could not open input file %s\n",argv[1]);
-        exit(1);
+    return k;
+}
+
+/* parse_chunk(), accounted as parsing */
+static int read_chunk(helix_input *in, helix *h, int max)
+{
+    double t0=qfh_stats_start(in->stats);
+    int k=parse_chunk(in, h, max);
+    
+    qfh_stats_stop(in->stats, QFH_PHASE_PARSE, t0);
+    return k;
+}
+
+static double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* Writes the model one chunk at a time. Returns 0 on success. */
+static int stream_deck(qfh_ctx *ctx, helix_input *in, qfh_model *m,
+                       helix *h, double spw, long *segments)
+{
+    qfh_segmentation seg;
+    double t0;
+    int *loads=NULL, *p, nloads=0, loadcap=0, feed=0, i, k;
+    
+    // comments, checking every helix
+    input_rewind(in);
+    m->h=h;
+    while((k=read_chunk(in, h, CHUNK))>0) {
+        m->nhelix=k;
+        m->comment_base=in->next-k;
+        for(i=0;i<k;i++)
+            if(toupper(h[2*i].feed)=='F' && ++feed>1) {
+                printf("Too many feed helices in model!!!\n");
+                return 1;
+            }
+        t0=qfh_stats_start(ctx->stats);
+        qfh_emit_nec_comments(ctx, m, m->comment_base==0, 0);
+        qfh_stats_stop(ctx->stats, QFH_PHASE_EMIT, t0);
     }
-    if((outfile=fopen(argv[2],"w"))==NULL) {
-        printf("Could not open output file %s\n",argv[2]);
-        exit(1);
+    if(k<0)
+        return 1;
+    if(feed==0) {
+        printf("No feed helix in model???\n");
+        return 1;
     }
-    
-    // Parse the input file
-    if(fscanf(infile, "%d", &n)!=1) {
-        printf("Error in input file %s (number of helices)\n",argv[1]);
-        exit(1);
+    // Frequency specification
+    if(next_double(in, &m->fstart) || next_double(in, &m->fstop) ||
+       next_double(in, &m->fstep)) {
+        printf("Error in input file %s, (frequency)\n",
+               in->name);
+        return 1;
     }
-    if((h=(helix*)malloc(2*n*sizeof(helix)))==NULL) {
-        printf("Error allocating memory for %d helices\n",n);
-        exit(1);
+    m->nhelix=0;
+    t0=qfh_stats_start(ctx->stats);
+    qfh_emit_nec_comments(ctx, m, 0, 1);
+    qfh_stats_stop(ctx->stats, QFH_PHASE_EMIT, t0);
+    
+    if(spw>0) {
+        ctx->seg.radial=ctx->seg.corner=ctx->seg.helix=1;
+        input_rewind(in);
+        while((m->nhelix=read_chunk(in, h, CHUNK))>0) {
+            seg=ctx->seg;
+            qfh_adaptive_segmentation(m, spw, &seg);
+            if(seg.radial>ctx->seg.radial)
+                ctx->seg.radial=seg.radial;
+            if(seg.corner>ctx->seg.corner)
+                ctx->seg.corner=seg.corner;
+            if(seg.helix>ctx->seg.helix)
+                ctx->seg.helix=seg.helix;
+        }
     }
-    fprintf(outfile, "CM NEC2 Input File produced by helix2nec\n");
-    fprintf(outfile, "CM Parameters:\n");
-    for(i=0;i<n;i++) {
-        if(fscanf(infile, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %c",
-            &h[i*2].H, &h[i*2].D, &h[i*2+1].H, &h[i*2+1].D,
-            &h[i*2].R, &h[i*2].wire,
-            &h[i*2].turns, &h[i*2].offset, &h[i*2].Theta,
-            &h[i*2].feed)!=10) {
-            printf("Error in input file %s, "
-            "helix number %d (helix data)\n",
-                   argv[1], i);
-            exit(1);
+    
+    // geometry
+    input_rewind(in);
+    ctx->itg=1;
+    *segments=0;
+    while((m->nhelix=read_chunk(in, h, CHUNK))>0) {
+        if(qfh_build_part(ctx, m)) {
+            printf("Error allocating memory for %d helices\n",m->nhelix);
+            free(loads);
+            return 1;
+        }
+        for(i=0;i<m->nhelix;i++) {
+            if(toupper(h[2*i].feed)=='F')
+                feed=h[2*i].feedpoint;
+            if(toupper(h[2*i].feed)!='T')
+                continue;
+            if(nloads==loadcap) {
+                loadcap=loadcap ? 2*loadcap : 1024;
+                if((p=(int*)realloc(loads, loadcap*sizeof(int)))==NULL) {
+                    printf("Error allocating memory for %d loads\n",loadcap);
+                    free(loads);
+                    return 1;
+                }
+                loads=p;
             }
-            h[i*2+1].R=h[i*2].R;
-        h[i*2+1].wire=h[i*2].wire;
-        h[i*2+1].turns=h[i*2].turns;
-        h[i*2+1].offset=h[i*2].offset;
-        fprintf(outfile, "CM Helix %d:"
-        " H1=%.5E D1=%.5E H2=%.5E D2=%.5E\n",
-        i, h[i*2].H, h[i*2].D, h[i*2+1].H, h[i*2+1].D);
-        fprintf(outfile, "CM turns=%.5E R=%.5E, wire=%.5E\n",
-                h[i*2].turns, h[i*2].R, h[i*2].wire);
-        fprintf(outfile, "CM offset=%.5E theta=%.5E ",
-                h[i*2].offset, h[i*2].Theta);
-        h[i*2+1].wire=(h[i*2].wire/=2); //diameter to radius
-        h[i*2].Theta=h[i*2].Theta/360*2*pi; //degrees to radians
-        h[i*2+1].Theta=h[i*2].Theta+pi/2;
-        switch(toupper(h[i*2].feed)) {
-            case 'O':
-                fprintf(outfile,"open\n");
-                break;
-            case 'S':
-                fprintf(outfile,"shorted\n");
-                break;
-            case 'T':
-                fprintf(outfile,"terminated\n");
-                break;
-            case 'F':
-                fprintf(outfile,"feed\n");
-                feed+=1;
-                break;
-            default:
-                printf("Error in input file %s, "
-                "helix number %d (termination type)\n",
-                       argv[1], i);
-                exit(1);
+            loads[nloads++]=h[2*i].feedpoint;
         }
+        *segments+=qfh_model_segments(m);
+        t0=qfh_stats_start(ctx->stats);
+        qfh_emit_nec_geometry(ctx, m);
+        qfh_stats_stop(ctx->stats, QFH_PHASE_EMIT, t0);
+    }
+    m->nhelix=0;
+    m->geom.n=0;
+    m->ncards=0;
+    if(qfh_build_end(ctx, m)) {
+        printf("Error building the symmetric copy\n");
+        free(loads);
+        return 1;
     }
+    *segments*=m->nsym;
+    t0=qfh_stats_start(ctx->stats);
+    qfh_emit_nec_geometry(ctx, m);
+    qfh_emit_nec_controls(ctx, m, loads, nloads, &feed, 1);
+    qfh_stats_stop(ctx->stats, QFH_PHASE_EMIT, t0);
+    free(loads);
+    return 0;
+}
+
+/* Reads every helix and builds the model at once, with a feed wire on
+ * the open helices too if wires is set. Returns 0 on success. */
+static int whole_model(qfh_ctx *ctx, helix_input *in, qfh_model *m,
+                       helix **hp, double spw, int wires)
+{
+    helix *h;
+    int i, feed=0;
+    
+    input_rewind(in);
+    if((h=(helix*)malloc(2*(size_t)(in->n ? in->n : 1)*sizeof(helix)))==NULL) {
+        printf("Error allocating memory for %d helices\n",in->n);
+        return 1;
+    }
+    *hp=h;
+    if(read_chunk(in, h, in->n)<0)
+        return 1;
+    for(i=0;i<in->n;i++)
+        if(toupper(h[2*i].feed)=='F')
+            feed++;
     if(feed==0) {
         printf("No feed helix in model???\n");
-        exit(1);
+        return 1;
     }
     if(feed>1) {
         printf("Too many feed helices in model!!!\n");
-        exit(1);
+        return 1;
     }
+    m->h=h;
+    m->nhelix=in->n;
+    m->comment_base=0;
     
     // Frequency specification
-    if(fscanf(infile, "%lf %lf %lf",
-        &fstart, &fstop, &fstep)!=3) {
+    if(next_double(in, &m->fstart) || next_double(in, &m->fstop) ||
+       next_double(in, &m->fstep)) {
         printf("Error in input file %s, (frequency)\n",
-               argv[1]);
-        exit(1);
-        }
-        fprintf(outfile, "CM %.5E - %.5E MHz in %.5E MHz steps\n",
-                fstart, fstop, fstep);
-        
-        fprintf(outfile, "CE\n");
+               in->name);
+        return 1;
+    }
     
-    // do the helices
-    for(i=0;i<n;i++) {
-        feedpointhack=1;
-        make_helix(outfile, h[2*i]);
-        feedpointhack=0;
-        make_helix(outfile, h[2*i+1]);
-        if(toupper(h[2*i].feed)!='O') {
-            fprintf(outfile, "GW %d %d %.5E %.5E %.5E "
-            "%.5E %.5E %.5E %.5E\n",
-            (h[2*i].feedpoint=ITG++), 1,
-                    (epsilon/2)*cos(h[2*i].Theta+pi/4)/1000,
-                    (epsilon/2)*sin(h[2*i].Theta+pi/4)/1000,
-                    (h[2*i].offset)/1000,
-                    -(epsilon/2)*cos(h[2*i].Theta+pi/4)/1000,
-                    -(epsilon/2)*sin(h[2*i].Theta+pi/4)/1000,
-                    (h[2*i].offset)/1000,
-                    h[2*i].wire/1000);
-            
+    if(spw>0)
+        qfh_adaptive_segmentation(m, spw, &ctx->seg);
+    // the second loop keeps the letter of an open helix
+    for(i=0;i<in->n && wires;i++)
+        if(toupper(h[2*i].feed)=='O')
+            h[2*i].feed='S';
+    if(qfh_build_model(ctx, m)) {
+        printf("Error allocating memory for %d helices\n",in->n);
+        return 1;
+    }
+    return 0;
+}
+
+/* Builds the whole model as format describes it, apart from the deck,
+ * and checks its helices and geometry with qfh_check_geometry(),
+ * printing what it finds. Returns 0 if it can be written, 1 if not. */
+static int check_input(helix_input *in, const qfh_emitter *format,
+                       double spw)
+{
+    qfh_ctx ctx;
+    qfh_model m;
+    qfh_check_result r;
+    helix *h=NULL;
+    char err[100];
+    double t0;
+    int i, failed;
+
+    memset(&m, 0, sizeof(m));
+    qfh_init(&ctx, &helix2nec_segmentation, NULL, NULL);
+    ctx.compact=format->compact;
+    ctx.symmetric=format->symmetric;
+    failed=whole_model(&ctx, in, &m, &h, spw, 0);
+    for(i=0;i<in->n && !failed;i++)
+        if(qfh_check_helix(&h[2*i], err, sizeof(err))) {
+            printf("Helix %d: %s\n",i+1,err);
+            failed=1;
+        }
+    if(!failed) {
+        t0=qfh_stats_start(in->stats);
+        failed=qfh_check_geometry(&m.geom, m.fstop, &r);
+        qfh_stats_stop(in->stats, QFH_PHASE_CHECK, t0);
+        if(failed) {
+            printf("Error allocating memory for the geometry check\n");
+            failed=1;
+        } else {
+            qfh_check_print(&r, stdout);
+            failed=r.errors>0;
         }
     }
-    fprintf(outfile, "GE 0\n");
-    
-    // Frequency specification
-    fprintf(outfile, "FR 0 %d 0 0 %.5E %.5E\n",
-            (int)((fstop-fstart)/fstep)+1, fstart, fstep);
-    
-    // LD impedance loading to 50 ohms resistive
-    for(i=0;i<n;i++) {
-        if(toupper(h[2*i].feed)=='T') {
-            fprintf(outfile, "LD 4 %d 1 1 "
-            "5.00000E+01 0.00000E+00\n",
-            h[2*i].feedpoint);
+    qfh_model_free(&m);
+    free(h);
+    return failed;
+}
+
+/* Most cases of -T all: every other helix terminated, open or shorted */
+#define MAXCASES 59049
+
+/* Reads the next case of a cases file into feeds, nhelix letters.
+ * Returns 1 at its end, -1 on a bad line. */
+static int next_case(FILE *f, char *feeds, int nhelix)
+{
+    int i=0, c;
+
+    while((c=getc(f))!=EOF && isspace(c))
+        ;
+    if(c==EOF)
+        return 1;
+    while(c!=EOF && !isspace(c)) {
+        if(i<nhelix)
+            feeds[i]=(char)c;
+        i++;
+        c=getc(f);
+    }
+    return i==nhelix ? 0 : -1;
+}
+
+/* Solves the model once per line of the cases file, or for every
+ * termination of the helices that are not fed with cases "all", at
+ * every frequency, and writes a csv line per case and frequency. The
+ * matrix is factored once per frequency and the cases are solved as
+ * changes of the loads on the feed wires (qfh_term_solve()), so every
+ * helix gets its feed wire, even the open ones. The first cases without
+ * an open helix are also solved in full for comparison. Returns 0 on
+ * success. */
+static int term_sweep(qfh_ctx *ctx, helix_input *in, qfh_model *m,
+                      helix **hp, double spw, const char *cases,
+                      int nthreads, FILE *out)
+{
+    qfh_term t;
+    qfh_result r, *full;
+    FILE *cf=NULL;
+    char *feeds, *all=NULL, *file;
+    double t0, tfactor=0, tcases=0, tfull=0, dz=0, dg=0, fstop;
+    long ncase=0, c, k, nfull=0;
+    int i, f, nfree=0, fed=-1, err=0;
+
+    if(whole_model(ctx, in, m, hp, spw, 1))
+        return 1;
+    if((feeds=(char*)malloc(2*(size_t)m->nhelix+1))==NULL) {
+        printf("Error allocating memory for %d helices\n",m->nhelix);
+        return 1;
+    }
+    file=feeds+m->nhelix;
+    for(i=0;i<m->nhelix;i++) {
+        file[i]=(*hp)[2*i+1].feed;
+        if(toupper(file[i])=='F')
+            fed=i;
+        else
+            nfree++;
+    }
+    if(strcmp(cases, "all")==0) {
+        for(ncase=1,i=0;i<nfree;i++)
+            if((ncase*=3)>MAXCASES) {
+                printf("Too many helices for -T all, %d cases at most\n",
+                       MAXCASES);
+                free(feeds);
+                return 1;
+            }
+        if((all=(char*)malloc((size_t)ncase*m->nhelix))==NULL) {
+            printf("Error allocating memory for %ld cases\n",ncase);
+            free(feeds);
+            return 1;
         }
+        for(c=0;c<ncase;c++)
+            for(k=c,i=0;i<m->nhelix;i++) {
+                if(i==fed) {
+                    all[c*m->nhelix+i]='F';
+                    continue;
+                }
+                all[c*m->nhelix+i]="TOS"[k%3];
+                k/=3;
+            }
+    } else if((cf=fopen(cases, "r"))==NULL) {
+        printf("Could not open cases file %s\n",cases);
+        free(feeds);
+        return 1;
     }
-    
-    // Voltage excitation
-    for(i=0;i<n;i++) {
-        if(toupper(h[2*i].feed)=='F') {
-            fprintf(outfile, "EX 0 %d 1 0 "
-            "1.00000E+00 0.00000E+00\n",
-            h[2*i].feedpoint);
+    if(qfh_term_init(&t, m)) {
+        printf("Error allocating memory for the solver\n");
+        free(feeds);
+        free(all);
+        if(cf)
+            fclose(cf);
+        return 1;
+    }
+    full=(qfh_result*)malloc(qfh_nfreq(m)*sizeof(qfh_result));
+    fprintf(out, "case,feeds,freq,re,im,swr,gain,axial\n");
+    for(f=0;f<qfh_nfreq(m) && !err;f++) {
+        t0=wall_time();
+        if(qfh_term_factor(&t, m->fstart+f*m->fstep, nthreads)) {
+            printf("Error solving the model at %g MHz\n",
+                   m->fstart+f*m->fstep);
+            err=1;
+            break;
         }
+        tfactor+=wall_time()-t0;
+        if(cf)
+            rewind(cf);
+        for(c=0;;c++) {
+            if(all) {
+                if(c==ncase)
+                    break;
+                memcpy(feeds, all+c*m->nhelix, m->nhelix);
+            } else if((k=next_case(cf, feeds, m->nhelix))!=0) {
+                if(k<0) {
+                    printf("Error in cases file %s, case %ld\n",cases,c);
+                    err=1;
+                }
+                break;
+            }
+            feeds[m->nhelix]='\0';
+            t0=wall_time();
+            if(qfh_term_solve(&t, feeds, &r, NULL)) {
+                printf("Cannot solve case %ld (%s)\n",c,feeds);
+                err=1;
+                break;
+            }
+            tcases+=wall_time()-t0;
+            fprintf(out, "%ld,%s,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", c, feeds,
+                    r.freq, creal(r.z), cimag(r.z), r.swr, r.gain, r.axial);
+            // a few cases again the slow way, on the same geometry
+            if(f>0 || nfull==3 || full==NULL || strpbrk(feeds, "Oo"))
+                continue;
+            for(i=0;i<m->nhelix;i++)
+                (*hp)[2*i].feed=(*hp)[2*i+1].feed=feeds[i];
+            fstop=m->fstop;
+            m->fstop=m->fstart;
+            t0=wall_time();
+            if(qfh_solve_model(m, nthreads, 0, full)==0) {
+                tfull+=wall_time()-t0;
+                dz=fmax(dz, cabs(full[0].z-r.z)/cabs(full[0].z));
+                dg=fmax(dg, fabs(full[0].gain-r.gain));
+                nfull++;
+            }
+            m->fstop=fstop;
+        }
+        ncase=c;
     }
-    
-    // Compute radiation pattern with fixed increments
-    fprintf(outfile, "RP 0 37 37 1000 0.00000E+00 0.00000E+00 "
-    "5.00000E+00 1.00000E+01 0.00000E+00 0.00000E+00\n");
-    
-    // End of run
-    fprintf(outfile, "EN\n");
-    return 0;
+    for(i=0;i<m->nhelix;i++)
+        (*hp)[2*i].feed=(*hp)[2*i+1].feed=file[i];
+    if(!err) {
+        printf("%ld cases at %d frequencies, %d unknowns: factored in %.3f s, "
+               "%.2f us per case\n", ncase, qfh_nfreq(m), t.ms.nbasis,
+               tfactor, 1e6*tcases/(ncase*qfh_nfreq(m)));
+        if(nfull>0)
+            printf("Full solve of a case %.3f s, %.0f times slower; "
+                   "impedances agree to %.1e, gains to %.1e dB\n",
+                   tfull/nfull, tfull/nfull/(tcases/(ncase*qfh_nfreq(m))),
+                   dz, dg);
+    }
+    qfh_term_free(&t);
+    free(full);
+    free(feeds);
+    free(all);
+    if(cf)
+        fclose(cf);
+    return err;
 }
 
-/* This outputs NEC2 code to the output file, to produce the type of
- *   bifilar helix loop defined by struct helix h. No checking is done
- *   re the sanity of the parameters passed therein. */
-void make_helix(FILE *outfile, helix h)
+int main(int argc, char*argv[])
 {
-    int i;
-    double x, y, z, alpha, theta, r;
-    double x1, y1, z1;
+    FILE *outfile;
+    qfh_ctx ctx;
+    qfh_model m;
+    const qfh_emitter *format;
+    helix_input in;
+    helix *h=NULL;
+    qfh_grid rp;
+    qfh_stats stats;
+    struct stat st;
+    int fd, failed, timing=0, nthreads=0, print_stats=0, check=0;
+    const char *cases=NULL, *rpspec=NULL, *json=NULL;
+    long segments=0;
+    double spw=0, t0, te;
     
-    // top radial wires
-    if(feedpointhack) {
-        x1=(epsilon/2)*cos(h.Theta+pi/4);
-        y1=(epsilon/2)*sin(h.Theta+pi/4);
-    } else {
-        x1=(epsilon/2)*cos(h.Theta-pi/4);
-        y1=(epsilon/2)*sin(h.Theta-pi/4);
+    format=qfh_find_emitter("nec");
+    while(argc>3 && argv[1][0]=='-') {
+        if(strcmp(argv[1],"-f")==0) {
+            if((format=qfh_find_emitter(argv[2]))==NULL) {
+                printf("Unknown output format %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"-s")==0) {
+            if((spw=atof(argv[2]))<=0) {
+                printf("Invalid segments per wavelength %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"-r")==0) {
+            if(qfh_grid_parse(&rp, argv[2])) {
+                printf("Invalid radiation pattern grid %s\n",argv[2]);
+                exit(1);
+            }
+            rpspec=argv[2];
+        } else if(strcmp(argv[1],"-T")==0) {
+            cases=argv[2];
+        } else if(strcmp(argv[1],"-j")==0) {
+            if((nthreads=atoi(argv[2]))<=0) {
+                printf("Invalid number of threads %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"-t")==0) {
+            timing=1;
+            argc-=1;
+            argv+=1;
+            continue;
+        } else if(strcmp(argv[1],"--stats")==0) {
+            print_stats=1;
+            argc-=1;
+            argv+=1;
+            continue;
+        } else if(strcmp(argv[1],"--check")==0) {
+            check=1;
+            argc-=1;
+            argv+=1;
+            continue;
+        } else if(strcmp(argv[1],"--stats-json")==0) {
+            json=argv[2];
+        } else
+            break;
+        argc-=2;
+        argv+=2;
     }
-    z1=0;
-    x=(h.D/2-h.R)*cos(h.Theta);
-    y=(h.D/2-h.R)*sin(h.Theta);
-    z=0;
-    fprintf(outfile, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-            ITG++, radialsegments,
-            x1/1000, y1/1000, (z1+h.offset)/1000,
-            x/1000, y/1000, (z+h.offset)/1000,
-            h.wire/1000);
-    fprintf(outfile, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-            ITG++, radialsegments,
-            -x1/1000, -y1/1000, (z1+h.offset)/1000,
-            -x/1000, -y/1000, (z+h.offset)/1000,
-            h.wire/1000);
-    
-    // top bends
-    for(i=1;i<=cornersegments;i++) {
-        x1=x; y1=y; z1=z;
-        alpha=pi/2*(double)i/cornersegments;
-        z=-h.R+h.R*cos(alpha);
-        theta=z/h.H*h.turns*2*pi+h.Theta;
-        r=h.D/2-h.R+h.R*sin(alpha);
-        x=r*cos(theta);
-        y=r*sin(theta);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                x1/1000, y1/1000, (z1+h.offset)/1000,
-                x/1000, y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                -x1/1000, -y1/1000, (z1+h.offset)/1000,
-                -x/1000, -y/1000, (z+h.offset)/1000,
-                h.wire/1000);
+    if(argc!=3) {
+        printf("Usage: helix2nec [-f nec|necgh|necgr|csv|bin] [-s segments_per_wavelength] [-r grid] [-t] [--stats] [--stats-json file] [--check] [-T cases|all [-j threads]] <inputfile> <outputfile>\n");
+        exit(1);
     }
-    
-    // helical wires
-    r=h.D/2;
-    for(i=1;i<=helixsegments;i++) {
-        x1=x; y1=y; z1=z;
-        z=-h.R - (double)i/helixsegments*(h.H-2*h.R);
-        theta=z/h.H*h.turns*2*pi+h.Theta;
-        x=r*cos(theta);
-        y=r*sin(theta);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                x1/1000, y1/1000, (z1+h.offset)/1000,
-                x/1000, y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                -x1/1000, -y1/1000, (z1+h.offset)/1000,
-                -x/1000, -y/1000, (z+h.offset)/1000,
-                h.wire/1000);
+    t0=wall_time();
+    qfh_stats_init(&stats);
+    memset(&in, 0, sizeof(in));
+    in.name=argv[1];
+    if(print_stats || json)
+        in.stats=&stats;
+    if((fd=open(argv[1], O_RDONLY))<0 || fstat(fd, &st)) {
+        printf("Could not open input file %s\n",argv[1]);
+        exit(1);
     }
-    
-    // bottom bends
-    for(i=1;i<=cornersegments;i++) {
-        x1=x; y1=y; z1=z;
-        alpha=pi/2*(double)i/cornersegments;
-        z=-h.H+h.R - h.R*sin(alpha);
-        theta=z/h.H*h.turns*2*pi+h.Theta;
-        r=h.D/2-h.R+h.R*cos(alpha);
-        x=r*cos(theta);
-        y=r*sin(theta);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                x1/1000, y1/1000, (z1+h.offset)/1000,
-                x/1000, y/1000, (z+h.offset)/1000,
-                h.wire/1000);
-        fprintf(outfile,
-                "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-                ITG++, 1,
-                -x1/1000, -y1/1000, (z1+h.offset)/1000,
-                -x/1000, -y/1000, (z+h.offset)/1000,
-                h.wire/1000);
+    if(st.st_size>0) {
+        in.data=(const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                  fd, 0);
+        if(in.data==MAP_FAILED) {
+            printf("Could not read input file %s\n",argv[1]);
+            exit(1);
+        }
+        madvise((void*)in.data, st.st_size, MADV_SEQUENTIAL);
+        in.end=in.data+st.st_size;
+    }
+    close(fd);
+    if(input_rewind(&in)) {
+        printf("Error in input file %s (number of helices)\n",argv[1]);
+        exit(1);
+    }
+    if(check && check_input(&in, format, spw))
+        exit(1);
+    if((outfile=fopen(argv[2],"w"))==NULL) {
+        printf("Could not open output file %s\n",argv[2]);
+        exit(1);
+    }
+    setvbuf(outfile, NULL, _IOFBF, 1<<20);
+    if((h=(helix*)malloc(2*CHUNK*sizeof(helix)))==NULL) {
+        printf("Error allocating memory for %d helices\n",CHUNK);
+        exit(1);
     }
     
-    // bottom radial wire
-    fprintf(outfile, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
-            ITG++, radialsegments*2-1,
-            x/1000, y/1000, (z+h.offset)/1000,
-            -x/1000, -y/1000, (z+h.offset)/1000,
-            h.wire/1000);
-    
-    return;
+    // do the helices
+    memset(&m, 0, sizeof(m));
+    if(rpspec)
+        m.rp=&rp;
+    m.stats=in.stats;
+    qfh_init(&ctx, &helix2nec_segmentation, qfh_file_sink, outfile);
+    ctx.stats=in.stats;
+    ctx.compact=format->compact;
+    ctx.symmetric=format->symmetric;
+    if(cases) {
+        free(h);
+        h=NULL;
+        if(nthreads<=0)
+            nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+        failed=term_sweep(&ctx, &in, &m, &h, spw, cases,
+                          nthreads>0 ? nthreads : 1, outfile);
+        segments=qfh_model_segments(&m);
+    } else if(format->emit==qfh_emit_nec || format->emit==qfh_emit_necgh)
+        failed=stream_deck(&ctx, &in, &m, h, spw, &segments);
+    else {
+        free(h);
+        h=NULL;
+        failed=whole_model(&ctx, &in, &m, &h, spw, 0);
+        if(!failed) {
+            segments=qfh_model_segments(&m);
+            te=qfh_stats_start(in.stats);
+            format->emit(&ctx, &m);
+            qfh_stats_stop(in.stats, QFH_PHASE_EMIT, te);
+        }
+    }
+    if(failed) {
+        fclose(outfile);
+        remove(argv[2]);
+        exit(1);
+    }
+    if(spw>0)
+        printf("Segmentation: %d radial, %d per bend, %d helical, "
+               "%ld segments in total\n", ctx.seg.radial, ctx.seg.corner,
+               ctx.seg.helix, segments);
+    if(ctx.error || fclose(outfile)) {
+        printf("Error writing output file %s\n",argv[2]);
+        exit(1);
+    }
+    te=wall_time()-t0;
+    if(timing)
+        printf("%d helices in %.3f s, %.0f helices/s\n", in.n, te,
+               in.n/te);
+    if(in.stats && qfh_stats_write(&stats, te, print_stats, json))
+        exit(1);
+    qfh_model_free(&m);
+    free(h);
+    if(in.data)
+        munmap((void*)in.data, st.st_size);
+    return 0;
 }
@@ -0,0 +1,610 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * necscan: collects the results of nec2c runs on the decks of QFH2nec
+ * and helix2nec into one table. Every output file is mapped into memory
+ * and parsed by qfh_necout_parse() on the work stealing pool, a file
+ * per task, and the table gets a row per file and frequency with the
+ * design parameters read back from the file name.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include<math.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<dirent.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "qfh.h"
+
+#define NDESIGN 6 // design parameters in a QFH2nec file name
+
+typedef struct {
+    const char *path;
+    qfh_necout_row *rows;
+    long n;
+    size_t size;
+    int failed; // 1 unreadable, 2 out of memory, 3 no input parameters
+} scan_file;
+
+static const char *const design_names[NDESIGN]={
+    "design", "turns", "ratio", "length", "radius", "diameter"
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void scan_task(void *arg, long task, int worker)
+{
+    scan_file *f=&((scan_file*)arg)[task];
+    struct stat st;
+    const char *data;
+    int fd;
+
+    (void)worker;
+    if((fd=open(f->path, O_RDONLY))<0 || fstat(fd, &st)) {
+        if(fd>=0)
+            close(fd);
+        f->failed=1;
+        return;
+    }
+    f->size=st.st_size;
+    if(st.st_size==0) {
+        close(fd);
+        f->failed=3;
+        return;
+    }
+    data=(const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data==MAP_FAILED) {
+        f->failed=1;
+        return;
+    }
+    madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+    if(qfh_necout_parse(data, st.st_size, &f->rows, &f->n))
+        f->failed=2;
+    else if(f->n==0)
+        f->failed=3;
+    munmap((void*)data, st.st_size);
+}
+
+/* Parses every file on nthreads threads. Returns 0 on success, 1 if
+ * the pool could not be started. */
+static int scan_files(scan_file *files, long n, int nthreads)
+{
+    qfh_pool pool;
+
+    if(qfh_pool_init(&pool, nthreads))
+        return 1;
+    qfh_pool_run(&pool, n, scan_task, files);
+    qfh_pool_free(&pool);
+    return 0;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp(*(char *const*)a, *(char *const*)b);
+}
+
+/* Appends path to the list, or the .out files of the directory path in
+ * name order. Returns 0 on success, 1 if out of memory. */
+static int add_path(char ***list, long *n, long *cap, const char *path)
+{
+    struct stat st;
+    struct dirent *de;
+    char **nl;
+    DIR *d;
+    long first=*n;
+    size_t len;
+
+    if(stat(path, &st) || !S_ISDIR(st.st_mode) || (d=opendir(path))==NULL) {
+        if(*n==*cap) {
+            *cap=*cap ? 2**cap : 256;
+            if((nl=(char**)realloc(*list, *cap*sizeof(char*)))==NULL)
+                return 1;
+            *list=nl;
+        }
+        return ((*list)[(*n)++]=strdup(path))==NULL;
+    }
+    while((de=readdir(d))!=NULL) {
+        len=strlen(de->d_name);
+        if(len<4 || strcmp(de->d_name+len-4, ".out"))
+            continue;
+        if(*n==*cap) {
+            *cap=*cap ? 2**cap : 256;
+            if((nl=(char**)realloc(*list, *cap*sizeof(char*)))==NULL) {
+                closedir(d);
+                return 1;
+            }
+            *list=nl;
+        }
+        if(((*list)[*n]=(char*)malloc(strlen(path)+len+2))==NULL) {
+            closedir(d);
+            return 1;
+        }
+        sprintf((*list)[(*n)++], "%s/%s", path, de->d_name);
+    }
+    closedir(d);
+    qsort(*list+first, *n-first, sizeof(char*), cmp_name);
+    return 0;
+}
+
+/* The design of a file named as QFH2nec names its decks (frequency,
+ * turns, ratio, length, radius and diameter), NAN if it is not */
+static void design_of(const char *path, double *v)
+{
+    const char *base=strrchr(path, '/');
+    int k;
+
+    if(sscanf(base ? base+1 : path, "QFH %lf_%lf_%lf_%lf_%lf_%lf", &v[0],
+              &v[1], &v[2], &v[3], &v[4], &v[5])!=NDESIGN)
+        for(k=0;k<NDESIGN;k++)
+            v[k]=NAN;
+}
+
+/* Writes s as a csv field, quoted if it needs to be */
+static void csv_field(FILE *f, const char *s)
+{
+    if(strpbrk(s, ",\"\n")==NULL) {
+        fputs(s, f);
+        return;
+    }
+    putc('"', f);
+    for(;*s;s++) {
+        if(*s=='"')
+            putc('"', f);
+        putc(*s, f);
+    }
+    putc('"', f);
+}
+
+/* v with 6 significant digits, nothing if it is not a number */
+static void csv_number(FILE *f, double v)
+{
+    if(!isnan(v))
+        fprintf(f, "%.6g", v);
+}
+
+static int write_csv(FILE *f, const scan_file *files, long nfiles)
+{
+    const qfh_necout_row *r;
+    double v[NDESIGN];
+    long i, j;
+    int k;
+
+    fprintf(f, "file");
+    for(k=0;k<NDESIGN;k++)
+        fprintf(f, ",%s", design_names[k]);
+    fprintf(f, ",freq,re,im,swr,gain\n");
+    for(i=0;i<nfiles;i++) {
+        design_of(files[i].path, v);
+        for(j=0;j<files[i].n;j++) {
+            r=&files[i].rows[j];
+            csv_field(f, files[i].path);
+            for(k=0;k<NDESIGN;k++) {
+                putc(',', f);
+                csv_number(f, v[k]);
+            }
+            fprintf(f, ",%.6g,%.6g,%.6g,%.6g,", r->freq, creal(r->z),
+                    cimag(r->z), r->swr);
+            csv_number(f, r->gain);
+            putc('\n', f);
+        }
+    }
+    return ferror(f);
+}
+
+/*
+ * Binary table in host byte order:
+ *    char magic[4] = "QFHN", uint32 version = 1, uint32 number of rows n
+ *    double design[n], turns[n], ratio[n], length[n], radius[n],
+ *           diameter[n], freq[n], re[n], im[n], swr[n], gain[n]
+ *    int32 file[n] (index of the file in the order scanned)
+ * with NAN for the design of files not named by QFH2nec and for the
+ * gain without a radiation pattern.
+ */
+static int write_bin(FILE *f, const scan_file *files, long nfiles)
+{
+    const qfh_necout_row *r;
+    double v[NDESIGN], *col;
+    int32_t *idx;
+    uint32_t hdr[3];
+    long i, j, n=0, row;
+    int k, err;
+
+    for(i=0;i<nfiles;i++)
+        n+=files[i].n;
+    col=(double*)malloc((size_t)(n ? n : 1)*(NDESIGN+5)*sizeof(double));
+    idx=(int32_t*)malloc((size_t)(n ? n : 1)*sizeof(int32_t));
+    if(col==NULL || idx==NULL) {
+        free(col);
+        free(idx);
+        return 1;
+    }
+    for(row=0,i=0;i<nfiles;i++) {
+        design_of(files[i].path, v);
+        for(j=0;j<files[i].n;j++,row++) {
+            r=&files[i].rows[j];
+            for(k=0;k<NDESIGN;k++)
+                col[k*n+row]=v[k];
+            col[(NDESIGN+0)*n+row]=r->freq;
+            col[(NDESIGN+1)*n+row]=creal(r->z);
+            col[(NDESIGN+2)*n+row]=cimag(r->z);
+            col[(NDESIGN+3)*n+row]=r->swr;
+            col[(NDESIGN+4)*n+row]=r->gain;
+            idx[row]=(int32_t)i;
+        }
+    }
+    memcpy(&hdr[0], "QFHN", 4);
+    hdr[1]=1;
+    hdr[2]=(uint32_t)n;
+    err=fwrite(hdr, sizeof(hdr), 1, f)!=1;
+    if(!err && n)
+        err=fwrite(col, sizeof(double), (size_t)n*(NDESIGN+5), f)!=
+            (size_t)n*(NDESIGN+5) ||
+            fwrite(idx, sizeof(int32_t), n, f)!=(size_t)n;
+    free(col);
+    free(idx);
+    return err;
+}
+
+/*
+ * Benchmark: nec2c output written by the benchmark itself, parsed by
+ * the scanner and by the usual fgets()/sscanf() loop.
+ */
+
+/* Writes an output file laid out as nec2c writes one for the default
+ * QFH2nec deck (one source, 159 segments, 37 x 37 pattern) with made up
+ * values varying with the design number k, and two sources, as for a
+ * necgr deck, on odd k. Returns 0 on success. */
+static int write_synthetic(const char *path, long k, int nfreq)
+{
+    static const char *const sense[3]={"RIGHT", "LEFT", "LINEAR"};
+    FILE *f;
+    double freq, th, ph, g, a;
+    int i, j, s, nsrc=k%2 ? 2 : 1;
+
+    if((f=fopen(path, "w"))==NULL)
+        return 1;
+    fprintf(f, "\n\n\n\n\n\n\n\n\n\n"
+            "                              __________________________________________\n"
+            "                             |                                          |\n"
+            "                             |  NUMERICAL ELECTROMAGNETICS CODE (nec2c) |\n"
+            "                             |   Translated to 'C' in Double Precision  |\n"
+            "                             |__________________________________________|\n\n"
+            "                               ---------------- COMMENTS ----------------\n"
+            "                               NEC2 Input File produced by helix2nec\n"
+            "                               Parameters:\n\n");
+    for(j=0;j<nfreq;j++) {
+        freq=130+0.25*j+0.01*(k%100);
+        fprintf(f, "\n\n\n"
+                "                               --------- FREQUENCY --------\n"
+                "                                FREQUENCY=%11.4E MHZ\n"
+                "                                WAVELENGTH=%11.4E METERS\n\n",
+                freq, 299.792458/freq);
+        fprintf(f, "\n\n\n"
+                "                        --------- ANTENNA INPUT PARAMETERS ---------\n"
+                "  TAG   SEG       VOLTAGE (VOLTS)         CURRENT (AMPS)         IMPEDANCE (OHMS)        ADMITTANCE (MHOS)     POWER\n"
+                "  NO.   NO.     REAL      IMAGINARY     REAL      IMAGINARY     REAL      IMAGINARY    REAL       IMAGINARY   (WATTS)\n");
+        for(s=0;s<nsrc;s++)
+            fprintf(f, " %4d %5d %11.4E %11.4E %11.4E %11.4E %11.4E %11.4E "
+                    "%11.4E %11.4E %11.4E\n", 127+s, 1,
+                    s ? -0.5 : nsrc==1 ? 1.0 : 0.5, 0.0,
+                    1.2345e-2, -3.4567e-3, (40+30*sin(j+k))/nsrc,
+                    (-20+60*cos(0.3*j+k))/nsrc, 1e-2, 2e-3, 6.1725e-3);
+        fprintf(f, "\n\n\n"
+                "                           -------- CURRENTS AND LOCATION --------\n"
+                "                                  DISTANCES IN WAVELENGTHS\n\n"
+                "   SEG  TAG    COORDINATES OF SEGM CENTER     SEGM    ------------- CURRENT (AMPS) -------------\n"
+                "   No:  No:       X         Y         Z      LENGTH     REAL      IMAGINARY    MAGN        PHASE\n");
+        for(i=0;i<159;i++)
+            fprintf(f, " %5d %4d %9.4f %9.4f %9.4f %9.5f %11.4E %11.4E %11.4E "
+                    "%8.3f\n", i+1, i/5+1, 0.05*sin(i), 0.05*cos(i), 0.002*i,
+                    0.0123, 1e-3*sin(i+j), 1e-3*cos(i+j), 1e-3, 57.3*(i+j));
+        fprintf(f, "\n\n\n"
+                "                               ---------- POWER BUDGET ---------\n"
+                "                               INPUT POWER   = %11.4E Watts\n"
+                "                               RADIATED POWER= %11.4E Watts\n"
+                "                               STRUCTURE LOSS= %11.4E Watts\n"
+                "                               NETWORK LOSS  = %11.4E Watts\n"
+                "                               EFFICIENCY    = %7.2f Percent\n",
+                6.1725e-3, 6.1725e-3, 0.0, 0.0, 100.0);
+        fprintf(f, "\n\n\n"
+                "                             ---------- RADIATION PATTERNS -----------\n\n"
+                " ---- ANGLES -----     ----- POWER GAINS -----       ---- POLARIZATION ----   ---- E(THETA) ----    ----- E(PHI) ------\n"
+                "  THETA      PHI       MAJOR    MINOR    TOTAL       AXIAL      TILT  SENSE   MAGNITUDE   PHASE    MAGNITUDE   PHASE\n"
+                " DEGREES   DEGREES        DB       DB       DB       RATIO     DEGREES            VOLTS  DEGREES     VOLTS   DEGREES\n");
+        for(i=0;i<37*37;i++) {
+            th=5.0*(i%37);
+            ph=10.0*(i/37);
+            g=4*cos(th*pi/360)+0.2*sin((j+k+ph)*pi/180)-3*th/180;
+            a=0.5+0.5*cos((th+j)*pi/180);
+            fprintf(f, " %7.2f %9.2f  %8.2f %8.2f %8.2f %11.4f %9.2f %6s "
+                    "%11.4E %9.2f %11.4E %9.2f\n", th, ph, g-0.5, g-9,
+                    g, a, ph-90, sense[(i+j)%3], 1.2345*a, ph-45,
+                    0.5432*a, 45-ph);
+        }
+    }
+    return fclose(f);
+}
+
+/* The rows of the file at path read a line at a time, with the same
+ * rules as qfh_necout_parse(). Returns 0 on success. */
+static int plain_parse(const char *path, qfh_necout_row **rows, long *n)
+{
+    enum { NONE, SRC_HEAD, SRC, AFTER_SRC, PAT_HEAD, PAT, DONE };
+    FILE *f;
+    char line[1024], *s;
+    qfh_necout_row row, *nr;
+    double v[8];
+    long cap=0;
+    int state=DONE, skip=0, nsrc=0, have=0;
+
+    *rows=NULL;
+    *n=0;
+    if((f=fopen(path, "r"))==NULL)
+        return 1;
+    for(;;) {
+        s=fgets(line, sizeof(line), f);
+        if(s==NULL || strstr(line, "FREQUENCY=")) {
+            if(have && nsrc>0) {
+                row.swr=qfh_swr(row.z, 50);
+                if(*n==cap) {
+                    cap=cap ? 2*cap : 64;
+                    if((nr=(qfh_necout_row*)realloc(*rows,
+                                                    cap*sizeof(row)))==NULL)
+                        break;
+                    *rows=nr;
+                }
+                (*rows)[(*n)++]=row;
+            }
+            if(s==NULL)
+                break;
+            have=sscanf(strstr(line, "FREQUENCY=")+10, "%lf", &row.freq)==1;
+            row.z=0;
+            row.gain=NAN;
+            nsrc=0;
+            state=NONE;
+            continue;
+        }
+        switch(state) {
+            case NONE:
+                if(strstr(line, "ANTENNA INPUT PARAMETERS")) {
+                    state=SRC_HEAD;
+                    skip=0;
+                }
+                break;
+            case SRC_HEAD:
+            case SRC:
+                if(sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf", &v[0],
+                          &v[1], &v[2], &v[3], &v[4], &v[5], &v[6],
+                          &v[7])==8) {
+                    row.z+=v[6]+I*v[7];
+                    nsrc++;
+                    state=SRC;
+                } else if(state==SRC)
+                    state=AFTER_SRC;
+                else if(++skip==8)
+                    state=DONE;
+                break;
+            case AFTER_SRC:
+                if(strstr(line, "RADIATION PATTERNS")) {
+                    state=PAT_HEAD;
+                    skip=0;
+                }
+                break;
+            case PAT_HEAD:
+            case PAT:
+                if(sscanf(line, "%lf %lf %lf %lf %lf", &v[0], &v[1], &v[2],
+                          &v[3], &v[4])==5) {
+                    if(!(v[4]<=row.gain))
+                        row.gain=v[4];
+                    state=PAT;
+                } else if(state==PAT || ++skip==8)
+                    state=DONE;
+                break;
+        }
+    }
+    fclose(f);
+    return s!=NULL;
+}
+
+static int bench_main(int argc, char *argv[])
+{
+    scan_file *files;
+    qfh_necout_row *rows;
+    char dir[]="/tmp/necscanXXXXXX", path[4096];
+    double t0, tscan, tplain, mb=0;
+    long i, nfiles=100, n, nrows=0, differ=0, failed=0;
+    int nfreq=11, nthreads=0;
+
+    for(i=1;i+1<argc && strcmp(argv[i],"-j")==0;i+=2)
+        nthreads=atoi(argv[i+1]);
+    if(i<argc)
+        nfiles=atol(argv[i++]);
+    if(i<argc)
+        nfreq=atoi(argv[i++]);
+    if(i!=argc || nfiles<=0 || nfreq<=0 || nthreads<0) {
+        printf("Usage: necscan --bench [-j threads] [files] [frequencies]\n");
+        exit(1);
+    }
+    if(nthreads==0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    if(mkdtemp(dir)==NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    if((files=(scan_file*)calloc(nfiles, sizeof(scan_file)))==NULL) {
+        printf("Error allocating memory for %ld files\n",nfiles);
+        rmdir(dir);
+        exit(1);
+    }
+    for(i=0;i<nfiles;i++) {
+        snprintf(path, sizeof(path), "%s/QFH %4.1f_%.1f_%.2f_%.1f_%.1f_%.1f.out",
+                 dir, 100+0.5*i, 0.5, 0.3, 1.0, 15.0, 5.0);
+        if((files[i].path=strdup(path))==NULL ||
+           write_synthetic(files[i].path, i, nfreq)) {
+            printf("Could not write %s\n",path);
+            nfiles=i+1;
+            failed=1;
+            break;
+        }
+    }
+    if(!failed) {
+        t0=now();
+        if(scan_files(files, nfiles, nthreads)) {
+            printf("Could not start %d threads\n",nthreads);
+            failed=1;
+        }
+        tscan=now()-t0;
+        t0=now();
+        for(i=0;i<nfiles && !failed;i++) {
+            mb+=files[i].size/1e6;
+            nrows+=files[i].n;
+            if(files[i].failed || plain_parse(files[i].path, &rows, &n)) {
+                failed++;
+                continue;
+            }
+            if(n!=files[i].n ||
+               (n && memcmp(rows, files[i].rows, n*sizeof(*rows))))
+                differ++;
+            free(rows);
+        }
+        tplain=now()-t0;
+        if(!failed) {
+            printf("%ld files, %.1f MB, %ld rows\n", nfiles, mb, nrows);
+            printf("scanner, %d threads: %.3f s, %.0f files/s, %.0f MB/s\n",
+                   nthreads, tscan, nfiles/tscan, mb/tscan);
+            printf("fgets and sscanf:    %.3f s, %.0f files/s, %.0f MB/s, "
+                   "%.1fx slower\n", tplain, nfiles/tplain, mb/tplain,
+                   tplain/tscan);
+            printf("%ld files differ\n", differ);
+        }
+    }
+    for(i=0;i<nfiles;i++) {
+        if(files[i].path)
+            unlink(files[i].path);
+        free((void*)files[i].path);
+        free(files[i].rows);
+    }
+    free(files);
+    rmdir(dir);
+    return failed || differ;
+}
+
+int main(int argc, char *argv[])
+{
+    scan_file *files;
+    char **list=NULL;
+    FILE *out;
+    double t0=now(), t, mb=0;
+    long i, n=0, cap=0, nrows=0, failed=0;
+    int nthreads=0, timing=0, bin=0, err;
+
+    if(argc>1 && strcmp(argv[1],"--bench")==0)
+        return bench_main(argc-1, argv+1);
+    while(argc>2 && argv[1][0]=='-') {
+        if(strcmp(argv[1],"-t")==0) {
+            timing=1;
+            argc-=1;
+            argv+=1;
+            continue;
+        } else if(strcmp(argv[1],"-j")==0) {
+            if((nthreads=atoi(argv[2]))<=0) {
+                printf("Invalid number of threads %s\n",argv[2]);
+                exit(1);
+            }
+        } else if(strcmp(argv[1],"-f")==0) {
+            if(strcmp(argv[2],"csv") && strcmp(argv[2],"bin")) {
+                printf("Unknown output format %s\n",argv[2]);
+                exit(1);
+            }
+            bin=strcmp(argv[2],"bin")==0;
+        } else
+            break;
+        argc-=2;
+        argv+=2;
+    }
+    if(argc<3) {
+        printf("Usage:\n");
+        printf("necscan [-j threads] [-f csv|bin] [-t] <outputfile> <nec2c output file or directory>...\n");
+        printf("necscan --bench [-j threads] [files] [frequencies]\n");
+        exit(1);
+    }
+    if(nthreads<=0)
+        nthreads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads<=0)
+        nthreads=1;
+    for(i=2;i<argc;i++)
+        if(add_path(&list, &n, &cap, argv[i])) {
+            printf("Error allocating memory for %ld files\n",n);
+            exit(1);
+        }
+    if((files=(scan_file*)calloc(n ? n : 1, sizeof(scan_file)))==NULL) {
+        printf("Error allocating memory for %ld files\n",n);
+        exit(1);
+    }
+    for(i=0;i<n;i++)
+        files[i].path=list[i];
+    if(scan_files(files, n, nthreads)) {
+        printf("Could not start %d threads\n",nthreads);
+        exit(1);
+    }
+    for(i=0;i<n;i++) {
+        mb+=files[i].size/1e6;
+        nrows+=files[i].n;
+        if(files[i].failed==1)
+            printf("Could not read %s\n",files[i].path);
+        else if(files[i].failed==2)
+            printf("Error allocating memory for %s\n",files[i].path);
+        else if(files[i].failed==3)
+            printf("No antenna input parameters in %s\n",files[i].path);
+        failed+=files[i].failed!=0;
+    }
+    if((out=fopen(argv[1], bin ? "wb" : "w"))==NULL) {
+        printf("Could not open output file %s\n",argv[1]);
+        exit(1);
+    }
+    setvbuf(out, NULL, _IOFBF, 1<<20);
+    err=bin ? write_bin(out, files, n) : write_csv(out, files, n);
+    if(fclose(out) || err) {
+        printf("Error writing output file %s\n",argv[1]);
+        exit(1);
+    }
+    t=now()-t0;
+    if(timing)
+        printf("%ld files (%ld failed), %.1f MB, %ld rows in %.3f s, "
+               "%.0f files/s, %.0f MB/s\n", n, failed, mb, nrows, t, n/t,
+               mb/t);
+    for(i=0;i<n;i++) {
+        free(list[i]);
+        free(files[i].rows);
+    }
+    free(list);
+    free(files);
+    return failed ? 1 : 0;
+}
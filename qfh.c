@@ -0,0 +1,1084 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ * 
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ * 
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdarg.h>
+#include<string.h>
+#include<math.h>
+#include<ctype.h>
+#include "qfh.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include<immintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+
+/* Mmmmm... pi */
+// actual better way to get the value
+const double pi = 4.0 * atan(1.0);
+
+/* Segmentation used by QFH2nec */
+const qfh_segmentation qfh_default_segmentation = {
+    5, // radial
+    5, // corner
+    20, // helix
+    2 // epsilon
+};
+
+void qfh_init(qfh_ctx *ctx, const qfh_segmentation *seg,
+              qfh_write_fn write, void *opaque)
+{
+    ctx->itg=1;
+    ctx->feedside=1;
+    ctx->seg=seg ? *seg : qfh_default_segmentation;
+    ctx->compact=0;
+    ctx->symmetric=0;
+    ctx->libm_trig=0;
+    ctx->generic_layout=0;
+    ctx->bend_corner=0;
+    ctx->write=write;
+    ctx->opaque=opaque;
+    ctx->error=0;
+    ctx->stats=NULL;
+}
+
+/* Allocates the next NEC tag number */
+int qfh_tag(qfh_ctx *ctx)
+{
+    return ctx->itg++;
+}
+
+/* Hands len bytes to the sink of ctx and counts them in ctx->stats.
+ * Returns the sink's result. */
+int qfh_write(qfh_ctx *ctx, const char *data, size_t len)
+{
+    if(ctx->stats) {
+        ctx->stats->bytes+=len;
+        QFH_COUNT(ctx->stats->count[QFH_COUNT_WRITES], 1);
+    }
+    return ctx->write(ctx->opaque, data, len);
+}
+
+/* Formats into the sink of ctx. Output is dropped once the sink failed,
+ * the failure is kept in ctx->error. */
+int qfh_printf(qfh_ctx *ctx, const char *fmt, ...)
+{
+    char line[256], *p=line;
+    va_list ap;
+    int n;
+    
+    if(ctx->error)
+        return -1;
+    va_start(ap, fmt);
+    n=vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if(n<0) {
+        ctx->error=1;
+        return -1;
+    }
+    if((size_t)n>=sizeof(line)) {
+        // Only long comment cards get here
+        if((p=(char*)malloc(n+1))==NULL) {
+            ctx->error=1;
+            return -1;
+        }
+        va_start(ap, fmt);
+        vsnprintf(p, n+1, fmt, ap);
+        va_end(ap);
+    }
+    if(qfh_write(ctx, p, n))
+        ctx->error=1;
+    if(p!=line)
+        free(p);
+    return ctx->error ? -1 : n;
+}
+
+/* Sink writing to the FILE* passed as opaque */
+int qfh_file_sink(void *opaque, const char *data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE*)opaque)!=len;
+}
+
+/* Sink appending to the qfh_membuf passed as opaque */
+int qfh_membuf_sink(void *opaque, const char *data, size_t len)
+{
+    qfh_membuf *buf=(qfh_membuf*)opaque;
+    
+    if(qfh_membuf_reserve(buf, len))
+        return 1;
+    memcpy(buf->data+buf->len, data, len);
+    buf->len+=len;
+    return 0;
+}
+
+void qfh_membuf_free(qfh_membuf *buf)
+{
+    free(buf->data);
+    buf->data=NULL;
+    buf->len=buf->cap=0;
+}
+
+/* Validates the design requirements. Returns 0 if they are usable,
+ * otherwise a message explaining which value is out of range is put
+ * in msg. */
+int qfh_check_design(const design_req *req, char *msg, size_t len)
+{
+    // Design frequency validation
+    if(!(req->freq >= 10 && req->freq <= 5000)) {
+        snprintf(msg,len,"Design frequency %f is not in the range 10-5000MHz",req->freq);
+        return 1;
+    }
+    // Turn number validation
+    if(!(req->turns >= 0.1 && req->turns <= 50)) {
+        snprintf(msg,len,"Turn number %f is not in the range 0.1-50",req->turns);
+        return 1;
+    }
+    // One turn wavelength validation
+    if(!(req->length >= 0.1 && req->length <= 5)) {
+        snprintf(msg,len,"One turn length %f is not in the range 0.1-5",req->length);
+        return 1;
+    }
+    // Bending radius validation
+    if(!(req->radius >= 1 && req->radius <= 1000)) {
+        snprintf(msg,len,"Bending radius %f is not in the range 1-1000",req->radius);
+        return 1;
+    }
+    // Conductor diameter validation
+    if(!(req->diam >= 1 && req->diam <= 50)) {
+        snprintf(msg,len,"Conductor diameter %f is not in the range 1-50",req->diam);
+        return 1;
+    }
+    // Width/height ratio validation
+    if(!(req->ratio >= 0.1 && req->ratio <= 2)) {
+        snprintf(msg,len,"Width/height ratio %f is not in the range 0.1-2",req->ratio);
+        return 1;
+    }
+    return 0;
+}
+
+/* Computes the design and fills in the model for it: the two loops in
+ * h[0..1] and the sweep of design frequency +-5MHz. The wires are built
+ * separately by qfh_build_model(). */
+void qfh_design_model(const design_req *req, helix *h, qfh_model *m)
+{
+    qfh_compute_design(req, h);
+    m->h=h;
+    m->nhelix=1;
+    m->comment_base=1;
+    m->fstep=0.25;
+    m->fstart=req->freq - 5;
+    m->fstop=req->freq + 5;
+}
+
+/* Sets the sweep of the model to span MHz centred on freq in steps of
+ * fstep MHz. A span or step that is not positive is left as it is.
+ * Returns 0 if the sweep is usable, otherwise the model is left alone
+ * and a message saying why is put in msg: the span must stay above
+ * 0 MHz and the sweep have at most QFH_MAX_FREQS points. */
+int qfh_design_band(qfh_model *m, double freq, double span, double fstep,
+                    char *msg, size_t len)
+{
+    double fstart=m->fstart, fstop=m->fstop;
+    
+    if(span>0) {
+        if(!(span<2*freq)) {
+            snprintf(msg,len,"Frequency span %f is not below twice the "
+                     "frequency %f",span,freq);
+            return 1;
+        }
+        fstart=freq-span/2;
+        fstop=freq+span/2;
+    }
+    if(fstep<=0)
+        fstep=m->fstep;
+    if(!((fstop-fstart)/fstep<QFH_MAX_FREQS)) {
+        snprintf(msg,len,"Frequency sweep of more than %d points",
+                 QFH_MAX_FREQS);
+        return 1;
+    }
+    m->fstart=fstart;
+    m->fstop=fstop;
+    m->fstep=fstep;
+    return 0;
+}
+
+/* Number of straight pieces needed for a section of length len (mm)
+ * with pieces no longer than maxlen, turning through angle radians in
+ * steps of at most maxangle, but not pieces shorter than minlen. */
+static int section_segments(double len, double maxlen, double minlen,
+                            double angle, double maxangle)
+{
+    int n=(int)ceil(len/maxlen-1e-9), na=(int)ceil(angle/maxangle-1e-9);
+    
+    if(na>n && len/na>=minlen)
+        n=na;
+    return n<1 ? 1 : n;
+}
+
+/* Chooses the segmentation of the model from the shortest wavelength of
+ * its sweep so that no segment is longer than a wavelength divided by
+ * spw. Bends and helical wires are also split finely enough to follow
+ * their curvature (30 degrees per piece) unless that would make pieces
+ * shorter than the wire diameter. seg->epsilon is left as it is. */
+void qfh_adaptive_segmentation(const qfh_model *m, double spw,
+                               qfh_segmentation *seg)
+{
+    const helix *h;
+    double maxlen=299792.458/m->fstop/spw, maxangle=pi/6;
+    double wire, len, twist;
+    int i, n;
+    
+    seg->radial=seg->corner=seg->helix=1;
+    for(i=0;i<2*m->nhelix;i++) {
+        h=&m->h[i];
+        wire=m->h[i&~1].wire; // set on the first loop of each helix
+        n=section_segments(h->D/2-h->R-seg->epsilon/2, maxlen, wire, 0, 1);
+        if(n>seg->radial)
+            seg->radial=n;
+        n=section_segments(pi/2*h->R, maxlen, wire, pi/2, maxangle);
+        if(n>seg->corner)
+            seg->corner=n;
+        twist=(h->H-2*h->R)/h->H*fabs(h->turns)*2*pi;
+        len=sqrt((h->H-2*h->R)*(h->H-2*h->R)+h->D*h->D/4*twist*twist);
+        n=section_segments(len, maxlen, wire, twist, maxangle);
+        if(n>seg->helix)
+            seg->helix=n;
+    }
+}
+
+/* Total number of segments of a built model */
+int qfh_model_segments(const qfh_model *m)
+{
+    int i, n=0;
+    
+    for(i=0;i<m->geom.n;i++)
+        n+=m->geom.segs[i];
+    return n;
+}
+
+/* Cards per loop written by qfh_build_helix_cards(): the radials, GH
+ * with its two GM and a GW per bend wire */
+static int loop_cards(const qfh_segmentation *seg)
+{
+    return 6+4*seg->corner;
+}
+
+/* Records wire i of the geometry as a GW card */
+static void card_from_wire(qfh_model *m, int i)
+{
+    const qfh_geom *g=&m->geom;
+    qfh_card *c=&m->cards[m->ncards++];
+
+    strcpy(c->type, "GW");
+    c->i1=g->tag[i];
+    c->i2=g->segs[i];
+    c->f[0]=g->x1[i];
+    c->f[1]=g->y1[i];
+    c->f[2]=g->z1[i];
+    c->f[3]=g->x2[i];
+    c->f[4]=g->y2[i];
+    c->f[5]=g->z2[i];
+    c->f[6]=g->radius[i];
+}
+
+/* Records a card and expands it into the geometry, which has room */
+static void add_card(qfh_model *m, const char *type, int i1, int i2,
+                     double f0, double f1, double f2, double f3,
+                     double f4, double f5, double f6)
+{
+    qfh_card *c=&m->cards[m->ncards++];
+
+    strcpy(c->type, type);
+    c->i1=i1;
+    c->i2=i2;
+    c->f[0]=f0;
+    c->f[1]=f1;
+    c->f[2]=f2;
+    c->f[3]=f3;
+    c->f[4]=f4;
+    c->f[5]=f5;
+    c->f[6]=f6;
+    qfh_geom_card(&m->geom, c);
+}
+
+/* Builds the wires of every helix of the model, numbering the tags
+ * from 1. A symmetric build only makes the wires on one side of the axis,
+ * the feed wire and bottom radials up to the axis, and copies them to the
+ * other side with a GR card. Returns 0 on success, 1 on an unknown feed
+ * type or when the geometry could not be allocated. */
+int qfh_build_model(qfh_ctx *ctx, qfh_model *m)
+{
+    ctx->itg=1;
+    if(qfh_build_part(ctx, m))
+        return 1;
+    return qfh_build_end(ctx, m);
+}
+
+static int build_part(qfh_ctx *ctx, qfh_model *m)
+{
+    helix a, b;
+    int i, ncards;
+    
+    m->geom.n=0;
+    m->ncards=0;
+    m->nsym=1;
+    m->symtag=0;
+    if(qfh_geom_reserve(&m->geom,
+                        m->nhelix*(2*qfh_helix_wires(&ctx->seg)+1)))
+        return 1;
+    ncards=ctx->compact ? m->nhelix*(2*loop_cards(&ctx->seg)+1)+1 :
+           ctx->symmetric ? m->nhelix*(2*qfh_helix_wires(&ctx->seg)+1)+1 : 0;
+    if(m->cardcap<ncards) {
+        free(m->cards);
+        m->cardcap=ncards;
+        if((m->cards=(qfh_card*)malloc(m->cardcap*sizeof(qfh_card)))==NULL) {
+            m->cardcap=0;
+            return 1;
+        }
+    }
+    for(i=0;i<m->nhelix;i++) {
+        if(strchr("OSTF", toupper(m->h[2*i].feed))==NULL ||
+           m->h[2*i].feed=='\0')
+            return 1;
+        a=m->h[2*i];
+        b=m->h[2*i+1];
+        b.wire=(a.wire/=2); //diameter to radius
+        a.Theta=a.Theta/360*2*pi; //degrees to radians
+        b.Theta=a.Theta+pi/2;
+        if(ctx->compact) {
+            ctx->feedside=1;
+            qfh_build_helix_cards(ctx, m, &a);
+            ctx->feedside=0;
+            qfh_build_helix_cards(ctx, m, &b);
+            if(toupper(a.feed)!='O') {
+                m->h[2*i].feedpoint=qfh_build_feed_wire(ctx, &m->geom, &a);
+                card_from_wire(m, m->geom.n-1);
+            }
+            continue;
+        }
+        ctx->feedside=1;
+        qfh_build_helix(ctx, &m->geom, &a);
+        ctx->feedside=0;
+        qfh_build_helix(ctx, &m->geom, &b);
+        if(toupper(a.feed)!='O')
+            m->h[2*i].feedpoint=qfh_build_feed_wire(ctx, &m->geom, &a);
+    }
+    if(ctx->symmetric && !ctx->compact)
+        for(i=0;i<m->geom.n;i++)
+            card_from_wire(m, i);
+    return 0;
+}
+
+/* Adds wires first.. of the model to ctx->stats */
+static void count_wires(qfh_ctx *ctx, const qfh_model *m, int first)
+{
+    int i;
+
+    ctx->stats->tags+=m->geom.n-first;
+    for(i=first;i<m->geom.n;i++)
+        ctx->stats->segments+=m->geom.segs[i];
+}
+
+/* Builds the helices of m with the tags following those of the previous
+ * part, replacing the wires and cards of that part. A model too large to
+ * hold can be built and written a few helices at a time this way, with
+ * ctx->itg set to 1 before the first part. Returns 0 on success. */
+int qfh_build_part(qfh_ctx *ctx, qfh_model *m)
+{
+    double t0=qfh_stats_start(ctx->stats);
+    int err=build_part(ctx, m);
+
+    if(ctx->stats) {
+        qfh_stats_stop(ctx->stats, QFH_PHASE_GEOMETRY, t0);
+        count_wires(ctx, m, 0);
+    }
+    return err;
+}
+
+/* Completes a model after its last part: a symmetric build gets the GR
+ * card, which copies the wires in m to the other side of the axis. A
+ * model written in parts is emptied first so that only the GR card is
+ * added. Returns 0 on success. */
+int qfh_build_end(qfh_ctx *ctx, qfh_model *m)
+{
+    int n;
+    
+    double t0;
+    
+    if(!ctx->symmetric)
+        return 0;
+    t0=qfh_stats_start(ctx->stats);
+    m->nsym=2;
+    m->symtag=ctx->itg-1;
+    n=m->geom.n;
+    if(m->ncards==m->cardcap)
+        return 1;
+    add_card(m, "GR", m->symtag, m->nsym, 0, 0, 0, 0, 0, 0, 0);
+    if(ctx->stats) {
+        qfh_stats_stop(ctx->stats, QFH_PHASE_GEOMETRY, t0);
+        count_wires(ctx, m, n);
+    }
+    return m->geom.n!=m->nsym*n;
+}
+
+void qfh_model_free(qfh_model *m)
+{
+    qfh_geom_free(&m->geom);
+    free(m->cards);
+    m->cards=NULL;
+    m->ncards=m->cardcap=0;
+}
+
+/* Computes the design and writes the complete NEC2 deck to the sink of
+ * ctx. Returns 0 on success. */
+int qfh_write_deck(qfh_ctx *ctx, const design_req *req)
+{
+    helix h[2];
+    qfh_model m;
+    int err;
+    
+    memset(&m, 0, sizeof(m));
+    qfh_design_model(req, h, &m);
+    if((err=qfh_build_model(ctx, &m))==0)
+        err=qfh_emit_nec(ctx, &m);
+    qfh_model_free(&m);
+    return err;
+}
+
+/* Adds the single segment feed wire across the gap at the top of
+ * helix h and returns its tag. A symmetric build only gets the half up
+ * to the axis. */
+int qfh_build_feed_wire(qfh_ctx *ctx, qfh_geom *g, const helix *h)
+{
+    double eps=ctx->seg.epsilon;
+    double x=(eps/2)*cos(h->Theta+pi/4)/1000, y=(eps/2)*sin(h->Theta+pi/4)/1000;
+    int tag=qfh_tag(ctx);
+    
+    qfh_geom_add(g, tag, 1, x, y, (h->offset)/1000,
+            ctx->symmetric ? 0 : -x, ctx->symmetric ? 0 : -y,
+            (h->offset)/1000, h->wire/1000);
+    return tag;
+}
+
+/* Sines and cosines of n angles, point by point with libm for
+ * ctx->libm_trig, in one qfh_sincos() call otherwise */
+static void point_sincos(const qfh_ctx *ctx, const double *x, double *s,
+                         double *c, int n)
+{
+    int i;
+    
+    if(ctx->stats)
+        QFH_COUNT(ctx->stats->count[QFH_COUNT_POINTS], n);
+    if(!ctx->libm_trig) {
+        qfh_sincos(x, s, c, n);
+        return;
+    }
+    for(i=0;i<n;i++) {
+        s[i]=sin(x[i]);
+        c[i]=cos(x[i]);
+    }
+}
+
+/* Sines and cosines of the angles alpha of the bend points from number i
+ * on, the same for every loop with the same corner segmentation. They
+ * are kept in the context between calls. Returns how many there are,
+ * at most QFH_TRIG_BLOCK. */
+static int bend_angles(qfh_ctx *ctx, int i, const double **s,
+                       const double **c, double (*buf)[QFH_TRIG_BLOCK])
+{
+    const qfh_segmentation *seg=&ctx->seg;
+    double alpha[QFH_TRIG_BLOCK];
+    int k, n=seg->corner-i+1<QFH_TRIG_BLOCK ? seg->corner-i+1 : QFH_TRIG_BLOCK;
+    
+    if(i==1 && ctx->bend_corner==seg->corner &&
+       ctx->bend_libm==ctx->libm_trig) {
+        *s=ctx->bend_sin;
+        *c=ctx->bend_cos;
+        return n;
+    }
+    if(n<1)
+        return 0;
+    for(k=0;k<n;k++)
+        alpha[k]=pi/2*(double)(i+k)/seg->corner;
+    point_sincos(ctx, alpha, buf[0], buf[1], n);
+    if(i==1 && n==seg->corner) {
+        memcpy(ctx->bend_sin, buf[0], n*sizeof(double));
+        memcpy(ctx->bend_cos, buf[1], n*sizeof(double));
+        ctx->bend_corner=seg->corner;
+        ctx->bend_libm=ctx->libm_trig;
+    }
+    *s=buf[0];
+    *c=buf[1];
+    return n;
+}
+
+/* Adds a single segment wire from the point p to each of the n points at
+ * radius r[k], height z[k] and angle theta[k] in turn, and its copy
+ * through the axis unless the build is symmetric. p ends up at the last
+ * point. Lengths are in mm. */
+static void add_section(qfh_ctx *ctx, qfh_geom *g, const helix *h,
+                        double *p, const double *r, const double *z,
+                        const double *theta, int n)
+{
+    double s[QFH_TRIG_BLOCK], c[QFH_TRIG_BLOCK], x, y;
+    int k;
+    
+    point_sincos(ctx, theta, s, c, n);
+    for(k=0;k<n;k++) {
+        x=r[k]*c[k];
+        y=r[k]*s[k];
+        qfh_geom_add(g, qfh_tag(ctx), 1,
+                p[0]/1000, p[1]/1000, (p[2]+h->offset)/1000,
+                x/1000, y/1000, (z[k]+h->offset)/1000,
+                h->wire/1000);
+        if(!ctx->symmetric)
+            qfh_geom_add(g, qfh_tag(ctx), 1,
+                    -p[0]/1000, -p[1]/1000, (p[2]+h->offset)/1000,
+                    -x/1000, -y/1000, (z[k]+h->offset)/1000,
+                    h->wire/1000);
+        p[0]=x;
+        p[1]=y;
+        p[2]=z[k];
+    }
+}
+
+/* Sines and cosines of the bend angles pi/2*k/n, k=1..n, exactly as
+ * qfh_sincos() gives them; its results do not depend on the processor,
+ * so a specialized build places the same points as the generic one. */
+static const double bend_sin_3[]={
+    0.49999999999999994, 0.8660254037844386, 1
+};
+static const double bend_cos_3[]={
+    0.86602540378443871, 0.50000000000000011, 6.123233995736766e-17
+};
+static const double bend_sin_5[]={
+    0.3090169943749474, 0.58778525229247314, 0.80901699437494734,
+    0.95105651629515353, 1
+};
+static const double bend_cos_5[]={
+    0.95105651629515353, 0.80901699437494745, 0.58778525229247325,
+    0.30901699437494745, 6.123233995736766e-17
+};
+
+/* Layouts (helical segments, bend segments) with a build of their own:
+ * the QFH2nec and helix2nec defaults. A layout needs the bend tables of
+ * its corner count above. */
+#define QFH_LAYOUTS(X) \
+    X(20, 5) \
+    X(15, 3)
+
+/* Adds the ncorner wires of the top (top set) or bottom bend of helix h
+ * from the point p on, as add_section() does. bsin and bcos are the
+ * bend tables of a specialized layout, NULL makes the angles be
+ * computed. */
+static inline __attribute__((always_inline))
+void add_bend(qfh_ctx *ctx, qfh_geom *g, const helix *h, double *p, int top,
+              int ncorner, const double *bsin, const double *bcos)
+{
+    int i, k, n;
+    double a[2][QFH_TRIG_BLOCK], pr[QFH_TRIG_BLOCK], pz[QFH_TRIG_BLOCK];
+    double theta[QFH_TRIG_BLOCK];
+    const double *sa, *ca;
+    
+    for(i=1;i<=ncorner;i+=n) {
+        if(bsin) {
+            n=ncorner;
+            sa=bsin;
+            ca=bcos;
+        } else
+            n=bend_angles(ctx, i, &sa, &ca, a);
+        for(k=0;k<n;k++) {
+            if(top) {
+                pz[k]=-h->R+h->R*ca[k];
+                pr[k]=h->D/2-h->R+h->R*sa[k];
+            } else {
+                pz[k]=-h->H+h->R - h->R*sa[k];
+                pr[k]=h->D/2-h->R+h->R*ca[k];
+            }
+            theta[k]=pz[k]/h->H*h->turns*2*pi+h->Theta;
+        }
+        add_section(ctx, g, h, p, pr, pz, theta, n);
+    }
+}
+
+/* This adds the wires of the type of bifilar helix loop defined by
+ * struct helix h to the geometry g, with nhelix helical and ncorner bend
+ * segments. bsin and bcos are the bend tables of a specialized layout,
+ * in which case the counts are constants and the section loops are
+ * unrolled; NULL makes the angles be computed. */
+static inline __attribute__((always_inline))
+void build_helix_layout(qfh_ctx *ctx, qfh_geom *g, const helix *hp,
+                        int nhelix, int ncorner, const double *bsin, const double *bcos)
+{
+    const helix h=*hp;
+    const qfh_segmentation *seg=&ctx->seg;
+    int i, k, n;
+    double x, y, z, p[3];
+    double x1, y1, z1;
+    double pr[QFH_TRIG_BLOCK], pz[QFH_TRIG_BLOCK], theta[QFH_TRIG_BLOCK];
+    
+    // top radial wires
+    if(ctx->feedside) {
+        x1=(seg->epsilon/2)*cos(h.Theta+pi/4);
+        y1=(seg->epsilon/2)*sin(h.Theta+pi/4);
+    } else {
+        x1=(seg->epsilon/2)*cos(h.Theta-pi/4);
+        y1=(seg->epsilon/2)*sin(h.Theta-pi/4);
+    }
+    z1=0;
+    x=(h.D/2-h.R)*cos(h.Theta);
+    y=(h.D/2-h.R)*sin(h.Theta);
+    z=0;
+    qfh_geom_add(g, qfh_tag(ctx), seg->radial,
+            x1/1000, y1/1000, (z1+h.offset)/1000,
+            x/1000, y/1000, (z+h.offset)/1000,
+            h.wire/1000);
+    if(!ctx->symmetric)
+        qfh_geom_add(g, qfh_tag(ctx), seg->radial,
+                -x1/1000, -y1/1000, (z1+h.offset)/1000,
+                -x/1000, -y/1000, (z+h.offset)/1000,
+                h.wire/1000);
+    
+    // top bends
+    p[0]=x; p[1]=y; p[2]=z;
+    add_bend(ctx, g, &h, p, 1, ncorner, bsin, bcos);
+    
+    // helical wires
+    for(i=1;i<=nhelix;i+=n) {
+        n=nhelix-i+1<QFH_TRIG_BLOCK ? nhelix-i+1 : QFH_TRIG_BLOCK;
+        for(k=0;k<n;k++) {
+            pz[k]=-h.R - (double)(i+k)/nhelix*(h.H-2*h.R);
+            theta[k]=pz[k]/h.H*h.turns*2*pi+h.Theta;
+            pr[k]=h.D/2;
+        }
+        add_section(ctx, g, &h, p, pr, pz, theta, n);
+    }
+    
+    // bottom bends
+    add_bend(ctx, g, &h, p, 0, ncorner, bsin, bcos);
+    x=p[0]; y=p[1]; z=p[2];
+    
+    // bottom radial wire
+    if(ctx->symmetric)
+        qfh_geom_add(g, qfh_tag(ctx), seg->radial,
+                x/1000, y/1000, (z+h.offset)/1000,
+                0, 0, (z+h.offset)/1000,
+                h.wire/1000);
+    else
+        qfh_geom_add(g, qfh_tag(ctx), seg->radial*2-1,
+                x/1000, y/1000, (z+h.offset)/1000,
+                -x/1000, -y/1000, (z+h.offset)/1000,
+                h.wire/1000);
+}
+
+#define LAYOUT_BUILD(nh, nc) \
+static void build_helix_##nh##_##nc(qfh_ctx *ctx, qfh_geom *g, \
+                                    const helix *hp) \
+{ \
+    build_helix_layout(ctx, g, hp, nh, nc, bend_sin_##nc, bend_cos_##nc); \
+}
+QFH_LAYOUTS(LAYOUT_BUILD)
+
+#define LAYOUT_CASE(nh, nc) \
+    if(seg->helix==nh && seg->corner==nc) { \
+        build_helix_##nh##_##nc(ctx, g, hp); \
+        return; \
+    }
+
+/* This adds the wires of the type of bifilar helix loop defined by
+ * struct helix h to the geometry g, which must have room for
+ * qfh_helix_wires() more wires. No checking is done re the sanity of
+ * the parameters passed therein. With ctx->symmetric set only the wires
+ * of one side are added and the bottom radial ends at the axis; the
+ * rest is the same half turned by 180 degrees. The segment counts of
+ * QFH_LAYOUTS have builds of their own, other counts (and libm points)
+ * take the generic one. */
+// TODO make the helixes inside one another centered in the middle
+void qfh_build_helix(qfh_ctx *ctx, qfh_geom *g, const helix *hp)
+{
+    const qfh_segmentation *seg=&ctx->seg;
+    
+    if(!ctx->libm_trig && !ctx->generic_layout) {
+        QFH_LAYOUTS(LAYOUT_CASE)
+    }
+    build_helix_layout(ctx, g, hp, seg->helix, seg->corner, NULL, NULL);
+}
+
+
+/* Adds the wires of a bend of h from p, as in qfh_build_helix(), and
+ * records each as a GW card */
+static void add_bend_cards(qfh_ctx *ctx, qfh_model *m, const helix *h,
+                           double *p, int top)
+{
+    int i, n=m->geom.n;
+    
+    add_bend(ctx, &m->geom, h, p, top, ctx->seg.corner, NULL, NULL);
+    for(i=n;i<m->geom.n;i++)
+        card_from_wire(m, i);
+}
+
+/* Compact version of qfh_build_helix(): each helical run is one GH
+ * helix, moved into place with GM and copied to the other side of the
+ * axis with a second GM. The radial wires and the bends are the GW
+ * wires of the full model, a bend twists along with the helix and no
+ * single GA arc follows it. The cards are recorded in m and the wires
+ * expanded from them. A symmetric build leaves out the copies, as
+ * qfh_build_helix() does. */
+void qfh_build_helix_cards(qfh_ctx *ctx, qfh_model *m, const helix *hp)
+{
+    const helix h=*hp;
+    const qfh_segmentation *seg=&ctx->seg;
+    qfh_geom *g=&m->geom;
+    double x1, y1, r=h.D/2-h.R, twist=h.turns*2*pi/h.H;
+    double top[3], htop[3], hbot[3], bot[3], p[3];
+    int tag;
+    
+    // ends of the bends, on the full model's helix
+    top[0]=r*cos(h.Theta);
+    top[1]=r*sin(h.Theta);
+    top[2]=h.offset;
+    htop[0]=h.D/2*cos(h.Theta-h.R*twist);
+    htop[1]=h.D/2*sin(h.Theta-h.R*twist);
+    htop[2]=h.offset-h.R;
+    hbot[0]=h.D/2*cos(h.Theta-(h.H-h.R)*twist);
+    hbot[1]=h.D/2*sin(h.Theta-(h.H-h.R)*twist);
+    hbot[2]=h.offset-h.H+h.R;
+    bot[0]=r*cos(h.Theta-h.H*twist);
+    bot[1]=r*sin(h.Theta-h.H*twist);
+    bot[2]=h.offset-h.H;
+    
+    // top radial wires, as in qfh_build_helix()
+    if(ctx->feedside) {
+        x1=(seg->epsilon/2)*cos(h.Theta+pi/4);
+        y1=(seg->epsilon/2)*sin(h.Theta+pi/4);
+    } else {
+        x1=(seg->epsilon/2)*cos(h.Theta-pi/4);
+        y1=(seg->epsilon/2)*sin(h.Theta-pi/4);
+    }
+    qfh_geom_add(g, qfh_tag(ctx), seg->radial,
+            x1/1000, y1/1000, h.offset/1000,
+            top[0]/1000, top[1]/1000, top[2]/1000,
+            h.wire/1000);
+    card_from_wire(m, g->n-1);
+    if(!ctx->symmetric) {
+        qfh_geom_add(g, qfh_tag(ctx), seg->radial,
+                -x1/1000, -y1/1000, h.offset/1000,
+                -top[0]/1000, -top[1]/1000, top[2]/1000,
+                h.wire/1000);
+        card_from_wire(m, g->n-1);
+    }
+    
+    // top bends
+    p[0]=top[0]; p[1]=top[1]; p[2]=0;
+    if(h.R>0)
+        add_bend_cards(ctx, m, &h, p, 1);
+    
+    // helical wires, built upwards from the bottom bend
+    tag=qfh_tag(ctx);
+    if(h.turns!=0) {
+        add_card(m, "GH", tag, seg->helix, h.H/h.turns/1000,
+                 (h.H-2*h.R)/1000, h.D/2/1000, h.D/2/1000, h.D/2/1000,
+                 h.D/2/1000, h.wire/1000);
+        // keep the angle small, the deck only has six digits
+        add_card(m, "GM", 0, 0, 0, 0,
+                 remainder((h.Theta-(h.H-h.R)*twist)*180/pi, 360), 0, 0,
+                 hbot[2]/1000, tag);
+    } else
+        add_card(m, "GW", tag, seg->helix,
+                 hbot[0]/1000, hbot[1]/1000, hbot[2]/1000,
+                 htop[0]/1000, htop[1]/1000, htop[2]/1000, h.wire/1000);
+    if(!ctx->symmetric) {
+        qfh_tag(ctx);
+        add_card(m, "GM", 1, 1, 0, 0, 180, 0, 0, 0, tag);
+    }
+    
+    // bottom bends
+    p[0]=hbot[0]; p[1]=hbot[1]; p[2]=hbot[2]-h.offset;
+    if(h.R>0) {
+        add_bend_cards(ctx, m, &h, p, 0);
+        bot[0]=p[0];
+        bot[1]=p[1];
+    }
+    
+    // bottom radial wire
+    if(ctx->symmetric)
+        qfh_geom_add(g, qfh_tag(ctx), seg->radial,
+                bot[0]/1000, bot[1]/1000, bot[2]/1000,
+                0, 0, bot[2]/1000,
+                h.wire/1000);
+    else
+        qfh_geom_add(g, qfh_tag(ctx), seg->radial*2-1,
+                bot[0]/1000, bot[1]/1000, bot[2]/1000,
+                -bot[0]/1000, -bot[1]/1000, bot[2]/1000,
+                h.wire/1000);
+    card_from_wire(m, g->n-1);
+}
+
+
+/*
+ * The following code has been adapted from the software published by 
+ * John Coppens here: https://www.jcoppens.com/ant/qfh/calc.en.php
+ * The following license was part of the original file.
+ * 
+ *    qfhcalc.js
+ * 
+ *    Copyright (C) 2000 John Coppens (jcoppens@usa.net)
+ * 
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ * 
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ * 
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define DELTA_TABLE 17
+
+static const double deltal_tbl[DELTA_TABLE] = {1.045, 1.053, 1.060, 1.064,
+    1.068, 1.070, 1.070, 1.071, 1.071, 1.070, 1.070, 1.070, 1.070, 1.069,
+    1.069, 1.068, 1.067};
+
+// Not used by the calculator, kept with the table it came with
+static const double deltaf_tbl[DELTA_TABLE] = {1.013, 1.014, 1.015, 1.016,
+    1.017, 1.018, 1.020, 1.022, 1.025, 1.027, 1.030, 1.033, 1.036, 1.041,
+    1.044, 1.049, 1.054};
+
+/* Linear interpolation in a table of the values at 0, 1, ... n-1 mm.
+ * Outside the table the first or last interval is extended. */
+static double delta_interp(const double *tbl, int n, double diam) {
+    int intv = 0;
+    if (diam >= n-2) intv = n-2;
+    else if (diam > 0) intv = (int)diam;
+    return (tbl[intv] + (tbl[intv+1]-tbl[intv])*(diam-intv));
+}
+
+static double deltal(double diam) {
+    return delta_interp(deltal_tbl, DELTA_TABLE, diam);
+}
+
+static __attribute__((unused)) double deltaf(double diam) {
+    return delta_interp(deltaf_tbl, DELTA_TABLE, diam);
+}
+
+/* Everything but the sizes of the two loops */
+static void design_fields(const design_req *requirements, helix *helixes) {
+    double wdiam = requirements->diam;
+    double wrad = requirements->radius;
+    double turns = requirements->turns;
+    
+    helixes[0].turns = -turns;
+    helixes[0].feed = 'F';
+    helixes[0].offset = 0;
+    helixes[0].Theta = 0;
+    helixes[0].R = wrad;
+    helixes[0].wire = wdiam / 2;
+    
+    helixes[1].turns = -turns;
+    helixes[1].feed = 'F';
+    helixes[1].offset = 0;
+    helixes[1].Theta = 0;
+    helixes[1].R = wrad;
+    helixes[1].wire = wdiam / 2;
+}
+
+void qfh_compute_design(const design_req *requirements, helix *helixes) {
+    double freq = requirements->freq;
+    double wdiam = requirements->diam;
+    double wrad = requirements->radius;
+    double ratio = requirements->ratio;
+    double turns = requirements->turns;
+    double nrwavel = requirements->length;
+    
+    design_fields(requirements, helixes);
+    
+    double wavel = 299792/freq;
+    double wd_eff = wdiam;
+    if (wdiam > 15) wd_eff = 15;
+
+    double wavelc = nrwavel * wavel * deltal(wd_eff);
+
+    double bendcorr = 2*wrad - pi*wrad/2;
+    
+ //  double optdiam = 0.0088 * wavelc;
+    
+    double total1 = wavelc * 1.026;
+    double total1c = total1 + 4*bendcorr;
+    double rad1 = 0.5 * total1c / 
+    (1 + sqrt(1/pow(ratio,2) + pow(turns*pi,2)));
+    //double vert1 = (total1c - 2*rad1)/2;
+    double height1 = rad1 / ratio;
+    
+    helixes[1].D = rad1;
+    helixes[1].H = height1;
+    
+    
+    double total2 = wavelc * 0.975;
+    double total2c = total2 + 4*bendcorr;
+    double rad2 = 0.5 * total2c /
+    (1 + sqrt(1/pow(ratio,2) + pow(turns*pi,2)));
+    //double vert2 = (total2c - 2*rad2)/2;
+    double height2 = rad2 / ratio;
+    
+    helixes[0].D = rad2;
+    helixes[0].H = height2;
+}
+
+/*
+ * qfh_compute_design() for n designs at once, helixes[2*i] and
+ * helixes[2*i+1] being the loops of requirements[i]. The SSE2 and AVX2
+ * versions size 2 and 4 designs at a time with the same operations in
+ * the same order (pow(x, 2) is x*x, there is no fused multiply-add), so
+ * they give exactly the results of the scalar version.
+ */
+
+#define LOAD2(f) _mm_set_pd(r[1].f, r[0].f)
+#define LOAD4(f) _mm256_set_pd(r[3].f, r[2].f, r[1].f, r[0].f)
+
+#ifdef HAVE_SSE2
+static int compute_designs_sse2(const design_req *requirements,
+                                helix *helixes, int n) {
+    const design_req *r;
+    __m128d wavel, wd_eff, dl, wavelc, bendcorr, den, rad1, rad2;
+    __m128d wrad, ratio, turns;
+    __m128i intv;
+    double d[4][2];
+    int i, k, i0, i1;
+    
+    for (i = 0; i+2 <= n; i += 2) {
+        r = requirements+i;
+        wrad = LOAD2(radius);
+        ratio = LOAD2(ratio);
+        turns = LOAD2(turns);
+        wavel = _mm_div_pd(_mm_set1_pd(299792), LOAD2(freq));
+        wd_eff = _mm_min_pd(_mm_set1_pd(15), LOAD2(diam));
+        
+        // deltal(): NaN and negative diameters take the first interval
+        intv = _mm_cvttpd_epi32(_mm_min_pd(_mm_set1_pd(DELTA_TABLE-2),
+                                _mm_max_pd(wd_eff, _mm_setzero_pd())));
+        i0 = _mm_cvtsi128_si32(intv);
+        i1 = _mm_cvtsi128_si32(_mm_srli_si128(intv, 4));
+        dl = _mm_set_pd(deltal_tbl[i1], deltal_tbl[i0]);
+        dl = _mm_add_pd(dl, _mm_mul_pd(_mm_sub_pd(
+            _mm_set_pd(deltal_tbl[i1+1], deltal_tbl[i0+1]), dl),
+            _mm_sub_pd(wd_eff, _mm_cvtepi32_pd(intv))));
+        
+        wavelc = _mm_mul_pd(_mm_mul_pd(LOAD2(length), wavel), dl);
+        bendcorr = _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(2), wrad),
+            _mm_div_pd(_mm_mul_pd(_mm_set1_pd(pi), wrad), _mm_set1_pd(2)));
+        bendcorr = _mm_mul_pd(_mm_set1_pd(4), bendcorr);
+        turns = _mm_mul_pd(turns, _mm_set1_pd(pi));
+        den = _mm_add_pd(_mm_set1_pd(1), _mm_sqrt_pd(_mm_add_pd(
+            _mm_div_pd(_mm_set1_pd(1), _mm_mul_pd(ratio, ratio)),
+            _mm_mul_pd(turns, turns))));
+        rad1 = _mm_div_pd(_mm_mul_pd(_mm_set1_pd(0.5), _mm_add_pd(
+            _mm_mul_pd(wavelc, _mm_set1_pd(1.026)), bendcorr)), den);
+        rad2 = _mm_div_pd(_mm_mul_pd(_mm_set1_pd(0.5), _mm_add_pd(
+            _mm_mul_pd(wavelc, _mm_set1_pd(0.975)), bendcorr)), den);
+        _mm_storeu_pd(d[0], rad1);
+        _mm_storeu_pd(d[1], _mm_div_pd(rad1, ratio));
+        _mm_storeu_pd(d[2], rad2);
+        _mm_storeu_pd(d[3], _mm_div_pd(rad2, ratio));
+        
+        for (k = 0; k < 2; k++) {
+            design_fields(r+k, helixes+2*(i+k));
+            helixes[2*(i+k)+1].D = d[0][k];
+            helixes[2*(i+k)+1].H = d[1][k];
+            helixes[2*(i+k)].D = d[2][k];
+            helixes[2*(i+k)].H = d[3][k];
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int compute_designs_avx2(const design_req *requirements,
+                                helix *helixes, int n) {
+    const design_req *r;
+    __m256d wavel, wd_eff, dl, wavelc, bendcorr, den, rad1, rad2;
+    __m256d wrad, ratio, turns;
+    __m128i intv;
+    double d[4][4];
+    int i, k;
+    
+    for (i = 0; i+4 <= n; i += 4) {
+        r = requirements+i;
+        wrad = LOAD4(radius);
+        ratio = LOAD4(ratio);
+        turns = LOAD4(turns);
+        wavel = _mm256_div_pd(_mm256_set1_pd(299792), LOAD4(freq));
+        wd_eff = _mm256_min_pd(_mm256_set1_pd(15), LOAD4(diam));
+        
+        // deltal(): NaN and negative diameters take the first interval
+        intv = _mm256_cvttpd_epi32(_mm256_min_pd(
+            _mm256_set1_pd(DELTA_TABLE-2),
+            _mm256_max_pd(wd_eff, _mm256_setzero_pd())));
+        dl = _mm256_i32gather_pd(deltal_tbl, intv, 8);
+        dl = _mm256_add_pd(dl, _mm256_mul_pd(_mm256_sub_pd(
+            _mm256_i32gather_pd(deltal_tbl+1, intv, 8), dl),
+            _mm256_sub_pd(wd_eff, _mm256_cvtepi32_pd(intv))));
+        
+        wavelc = _mm256_mul_pd(_mm256_mul_pd(LOAD4(length), wavel), dl);
+        bendcorr = _mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(2), wrad),
+            _mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(pi), wrad),
+                          _mm256_set1_pd(2)));
+        bendcorr = _mm256_mul_pd(_mm256_set1_pd(4), bendcorr);
+        turns = _mm256_mul_pd(turns, _mm256_set1_pd(pi));
+        den = _mm256_add_pd(_mm256_set1_pd(1), _mm256_sqrt_pd(_mm256_add_pd(
+            _mm256_div_pd(_mm256_set1_pd(1), _mm256_mul_pd(ratio, ratio)),
+            _mm256_mul_pd(turns, turns))));
+        rad1 = _mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_add_pd(
+            _mm256_mul_pd(wavelc, _mm256_set1_pd(1.026)), bendcorr)), den);
+        rad2 = _mm256_div_pd(_mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_add_pd(
+            _mm256_mul_pd(wavelc, _mm256_set1_pd(0.975)), bendcorr)), den);
+        _mm256_storeu_pd(d[0], rad1);
+        _mm256_storeu_pd(d[1], _mm256_div_pd(rad1, ratio));
+        _mm256_storeu_pd(d[2], rad2);
+        _mm256_storeu_pd(d[3], _mm256_div_pd(rad2, ratio));
+        
+        for (k = 0; k < 4; k++) {
+            design_fields(r+k, helixes+2*(i+k));
+            helixes[2*(i+k)+1].D = d[0][k];
+            helixes[2*(i+k)+1].H = d[1][k];
+            helixes[2*(i+k)].D = d[2][k];
+            helixes[2*(i+k)].H = d[3][k];
+        }
+    }
+    return i;
+}
+#endif
+
+void qfh_compute_designs(const design_req *requirements, helix *helixes,
+                         int n) {
+    int i = 0;
+    
+#ifdef HAVE_SSE2
+    if (__builtin_cpu_supports("avx2"))
+        i = compute_designs_avx2(requirements, helixes, n);
+    else
+        i = compute_designs_sse2(requirements, helixes, n);
+#endif
+    for (; i < n; i++)
+        qfh_compute_design(requirements+i, helixes+2*i);
+}
@@ -0,0 +1,692 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libqfh: the helix geometry generator shared by QFH2nec and helix2nec.
+ *
+ * All state lives in a qfh_ctx owned by the caller: the NEC tag counter,
+ * the side of the feed gap the next loop starts on, the segmentation and
+ * the output sink. There are no globals, so any number of threads may
+ * generate decks at the same time as long as each uses its own context.
+ */
+
+#ifndef QFH_H
+#define QFH_H
+
+#include<stdio.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<complex.h>
+#include<pthread.h>
+
+#define QFH_VERSION "0.2"
+
+extern const double pi;
+
+typedef struct {
+    double H; //height
+    double D; //diameter
+    double R; //corner radius
+    double turns; //number of turns
+    double offset; //distance from origin
+    double Theta; //initial theta angle
+    double wire; //radius of wire
+    char feed; //O=open, S=short, T=terminated to 50 ohms
+    int feedpoint; //tag of feed segment
+} helix;
+
+typedef struct {
+    double freq; // Design frequency in MHz
+    double turns; // Number of turns (twist)
+    double length; // Length of one turn in wavelengths
+    double radius; // Bending radius in mm
+    double diam; // Conductor diameter in mm
+    double ratio; // Width/height ratio
+} design_req;
+
+/* This defines how small segments to use in the produced NEC2 code */
+typedef struct {
+    int radial; // segments of each top radial wire
+    int corner; // steps in each 90-degree bend
+    int helix; // steps in each helical wire
+    double epsilon; // length of the feedpoint in mm
+} qfh_segmentation;
+
+/* In-memory wire model, one entry per GW card, structure of arrays.
+ * Coordinates and radii are in metres. All arrays live in one arena
+ * which is only reallocated when a larger model is built. */
+typedef struct {
+    int n; // wires in use
+    int cap; // wires allocated
+    double *x1, *y1, *z1;
+    double *x2, *y2, *z2;
+    double *radius;
+    int *segs;
+    int *tag;
+    void *arena;
+} qfh_geom;
+
+/* A NEC geometry card (GW, GA, GH, GM, ...): the two integer fields and
+ * the floating point fields in deck units, metres and degrees */
+typedef struct {
+    char type[3];
+    int i1, i2;
+    double f[7];
+} qfh_card;
+
+/* Phases of a run accounted in qfh_stats */
+enum {
+    QFH_PHASE_PARSE, // command line or helix input
+    QFH_PHASE_DESIGN, // qfh_design_model()
+    QFH_PHASE_GEOMETRY, // qfh_build_part() and qfh_build_end()
+    QFH_PHASE_CHECK, // qfh_check_geometry()
+    QFH_PHASE_EMIT, // writing the decks
+    QFH_PHASE_FILL, // interaction matrix
+    QFH_PHASE_FACTOR, // LU factorization
+    QFH_PHASE_SOLVE, // everything else of a solve
+    QFH_NPHASES
+};
+
+/* Hot path counters, only counted by a library built with -DQFH_COUNTERS */
+enum {
+    QFH_COUNT_POINTS, // helix points whose sin and cos were computed
+    QFH_COUNT_WRITES, // calls of the output sink
+    QFH_COUNT_PAIRS, // segment pairs integrated by the solver
+    QFH_COUNT_NEAR, // of which with the 1/R part done exactly
+    QFH_NCOUNTERS
+};
+
+#ifdef QFH_COUNTERS
+#define QFH_COUNT(var, n) ((var)+=(n))
+#else
+#define QFH_COUNT(var, n) ((void)(n))
+#endif
+
+/* Where the time of a run goes, see qfh_stats.c. Phase times of several
+ * threads are summed. */
+typedef struct {
+    double seconds[QFH_NPHASES];
+    long calls[QFH_NPHASES];
+    long tags; // wires built
+    long segments;
+    uint64_t bytes; // handed to the output sink
+    int unknowns; // largest system solved
+    double flops; // estimated work of the factorizations and solves
+    int counters; // the counters below were compiled in
+    uint64_t count[QFH_NCOUNTERS];
+} qfh_stats;
+
+/* Directions of a far field pattern, as on a NEC RP card: ntheta values
+ * of theta (from the zenith) starting at theta0 in steps of dtheta,
+ * times nphi values of phi from phi0 in steps of dphi, in degrees */
+typedef struct {
+    int ntheta, nphi;
+    double theta0, phi0, dtheta, dphi;
+} qfh_grid;
+
+/* A complete model: bifilar loop pairs, their wires and the frequency
+ * sweep. h[2*i] and h[2*i+1] are the two loops of helix i, given in
+ * input units (wire diameter, Theta in degrees); h[2*i] holds the feed
+ * type and receives the tag of the feed wire. A compact or symmetric
+ * build also keeps the geometry cards the wires were expanded from.
+ * A symmetric build is made of nsym copies of one sector rotated about
+ * the z axis, the wires of copy k follow those of copy k-1 in the same
+ * order with their tags increased by symtag. */
+typedef struct {
+    helix *h;
+    int nhelix;
+    int comment_base; // number of the first helix in the CM cards
+    double fstart, fstop, fstep;
+    qfh_geom geom;
+    qfh_card *cards;
+    int ncards, cardcap;
+    int nsym; // 2 for a symmetric build, 1 otherwise
+    int symtag; // tags per sector
+    const qfh_grid *rp; // RP card, NULL for the whole sphere in 37 x 37 points
+    qfh_stats *stats; // solves accounted here, NULL for nowhere
+} qfh_model;
+
+#define QFH_MAX_FREQS 100000 // frequencies qfh_design_band() accepts
+
+/* Output sink: receives every byte of the deck, returns 0 on success */
+typedef int (*qfh_write_fn)(void *opaque, const char *data, size_t len);
+
+/* Points of a helix are computed a block of at most this many at a time */
+#define QFH_TRIG_BLOCK 64
+
+typedef struct {
+    int itg; // next tag to be allocated
+    int feedside; // the next loop starts on the feed side of the gap
+    qfh_segmentation seg;
+    int compact; // build with GH/GM cards, see qfh_build_helix_cards()
+    int symmetric; // build half of each helix and a GR card
+    int libm_trig; // points with libm sin and cos instead of qfh_sincos()
+    int generic_layout; // no specialized qfh_build_helix() layouts
+    int bend_corner, bend_libm; // corner and libm_trig of the table below
+    double bend_sin[QFH_TRIG_BLOCK], bend_cos[QFH_TRIG_BLOCK]; // of the bend angles
+    qfh_write_fn write;
+    void *opaque;
+    int error; // set once the sink has failed
+    qfh_stats *stats; // building and writing accounted here, NULL for nowhere
+} qfh_ctx;
+
+/* Growable memory sink */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} qfh_membuf;
+
+/* Output format, writes a built model to the sink of ctx */
+typedef struct {
+    const char *name;
+    const char *ext; // file extension
+    int (*emit)(qfh_ctx *ctx, const qfh_model *m);
+    int compact; // needs a model built with ctx->compact set
+    int symmetric; // needs a model built with ctx->symmetric set
+} qfh_emitter;
+
+/* Segments of a model and the triangle basis functions spanning them,
+ * as used by the method of moments solver. Each basis function is made
+ * of two halves on the two segments meeting at a node; a half is a
+ * linear ramp that peaks at the node. Free wire ends carry no current. */
+typedef struct {
+    int nseg;
+    double *ax, *ay, *az; // start point of each segment in metres
+    double *dx, *dy, *dz; // unit direction
+    double *len; // length
+    double *a; // wire radius
+    int *wfirst; // first segment of each wire of the geometry
+    int nbasis;
+    int *hseg; // segment of each half, halves 2*b and 2*b+1 form basis b
+    signed char *hsign; // current direction relative to the segment
+    signed char *hend; // 1 if the half peaks at the segment end, 0 at its start
+    int *shalf_start; // halves on segment s are shalf[shalf_start[s]..shalf_start[s+1]-1]
+    int *shalf;
+    void *arena;
+} qfh_mesh;
+
+/* A voltage source (v in volts) or series load (v in ohms) at the centre
+ * of a segment */
+typedef struct {
+    int seg;
+    double complex v;
+} qfh_port;
+
+typedef struct {
+    double freq; // MHz
+    double complex z; // feed point impedance in ohms
+    double swr; // against 50 ohms
+    double gain; // power gain towards the zenith in dBi
+    double axial; // axial ratio towards the zenith in dB
+} qfh_result;
+
+/* Far field in one direction */
+typedef struct {
+    double theta, phi; // degrees
+    double gain; // power gain in dBi
+    double rhcp, lhcp; // gain of the right and left hand circular parts in dBic
+    double axial; // axial ratio in dB
+} qfh_farpoint;
+
+/* A built model reduced to the feed wires of its helices, for solving
+ * the same geometry with other feeds and terminations. The interaction
+ * matrix is factored once per frequency without any loads; every port
+ * (one per feed wire, two on a split one) keeps its current response
+ * Z^-1 u, the currents it induces at all the ports and the zenith
+ * radiation vector of that response. See qfh_term_solve(). */
+typedef struct {
+    qfh_mesh ms;
+    int nhelix;
+    int nport;
+    int split; // split feed wires of a symmetric model
+    int *seg; // segment of each port
+    int *helix; // helix of each port
+    int *first; // first port of each helix, -1 if it has no feed wire
+    double freq; // of the factored matrix, 0 before qfh_term_factor()
+    double complex *zmat; // LU factors
+    int *piv;
+    void *sym; // solver of the modes of a symmetric mesh, used instead
+    double complex *w; // response of each port, nport rows of ms.nbasis
+    double complex *y; // current at port p from a unit source at q, y[p*nport+q]
+    double complex *nx, *ny; // zenith radiation vector of each response
+    double complex *c, *a; // scratch of qfh_term_solve()
+    int *cpiv, *lport;
+    qfh_stats *stats; // that of the model
+} qfh_term;
+
+/* Samples nfun complex functions at freq MHz into v, returns 0 on success */
+typedef int (*qfh_sample_fn)(void *opaque, double freq, double complex *v);
+
+/* Rational fit of sampled functions of frequency, see qfh_mbpe.c */
+typedef struct {
+    int nfun; // functions, sharing the denominator
+    int nsamples;
+    double *freq; // sampled frequencies in MHz, in order
+    double complex *v; // nfun values per sample
+    double f0, half; // centre and half width of the band
+    int degree; // of the numerators and the denominator
+    double complex *coef; // nfun*(degree+1) numerator coefficients, then degree
+    double error; // estimated relative error of the fit
+} qfh_mbpe;
+
+/* Index entry of a deck archive: the design_req fields freq, turns,
+ * length, radius, diam and ratio, the output format name and where the
+ * deck is in the file */
+typedef struct {
+    double key[6];
+    char format[8];
+    uint64_t offset;
+    uint64_t length;
+} qfh_archive_entry;
+
+/* Deck archive open for appending, see qfh_archive.c */
+typedef struct {
+    FILE *f;
+    uint64_t pos; // file offset of the next record
+    qfh_archive_entry *index;
+    long n, cap;
+    int error; // set once a write has failed
+    pthread_mutex_t lock;
+} qfh_archive;
+
+/* Deck archive mapped for reading, index sorted by key and format */
+typedef struct {
+    const char *data;
+    size_t size;
+    const qfh_archive_entry *index;
+    long n;
+    qfh_archive_entry *own; // index rebuilt from the records
+    int unclosed; // the archive has no index, it was never closed
+} qfh_archive_reader;
+
+/* Result cache, see qfh_cache.c */
+#define QFH_CACHE_KEY 128
+
+typedef struct {
+    unsigned char b[QFH_CACHE_KEY]; // canonical bytes of everything hashed
+    uint64_t hash;
+} qfh_cache_key;
+
+typedef struct {
+    long hits, misses, stores;
+    double saved; // seconds the hits took to compute in the first place
+    double lookup; // seconds spent looking up
+} qfh_cache_stats;
+
+typedef struct {
+    int ifd, dfd; // index and data files
+    unsigned char *index; // mapped index
+    size_t isize;
+    const char *data; // data mapped up to dmap
+    uint64_t dmap;
+    uint64_t end; // end of the data
+    pthread_mutex_t lock;
+    int locked; // lock initialized
+    qfh_cache_stats stats;
+} qfh_cache;
+
+/* Work stealing thread pool, see qfh_pool.c */
+typedef void (*qfh_task_fn)(void *arg, long task, int worker);
+
+typedef struct qfh_pool qfh_pool;
+
+typedef struct {
+    qfh_pool *pool;
+    int id;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    long lo, hi; // tasks of this worker not yet taken
+    long steals;
+} qfh_pool_worker;
+
+struct qfh_pool {
+    int nthreads;
+    qfh_pool_worker *worker;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned long round; // one per qfh_pool_run()
+    int active; // workers not done with the round
+    int quit;
+    qfh_task_fn fn;
+    void *arg;
+};
+
+/* Goal of the design optimizer. The design frequency and conductor
+ * diameter are fixed, turns, length, radius and ratio are searched
+ * between lo and hi, in that order. */
+typedef struct {
+    double freq; // centre of the band in MHz, also the design frequency
+    double band; // width of the band in MHz
+    int npoints; // frequencies solved across the band
+    double swr; // highest SWR wanted over the band
+    double axial; // highest zenith axial ratio in dB over the band, 0 for none
+    double gain; // lowest zenith gain in dBi over the band, -HUGE_VAL for none
+    double diam; // conductor diameter in mm
+    double lo[4], hi[4];
+    double spw; // segments per wavelength, 0 for the default segmentation
+    int population;
+    int generations;
+    unsigned long seed;
+    qfh_cache *cache; // solved designs are looked up and kept here, or NULL
+} qfh_goal;
+
+/* Best design found so far and the state of the search */
+typedef struct {
+    design_req best;
+    double cost;
+    double swr, axial, gain; // worst values of best over the band
+    int generation;
+    long evals; // designs solved
+    double spread; // largest extent of the population relative to its bounds
+    double seconds;
+    long steals; // task ranges stolen by idle threads
+} qfh_optim_result;
+
+typedef void (*qfh_optim_report)(void *opaque, const qfh_optim_result *r);
+
+/* Error of one dimension of a built antenna in mm: normal with standard
+ * deviation width ('n') or uniform within +-width ('u') */
+typedef struct {
+    char dist;
+    double width;
+} qfh_tolerance;
+
+/* Dimensions of qfh_tol_spec.tol */
+enum {
+    QFH_TOL_HEIGHT, // H of each loop
+    QFH_TOL_DIAMETER, // D of each loop
+    QFH_TOL_BEND, // R of each loop
+    QFH_TOL_WIRE, // conductor diameter, the same for both loops
+    QFH_NTOL
+};
+
+/* Tolerance analysis of a design, see qfh_tol.c */
+typedef struct {
+    design_req req; // nominal design, also the centre of the band
+    double band; // width of the band in MHz
+    int npoints; // frequencies solved across the band
+    double swr; // a sample passes with its SWR below this over the band
+    qfh_tolerance tol[QFH_NTOL];
+    double spw; // segments per wavelength, 0 for the default segmentation
+    long samples;
+    int batch; // samples drawn and solved at a time
+    unsigned long seed;
+} qfh_tol_spec;
+
+/* Yield and resonance statistics of the samples solved so far */
+typedef struct {
+    long samples;
+    long failed; // could not be built (bends too large) or solved
+    long pass; // SWR below the goal over the whole band
+    double yield; // pass/samples
+    double swr_mean; // mean of the worst SWR over the band, of those solved
+    long resonant; // reactance crossing zero within the band
+    double res_mean, res_sd; // of the resonances in MHz
+    double res_lo, res_hi, res_p5, res_p50, res_p95;
+    double nominal_swr, nominal_res; // of the nominal design
+    double seconds;
+    long steals; // task ranges stolen by idle threads
+} qfh_tol_result;
+
+typedef void (*qfh_tol_report)(void *opaque, const qfh_tol_result *r);
+
+/* Segmentation convergence study of a design, see qfh_conv.c */
+#define QFH_CONV_MAX 16 // rungs of the ladder
+
+typedef struct {
+    design_req req;
+    double freq; // MHz, at which the impedance is solved
+    double spw; // segments per wavelength of the coarsest rung
+    double ratio; // of spw from one rung to the next
+    int levels; // rungs, at least 3
+    double tol; // relative error of the recommended rung
+    int symmetric; // solve the symmetric models
+} qfh_conv_spec;
+
+typedef struct {
+    double spw; // 0 for the default segmentation
+    qfh_segmentation seg;
+    int segments;
+    double complex z; // feed point impedance
+    double error; // relative to the extrapolated impedance
+    double seconds; // of building and solving on one thread
+    int failed;
+} qfh_conv_level;
+
+typedef struct {
+    int nlevels; // distinct rungs, coarsest first
+    qfh_conv_level level[QFH_CONV_MAX];
+    qfh_conv_level dflt; // the default segmentation
+    double complex z; // extrapolated impedance
+    double order; // of convergence, p in Z + C h^p
+    int best; // recommended rung, -1 if none is within the tolerance
+    double seconds;
+} qfh_conv_result;
+
+/* Problems found by qfh_check_geometry(), see qfh_check.c. The first
+ * QFH_CHECK_ERRORS make a model unusable, the others make NEC2 results
+ * doubtful. */
+enum {
+    QFH_CHECK_TOUCH, // unconnected segments closer than their radii add up to
+    QFH_CHECK_EMPTY, // segment without length or radius
+    QFH_CHECK_NEAR, // unconnected segments within twice that
+    QFH_CHECK_STUB, // segment shorter than twice its radius
+    QFH_CHECK_LONG, // segment longer than a tenth of the wavelength
+    QFH_CHECK_THICK, // wire too thick for the wavelength
+    QFH_NCHECK
+};
+#define QFH_CHECK_ERRORS 2
+#define QFH_CHECK_KEEP 16 // problems listed in a qfh_check_result
+
+typedef struct {
+    int kind;
+    int tag[2], seg[2]; // wire tag and segment number in it, the second for pairs
+    double value; // gap over the sum of the radii, length over radius,
+                  // length or radius over the wavelength
+} qfh_check_issue;
+
+typedef struct {
+    int count[QFH_NCHECK];
+    int errors, warnings;
+    int nissue; // listed, errors first
+    qfh_check_issue issue[QFH_CHECK_KEEP];
+    long pairs; // segment pairs whose distance was measured
+    double seconds;
+} qfh_check_result;
+
+/* One frequency of a NEC2 output file as nec2c writes it, see
+ * qfh_necout.c */
+typedef struct {
+    double freq; // MHz
+    double complex z; // input impedance in ohms, summed over the sources
+    double swr; // against 50 ohms
+    double gain; // largest total gain of the radiation pattern in dBi,
+                 // NAN without one
+} qfh_necout_row;
+
+/* Flags of qfh_solve_model() */
+#define QFH_SOLVE_NOSYM 1 // solve rotationally symmetric models as a whole
+
+extern const qfh_segmentation qfh_default_segmentation;
+extern const qfh_emitter qfh_emitters[];
+
+void qfh_init(qfh_ctx *ctx, const qfh_segmentation *seg,
+              qfh_write_fn write, void *opaque);
+int qfh_tag(qfh_ctx *ctx);
+int qfh_write(qfh_ctx *ctx, const char *data, size_t len);
+int qfh_printf(qfh_ctx *ctx, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+int qfh_file_sink(void *opaque, const char *data, size_t len);
+int qfh_membuf_sink(void *opaque, const char *data, size_t len);
+void qfh_membuf_free(qfh_membuf *buf);
+
+/* Room to reserve per card before using the qfh_buf_ appenders */
+#define QFH_CARDMAX 256
+
+int qfh_fmt_e5(char *out, double v);
+int qfh_fmt_int(char *out, int v);
+int qfh_membuf_reserve(qfh_membuf *b, size_t extra);
+void qfh_buf_str(qfh_membuf *b, const char *s);
+void qfh_buf_int(qfh_membuf *b, int v);
+void qfh_buf_e5(qfh_membuf *b, double v);
+void qfh_buf_e5list(qfh_membuf *b, const double *v, int n);
+
+void qfh_sincos(const double *x, double *s, double *c, int n);
+const char *qfh_sincos_kernel(void);
+
+int qfh_geom_reserve(qfh_geom *g, int nwires);
+void qfh_geom_add(qfh_geom *g, int tag, int segs,
+                  double x1, double y1, double z1,
+                  double x2, double y2, double z2, double radius);
+void qfh_geom_free(qfh_geom *g);
+int qfh_helix_wires(const qfh_segmentation *seg);
+int qfh_card_floats(const char *type);
+int qfh_geom_card(qfh_geom *g, const qfh_card *c);
+int qfh_read_geometry(const char *data, size_t len, qfh_geom *g);
+
+const qfh_emitter *qfh_find_emitter(const char *name);
+int qfh_emit_nec(qfh_ctx *ctx, const qfh_model *m);
+int qfh_emit_nec_printf(qfh_ctx *ctx, const qfh_model *m);
+int qfh_emit_nec_comments(qfh_ctx *ctx, const qfh_model *m, int first,
+                          int last);
+int qfh_emit_nec_geometry(qfh_ctx *ctx, const qfh_model *m);
+int qfh_emit_nec_controls(qfh_ctx *ctx, const qfh_model *m,
+                          const int *loads, int nloads,
+                          const int *feeds, int nfeeds);
+int qfh_emit_necgh(qfh_ctx *ctx, const qfh_model *m);
+int qfh_emit_csv(qfh_ctx *ctx, const qfh_model *m);
+int qfh_emit_bin(qfh_ctx *ctx, const qfh_model *m);
+
+void qfh_compute_design(const design_req *requirements, helix *helixes);
+void qfh_compute_designs(const design_req *requirements, helix *helixes,
+                         int n);
+int qfh_check_design(const design_req *req, char *msg, size_t len);
+void qfh_design_model(const design_req *req, helix *h, qfh_model *m);
+int qfh_design_band(qfh_model *m, double freq, double span, double fstep,
+                    char *msg, size_t len);
+void qfh_adaptive_segmentation(const qfh_model *m, double spw,
+                               qfh_segmentation *seg);
+int qfh_model_segments(const qfh_model *m);
+void qfh_build_helix(qfh_ctx *ctx, qfh_geom *g, const helix *h);
+void qfh_build_helix_cards(qfh_ctx *ctx, qfh_model *m, const helix *h);
+int qfh_build_feed_wire(qfh_ctx *ctx, qfh_geom *g, const helix *h);
+int qfh_build_model(qfh_ctx *ctx, qfh_model *m);
+int qfh_build_part(qfh_ctx *ctx, qfh_model *m);
+int qfh_build_end(qfh_ctx *ctx, qfh_model *m);
+void qfh_model_free(qfh_model *m);
+int qfh_write_deck(qfh_ctx *ctx, const design_req *req);
+
+int qfh_archive_open(qfh_archive *a, const char *path);
+int qfh_archive_append(qfh_archive *a, const design_req *req,
+                       const char *format, const char *data, size_t len);
+int qfh_archive_close(qfh_archive *a);
+int qfh_archive_map(qfh_archive_reader *r, const char *path);
+const char *qfh_archive_find(const qfh_archive_reader *r,
+                             const design_req *req, const char *format,
+                             size_t *len);
+const char *qfh_archive_deck(const qfh_archive_reader *r, long i, size_t *len);
+void qfh_archive_unmap(qfh_archive_reader *r);
+
+int qfh_mesh_build(qfh_mesh *ms, const qfh_geom *g);
+void qfh_mesh_free(qfh_mesh *ms);
+int qfh_mesh_segment(const qfh_mesh *ms, const qfh_geom *g, int tag, int seg);
+void qfh_fill(const qfh_mesh *ms, double freq, int nthreads,
+              double complex *zmat);
+void qfh_add_load(const qfh_mesh *ms, double complex *zmat,
+                  const qfh_port *load);
+int qfh_lu_factor(double complex *a, int n, int *piv);
+void qfh_lu_solve(const double complex *a, int n, const int *piv,
+                  double complex *b);
+void qfh_port_rhs(const qfh_mesh *ms, const qfh_port *src,
+                  double complex *rhs);
+double complex qfh_port_current(const qfh_mesh *ms, const double complex *cur,
+                                int seg);
+double qfh_zenith_gain(const qfh_mesh *ms, double freq,
+                       const double complex *cur, double pin);
+double qfh_zenith_axial(const qfh_mesh *ms, double freq,
+                        const double complex *cur);
+double qfh_swr(double complex z, double z0);
+int qfh_nfreq(const qfh_model *m);
+int qfh_solve_model(const qfh_model *m, int nthreads, int flags,
+                    qfh_result *res);
+int qfh_solve_fast(const qfh_model *m, int nthreads, int flags, double tol,
+                   qfh_result *res, qfh_mbpe *mb);
+int qfh_solve_currents(const qfh_model *m, double freq, int nthreads,
+                       int flags, qfh_result *res, qfh_mesh *ms,
+                       double complex **cur, double *pin);
+int qfh_term_init(qfh_term *t, const qfh_model *m);
+int qfh_term_factor(qfh_term *t, double freq, int nthreads);
+int qfh_term_solve(qfh_term *t, const char *feeds, qfh_result *res,
+                   double complex *cur);
+void qfh_term_free(qfh_term *t);
+
+int qfh_pool_init(qfh_pool *p, int nthreads);
+void qfh_pool_run(qfh_pool *p, long n, qfh_task_fn fn, void *arg);
+long qfh_pool_steals(qfh_pool *p);
+void qfh_pool_free(qfh_pool *p);
+
+int qfh_cache_open(qfh_cache *c, const char *dir);
+void qfh_cache_key_make(qfh_cache_key *k, const design_req *req,
+                        const qfh_ctx *ctx, const qfh_model *m, int flags);
+int qfh_cache_get(qfh_cache *c, const qfh_cache_key *k, qfh_result *res,
+                  int maxres, qfh_geom *g);
+int qfh_cache_put(qfh_cache *c, const qfh_cache_key *k, const qfh_geom *g,
+                  const qfh_result *res, int nres, double seconds);
+long qfh_cache_entries(qfh_cache *c);
+void qfh_cache_close(qfh_cache *c);
+
+void qfh_stats_init(qfh_stats *s);
+double qfh_stats_start(const qfh_stats *s);
+void qfh_stats_stop(qfh_stats *s, int phase, double t0);
+void qfh_stats_merge(qfh_stats *to, const qfh_stats *from);
+double qfh_lu_flops(int n);
+void qfh_stats_print(const qfh_stats *s, double wall, FILE *f);
+int qfh_stats_json(const qfh_stats *s, double wall, FILE *f);
+int qfh_stats_write(const qfh_stats *st, double wall, int print,
+                    const char *json);
+
+extern const qfh_grid qfh_rp_default;
+int qfh_grid_parse(qfh_grid *g, const char *spec);
+int qfh_pattern(const qfh_mesh *ms, double freq, const double complex *cur,
+                double pin, const qfh_grid *grid, int nthreads,
+                qfh_farpoint *pts);
+
+int qfh_mbpe_sweep(qfh_mbpe *mb, int nfun, double flo, double fhi,
+                   double tol, int maxsamples, qfh_sample_fn fn, void *opaque);
+void qfh_mbpe_eval(const qfh_mbpe *mb, double freq, double complex *v);
+void qfh_mbpe_free(qfh_mbpe *mb);
+
+void qfh_goal_init(qfh_goal *g, double freq, double diam);
+int qfh_optimize(const qfh_goal *g, int nthreads, qfh_optim_report report,
+                 void *opaque, qfh_optim_result *r);
+
+void qfh_tol_init(qfh_tol_spec *s, const design_req *req);
+int qfh_tolerance_parse(qfh_tolerance *t, const char *spec);
+int qfh_tol_run(const qfh_tol_spec *s, int nthreads, qfh_tol_report report,
+                void *opaque, qfh_tol_result *r);
+
+void qfh_conv_init(qfh_conv_spec *s, const design_req *req);
+int qfh_conv_run(const qfh_conv_spec *s, int nthreads, qfh_conv_result *r);
+
+int qfh_check_helix(const helix *h, char *msg, size_t len);
+int qfh_check_geometry(const qfh_geom *g, double fmax, qfh_check_result *r);
+void qfh_check_print(const qfh_check_result *r, FILE *f);
+
+int qfh_necout_parse(const char *data, size_t len, qfh_necout_row **rows,
+                     long *n);
+
+#endif
@@ -0,0 +1,389 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Deck archives: many decks in one append-only file, keyed by the exact
+ * design parameters they were built from and the output format.
+ *
+ * Layout, host byte order, every part aligned to 8 bytes:
+ *   header   "QFHA", uint32 version
+ *   records  "QFHR", char format[8], uint32 0, double key[6],
+ *            uint64 deck length, the deck, zero padding
+ *   index    one qfh_archive_entry per deck, sorted, a later deck with
+ *            the same key and format replaces an earlier one
+ *   trailer  uint64 index offset, uint64 entry count, "QFHI", uint32 version
+ * The key is freq, turns, length, radius, diam, ratio of the design_req.
+ *
+ * Decks are only ever appended. Reopening an archive drops its index and
+ * trailer, and a new index is written when it is closed again. If the
+ * writer never got to close it, the records are self describing: a
+ * reader rebuilds the index by scanning them, and the next writer cuts
+ * off a record left incomplete.
+ *
+ * A writer holds an exclusive flock() on the file from open to close,
+ * so a second writer waits for the first one, as with the result cache.
+ * Readers take no lock and must not map an archive while it is written.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/file.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "qfh.h"
+
+#define ARCHIVE_VERSION 1
+#define HEADER_SIZE 8
+#define RECORD_SIZE 72
+#define TRAILER_SIZE 24
+
+typedef struct {
+    char magic[4];
+    char format[8];
+    uint32_t zero;
+    double key[6];
+    uint64_t length;
+} archive_record;
+
+typedef struct {
+    uint64_t index;
+    uint64_t count;
+    char magic[4];
+    uint32_t version;
+} archive_trailer;
+
+static void archive_key(const design_req *req, double *key)
+{
+    key[0]=req->freq;
+    key[1]=req->turns;
+    key[2]=req->length;
+    key[3]=req->radius;
+    key[4]=req->diam;
+    key[5]=req->ratio;
+}
+
+/* Format names are stored in 8 bytes, NUL padded */
+static void archive_format(char *dst, const char *name)
+{
+    size_t n=strlen(name);
+
+    memset(dst, 0, 8);
+    memcpy(dst, name, n<8 ? n : 8);
+}
+
+static uint64_t padded(uint64_t len)
+{
+    return (len+7)&~(uint64_t)7;
+}
+
+/* Orders entries by key and then format */
+static int cmp_key(const qfh_archive_entry *a, const qfh_archive_entry *b)
+{
+    int i;
+
+    for(i=0;i<6;i++)
+        if(a->key[i]!=b->key[i])
+            return a->key[i]<b->key[i] ? -1 : 1;
+    return strncmp(a->format, b->format, sizeof(a->format));
+}
+
+/* Orders entries by key and format, equal ones by their position */
+static int cmp_entry(const void *pa, const void *pb)
+{
+    const qfh_archive_entry *a=(const qfh_archive_entry*)pa;
+    const qfh_archive_entry *b=(const qfh_archive_entry*)pb;
+    int c;
+
+    if((c=cmp_key(a, b))!=0)
+        return c;
+    return a->offset<b->offset ? -1 : a->offset>b->offset;
+}
+
+/* Sorts the entries and keeps only the last deck of every key and
+ * format, returns the new count */
+static long sort_index(qfh_archive_entry *e, long n)
+{
+    long i, k=0;
+
+    qsort(e, n, sizeof(*e), cmp_entry);
+    for(i=0;i<n;i++)
+        if(i+1==n || cmp_key(&e[i], &e[i+1])!=0)
+            e[k++]=e[i];
+    return k;
+}
+
+static int add_entry(qfh_archive_entry **e, long *n, long *cap,
+                     const archive_record *r, uint64_t offset)
+{
+    qfh_archive_entry *ne;
+
+    if(*n==*cap) {
+        *cap=*cap ? 2**cap : 1024;
+        if((ne=(qfh_archive_entry*)realloc(*e, *cap*sizeof(**e)))==NULL)
+            return 1;
+        *e=ne;
+    }
+    memcpy((*e)[*n].key, r->key, sizeof(r->key));
+    memcpy((*e)[*n].format, r->format, sizeof(r->format));
+    (*e)[*n].offset=offset;
+    (*e)[*n].length=r->length;
+    (*n)++;
+    return 0;
+}
+
+/* Finds the trailer of the size bytes at data. Returns the index and its
+ * length, or NULL if the archive was not closed. */
+static const qfh_archive_entry *find_index(const char *data, uint64_t size,
+                                           long *n)
+{
+    archive_trailer t;
+
+    if(size<HEADER_SIZE+TRAILER_SIZE)
+        return NULL;
+    memcpy(&t, data+size-TRAILER_SIZE, TRAILER_SIZE);
+    if(memcmp(t.magic, "QFHI", 4) || t.version!=ARCHIVE_VERSION ||
+       t.index<HEADER_SIZE || t.index%8 || t.index>size-TRAILER_SIZE ||
+       t.count>(size-TRAILER_SIZE-t.index)/sizeof(qfh_archive_entry) ||
+       t.index+t.count*sizeof(qfh_archive_entry)!=size-TRAILER_SIZE)
+        return NULL;
+    *n=(long)t.count;
+    return (const qfh_archive_entry*)(data+t.index);
+}
+
+/* Walks the records from the header on, adding one entry per complete
+ * record. Returns the offset just past the last of them. */
+static uint64_t scan_records(const char *data, uint64_t size,
+                             qfh_archive_entry **e, long *n, long *cap)
+{
+    archive_record r;
+    uint64_t pos=HEADER_SIZE;
+
+    while(size-pos>=RECORD_SIZE) {
+        memcpy(&r, data+pos, RECORD_SIZE);
+        if(memcmp(r.magic, "QFHR", 4) ||
+           r.length>size-pos-RECORD_SIZE ||
+           padded(r.length)>size-pos-RECORD_SIZE)
+            break;
+        if(add_entry(e, n, cap, &r, pos+RECORD_SIZE))
+            break;
+        pos+=RECORD_SIZE+padded(r.length);
+    }
+    return pos;
+}
+
+static int check_header(const char *data, uint64_t size)
+{
+    uint32_t version;
+
+    if(size<HEADER_SIZE || memcmp(data, "QFHA", 4))
+        return 1;
+    memcpy(&version, data+4, 4);
+    return version!=ARCHIVE_VERSION;
+}
+
+/* Opens the archive at path for appending, creating it if needed, and
+ * waits until no other writer has it open. Returns 0 on success. */
+int qfh_archive_open(qfh_archive *a, const char *path)
+{
+    const qfh_archive_entry *index;
+    char *data=MAP_FAILED, header[HEADER_SIZE];
+    struct stat st;
+    uint32_t version;
+    int fd;
+
+    memset(a, 0, sizeof(*a));
+    if((fd=open(path, O_RDWR|O_CREAT, 0666))<0)
+        return 1;
+    // the size is only read under the lock, another writer may be busy
+    if(flock(fd, LOCK_EX) || fstat(fd, &st))
+        goto fail;
+    if(st.st_size==0) {
+        memcpy(header, "QFHA", 4);
+        version=ARCHIVE_VERSION;
+        memcpy(header+4, &version, 4);
+        if(write(fd, header, HEADER_SIZE)!=HEADER_SIZE)
+            goto fail;
+        a->pos=HEADER_SIZE;
+    } else {
+        data=(char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(data==MAP_FAILED || check_header(data, st.st_size))
+            goto fail;
+        if((index=find_index(data, st.st_size, &a->n))!=NULL) {
+            // the old index is rewritten, with the new decks, on close
+            a->cap=a->n>1024 ? a->n : 1024;
+            if((a->index=(qfh_archive_entry*)malloc(a->cap*sizeof(*index)))==NULL)
+                goto fail;
+            memcpy(a->index, index, a->n*sizeof(*index));
+            a->pos=(const char*)index-data;
+        } else
+            a->pos=scan_records(data, st.st_size, &a->index, &a->n, &a->cap);
+        munmap(data, st.st_size);
+        data=MAP_FAILED;
+        if(ftruncate(fd, a->pos) || lseek(fd, a->pos, SEEK_SET)<0)
+            goto fail;
+    }
+    if((a->f=fdopen(fd, "w"))==NULL)
+        goto fail;
+    setvbuf(a->f, NULL, _IOFBF, 1<<20);
+    pthread_mutex_init(&a->lock, NULL);
+    return 0;
+fail:
+    if(data!=MAP_FAILED)
+        munmap(data, st.st_size);
+    close(fd);
+    free(a->index);
+    a->index=NULL;
+    return 1;
+}
+
+/* Appends the deck of len bytes at data, written for req in the format
+ * of the given name. Safe to call from several threads, the decks are
+ * written one after the other in the order of the calls. Returns 0 on
+ * success. */
+int qfh_archive_append(qfh_archive *a, const design_req *req,
+                       const char *format, const char *data, size_t len)
+{
+    static const char zero[8];
+    archive_record r;
+    int failed;
+
+    memset(&r, 0, sizeof(r));
+    memcpy(r.magic, "QFHR", 4);
+    archive_format(r.format, format);
+    archive_key(req, r.key);
+    r.length=len;
+
+    pthread_mutex_lock(&a->lock);
+    failed=a->error || strlen(format)>sizeof(r.format) ||
+           add_entry(&a->index, &a->n, &a->cap, &r, a->pos+RECORD_SIZE);
+    if(!failed) {
+        failed=fwrite(&r, RECORD_SIZE, 1, a->f)!=1 ||
+               (len && fwrite(data, len, 1, a->f)!=1) ||
+               (padded(len)!=len &&
+                fwrite(zero, padded(len)-len, 1, a->f)!=1);
+        if(failed) {
+            a->n--;
+            a->error=1;
+        } else
+            a->pos+=RECORD_SIZE+padded(len);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return failed;
+}
+
+/* Writes the index and closes the archive. Returns 0 if every deck and
+ * the index made it to the file. */
+int qfh_archive_close(qfh_archive *a)
+{
+    archive_trailer t;
+    int failed=a->error;
+
+    a->n=sort_index(a->index, a->n);
+    t.index=a->pos;
+    t.count=a->n;
+    memcpy(t.magic, "QFHI", 4);
+    t.version=ARCHIVE_VERSION;
+    if(!failed)
+        failed=(a->n && fwrite(a->index, sizeof(*a->index), a->n, a->f)!=(size_t)a->n) ||
+               fwrite(&t, TRAILER_SIZE, 1, a->f)!=1;
+    failed|=fclose(a->f)!=0;
+    pthread_mutex_destroy(&a->lock);
+    free(a->index);
+    memset(a, 0, sizeof(*a));
+    return failed;
+}
+
+/* Maps the archive at path for reading. The index is used in place if
+ * the archive was closed, otherwise it is rebuilt from the records.
+ * Returns 0 on success. */
+int qfh_archive_map(qfh_archive_reader *r, const char *path)
+{
+    qfh_archive_entry *own=NULL;
+    struct stat st;
+    long cap=0;
+    int fd;
+
+    memset(r, 0, sizeof(*r));
+    if((fd=open(path, O_RDONLY))<0)
+        return 1;
+    if(fstat(fd, &st) || st.st_size==0) {
+        close(fd);
+        return 1;
+    }
+    r->data=(const char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(r->data==MAP_FAILED) {
+        r->data=NULL;
+        return 1;
+    }
+    r->size=st.st_size;
+    if(check_header(r->data, r->size)) {
+        qfh_archive_unmap(r);
+        return 1;
+    }
+    if((r->index=find_index(r->data, r->size, &r->n))==NULL) {
+        scan_records(r->data, r->size, &own, &r->n, &cap);
+        r->n=own ? sort_index(own, r->n) : 0;
+        r->index=r->own=own;
+        r->unclosed=1;
+    }
+    return 0;
+}
+
+/* Looks up the deck of req in the given format. Returns a pointer into
+ * the mapping and its length, or NULL if the archive has no such deck. */
+const char *qfh_archive_find(const qfh_archive_reader *r,
+                             const design_req *req, const char *format,
+                             size_t *len)
+{
+    qfh_archive_entry key;
+    const qfh_archive_entry *e;
+    long lo=0, hi=r->n, mid;
+
+    memset(&key, 0, sizeof(key));
+    archive_key(req, key.key);
+    archive_format(key.format, format);
+    while(lo<hi) {
+        mid=lo+(hi-lo)/2;
+        if(cmp_key(&r->index[mid], &key)<0)
+            lo=mid+1;
+        else
+            hi=mid;
+    }
+    if(lo==r->n || cmp_key(&r->index[lo], &key)!=0)
+        return NULL;
+    e=&r->index[lo];
+    *len=e->length;
+    return r->data+e->offset;
+}
+
+/* Returns the deck of index entry i */
+const char *qfh_archive_deck(const qfh_archive_reader *r, long i, size_t *len)
+{
+    *len=r->index[i].length;
+    return r->data+r->index[i].offset;
+}
+
+void qfh_archive_unmap(qfh_archive_reader *r)
+{
+    if(r->data)
+        munmap((void*)r->data, r->size);
+    free(r->own);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,515 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Result cache: solved designs kept on disk, addressed by a hash of
+ * everything that went into them.
+ *
+ * The key (qfh_cache_key_make) is a canonical byte string of the
+ * design_req, the segmentation, the build and solver flags, the
+ * frequency sweep and the generator version; -0 is written as 0 and
+ * every NaN the same way, so equal designs give equal keys. Its 64 bit
+ * FNV-1a hash addresses the entry, and the full key stored with the
+ * entry is compared on every hit.
+ *
+ * A cache is a directory of two files, host byte order:
+ *   data   "QFHD", uint32 version, then records: "QFHE", uint32 wires,
+ *          uint32 results, uint32 0, double solve seconds, the key,
+ *          the wire table columns (x1 y1 z1 x2 y2 z2 radius as doubles,
+ *          segs and tag as int32, padded to 8) and per result freq,
+ *          R, X, SWR, gain and axial ratio as doubles
+ *   index  "QFHI", uint32 version, uint64 slots, uint64 entries,
+ *          uint64 end of the data, then an open addressing table of
+ *          (hash, record offset) slots, offset 0 when empty
+ * The index is mapped shared and written in place, so a lookup is a
+ * few probes and one key comparison in mapped memory. Records are only
+ * appended, and a record is in the index only once it is complete. The
+ * index is marked dirty while it is rehashed into a larger table; a
+ * dirty or missing index is rebuilt by scanning the data. One process
+ * at a time has a cache open, the others wait for its lock.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<math.h>
+#include<errno.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/file.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include "qfh.h"
+
+#define CACHE_VERSION 1
+#define DATA_HEADER 8
+#define MIN_SLOTS 1024
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t slots;
+    uint64_t count;
+    uint64_t end;
+} cache_header;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;
+} cache_slot;
+
+typedef struct {
+    char magic[4];
+    uint32_t nwires;
+    uint32_t nres;
+    uint32_t zero;
+    double seconds;
+    unsigned char key[QFH_CACHE_KEY];
+} cache_record;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void key_bytes(qfh_cache_key *k, size_t *pos, const void *p,
+                      size_t len)
+{
+    if(*pos+len<=QFH_CACHE_KEY)
+        memcpy(k->b+*pos, p, len);
+    *pos+=len;
+}
+
+static void key_double(qfh_cache_key *k, size_t *pos, double v)
+{
+    if(v==0)
+        v=0;
+    else if(isnan(v))
+        v=NAN;
+    key_bytes(k, pos, &v, sizeof(v));
+}
+
+static void key_int(qfh_cache_key *k, size_t *pos, int v)
+{
+    int32_t i=v;
+
+    key_bytes(k, pos, &i, sizeof(i));
+}
+
+/* FNV-1a of the key bytes, 0 marks an empty slot */
+static void key_hash(qfh_cache_key *k)
+{
+    size_t i;
+
+    k->hash=0xcbf29ce484222325ULL;
+    for(i=0;i<sizeof(k->b);i++)
+        k->hash=(k->hash^k->b[i])*0x100000001b3ULL;
+    if(k->hash==0)
+        k->hash=1;
+}
+
+/* Builds the key of design req built with the segmentation and flags
+ * of ctx, into the model m (for its sweep) and solved with solver flags
+ * flags */
+void qfh_cache_key_make(qfh_cache_key *k, const design_req *req,
+                        const qfh_ctx *ctx, const qfh_model *m, int flags)
+{
+    char version[8]={0};
+    size_t pos=0;
+
+    memset(k->b, 0, sizeof(k->b));
+    strncat(version, QFH_VERSION, sizeof(version)-1);
+    key_bytes(k, &pos, version, sizeof(version));
+    key_int(k, &pos, CACHE_VERSION);
+    key_double(k, &pos, req->freq);
+    key_double(k, &pos, req->turns);
+    key_double(k, &pos, req->length);
+    key_double(k, &pos, req->radius);
+    key_double(k, &pos, req->diam);
+    key_double(k, &pos, req->ratio);
+    key_int(k, &pos, ctx->seg.radial);
+    key_int(k, &pos, ctx->seg.corner);
+    key_int(k, &pos, ctx->seg.helix);
+    key_double(k, &pos, ctx->seg.epsilon);
+    key_int(k, &pos, ctx->compact);
+    key_int(k, &pos, ctx->symmetric);
+    key_int(k, &pos, ctx->libm_trig);
+    key_double(k, &pos, m->fstart);
+    key_double(k, &pos, m->fstep);
+    key_int(k, &pos, qfh_nfreq(m));
+    key_int(k, &pos, flags);
+    key_hash(k);
+}
+
+static size_t record_size(uint32_t nwires, uint32_t nres)
+{
+    return sizeof(cache_record)+nwires*7*sizeof(double)+
+        ((nwires*2*sizeof(int32_t)+7)&~(size_t)7)+nres*6*sizeof(double);
+}
+
+static cache_header *header(qfh_cache *c)
+{
+    return (cache_header*)c->index;
+}
+
+static cache_slot *slots(qfh_cache *c)
+{
+    return (cache_slot*)(c->index+sizeof(cache_header));
+}
+
+/* Maps the data file up to the end of the data */
+static int map_data(qfh_cache *c)
+{
+    if(c->dmap>=c->end)
+        return 0;
+    if(c->data)
+        munmap((void*)c->data, c->dmap);
+    c->data=(const char*)mmap(NULL, c->end, PROT_READ, MAP_SHARED, c->dfd, 0);
+    if(c->data==MAP_FAILED) {
+        c->data=NULL;
+        c->dmap=0;
+        return 1;
+    }
+    c->dmap=c->end;
+    return 0;
+}
+
+/* Record at offset if it is complete and well formed */
+static const cache_record *record_at(qfh_cache *c, uint64_t offset)
+{
+    const cache_record *r;
+
+    if(offset<DATA_HEADER || offset+sizeof(cache_record)>c->end ||
+       map_data(c))
+        return NULL;
+    r=(const cache_record*)(c->data+offset);
+    if(memcmp(r->magic, "QFHE", 4) ||
+       offset+record_size(r->nwires, r->nres)>c->end)
+        return NULL;
+    return r;
+}
+
+static void insert_slot(qfh_cache *c, uint64_t hash, uint64_t offset)
+{
+    cache_slot *s=slots(c);
+    uint64_t mask=header(c)->slots-1, i=hash&mask;
+
+    while(s[i].offset && s[i].hash!=hash)
+        i=(i+1)&mask;
+    if(s[i].offset) {
+        // the same hash: a newer record of that key, or a collision
+        // that is left unreachable
+        s[i].offset=offset;
+        return;
+    }
+    s[i].hash=hash;
+    s[i].offset=offset;
+    header(c)->count++;
+}
+
+/* Maps an index of nslots empty slots */
+static int map_index(qfh_cache *c, uint64_t nslots)
+{
+    size_t size=sizeof(cache_header)+nslots*sizeof(cache_slot);
+    cache_header *h;
+
+    if(c->index)
+        munmap(c->index, c->isize);
+    c->index=NULL;
+    if(ftruncate(c->ifd, 0) || ftruncate(c->ifd, size))
+        return 1;
+    c->index=(unsigned char*)mmap(NULL, size, PROT_READ|PROT_WRITE,
+                                  MAP_SHARED, c->ifd, 0);
+    if(c->index==MAP_FAILED) {
+        c->index=NULL;
+        return 1;
+    }
+    c->isize=size;
+    h=header(c);
+    memcpy(h->magic, "QFHX", 4); // dirty until filled
+    h->version=CACHE_VERSION;
+    h->slots=nslots;
+    h->count=0;
+    h->end=c->end;
+    return 0;
+}
+
+/* Rebuilds the index by scanning the data records */
+static int rebuild_index(qfh_cache *c, uint64_t size)
+{
+    cache_record r;
+    qfh_cache_key k;
+    uint64_t off=DATA_HEADER, n=0, nslots=MIN_SLOTS;
+
+    c->end=DATA_HEADER;
+    while(off+sizeof(r)<=size &&
+          pread(c->dfd, &r, sizeof(r), off)==(ssize_t)sizeof(r) &&
+          memcmp(r.magic, "QFHE", 4)==0 &&
+          off+record_size(r.nwires, r.nres)<=size) {
+        off+=record_size(r.nwires, r.nres);
+        n++;
+    }
+    c->end=off;
+    while(nslots<2*n)
+        nslots*=2;
+    if(map_index(c, nslots))
+        return 1;
+    for(off=DATA_HEADER;off<c->end;off+=record_size(r.nwires, r.nres)) {
+        if(pread(c->dfd, &r, sizeof(r), off)!=(ssize_t)sizeof(r))
+            return 1;
+        memcpy(k.b, r.key, sizeof(k.b));
+        key_hash(&k);
+        insert_slot(c, k.hash, off);
+    }
+    header(c)->end=c->end;
+    memcpy(header(c)->magic, "QFHI", 4);
+    return 0;
+}
+
+/* Doubles the index when it is half full */
+static int grow_index(qfh_cache *c)
+{
+    cache_slot *old;
+    uint64_t n=header(c)->slots, i;
+
+    if(2*(header(c)->count+1)<=n)
+        return 0;
+    if((old=(cache_slot*)malloc(n*sizeof(cache_slot)))==NULL)
+        return 1;
+    memcpy(old, slots(c), n*sizeof(cache_slot));
+    if(map_index(c, 2*n)) {
+        free(old);
+        return 1;
+    }
+    for(i=0;i<n;i++)
+        if(old[i].offset)
+            insert_slot(c, old[i].hash, old[i].offset);
+    free(old);
+    memcpy(header(c)->magic, "QFHI", 4);
+    return 0;
+}
+
+/* Opens or creates the cache in directory dir. Returns 0 on success. */
+int qfh_cache_open(qfh_cache *c, const char *dir)
+{
+    char path[4096];
+    struct stat st;
+    cache_header h;
+    char magic[DATA_HEADER];
+    uint32_t version=CACHE_VERSION;
+    int ok;
+
+    memset(c, 0, sizeof(*c));
+    c->ifd=c->dfd=-1;
+    if(mkdir(dir, 0777) && errno!=EEXIST)
+        return 1;
+    snprintf(path, sizeof(path), "%s/data", dir);
+    if((c->dfd=open(path, O_RDWR|O_CREAT, 0666))<0)
+        return 1;
+    snprintf(path, sizeof(path), "%s/index", dir);
+    if(flock(c->dfd, LOCK_EX) || (c->ifd=open(path, O_RDWR|O_CREAT, 0666))<0 ||
+       fstat(c->dfd, &st)) {
+        qfh_cache_close(c);
+        return 1;
+    }
+    if(st.st_size<DATA_HEADER) {
+        memcpy(magic, "QFHD", 4);
+        memcpy(magic+4, &version, 4);
+        if(ftruncate(c->dfd, 0) ||
+           pwrite(c->dfd, magic, DATA_HEADER, 0)!=DATA_HEADER) {
+            qfh_cache_close(c);
+            return 1;
+        }
+        st.st_size=DATA_HEADER;
+    } else if(pread(c->dfd, magic, DATA_HEADER, 0)!=DATA_HEADER ||
+              memcmp(magic, "QFHD", 4) || memcmp(magic+4, &version, 4)) {
+        qfh_cache_close(c);
+        return 1;
+    }
+    ok=pread(c->ifd, &h, sizeof(h), 0)==(ssize_t)sizeof(h) &&
+        memcmp(h.magic, "QFHI", 4)==0 && h.version==CACHE_VERSION &&
+        h.slots>=MIN_SLOTS && (h.slots&(h.slots-1))==0 &&
+        h.end>=DATA_HEADER && h.end<=(uint64_t)st.st_size;
+    if(ok) {
+        c->isize=sizeof(cache_header)+h.slots*sizeof(cache_slot);
+        c->index=(unsigned char*)mmap(NULL, c->isize, PROT_READ|PROT_WRITE,
+                                      MAP_SHARED, c->ifd, 0);
+        if(c->index==MAP_FAILED) {
+            c->index=NULL;
+            ok=0;
+        }
+        c->end=h.end;
+    }
+    if(!ok && rebuild_index(c, st.st_size)) {
+        qfh_cache_close(c);
+        return 1;
+    }
+    // drop a record the last writer did not finish
+    if((uint64_t)st.st_size>c->end && ftruncate(c->dfd, c->end)) {
+        qfh_cache_close(c);
+        return 1;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    c->locked=1;
+    return 0;
+}
+
+/* Looks the key up. On a hit the results are copied to res (at most
+ * maxres of them) and the wires appended to g unless it is NULL, and
+ * the number of results is returned; -1 on a miss. */
+int qfh_cache_get(qfh_cache *c, const qfh_cache_key *k, qfh_result *res,
+                  int maxres, qfh_geom *g)
+{
+    const cache_record *r=NULL;
+    const double *d;
+    const int32_t *seg, *tag;
+    cache_slot *s;
+    double t0=now();
+    uint64_t mask, i;
+    int n=-1;
+    uint32_t w;
+
+    pthread_mutex_lock(&c->lock);
+    s=slots(c);
+    mask=header(c)->slots-1;
+    for(i=k->hash&mask;s[i].offset;i=(i+1)&mask)
+        if(s[i].hash==k->hash) {
+            r=record_at(c, s[i].offset);
+            if(r && memcmp(r->key, k->b, sizeof(k->b)))
+                r=NULL;
+            break;
+        }
+    if(r && g && qfh_geom_reserve(g, g->n+r->nwires))
+        r=NULL;
+    if(r) {
+        n=(int)r->nres;
+        d=(const double*)(r+1);
+        seg=(const int32_t*)(d+7*r->nwires);
+        tag=seg+r->nwires;
+        for(w=0;g && w<r->nwires;w++)
+            qfh_geom_add(g, tag[w], seg[w], d[w], d[r->nwires+w],
+                         d[2*r->nwires+w], d[3*r->nwires+w],
+                         d[4*r->nwires+w], d[5*r->nwires+w],
+                         d[6*r->nwires+w]);
+        d=(const double*)((const char*)r+record_size(r->nwires, r->nres))-
+            6*r->nres;
+        for(i=0;i<r->nres && (int)i<maxres;i++,d+=6) {
+            res[i].freq=d[0];
+            res[i].z=d[1]+I*d[2];
+            res[i].swr=d[3];
+            res[i].gain=d[4];
+            res[i].axial=d[5];
+        }
+        c->stats.hits++;
+        c->stats.saved+=r->seconds;
+    } else
+        c->stats.misses++;
+    c->stats.lookup+=now()-t0;
+    pthread_mutex_unlock(&c->lock);
+    return n;
+}
+
+/* Stores the wires of g and nres results under the key, with the
+ * seconds it took to compute them. Returns 0 on success. */
+int qfh_cache_put(qfh_cache *c, const qfh_cache_key *k, const qfh_geom *g,
+                  const qfh_result *res, int nres, double seconds)
+{
+    cache_record r;
+    size_t size=record_size(g->n, nres), pos=0;
+    char *buf;
+    double *d;
+    int32_t *i32;
+    int i, err=0;
+
+    if((buf=(char*)calloc(1, size))==NULL)
+        return 1;
+    memcpy(r.magic, "QFHE", 4);
+    r.nwires=g->n;
+    r.nres=nres;
+    r.zero=0;
+    r.seconds=seconds;
+    memcpy(r.key, k->b, sizeof(r.key));
+    memcpy(buf, &r, sizeof(r));
+    pos=sizeof(r);
+    d=(double*)(buf+pos);
+    memcpy(d, g->x1, g->n*sizeof(double));
+    memcpy(d+g->n, g->y1, g->n*sizeof(double));
+    memcpy(d+2*g->n, g->z1, g->n*sizeof(double));
+    memcpy(d+3*g->n, g->x2, g->n*sizeof(double));
+    memcpy(d+4*g->n, g->y2, g->n*sizeof(double));
+    memcpy(d+5*g->n, g->z2, g->n*sizeof(double));
+    memcpy(d+6*g->n, g->radius, g->n*sizeof(double));
+    i32=(int32_t*)(d+7*g->n);
+    for(i=0;i<g->n;i++) {
+        i32[i]=g->segs[i];
+        i32[g->n+i]=g->tag[i];
+    }
+    d=(double*)(buf+size)-6*nres;
+    for(i=0;i<nres;i++,d+=6) {
+        d[0]=res[i].freq;
+        d[1]=creal(res[i].z);
+        d[2]=cimag(res[i].z);
+        d[3]=res[i].swr;
+        d[4]=res[i].gain;
+        d[5]=res[i].axial;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if(pwrite(c->dfd, buf, size, c->end)!=(ssize_t)size || grow_index(c))
+        err=1;
+    else {
+        insert_slot(c, k->hash, c->end);
+        c->end+=size;
+        header(c)->end=c->end;
+        c->stats.stores++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    free(buf);
+    return err;
+}
+
+/* Number of entries in the cache */
+long qfh_cache_entries(qfh_cache *c)
+{
+    long n;
+
+    pthread_mutex_lock(&c->lock);
+    n=(long)header(c)->count;
+    pthread_mutex_unlock(&c->lock);
+    return n;
+}
+
+void qfh_cache_close(qfh_cache *c)
+{
+    if(c->data)
+        munmap((void*)c->data, c->dmap);
+    if(c->index)
+        munmap(c->index, c->isize);
+    if(c->ifd>=0)
+        close(c->ifd);
+    if(c->dfd>=0)
+        close(c->dfd); // drops the lock
+    if(c->locked)
+        pthread_mutex_destroy(&c->lock);
+    c->data=NULL;
+    c->index=NULL;
+    c->ifd=c->dfd=-1;
+    c->locked=0;
+}
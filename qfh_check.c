@@ -0,0 +1,688 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Geometry validation.
+ *
+ * qfh_build_helix() takes its parameters as they come, so a bend radius
+ * over half the diameter or a wire thicker than the gap between two
+ * helices only shows up as a failed or meaningless solve. The checks
+ * here run on the built wires before a deck is written or solved.
+ *
+ * Every segment is checked against the NEC2 thin wire rules: longer
+ * than twice its radius, shorter than a tenth of the wavelength at the
+ * highest frequency, and with 2 pi a / lambda well below 1. Pairs of
+ * segments that are not connected (neither directly nor through a
+ * third segment, as around a short feed wire) must keep their surfaces
+ * apart, and should keep their axes further apart than twice the sum of
+ * their radii.
+ *
+ * The pairs are found on a uniform grid: cells CELL_SIZE times the mean
+ * box of a segment with its margin, so a typical segment covers one or
+ * two cells and a cell holds a few segments (the cells grow if some
+ * segments are far longer than the rest). Every cell a segment covers
+ * is a 64 bit entry packing the cell, the segment and which axes the
+ * cell is the first on; a radix sort brings the entries of a cell
+ * together, and a pair is only measured in the first cell its two boxes
+ * share, so the whole check takes time linear in the number of segments
+ * for geometry spread out in space.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<float.h>
+#include<time.h>
+#include "qfh.h"
+
+#define C0 299792458.0
+#define NEAR 2 // axes closer than NEAR times the sum of the radii are near
+#define MIN_RATIO 2 // segment length over radius
+#define MAX_LENGTH 0.1 // segment length in wavelengths
+#define MAX_THICK 0.2 // 2 pi a / lambda
+#define JOIN 1e-3 // wire ends closer than this times the shorter segment meet
+#define CELL_SIZE 3 // grid cell over the mean segment box
+#define MAX_CELLS 32 // grid entries per segment on average
+#define SORT_BITS 11 // digit of sort_entries()
+
+static const char *const check_names[QFH_NCHECK]={
+    "wires touch", "empty segment", "wires close",
+    "segment shorter than 2 radii", "segment longer than 0.1 wavelength",
+    "wire too thick for the wavelength"
+};
+
+/* The segments of the wires of g, numbered as qfh_mesh_build() numbers
+ * them: segment s is segment s-first[wire[s]] of wire wire[s], which is
+ * length[wire[s]] long */
+typedef struct {
+    const qfh_geom *g;
+    int nseg;
+    int *wire;
+    int *first;
+    double *length;
+} check_segs;
+
+/* Ends of the segments joined into nodes: end e of segment s is at node
+ * node[2*s+e], and the segment ends at node x are list[start[x]..
+ * start[x+1]-1]. Only the node numbers that are roots are used. */
+typedef struct {
+    int *node;
+    int *start;
+    int *list;
+} check_nodes;
+
+/* Unconnected looking segments s<t whose axes are d apart, kept until
+ * the nodes are known */
+typedef struct {
+    int s, t;
+    double d;
+} near_pair;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* Checks that the loops of a helix can be built: positive sizes, and
+ * bends that fit in the height and diameter of their loop. Returns 0 if
+ * so, 1 with the reason in msg otherwise. */
+int qfh_check_helix(const helix *h, char *msg, size_t len)
+{
+    int k;
+
+    if(!(h[0].wire>0)) {
+        snprintf(msg,len,"Wire diameter %f is not positive",h[0].wire);
+        return 1;
+    }
+    if(!(fabs(h[0].turns)>0)) {
+        snprintf(msg,len,"Number of turns %f is not positive",h[0].turns);
+        return 1;
+    }
+    for(k=0;k<2;k++) {
+        if(!(h[k].H>0) || !(h[k].D>0)) {
+            snprintf(msg,len,"Loop %d is %f high and %f wide",k+1,h[k].H,
+                     h[k].D);
+            return 1;
+        }
+        if(!(h[k].R>=0) || 2*h[k].R>=h[k].D || 2*h[k].R>=h[k].H) {
+            snprintf(msg,len,"Bend radius %f does not fit in loop %d, "
+                     "%f high and %f wide",h[k].R,k+1,h[k].H,h[k].D);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Start p and unit direction d of the axis of segment s, computed as
+ * qfh_mesh_build() does. Returns its length. */
+static double segment_axis(const check_segs *cs, int s, double *p, double *d)
+{
+    const qfh_geom *g=cs->g;
+    int w=cs->wire[s], i=s-cs->first[w];
+    double px[3], l=cs->length[w];
+
+    px[0]=g->x2[w]-g->x1[w];
+    px[1]=g->y2[w]-g->y1[w];
+    px[2]=g->z2[w]-g->z1[w];
+    p[0]=g->x1[w]+px[0]*i/g->segs[w];
+    p[1]=g->y1[w]+px[1]*i/g->segs[w];
+    p[2]=g->z1[w]+px[2]*i/g->segs[w];
+    d[0]=l>0 ? px[0]/l : 0;
+    d[1]=l>0 ? px[1]/l : 0;
+    d[2]=l>0 ? px[2]/l : 1;
+    return l/g->segs[w];
+}
+
+/* Wire tag of segment s and its number in the tag, counted over the
+ * wires of the tag as NEC does (a compact build expands a card into
+ * wires that follow each other) */
+static void segment_name(const check_segs *cs, int s, int *tag, int *seg)
+{
+    const qfh_geom *g=cs->g;
+    int w=cs->wire[s];
+
+    *tag=g->tag[w];
+    *seg=s-cs->first[w]+1;
+    while(w>0 && g->tag[w-1]==*tag)
+        *seg+=g->segs[--w];
+}
+
+static int cmp_issue(const void *a, const void *b)
+{
+    const qfh_check_issue *x=(const qfh_check_issue*)a;
+    const qfh_check_issue *y=(const qfh_check_issue*)b;
+    int k;
+
+    if(x->kind!=y->kind)
+        return x->kind-y->kind;
+    for(k=0;k<2;k++) {
+        if(x->tag[k]!=y->tag[k])
+            return x->tag[k]-y->tag[k];
+        if(x->seg[k]!=y->seg[k])
+            return x->seg[k]-y->seg[k];
+    }
+    return 0;
+}
+
+/* Counts a problem with segment s (and t unless it is negative) and
+ * lists it if it comes before the last of a full list, so that the list
+ * holds the first problems in the order of cmp_issue(), errors first,
+ * whatever order they were found in */
+static void add_issue(qfh_check_result *r, const check_segs *cs, int kind,
+                      int s, int t, double value)
+{
+    qfh_check_issue is, *last;
+    int i;
+
+    r->count[kind]++;
+    if(kind<QFH_CHECK_ERRORS)
+        r->errors++;
+    else
+        r->warnings++;
+    is.kind=kind;
+    is.value=value;
+    segment_name(cs, s, &is.tag[0], &is.seg[0]);
+    is.tag[1]=is.seg[1]=0;
+    if(t>=0)
+        segment_name(cs, t, &is.tag[1], &is.seg[1]);
+    if(r->nissue<QFH_CHECK_KEEP) {
+        r->issue[r->nissue++]=is;
+        return;
+    }
+    for(last=r->issue,i=1;i<QFH_CHECK_KEEP;i++)
+        if(cmp_issue(&r->issue[i], last)>0)
+            last=&r->issue[i];
+    if(cmp_issue(&is, last)<0)
+        *last=is;
+}
+
+static int node_root(int *node, int x)
+{
+    while(node[x]!=x)
+        x=node[x]=node[node[x]];
+    return x;
+}
+
+/* Joins the ends x and y into one node */
+static void join(int *node, int x, int y)
+{
+    x=node_root(node, x);
+    y=node_root(node, y);
+    if(x!=y)
+        node[x>y ? x : y]=x<y ? x : y;
+}
+
+/* Lists the segment ends at each node once all are joined. Returns 0 on
+ * success, 1 if out of memory. */
+static int nodes_list(check_nodes *nd, int nseg)
+{
+    int n=2*nseg, x;
+
+    nd->start=(int*)calloc((size_t)n+1, sizeof(int));
+    nd->list=(int*)malloc((size_t)n*sizeof(int));
+    if(nd->start==NULL || nd->list==NULL)
+        return 1;
+    for(x=0;x<n;x++)
+        nd->start[(nd->node[x]=node_root(nd->node, x))+1]++;
+    for(x=0;x<n;x++)
+        nd->start[x+1]+=nd->start[x];
+    for(x=0;x<n;x++)
+        nd->list[nd->start[nd->node[x]]++]=x;
+    for(x=n;x>0;x--)
+        nd->start[x]=nd->start[x-1];
+    nd->start[0]=0;
+    return 0;
+}
+
+/* Whether segments s and t share a node or are both joined to a third */
+static int linked(const check_nodes *nd, int s, int t)
+{
+    const int *ns=&nd->node[2*s], *nt=&nd->node[2*t];
+    int e, i, u;
+
+    for(e=0;e<2;e++) {
+        if(ns[e]==nt[0] || ns[e]==nt[1])
+            return 1;
+        for(i=nd->start[ns[e]];i<nd->start[ns[e]+1];i++) {
+            // the other end of a segment at this node
+            u=nd->node[nd->list[i]^1];
+            if(u==nt[0] || u==nt[1])
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Distance between the axes of segments s and t, from the closest
+ * points of the two line segments */
+static double axis_distance(const check_segs *cs, int s, int t)
+{
+    double ps[3], pt[3], ds[3], dt[3], r[3], ls, lt, b, c, f, u, v, d;
+    int k;
+
+    ls=segment_axis(cs, s, ps, ds);
+    lt=segment_axis(cs, t, pt, dt);
+    for(k=0;k<3;k++)
+        r[k]=ps[k]-pt[k];
+    // u along s and v along t, both in metres, with unit directions
+    b=ds[0]*dt[0]+ds[1]*dt[1]+ds[2]*dt[2];
+    c=ds[0]*r[0]+ds[1]*r[1]+ds[2]*r[2];
+    f=dt[0]*r[0]+dt[1]*r[1]+dt[2]*r[2];
+    d=1-b*b;
+    u=d>1e-12 ? (b*f-c)/d : 0;
+    u=fmin(fmax(u, 0), ls);
+    v=b*u+f;
+    if(v<0) {
+        v=0;
+        u=fmin(fmax(-c, 0), ls);
+    } else if(v>lt) {
+        v=lt;
+        u=fmin(fmax(b*lt-c, 0), ls);
+    }
+    for(k=0;k<3;k++)
+        r[k]+=u*ds[k]-v*dt[k];
+    return sqrt(r[0]*r[0]+r[1]*r[1]+r[2]*r[2]);
+}
+
+/* Boxes of the segments of wire w with their margins at box+6*s (lower
+ * corner) and box+6*s+3 (upper), in floats rounded outwards: the boxes
+ * of near pairs overlap, and so do those of wire ends close enough to
+ * be joined, with JOIN times the segment to spare for the rounding of
+ * the corners */
+static void wire_boxes(const check_segs *cs, int w, float *box)
+{
+    const qfh_geom *g=cs->g;
+    const double p1[3]={g->x1[w], g->y1[w], g->z1[w]};
+    const double p2[3]={g->x2[w], g->y2[w], g->z2[w]};
+    double step[3], m=NEAR*g->radius[w]+JOIN*cs->length[w]/g->segs[w];
+    double a, b, l, h;
+    float *lo, *hi;
+    int i, k;
+
+    for(k=0;k<3;k++)
+        step[k]=(p2[k]-p1[k])/g->segs[w];
+    for(i=0;i<g->segs[w];i++) {
+        lo=box+6*(cs->first[w]+i);
+        hi=lo+3;
+        for(k=0;k<3;k++) {
+            a=p1[k]+step[k]*i;
+            b=a+step[k];
+            l=(a<b ? a : b)-m;
+            h=(a<b ? b : a)+m;
+            // a float is within 2^-24 of the double, relatively
+            lo[k]=(float)(l-fabs(l)*0x1p-23)-FLT_MIN;
+            hi[k]=(float)(h+fabs(h)*0x1p-23)+FLT_MIN;
+        }
+    }
+}
+
+/* Whether end e of segment s is an end of its wire */
+static int wire_end(const check_segs *cs, int s, int e)
+{
+    if(e)
+        return s==cs->nseg-1 || cs->wire[s+1]!=cs->wire[s];
+    return s==0 || cs->wire[s-1]!=cs->wire[s];
+}
+
+/* Joins the wire ends of segments s and t that qfh_mesh_build() joins,
+ * those closer than JOIN times the shorter segment. Returns whether it
+ * joined any. */
+static int join_ends(const check_segs *cs, int *node, int s, int t)
+{
+    double ps[3], pt[3], ds[3], dt[3], p[3], q[3], ls, lt, d, tol;
+    int e, f, k, joined=0;
+
+    ls=segment_axis(cs, s, ps, ds);
+    lt=segment_axis(cs, t, pt, dt);
+    tol=JOIN*(ls<lt ? ls : lt);
+    for(e=0;e<2;e++) {
+        if(!wire_end(cs, s, e))
+            continue;
+        for(k=0;k<3;k++)
+            p[k]=ps[k]+(e ? ls : 0)*ds[k];
+        for(f=0;f<2;f++) {
+            if(!wire_end(cs, t, f))
+                continue;
+            for(d=0,k=0;k<3;k++) {
+                q[k]=pt[k]+(f ? lt : 0)*dt[k]-p[k];
+                d+=q[k]*q[k];
+            }
+            if(sqrt(d)<=tol) {
+                join(node, 2*s+e, 2*t+f);
+                joined=1;
+            }
+        }
+    }
+    return joined;
+}
+
+/* Cell of the grid starting at lo that the coordinate x>=lo falls in */
+static long cell_of(double x, double lo, double cell)
+{
+    return (long)((x-lo)/cell);
+}
+
+/* Number of grid entries of the boxes, and in bits[] the bits of the
+ * cell coordinates on each axis */
+static size_t grid_entries(const float *box, int nseg, const double *glo,
+                           const double *ghi, double cell, int *bits)
+{
+    size_t n=0, m;
+    int s, k;
+
+    for(k=0;k<3;k++)
+        for(bits[k]=0;cell_of(ghi[k], glo[k], cell)>>bits[k];bits[k]++)
+            ;
+    for(s=0;s<nseg;s++) {
+        for(m=1,k=0;k<3;k++)
+            m*=(size_t)(cell_of(box[6*s+3+k], glo[k], cell)-
+                        cell_of(box[6*s+k], glo[k], cell))+1;
+        n+=m;
+    }
+    return n;
+}
+
+/* Sorts the n entries by their bits from lo up to hi: a radix sort,
+ * stable so that the segments of a cell stay in order, skipping the
+ * digits all entries have in common. Returns 0 on success, 1 if out of
+ * memory. */
+static int sort_entries(uint64_t *e, size_t n, int lo, int hi)
+{
+    const int nb=1<<SORT_BITS, nd=(hi-lo+SORT_BITS-1)/SORT_BITS;
+    uint64_t *e1=e, *e2, *et;
+    size_t *count, *c, i, sum, t;
+    int d, shift;
+
+    if(n<2 || nd==0)
+        return 0;
+    e2=(uint64_t*)malloc(n*sizeof(uint64_t));
+    count=(size_t*)calloc((size_t)nd*nb, sizeof(size_t));
+    if(e2==NULL || count==NULL) {
+        free(e2);
+        free(count);
+        return 1;
+    }
+    for(i=0;i<n;i++)
+        for(d=0;d<nd;d++)
+            count[d*nb+(e[i]>>(lo+d*SORT_BITS)&(nb-1))]++;
+    for(d=0;d<nd;d++) {
+        c=count+d*nb;
+        shift=lo+d*SORT_BITS;
+        if(c[e1[0]>>shift&(nb-1)]==n)
+            continue;
+        for(sum=0,i=0;i<(size_t)nb;i++) {
+            t=c[i];
+            c[i]=sum;
+            sum+=t;
+        }
+        for(i=0;i<n;i++)
+            e2[c[e1[i]>>shift&(nb-1)]++]=e1[i];
+        et=e1;
+        e1=e2;
+        e2=et;
+    }
+    if(e1!=e) {
+        memcpy(e, e1, n*sizeof(uint64_t));
+        e2=e1;
+    }
+    free(e2);
+    free(count);
+    return 0;
+}
+
+/* Measures every pair of segments whose boxes overlap, found on the
+ * grid, joining the wire ends on the way. Returns 0 on success, 1 if
+ * out of memory. */
+static int check_pairs(const check_segs *cs, qfh_check_result *r)
+{
+    const qfh_geom *g=cs->g;
+    const int nseg=cs->nseg, *wire=cs->wire;
+    check_nodes nd={NULL, NULL, NULL};
+    near_pair *np=NULL, *p;
+    uint64_t *e=NULL, cellkey, segmask;
+    int bits[3], shift[3], nbits, segbits, s, t, k, w, err=1;
+    float *box, *lo, *hi, *lo2, *hi2;
+    double glo[3], ghi[3], cell=0, ext, d, ra;
+    size_t ne, n, i, j, run, nnear=0, capnear=0;
+    long c0[3], c1[3], x, y, z;
+    unsigned first;
+
+    if(nseg==0)
+        return 0;
+    if((box=(float*)malloc(6*(size_t)nseg*sizeof(float)))==NULL)
+        return 1;
+    for(k=0;k<3;k++) {
+        glo[k]=HUGE_VAL;
+        ghi[k]=-HUGE_VAL;
+    }
+    for(w=0;w<g->n;w++) {
+        wire_boxes(cs, w, box);
+        for(s=cs->first[w];s<cs->first[w]+g->segs[w];s++) {
+            lo=box+6*s;
+            hi=lo+3;
+            for(ext=0,k=0;k<3;k++) {
+                if(hi[k]-lo[k]>ext)
+                    ext=hi[k]-lo[k];
+                if(lo[k]<glo[k])
+                    glo[k]=lo[k];
+                if(hi[k]>ghi[k])
+                    ghi[k]=hi[k];
+            }
+            cell+=ext;
+        }
+    }
+    if(!(cell>0)) {
+        free(box);
+        return 0;
+    }
+    // an entry packs the cell coordinates, the segment and three bits
+    // telling on which axes the cell is the first of the segment into 64
+    // bits; cells CELL_SIZE times the mean box put most segments in one
+    // or two of them, and grow if the coordinates do not fit
+    for(segbits=0;(nseg-1)>>segbits;segbits++)
+        ;
+    segmask=((uint64_t)1<<segbits)-1;
+    cell=CELL_SIZE*cell/nseg;
+    while((ne=grid_entries(box, nseg, glo, ghi, cell, bits))>
+          MAX_CELLS*(size_t)nseg ||
+          (nbits=bits[0]+bits[1]+bits[2]+segbits+3)>64)
+        cell*=2;
+    // the axis with the most cells goes first, so that the cells are
+    // visited along the geometry and the segments mostly in order
+    for(k=0;k<3;k++)
+        for(shift[k]=0,w=0;w<3;w++)
+            if(bits[w]<bits[k] || (bits[w]==bits[k] && w>k))
+                shift[k]+=bits[w];
+    e=(uint64_t*)malloc(ne*sizeof(uint64_t));
+    nd.node=(int*)malloc(2*(size_t)nseg*sizeof(int));
+    if(e==NULL || nd.node==NULL)
+        goto done;
+    for(n=0,s=0;s<nseg;s++) {
+        lo=box+6*s;
+        hi=lo+3;
+        for(k=0;k<3;k++) {
+            c0[k]=cell_of(lo[k], glo[k], cell);
+            c1[k]=cell_of(hi[k], glo[k], cell);
+        }
+        for(x=c0[0];x<=c1[0];x++)
+            for(y=c0[1];y<=c1[1];y++)
+                for(z=c0[2];z<=c1[2];z++)
+                    e[n++]=(((uint64_t)x<<shift[0]|(uint64_t)y<<shift[1]|
+                             (uint64_t)z<<shift[2])<<segbits|(uint64_t)s)<<3|
+                           (x==c0[0])<<2|(y==c0[1])<<1|(z==c0[2]);
+    }
+    if(sort_entries(e, ne, segbits+3, nbits))
+        goto done;
+    // the joints inside the wires, those between wire ends below
+    for(s=0;s<nseg;s++) {
+        nd.node[2*s]=s>cs->first[wire[s]] ? 2*s-1 : 2*s;
+        nd.node[2*s+1]=2*s+1;
+    }
+    for(i=0;i<ne;i=run) {
+        cellkey=e[i]>>(segbits+3);
+        for(run=i+1;run<ne && e[run]>>(segbits+3)==cellkey;run++)
+            ;
+        for(;i+1<run;i++) {
+            s=(int)(e[i]>>3&segmask);
+            lo=box+6*s;
+            hi=lo+3;
+            for(j=i+1;j<run;j++) {
+                // only in the first cell both boxes cover, the first of
+                // one or the other on every axis
+                first=(unsigned)(e[i]|e[j])&7;
+                if(first!=7)
+                    continue;
+                // segments next to each other on a wire share a node,
+                // those two apart a segment, and the ends of a straight
+                // wire never meet
+                t=(int)(e[j]>>3&segmask);
+                if(wire[s]==wire[t] && t-s<=2)
+                    continue;
+                lo2=box+6*t;
+                hi2=lo2+3;
+                for(k=0;k<3 && lo2[k]<=hi[k] && lo[k]<=hi2[k];k++)
+                    ;
+                if(k<3)
+                    continue;
+                // nor are segments joined at a junction measured
+                if(join_ends(cs, nd.node, s, t))
+                    continue;
+                r->pairs++;
+                d=axis_distance(cs, s, t);
+                if(d>=NEAR*(g->radius[wire[s]]+g->radius[wire[t]]))
+                    continue;
+                if(nnear==capnear) {
+                    capnear=capnear ? 2*capnear : 64;
+                    if((p=(near_pair*)realloc(np, capnear*sizeof(*np)))==NULL)
+                        goto done;
+                    np=p;
+                }
+                np[nnear].s=s;
+                np[nnear].t=t;
+                np[nnear++].d=d;
+            }
+        }
+    }
+    if(nnear>0 && nodes_list(&nd, nseg))
+        goto done;
+    for(p=np;p<np+nnear;p++)
+        if(!linked(&nd, p->s, p->t)) {
+            ra=g->radius[wire[p->s]]+g->radius[wire[p->t]];
+            add_issue(r, cs, p->d<ra ? QFH_CHECK_TOUCH : QFH_CHECK_NEAR,
+                      p->s, p->t, p->d/ra);
+        }
+    err=0;
+done:
+    free(box);
+    free(e);
+    free(np);
+    free(nd.node);
+    free(nd.start);
+    free(nd.list);
+    return err;
+}
+
+/* Checks the wires of g for use up to fmax MHz (the wavelength rules
+ * are left out if it is not positive) and leaves what was found in r.
+ * Returns 0 on success, 1 if out of memory. */
+int qfh_check_geometry(const qfh_geom *g, double fmax, qfh_check_result *r)
+{
+    check_segs cs;
+    double lambda=fmax>0 ? C0/(fmax*1e6) : 0, t0=now(), px[3], len, a;
+    int s, w, err;
+
+    memset(r, 0, sizeof(*r));
+    cs.g=g;
+    for(cs.nseg=0,w=0;w<g->n;w++)
+        cs.nseg+=g->segs[w];
+    cs.wire=(int*)malloc((size_t)cs.nseg*sizeof(int));
+    cs.first=(int*)malloc((size_t)g->n*sizeof(int));
+    cs.length=(double*)malloc((size_t)g->n*sizeof(double));
+    if(cs.wire==NULL || cs.first==NULL || cs.length==NULL) {
+        free(cs.wire);
+        free(cs.first);
+        free(cs.length);
+        return 1;
+    }
+    for(s=0,w=0;w<g->n;w++)
+        for(cs.first[w]=s;s<cs.first[w]+g->segs[w];s++)
+            cs.wire[s]=w;
+    // the rules on single segments hold for all segments of a wire or
+    // for none
+    for(w=0;w<g->n;w++) {
+        px[0]=g->x2[w]-g->x1[w];
+        px[1]=g->y2[w]-g->y1[w];
+        px[2]=g->z2[w]-g->z1[w];
+        cs.length[w]=sqrt(px[0]*px[0]+px[1]*px[1]+px[2]*px[2]);
+        len=cs.length[w]/g->segs[w];
+        a=g->radius[w];
+        for(s=cs.first[w];s<cs.first[w]+g->segs[w];s++) {
+            if(!(len>0) || !(a>0)) {
+                add_issue(r, &cs, QFH_CHECK_EMPTY, s, -1, len);
+                continue;
+            }
+            if(len<MIN_RATIO*a)
+                add_issue(r, &cs, QFH_CHECK_STUB, s, -1, len/a);
+            if(lambda>0 && len>MAX_LENGTH*lambda)
+                add_issue(r, &cs, QFH_CHECK_LONG, s, -1, len/lambda);
+            if(lambda>0 && 2*pi*a>MAX_THICK*lambda)
+                add_issue(r, &cs, QFH_CHECK_THICK, s, -1, a/lambda);
+        }
+    }
+    err=check_pairs(&cs, r);
+    qsort(r->issue, r->nissue, sizeof(qfh_check_issue), cmp_issue);
+    free(cs.wire);
+    free(cs.first);
+    free(cs.length);
+    r->seconds=now()-t0;
+    return err;
+}
+
+/* Prints a summary of r and the problems listed in it to f */
+void qfh_check_print(const qfh_check_result *r, FILE *f)
+{
+    const qfh_check_issue *is;
+    int i;
+
+    fprintf(f, "Geometry check: %d errors, %d warnings, %ld pairs measured "
+            "in %.0f us\n", r->errors, r->warnings, r->pairs, r->seconds*1e6);
+    for(i=0;i<r->nissue;i++) {
+        is=&r->issue[i];
+        fprintf(f, "  %s: tag %d segment %d", check_names[is->kind],
+                is->tag[0], is->seg[0]);
+        switch(is->kind) {
+            case QFH_CHECK_TOUCH:
+            case QFH_CHECK_NEAR:
+                fprintf(f, " and tag %d segment %d, %.2f times their radii "
+                        "apart\n", is->tag[1], is->seg[1], is->value);
+                break;
+            case QFH_CHECK_STUB:
+                fprintf(f, ", %.2f radii long\n", is->value);
+                break;
+            case QFH_CHECK_LONG:
+            case QFH_CHECK_THICK:
+                fprintf(f, ", %.3f wavelengths\n", is->value);
+                break;
+            default:
+                fprintf(f, "\n");
+        }
+    }
+    if(r->errors+r->warnings>r->nissue)
+        fprintf(f, "  and %d more\n", r->errors+r->warnings-r->nissue);
+}
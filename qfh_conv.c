@@ -0,0 +1,188 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Segmentation convergence study.
+ *
+ * The same design is built at a ladder of segment densities, from
+ * qfh_adaptive_segmentation() at spw, spw*ratio, spw*ratio^2, ..., and
+ * with the default segmentation, and the feed point impedance of each is
+ * solved at one frequency. Rungs that come out with the segmentation of
+ * the rung below (the 30 degree limit on bends and helical wires can
+ * dominate at low densities) are dropped. The rungs are solved at the
+ * same time on a work stealing pool, one rung per task.
+ *
+ * The impedance Z(h) at segment length h is taken to approach its limit
+ * as Z + C h^p. The three finest rungs give p and Z (Richardson
+ * extrapolation, with h the inverse of the segment count), and the
+ * cheapest rung from which on all are within a relative tolerance of Z
+ * is recommended.
+ */
+
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include "qfh.h"
+
+#define ORDER_LO 0.25 // orders of convergence searched
+#define ORDER_HI 8
+
+typedef struct {
+    const qfh_conv_spec *spec;
+    qfh_conv_result *r;
+} conv_job;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* Rungs from 10 segments per wavelength up by half each time, eight
+ * of them, symmetric models, recommending the cheapest within 1% */
+void qfh_conv_init(qfh_conv_spec *s, const design_req *req)
+{
+    s->req=*req;
+    s->freq=req->freq;
+    s->spw=10;
+    s->ratio=1.5;
+    s->levels=8;
+    s->tol=0.01;
+    s->symmetric=1;
+}
+
+/* The model of the design solved at s->freq only */
+static void conv_model(const qfh_conv_spec *s, helix *h, qfh_model *m)
+{
+    qfh_design_model(&s->req, h, m);
+    m->fstart=m->fstop=s->freq;
+    m->fstep=1;
+}
+
+static void solve_level(void *arg, long task, int worker)
+{
+    conv_job *job=(conv_job*)arg;
+    qfh_conv_level *lv=task<job->r->nlevels ? &job->r->level[task] :
+        &job->r->dflt;
+    qfh_model m;
+    helix h[2];
+    qfh_result res;
+    qfh_ctx ctx;
+    double t0=now();
+
+    (void)worker;
+    memset(&m, 0, sizeof(m));
+    conv_model(job->spec, h, &m);
+    qfh_init(&ctx, &lv->seg, NULL, NULL);
+    ctx.symmetric=job->spec->symmetric;
+    lv->failed=qfh_build_model(&ctx, &m) || qfh_solve_model(&m, 1, 0, &res);
+    lv->segments=qfh_model_segments(&m);
+    lv->z=res.z;
+    lv->seconds=now()-t0;
+    qfh_model_free(&m);
+}
+
+/* (h2^p-h3^p)/(h1^p-h2^p) */
+static double step_ratio(const double *h, double p)
+{
+    return (pow(h[1], p)-pow(h[2], p))/(pow(h[0], p)-pow(h[1], p));
+}
+
+/* Order p for which the steps between the impedances of the three
+ * finest rungs shrink by q, by bisection: the ratio of the steps falls
+ * as p grows. Clamped to the orders searched. */
+static double conv_order(const double *h, double q)
+{
+    double lo=ORDER_LO, hi=ORDER_HI, p;
+    int i;
+
+    if(q>=step_ratio(h, lo))
+        return lo;
+    if(q<=step_ratio(h, hi))
+        return hi;
+    for(i=0;i<60;i++) {
+        p=(lo+hi)/2;
+        if(step_ratio(h, p)>q)
+            lo=p;
+        else
+            hi=p;
+    }
+    return (lo+hi)/2;
+}
+
+/* Builds the ladder of s, solves it on nthreads threads and leaves the
+ * rungs (coarsest first), the default segmentation, the extrapolated
+ * impedance and the recommended rung in r. Returns 0 on success, 1 if
+ * the spec is unusable, out of memory, a rung failed or fewer than
+ * three distinct rungs remain. */
+int qfh_conv_run(const qfh_conv_spec *s, int nthreads, qfh_conv_result *r)
+{
+    qfh_model m;
+    helix h[2];
+    qfh_pool pool;
+    conv_job job;
+    qfh_conv_level *lv;
+    double spw=s->spw, hs[3], t0=now();
+    double complex z1, z2, z3;
+    int i, n;
+
+    memset(r, 0, sizeof(*r));
+    r->best=-1;
+    if(s->levels<3 || s->levels>QFH_CONV_MAX || !(s->spw>0) ||
+       !(s->ratio>1) || !(s->freq>0) || qfh_check_design(&s->req, NULL, 0))
+        return 1;
+    memset(&m, 0, sizeof(m));
+    conv_model(s, h, &m);
+    for(i=0;i<s->levels;i++,spw*=s->ratio) {
+        lv=&r->level[r->nlevels];
+        lv->spw=spw;
+        lv->seg=qfh_default_segmentation;
+        qfh_adaptive_segmentation(&m, spw, &lv->seg);
+        if(r->nlevels>0 && !memcmp(&lv->seg, &lv[-1].seg, sizeof(lv->seg)))
+            continue;
+        r->nlevels++;
+    }
+    r->dflt.seg=qfh_default_segmentation;
+    if(r->nlevels<3 || qfh_pool_init(&pool, nthreads))
+        return 1;
+    job.spec=s;
+    job.r=r;
+    qfh_pool_run(&pool, r->nlevels+1, solve_level, &job);
+    qfh_pool_free(&pool);
+    r->seconds=now()-t0;
+    for(i=0;i<=r->nlevels;i++)
+        if(i<r->nlevels ? r->level[i].failed : r->dflt.failed)
+            return 1;
+
+    n=r->nlevels;
+    for(i=0;i<3;i++)
+        hs[i]=1.0/r->level[n-3+i].segments;
+    z1=r->level[n-3].z;
+    z2=r->level[n-2].z;
+    z3=r->level[n-1].z;
+    r->order=conv_order(hs, cabs(z2-z3)/cabs(z1-z2));
+    r->z=z3+(z3-z2)*pow(hs[2], r->order)/
+        (pow(hs[1], r->order)-pow(hs[2], r->order));
+    for(i=0;i<n;i++)
+        r->level[i].error=cabs(r->level[i].z-r->z)/cabs(r->z);
+    // the coarsest rung from which on all are within the tolerance
+    for(i=n-1;i>=0 && r->level[i].error<=s->tol;i--)
+        r->best=i;
+    r->dflt.error=cabs(r->dflt.z-r->z)/cabs(r->z);
+    return 0;
+}
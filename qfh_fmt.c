@@ -0,0 +1,183 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Card formatting without stdio. The NEC cards only ever need integers
+ * and "%.5E" numbers, so these are formatted by hand straight into a
+ * memory buffer, which is then handed to the sink in one piece.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include "qfh.h"
+
+/* Exact powers of ten, every one of them is representable in a double */
+static const double pow10tbl[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Writes v formatted exactly like printf("%.5E") to out, which must
+ * have room for 16 characters. Returns the number of characters,
+ * no terminating zero is written.
+ * The six significant digits come from a single correctly rounded
+ * scaling by an exact power of ten. The result is only trusted when it
+ * is clearly away from a rounding tie; ties, very large or very small
+ * magnitudes, infinities and NaN go through snprintf. */
+int qfh_fmt_e5(char *out, double v)
+{
+    char *p=out;
+    double a, m, frac;
+    long mi;
+    int e, k, i;
+    char tmp[32];
+
+    if(!isfinite(v))
+        goto slow;
+    if(signbit(v))
+        *p++='-';
+    a=fabs(v);
+    if(a==0) {
+        memcpy(p, "0.00000E+00", 11);
+        return p-out+11;
+    }
+    e=(int)floor(log10(a));
+    // log10 may be one off near powers of ten
+    for(i=0;i<3;i++) {
+        k=5-e;
+        if(k>22 || k<-22)
+            goto slow;
+        m=k>=0 ? a*pow10tbl[k] : a/pow10tbl[-k];
+        if(m<100000)
+            e--;
+        else if(m>=1000000)
+            e++;
+        else
+            break;
+    }
+    if(i==3)
+        goto slow;
+    mi=(long)m;
+    frac=m-mi;
+    if(fabs(frac-0.5)<1e-6)
+        goto slow;
+    if(frac>0.5)
+        mi++;
+    if(mi==1000000) {
+        mi=100000;
+        e++;
+    }
+
+    p[6]=(char)('0'+mi%10); mi/=10;
+    p[5]=(char)('0'+mi%10); mi/=10;
+    p[4]=(char)('0'+mi%10); mi/=10;
+    p[3]=(char)('0'+mi%10); mi/=10;
+    p[2]=(char)('0'+mi%10); mi/=10;
+    p[1]='.';
+    p[0]=(char)('0'+mi);
+    p[7]='E';
+    if(e<0) {
+        p[8]='-';
+        e=-e;
+    } else
+        p[8]='+';
+    if(e>=100) {
+        p[9]=(char)('0'+e/100);
+        p[10]=(char)('0'+e/10%10);
+        p[11]=(char)('0'+e%10);
+        return p-out+12;
+    }
+    p[9]=(char)('0'+e/10);
+    p[10]=(char)('0'+e%10);
+    return p-out+11;
+
+slow:
+    k=snprintf(tmp, sizeof(tmp), "%.5E", v);
+    memcpy(out, tmp, k);
+    return k;
+}
+
+/* Writes v in decimal to out, returns the number of characters */
+int qfh_fmt_int(char *out, int v)
+{
+    char tmp[12];
+    unsigned int u;
+    int n=0, len=0;
+
+    if(v<0) {
+        out[len++]='-';
+        u=0u-(unsigned int)v;
+    } else
+        u=(unsigned int)v;
+    do {
+        tmp[n++]=(char)('0'+u%10);
+        u/=10;
+    } while(u);
+    while(n)
+        out[len++]=tmp[--n];
+    return len;
+}
+
+/* Makes room for extra more bytes in b. Returns 0 on success. */
+int qfh_membuf_reserve(qfh_membuf *b, size_t extra)
+{
+    char *p;
+    size_t cap;
+
+    if(b->len+extra<=b->cap)
+        return 0;
+    cap=b->cap ? b->cap : 4096;
+    while(cap<b->len+extra)
+        cap*=2;
+    if((p=(char*)realloc(b->data, cap))==NULL)
+        return 1;
+    b->data=p;
+    b->cap=cap;
+    return 0;
+}
+
+/* The appenders below need room reserved beforehand: a card is at most
+ * 2 + 2*11 + 7*13 characters plus separators, well under QFH_CARDMAX. */
+
+void qfh_buf_str(qfh_membuf *b, const char *s)
+{
+    size_t n=strlen(s);
+
+    memcpy(b->data+b->len, s, n);
+    b->len+=n;
+}
+
+void qfh_buf_int(qfh_membuf *b, int v)
+{
+    b->len+=qfh_fmt_int(b->data+b->len, v);
+}
+
+void qfh_buf_e5(qfh_membuf *b, double v)
+{
+    b->len+=qfh_fmt_e5(b->data+b->len, v);
+}
+
+/* " %.5E" for each of the n values */
+void qfh_buf_e5list(qfh_membuf *b, const double *v, int n)
+{
+    int i;
+
+    for(i=0;i<n;i++) {
+        b->data[b->len++]=' ';
+        b->len+=qfh_fmt_e5(b->data+b->len, v[i]);
+    }
+}
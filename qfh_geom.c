@@ -0,0 +1,803 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * In-memory wire model and the output formats built on top of it.
+ * The geometry is built once per design by qfh_build_model() and can
+ * then be written any number of times, in any of the formats below.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<ctype.h>
+#include<math.h>
+#include "qfh.h"
+
+const qfh_emitter qfh_emitters[] = {
+    {"nec", "nec", qfh_emit_nec, 0, 0},
+    {"necgh", "gh.nec", qfh_emit_necgh, 1, 0},
+    {"necgr", "gr.nec", qfh_emit_necgh, 0, 1},
+    {"csv", "csv", qfh_emit_csv, 0, 0},
+    {"bin", "bin", qfh_emit_bin, 0, 0},
+    {NULL, NULL, NULL, 0, 0}
+};
+
+/* Makes room for nwires wires, keeping the ones already in g.
+ * Returns 0 on success. */
+int qfh_geom_reserve(qfh_geom *g, int nwires)
+{
+    qfh_geom ng;
+    char *p;
+
+    if(nwires<=g->cap)
+        return 0;
+    // doubles first so that every array stays aligned
+    if((p=(char*)malloc((size_t)nwires*(7*sizeof(double)+2*sizeof(int))))==NULL)
+        return 1;
+    ng.arena=p;
+    ng.x1=(double*)p;
+    ng.y1=ng.x1+nwires;
+    ng.z1=ng.y1+nwires;
+    ng.x2=ng.z1+nwires;
+    ng.y2=ng.x2+nwires;
+    ng.z2=ng.y2+nwires;
+    ng.radius=ng.z2+nwires;
+    ng.segs=(int*)(ng.radius+nwires);
+    ng.tag=ng.segs+nwires;
+    ng.n=g->n;
+    ng.cap=nwires;
+    if(g->n) {
+        memcpy(ng.x1, g->x1, g->n*sizeof(double));
+        memcpy(ng.y1, g->y1, g->n*sizeof(double));
+        memcpy(ng.z1, g->z1, g->n*sizeof(double));
+        memcpy(ng.x2, g->x2, g->n*sizeof(double));
+        memcpy(ng.y2, g->y2, g->n*sizeof(double));
+        memcpy(ng.z2, g->z2, g->n*sizeof(double));
+        memcpy(ng.radius, g->radius, g->n*sizeof(double));
+        memcpy(ng.segs, g->segs, g->n*sizeof(int));
+        memcpy(ng.tag, g->tag, g->n*sizeof(int));
+    }
+    free(g->arena);
+    *g=ng;
+    return 0;
+}
+
+/* Appends one wire, the caller has reserved room for it */
+void qfh_geom_add(qfh_geom *g, int tag, int segs,
+                  double x1, double y1, double z1,
+                  double x2, double y2, double z2, double radius)
+{
+    int i=g->n++;
+
+    g->x1[i]=x1;
+    g->y1[i]=y1;
+    g->z1[i]=z1;
+    g->x2[i]=x2;
+    g->y2[i]=y2;
+    g->z2[i]=z2;
+    g->radius[i]=radius;
+    g->segs[i]=segs;
+    g->tag[i]=tag;
+}
+
+void qfh_geom_free(qfh_geom *g)
+{
+    free(g->arena);
+    memset(g, 0, sizeof(*g));
+}
+
+/* Number of wires qfh_build_helix() produces for one loop */
+int qfh_helix_wires(const qfh_segmentation *seg)
+{
+    return 2 + 4*seg->corner + 2*seg->helix + 1;
+}
+
+/* Number of floating point fields of a geometry card, -1 if the card
+ * is not supported */
+int qfh_card_floats(const char *type)
+{
+    if(strcmp(type, "GW")==0 || strcmp(type, "GH")==0 ||
+       strcmp(type, "GM")==0)
+        return 7;
+    if(strcmp(type, "GA")==0)
+        return 4;
+    if(strcmp(type, "GR")==0)
+        return 0;
+    return -1;
+}
+
+/* Adds one straight segment of an arc or helix, growing g as needed */
+static int add_segment(qfh_geom *g, int tag, double x1, double y1,
+                       double z1, double x2, double y2, double z2,
+                       double radius)
+{
+    if(g->n==g->cap && qfh_geom_reserve(g, g->cap ? 2*g->cap : 64))
+        return 1;
+    qfh_geom_add(g, tag, 1, x1, y1, z1, x2, y2, z2, radius);
+    return 0;
+}
+
+/* Moves the wires from index first on by the rotation (ROX, ROY, ROZ in
+ * degrees, applied in that order) and translation of GM card c, or
+ * appends c->i2 transformed copies of them */
+static int move_wires(qfh_geom *g, const qfh_card *c, int first)
+{
+    double sps=sin(c->f[0]*pi/180), cps=cos(c->f[0]*pi/180);
+    double sth=sin(c->f[1]*pi/180), cth=cos(c->f[1]*pi/180);
+    double sph=sin(c->f[2]*pi/180), cph=cos(c->f[2]*pi/180);
+    double r[3][3] = {
+        {cph*cth, cph*sth*sps-sph*cps, cph*sth*cps+sph*sps},
+        {sph*cth, sph*sth*sps+cph*cps, sph*sth*cps-cph*sps},
+        {-sth, cth*sps, cth*cps}
+    };
+    double x, y, z;
+    int i, k, n=g->n-first, src, dst, copies=c->i2>0 ? c->i2 : 1;
+
+    if(c->i2>0 && qfh_geom_reserve(g, g->n+c->i2*n))
+        return 1;
+    for(k=0;k<copies;k++)
+        for(i=0;i<n;i++) {
+            src=first+k*n+i;
+            dst=c->i2>0 ? g->n : src;
+            x=g->x1[src]; y=g->y1[src]; z=g->z1[src];
+            g->x1[dst]=r[0][0]*x+r[0][1]*y+r[0][2]*z+c->f[3];
+            g->y1[dst]=r[1][0]*x+r[1][1]*y+r[1][2]*z+c->f[4];
+            g->z1[dst]=r[2][0]*x+r[2][1]*y+r[2][2]*z+c->f[5];
+            x=g->x2[src]; y=g->y2[src]; z=g->z2[src];
+            g->x2[dst]=r[0][0]*x+r[0][1]*y+r[0][2]*z+c->f[3];
+            g->y2[dst]=r[1][0]*x+r[1][1]*y+r[1][2]*z+c->f[4];
+            g->z2[dst]=r[2][0]*x+r[2][1]*y+r[2][2]*z+c->f[5];
+            g->radius[dst]=g->radius[src];
+            g->segs[dst]=g->segs[src];
+            g->tag[dst]=g->tag[src] ? g->tag[src]+c->i1 : 0;
+            if(dst==g->n)
+                g->n++;
+        }
+    return 0;
+}
+
+/* Expands a geometry card into g the way NEC2 does. GA and GH produce
+ * one wire per segment, all with the card's tag. GM moves or copies the
+ * wires from the first one tagged ITS (all of them if ITS is 0). GR
+ * makes NR-1 copies of the whole structure, each turned by 360/NR
+ * degrees about z from the one before.
+ * Returns 0 on success, 1 on an unsupported card or out of memory. */
+int qfh_geom_card(qfh_geom *g, const qfh_card *c)
+{
+    double a, da, xs1, zs1, xs2, zs2, z1, z2, ra, rb, s=c->f[0], hl;
+    int i, its, first;
+    qfh_card gm;
+
+    if(strcmp(c->type, "GW")==0) {
+        if(g->n==g->cap && qfh_geom_reserve(g, g->cap ? 2*g->cap : 64))
+            return 1;
+        qfh_geom_add(g, c->i1, c->i2, c->f[0], c->f[1], c->f[2],
+                     c->f[3], c->f[4], c->f[5], c->f[6]);
+        return 0;
+    }
+    if(strcmp(c->type, "GA")==0) {
+        // arc of radius RADA in the XZ plane from ANG1 to ANG2
+        if(c->i2<1)
+            return 1;
+        a=c->f[1]*pi/180;
+        da=(c->f[2]-c->f[1])*pi/180/c->i2;
+        xs1=c->f[0]*cos(a);
+        zs1=c->f[0]*sin(a);
+        for(i=0;i<c->i2;i++) {
+            a+=da;
+            xs2=c->f[0]*cos(a);
+            zs2=c->f[0]*sin(a);
+            if(add_segment(g, c->i1, xs1, 0, zs1, xs2, 0, zs2, c->f[3]))
+                return 1;
+            xs1=xs2;
+            zs1=zs2;
+        }
+        return 0;
+    }
+    if(strcmp(c->type, "GH")==0) {
+        // helix along +z from the x axis, S per turn, HL long
+        if(c->i2<1 || s==0)
+            return 1;
+        hl=fabs(c->f[1]);
+        for(i=0;i<c->i2;i++) {
+            z1=hl*i/c->i2;
+            z2=hl*(i+1)/c->i2;
+            ra=c->f[2]+(c->f[4]-c->f[2])*z1/hl;
+            rb=(c->f[3] ? c->f[3] : c->f[2])
+               +((c->f[5] ? c->f[5] : c->f[4])-(c->f[3] ? c->f[3] : c->f[2]))
+               *z1/hl;
+            xs1=ra*cos(2*pi*z1/s);
+            zs1=rb*sin(2*pi*z1/s);
+            ra=c->f[2]+(c->f[4]-c->f[2])*z2/hl;
+            rb=(c->f[3] ? c->f[3] : c->f[2])
+               +((c->f[5] ? c->f[5] : c->f[4])-(c->f[3] ? c->f[3] : c->f[2]))
+               *z2/hl;
+            xs2=ra*cos(2*pi*z2/s);
+            zs2=rb*sin(2*pi*z2/s);
+            if(c->f[1]<0 ?
+               add_segment(g, c->i1, zs1, xs1, z1, zs2, xs2, z2, c->f[6]) :
+               add_segment(g, c->i1, xs1, zs1, z1, xs2, zs2, z2, c->f[6]))
+                return 1;
+        }
+        return 0;
+    }
+    if(strcmp(c->type, "GM")==0) {
+        its=(int)(c->f[6]+0.5);
+        for(first=0;its>0 && first<g->n && g->tag[first]!=its;first++)
+            ;
+        return move_wires(g, c, first);
+    }
+    if(strcmp(c->type, "GR")==0) {
+        if(c->i2<1)
+            return 1;
+        memset(&gm, 0, sizeof(gm));
+        strcpy(gm.type, "GM");
+        gm.i1=c->i1;
+        gm.i2=c->i2-1;
+        gm.f[2]=360.0/c->i2;
+        return gm.i2>0 ? move_wires(g, &gm, 0) : 0;
+    }
+    return 1;
+}
+
+/* Builds g from the geometry cards of a NEC deck in memory, up to its
+ * GE card. Other cards are skipped. Returns 0 on success, 1 on a
+ * geometry card that cannot be expanded. */
+int qfh_read_geometry(const char *data, size_t len, qfh_geom *g)
+{
+    const char *p=data, *end=data+len, *eol;
+    char *q, field[32];
+    qfh_card c;
+    int k, nf;
+    size_t n;
+
+    g->n=0;
+    while(p<end) {
+        if((eol=memchr(p, '\n', end-p))==NULL)
+            eol=end;
+        if(eol-p>=2 && toupper((unsigned char)p[0])=='G') {
+            c.type[0]='G';
+            c.type[1]=(char)toupper((unsigned char)p[1]);
+            c.type[2]='\0';
+            if(c.type[1]=='E')
+                return 0;
+            if((nf=qfh_card_floats(c.type))<0)
+                return 1;
+            memset(c.f, 0, sizeof(c.f));
+            c.i1=c.i2=0;
+            p+=2;
+            // fields are separated by blanks or commas
+            for(k=0;k<2+nf;k++) {
+                while(p<eol && (*p==' ' || *p=='\t' || *p==','))
+                    p++;
+                for(n=0;p<eol && *p!=' ' && *p!='\t' && *p!=',' && *p!='\r';p++)
+                    if(n<sizeof(field)-1)
+                        field[n++]=*p;
+                if(n==0)
+                    break;
+                field[n]='\0';
+                if(k==0)
+                    c.i1=(int)strtol(field, &q, 10);
+                else if(k==1)
+                    c.i2=(int)strtol(field, &q, 10);
+                else
+                    c.f[k-2]=strtod(field, &q);
+            }
+            if(qfh_geom_card(g, &c))
+                return 1;
+        }
+        p=eol+1;
+    }
+    return 0;
+}
+
+const qfh_emitter *qfh_find_emitter(const char *name)
+{
+    const qfh_emitter *e;
+
+    for(e=qfh_emitters;e->name;e++)
+        if(strcmp(e->name, name)==0)
+            return e;
+    return NULL;
+}
+
+/* Parameter comments of the helices of m */
+static void deck_helix_comments(qfh_membuf *b, const qfh_model *m)
+{
+    const helix *h;
+    int i;
+
+    for(i=0;i<m->nhelix;i++) {
+        h=&m->h[2*i];
+        qfh_buf_str(b, "CM Helix ");
+        qfh_buf_int(b, i+m->comment_base);
+        qfh_buf_str(b, ": H1=");
+        qfh_buf_e5(b, h[0].H);
+        qfh_buf_str(b, " D1=");
+        qfh_buf_e5(b, h[0].D);
+        qfh_buf_str(b, " H2=");
+        qfh_buf_e5(b, h[1].H);
+        qfh_buf_str(b, " D2=");
+        qfh_buf_e5(b, h[1].D);
+        qfh_buf_str(b, "\nCM turns=");
+        qfh_buf_e5(b, h[0].turns);
+        qfh_buf_str(b, " R=");
+        qfh_buf_e5(b, h[0].R);
+        qfh_buf_str(b, ", wire=");
+        qfh_buf_e5(b, h[0].wire);
+        qfh_buf_str(b, "\nCM offset=");
+        qfh_buf_e5(b, h[0].offset);
+        qfh_buf_str(b, " theta=");
+        qfh_buf_e5(b, h[0].Theta);
+        switch(toupper(h[0].feed)) {
+            case 'O':
+                qfh_buf_str(b, " open\n");
+                break;
+            case 'S':
+                qfh_buf_str(b, " shorted\n");
+                break;
+            case 'T':
+                qfh_buf_str(b, " terminated\n");
+                break;
+            case 'F':
+                qfh_buf_str(b, " feed\n");
+                break;
+            default:
+                qfh_buf_str(b, " ");
+                break;
+        }
+    }
+}
+
+/* Frequency comment and the end of the comments */
+static void deck_comments_end(qfh_membuf *b, const qfh_model *m)
+{
+    double v[1];
+
+    qfh_buf_str(b, "CM");
+    v[0]=m->fstart;
+    qfh_buf_e5list(b, v, 1);
+    qfh_buf_str(b, " -");
+    v[0]=m->fstop;
+    qfh_buf_e5list(b, v, 1);
+    qfh_buf_str(b, " MHz in");
+    v[0]=m->fstep;
+    qfh_buf_e5list(b, v, 1);
+    qfh_buf_str(b, " MHz steps\nCE\n");
+}
+
+/* Parameter comments at the top of a deck */
+static void deck_comments(qfh_membuf *b, const qfh_model *m)
+{
+    qfh_buf_str(b, "CM NEC2 Input File produced by helix2nec\n");
+    qfh_buf_str(b, "CM Parameters:\n");
+    deck_helix_comments(b, m);
+    deck_comments_end(b, m);
+}
+
+/* One GW card per wire of g */
+static void deck_wires(qfh_membuf *b, const qfh_geom *g)
+{
+    double v[7];
+    int i;
+
+    for(i=0;i<g->n;i++) {
+        qfh_buf_str(b, "GW ");
+        qfh_buf_int(b, g->tag[i]);
+        qfh_buf_str(b, " ");
+        qfh_buf_int(b, g->segs[i]);
+        v[0]=g->x1[i];
+        v[1]=g->y1[i];
+        v[2]=g->z1[i];
+        v[3]=g->x2[i];
+        v[4]=g->y2[i];
+        v[5]=g->z2[i];
+        v[6]=g->radius[i];
+        qfh_buf_e5list(b, v, 7);
+        qfh_buf_str(b, "\n");
+    }
+}
+
+/* The geometry cards the model was built from */
+static void deck_cards(qfh_membuf *b, const qfh_model *m)
+{
+    const qfh_card *c;
+    int i;
+
+    for(i=0;i<m->ncards;i++) {
+        c=&m->cards[i];
+        qfh_buf_str(b, c->type);
+        qfh_buf_str(b, " ");
+        qfh_buf_int(b, c->i1);
+        qfh_buf_str(b, " ");
+        qfh_buf_int(b, c->i2);
+        qfh_buf_e5list(b, c->f, qfh_card_floats(c->type));
+        qfh_buf_str(b, "\n");
+    }
+}
+
+/* GE and FR cards */
+static void deck_frequency(qfh_membuf *b, const qfh_model *m)
+{
+    double v[2];
+
+    qfh_buf_str(b, "GE 0\n");
+
+    // Frequency specification
+    qfh_buf_str(b, "FR 0 ");
+    qfh_buf_int(b, (int)((m->fstop-m->fstart)/m->fstep)+1);
+    qfh_buf_str(b, " 0 0");
+    v[0]=m->fstart;
+    v[1]=m->fstep;
+    qfh_buf_e5list(b, v, 2);
+    qfh_buf_str(b, "\n");
+}
+
+/* LD impedance loading to 50 ohms resistive on the feed wire tag. In a
+ * symmetric model the feed wire is split at the axis: each half gets
+ * half of the load, and half of the voltage in the direction of the
+ * whole wire, so that the source and load stay symmetric. */
+static void deck_load(qfh_membuf *b, const qfh_model *m, int tag)
+{
+    if(m->nsym==2) {
+        qfh_buf_str(b, "LD 4 ");
+        qfh_buf_int(b, tag);
+        qfh_buf_str(b, " 1 1 2.50000E+01 0.00000E+00\nLD 4 ");
+        qfh_buf_int(b, tag+m->symtag);
+        qfh_buf_str(b, " 1 1 2.50000E+01 0.00000E+00\n");
+    } else {
+        qfh_buf_str(b, "LD 4 ");
+        qfh_buf_int(b, tag);
+        qfh_buf_str(b, " 1 1 5.00000E+01 0.00000E+00\n");
+    }
+}
+
+/* Voltage excitation of the feed wire tag */
+static void deck_excitation(qfh_membuf *b, const qfh_model *m, int tag)
+{
+    if(m->nsym==2) {
+        qfh_buf_str(b, "EX 0 ");
+        qfh_buf_int(b, tag);
+        qfh_buf_str(b, " 1 0 5.00000E-01 0.00000E+00\nEX 0 ");
+        qfh_buf_int(b, tag+m->symtag);
+        qfh_buf_str(b, " 1 0 -5.00000E-01 0.00000E+00\n");
+    } else {
+        qfh_buf_str(b, "EX 0 ");
+        qfh_buf_int(b, tag);
+        qfh_buf_str(b, " 1 0 1.00000E+00 0.00000E+00\n");
+    }
+}
+
+/* Radiation pattern and end of the deck. A grid without directions
+ * leaves out the RP card. */
+static void deck_end(qfh_membuf *b, const qfh_model *m)
+{
+    const qfh_grid *rp=m->rp ? m->rp : &qfh_rp_default;
+    double v[6];
+
+    if(rp->ntheta>0 && rp->nphi>0) {
+        qfh_buf_str(b, "RP 0 ");
+        qfh_buf_int(b, rp->ntheta);
+        qfh_buf_str(b, " ");
+        qfh_buf_int(b, rp->nphi);
+        qfh_buf_str(b, " 1000");
+        v[0]=rp->theta0;
+        v[1]=rp->phi0;
+        v[2]=rp->dtheta;
+        v[3]=rp->dphi;
+        v[4]=v[5]=0;
+        qfh_buf_e5list(b, v, 6);
+        qfh_buf_str(b, "\n");
+    }
+
+    // End of run
+    qfh_buf_str(b, "EN\n");
+}
+
+/* Everything from the GE card to the end of a deck */
+static void deck_controls(qfh_membuf *b, const qfh_model *m)
+{
+    int i;
+
+    deck_frequency(b, m);
+    for(i=0;i<m->nhelix;i++)
+        if(toupper(m->h[2*i].feed)=='T')
+            deck_load(b, m, m->h[2*i].feedpoint);
+    for(i=0;i<m->nhelix;i++)
+        if(toupper(m->h[2*i].feed)=='F')
+            deck_excitation(b, m, m->h[2*i].feedpoint);
+    deck_end(b, m);
+}
+
+/* NEC2 deck: parameter comments, one GW card per wire, then the
+ * frequency, load, excitation and radiation pattern cards.
+ * The deck is formatted into one buffer and handed to the sink with a
+ * single write. The output is byte for byte that of
+ * qfh_emit_nec_printf(). */
+int qfh_emit_nec(qfh_ctx *ctx, const qfh_model *m)
+{
+    const qfh_geom *g=&m->geom;
+    qfh_membuf b={NULL, 0, 0};
+
+    if(ctx->error)
+        return ctx->error;
+    if(qfh_membuf_reserve(&b, (size_t)(g->n+7*m->nhelix+10)*QFH_CARDMAX))
+        return ctx->error=1;
+
+    deck_comments(&b, m);
+    deck_wires(&b, g);
+    deck_controls(&b, m);
+
+    if(qfh_write(ctx, b.data, b.len))
+        ctx->error=1;
+    qfh_membuf_free(&b);
+    return ctx->error;
+}
+
+/* Compact NEC2 deck: like qfh_emit_nec() but with the geometry cards
+ * the model was built from (qfh_build_helix_cards(), or the half
+ * structure and GR card of a symmetric build) instead of one GW card
+ * per wire */
+int qfh_emit_necgh(qfh_ctx *ctx, const qfh_model *m)
+{
+    qfh_membuf b={NULL, 0, 0};
+
+    if(ctx->error)
+        return ctx->error;
+    if(m->ncards==0)
+        return ctx->error=1;
+    if(qfh_membuf_reserve(&b, (size_t)(m->ncards+7*m->nhelix+10)*QFH_CARDMAX))
+        return ctx->error=1;
+
+    deck_comments(&b, m);
+    deck_cards(&b, m);
+    deck_controls(&b, m);
+
+    if(qfh_write(ctx, b.data, b.len))
+        ctx->error=1;
+    qfh_membuf_free(&b);
+    return ctx->error;
+}
+
+/*
+ * A NEC2 deck written in pieces, for models built a few helices at a
+ * time with qfh_build_part(). The pieces go in this order:
+ *    qfh_emit_nec_comments() for every part, with first set on the
+ *      first call and last on the final one, which may be for a model
+ *      without helices
+ *    qfh_emit_nec_geometry() after each qfh_build_part() and once more
+ *      after qfh_build_end() on the emptied model
+ *    qfh_emit_nec_controls() with the feed wire tags of the terminated
+ *      and fed helices, in helix order
+ * The result is the deck qfh_emit_nec() or qfh_emit_necgh() writes for
+ * the whole model.
+ */
+
+/* Writes b to the sink of ctx and frees it */
+static int write_piece(qfh_ctx *ctx, qfh_membuf *b)
+{
+    if(!ctx->error && b->len && qfh_write(ctx, b->data, b->len))
+        ctx->error=1;
+    qfh_membuf_free(b);
+    return ctx->error;
+}
+
+/* The comments of the helices of m, numbered from m->comment_base.
+ * first adds the title of the deck before them, last the frequency
+ * comment and CE card after them. */
+int qfh_emit_nec_comments(qfh_ctx *ctx, const qfh_model *m, int first,
+                          int last)
+{
+    qfh_membuf b={NULL, 0, 0};
+
+    if(ctx->error)
+        return ctx->error;
+    if(qfh_membuf_reserve(&b, (size_t)(3*m->nhelix+4)*QFH_CARDMAX))
+        return ctx->error=1;
+    if(first) {
+        qfh_buf_str(&b, "CM NEC2 Input File produced by helix2nec\n");
+        qfh_buf_str(&b, "CM Parameters:\n");
+    }
+    deck_helix_comments(&b, m);
+    if(last)
+        deck_comments_end(&b, m);
+    return write_piece(ctx, &b);
+}
+
+/* The geometry cards of the current part of the model: those it was
+ * built from in a compact or symmetric build, one GW per wire otherwise */
+int qfh_emit_nec_geometry(qfh_ctx *ctx, const qfh_model *m)
+{
+    qfh_membuf b={NULL, 0, 0};
+
+    if(ctx->error)
+        return ctx->error;
+    if(qfh_membuf_reserve(&b, (size_t)(m->ncards ? m->ncards : m->geom.n)
+                          *QFH_CARDMAX+1))
+        return ctx->error=1;
+    if(m->ncards)
+        deck_cards(&b, m);
+    else
+        deck_wires(&b, &m->geom);
+    return write_piece(ctx, &b);
+}
+
+/* Everything from the GE card on, for the feed wires loads[] of the
+ * terminated helices and feeds[] of the fed ones */
+int qfh_emit_nec_controls(qfh_ctx *ctx, const qfh_model *m,
+                          const int *loads, int nloads,
+                          const int *feeds, int nfeeds)
+{
+    qfh_membuf b={NULL, 0, 0};
+    int i;
+
+    if(ctx->error)
+        return ctx->error;
+    if(qfh_membuf_reserve(&b, (size_t)(2*nloads+2*nfeeds+4)*QFH_CARDMAX))
+        return ctx->error=1;
+    deck_frequency(&b, m);
+    for(i=0;i<nloads;i++)
+        deck_load(&b, m, loads[i]);
+    for(i=0;i<nfeeds;i++)
+        deck_excitation(&b, m, feeds[i]);
+    deck_end(&b, m);
+    return write_piece(ctx, &b);
+}
+
+/* Reference implementation of qfh_emit_nec() on top of printf, kept to
+ * check and benchmark the fast writer against */
+int qfh_emit_nec_printf(qfh_ctx *ctx, const qfh_model *m)
+{
+    const qfh_geom *g=&m->geom;
+    const qfh_grid *rp=m->rp ? m->rp : &qfh_rp_default;
+    const helix *h;
+    int i;
+
+    qfh_printf(ctx, "CM NEC2 Input File produced by helix2nec\n");
+    qfh_printf(ctx, "CM Parameters:\n");
+    for(i=0;i<m->nhelix;i++) {
+        h=&m->h[2*i];
+        qfh_printf(ctx, "CM Helix %d:"
+        " H1=%.5E D1=%.5E H2=%.5E D2=%.5E\n",
+        i+m->comment_base, h[0].H, h[0].D, h[1].H, h[1].D);
+        qfh_printf(ctx, "CM turns=%.5E R=%.5E, wire=%.5E\n",
+                h[0].turns, h[0].R, h[0].wire);
+        qfh_printf(ctx, "CM offset=%.5E theta=%.5E ",
+                h[0].offset, h[0].Theta);
+        switch(toupper(h[0].feed)) {
+            case 'O':
+                qfh_printf(ctx,"open\n");
+                break;
+            case 'S':
+                qfh_printf(ctx,"shorted\n");
+                break;
+            case 'T':
+                qfh_printf(ctx,"terminated\n");
+                break;
+            case 'F':
+                qfh_printf(ctx,"feed\n");
+                break;
+        }
+    }
+    qfh_printf(ctx, "CM %.5E - %.5E MHz in %.5E MHz steps\n",
+            m->fstart, m->fstop, m->fstep);
+
+    qfh_printf(ctx, "CE\n");
+
+    for(i=0;i<g->n;i++)
+        qfh_printf(ctx, "GW %d %d %.5E %.5E %.5E %.5E %.5E %.5E %.5E\n",
+                g->tag[i], g->segs[i],
+                g->x1[i], g->y1[i], g->z1[i],
+                g->x2[i], g->y2[i], g->z2[i],
+                g->radius[i]);
+
+    qfh_printf(ctx, "GE 0\n");
+
+    // Frequency specification
+    qfh_printf(ctx, "FR 0 %d 0 0 %.5E %.5E\n",
+            (int)((m->fstop-m->fstart)/m->fstep)+1, m->fstart, m->fstep);
+
+    // LD impedance loading to 50 ohms resistive
+    for(i=0;i<m->nhelix;i++) {
+        if(toupper(m->h[2*i].feed)=='T' && m->nsym==2) {
+            qfh_printf(ctx, "LD 4 %d 1 1 "
+            "2.50000E+01 0.00000E+00\n",
+            m->h[2*i].feedpoint);
+            qfh_printf(ctx, "LD 4 %d 1 1 "
+            "2.50000E+01 0.00000E+00\n",
+            m->h[2*i].feedpoint+m->symtag);
+        } else if(toupper(m->h[2*i].feed)=='T') {
+            qfh_printf(ctx, "LD 4 %d 1 1 "
+            "5.00000E+01 0.00000E+00\n",
+            m->h[2*i].feedpoint);
+        }
+    }
+
+    // Voltage excitation
+    for(i=0;i<m->nhelix;i++) {
+        if(toupper(m->h[2*i].feed)=='F' && m->nsym==2) {
+            qfh_printf(ctx, "EX 0 %d 1 0 "
+            "5.00000E-01 0.00000E+00\n",
+            m->h[2*i].feedpoint);
+            qfh_printf(ctx, "EX 0 %d 1 0 "
+            "-5.00000E-01 0.00000E+00\n",
+            m->h[2*i].feedpoint+m->symtag);
+        } else if(toupper(m->h[2*i].feed)=='F') {
+            qfh_printf(ctx, "EX 0 %d 1 0 "
+            "1.00000E+00 0.00000E+00\n",
+            m->h[2*i].feedpoint);
+        }
+    }
+
+    // Radiation pattern, the whole sphere unless the model says otherwise
+    if(rp->ntheta>0 && rp->nphi>0)
+        qfh_printf(ctx, "RP 0 %d %d 1000 %.5E %.5E %.5E %.5E "
+        "0.00000E+00 0.00000E+00\n", rp->ntheta, rp->nphi,
+        rp->theta0, rp->phi0, rp->dtheta, rp->dphi);
+
+    // End of run
+    qfh_printf(ctx, "EN\n");
+    return ctx->error;
+}
+
+/* One line per wire, lossless decimal coordinates in metres */
+int qfh_emit_csv(qfh_ctx *ctx, const qfh_model *m)
+{
+    const qfh_geom *g=&m->geom;
+    int i;
+
+    qfh_printf(ctx, "tag,segments,x1,y1,z1,x2,y2,z2,radius\n");
+    for(i=0;i<g->n;i++)
+        qfh_printf(ctx, "%d,%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+                g->tag[i], g->segs[i],
+                g->x1[i], g->y1[i], g->z1[i],
+                g->x2[i], g->y2[i], g->z2[i],
+                g->radius[i]);
+    return ctx->error;
+}
+
+/*
+ * Binary geometry in host byte order:
+ *    char magic[4] = "QFHG", uint32 version = 1, uint32 number of wires n
+ *    double x1[n], y1[n], z1[n], x2[n], y2[n], z2[n], radius[n]
+ *    int32 segments[n], tag[n]
+ */
+int qfh_emit_bin(qfh_ctx *ctx, const qfh_model *m)
+{
+    const qfh_geom *g=&m->geom;
+    const double *col[7]={g->x1, g->y1, g->z1, g->x2, g->y2, g->z2,
+        g->radius};
+    uint32_t hdr[3];
+    size_t nd=(size_t)g->n*sizeof(double);
+    int k;
+
+    if(ctx->error)
+        return ctx->error;
+    memcpy(&hdr[0], "QFHG", 4);
+    hdr[1]=1;
+    hdr[2]=(uint32_t)g->n;
+    if(qfh_write(ctx, (const char*)hdr, sizeof(hdr)))
+        ctx->error=1;
+    for(k=0;k<7 && !ctx->error;k++)
+        if(nd && qfh_write(ctx, (const char*)col[k], nd))
+            ctx->error=1;
+    if(!ctx->error && g->n &&
+       (qfh_write(ctx, (const char*)g->segs, g->n*sizeof(int)) ||
+        qfh_write(ctx, (const char*)g->tag, g->n*sizeof(int))))
+        ctx->error=1;
+    return ctx->error;
+}
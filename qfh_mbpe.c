@@ -0,0 +1,304 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Model based parameter estimation of a frequency sweep.
+ *
+ * The currents of a method of moments model, and so its impedance and
+ * far field, are close to rational functions of frequency over a band
+ * that holds a few resonances. A few complex functions sampled at some
+ * frequencies are fitted with rational functions sharing one
+ * denominator, in Chebyshev polynomials of the frequency scaled to
+ * [-1, 1]:
+ *
+ *   v_k(x) = sum p_kj T_j(x) / (1 + sum q_j T_j(x))
+ *
+ * which is linear in p and q once multiplied out, and solved by least
+ * squares (Householder QR). Two fits of consecutive degrees are made
+ * from the same samples; where they disagree most is where the next
+ * sample goes, and once they agree to the tolerance everywhere in the
+ * band the higher one is kept, with their difference as its error
+ * estimate.
+ */
+
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<complex.h>
+#include "qfh.h"
+
+#define MBPE_GRID 512 // points at which the two fits are compared
+#define MBPE_MAXDEG 16
+#define MBPE_FLOOR 1e-2 // of the largest sample, below which errors are absolute
+
+/* T_0(x)..T_d(x) */
+static void chebyshev(double x, int d, double *t)
+{
+    int j;
+
+    t[0]=1;
+    if(d>0)
+        t[1]=x;
+    for(j=2;j<=d;j++)
+        t[j]=2*x*t[j-1]-t[j-2];
+}
+
+/* Least squares solution of the m x n (m >= n) column major system
+ * a x = b by Householder QR, a and b overwritten, x in b[0..n-1].
+ * The columns are scaled to unit length first. Returns 1 if a is
+ * rank deficient. */
+static int lsq_solve(double complex *a, int m, int n, double complex *b,
+                     double *scale)
+{
+    double complex *ak, *aj, alpha, s;
+    double norm, vnorm, r0=0;
+    int i, j, k;
+
+    for(j=0;j<n;j++) {
+        aj=a+(size_t)j*m;
+        for(norm=0,i=0;i<m;i++)
+            norm+=creal(aj[i]*conj(aj[i]));
+        scale[j]=norm>0 ? 1/sqrt(norm) : 1;
+        for(i=0;i<m;i++)
+            aj[i]*=scale[j];
+    }
+    for(k=0;k<n;k++) {
+        ak=a+(size_t)k*m;
+        for(norm=0,i=k;i<m;i++)
+            norm+=creal(ak[i]*conj(ak[i]));
+        norm=sqrt(norm);
+        if(k==0)
+            r0=norm;
+        if(norm<=1e-13*r0 || norm==0)
+            return 1;
+        alpha=ak[k]!=0 ? -norm*ak[k]/cabs(ak[k]) : -norm;
+        // v = a_k - alpha e_k, kept in a_k; R_kk = alpha
+        ak[k]-=alpha;
+        for(vnorm=0,i=k;i<m;i++)
+            vnorm+=creal(ak[i]*conj(ak[i]));
+        for(j=k+1;j<=n;j++) {
+            aj=j<n ? a+(size_t)j*m : b;
+            for(s=0,i=k;i<m;i++)
+                s+=conj(ak[i])*aj[i];
+            s*=2/vnorm;
+            for(i=k;i<m;i++)
+                aj[i]-=s*ak[i];
+        }
+        ak[k]=alpha;
+    }
+    for(k=n-1;k>=0;k--) {
+        s=b[k];
+        for(j=k+1;j<n;j++)
+            s-=a[(size_t)j*m+k]*b[j];
+        b[k]=s/a[(size_t)k*m+k];
+    }
+    for(j=0;j<n;j++)
+        b[j]*=scale[j];
+    return 0;
+}
+
+/* Fits degree d to the samples of mb into coef, nfun*(d+1) numerator
+ * coefficients then d of the denominator. Returns 0 on success. */
+static int fit(const qfh_mbpe *mb, int d, const double *weight,
+               double complex *coef)
+{
+    double complex *a, *b, v;
+    double t[MBPE_MAXDEG+1], *scale, x;
+    int m=mb->nfun*mb->nsamples, n=mb->nfun*(d+1)+d, i, j, k, r, err;
+
+    a=(double complex*)calloc((size_t)m*n+m, sizeof(double complex));
+    scale=(double*)malloc(n*sizeof(double));
+    if(a==NULL || scale==NULL) {
+        free(a);
+        free(scale);
+        return 1;
+    }
+    b=a+(size_t)m*n;
+    for(i=0;i<mb->nsamples;i++) {
+        x=(mb->freq[i]-mb->f0)/mb->half;
+        chebyshev(x, d, t);
+        for(k=0;k<mb->nfun;k++) {
+            r=i*mb->nfun+k;
+            v=mb->v[r]*weight[k];
+            for(j=0;j<=d;j++)
+                a[(size_t)(k*(d+1)+j)*m+r]=t[j]*weight[k];
+            for(j=1;j<=d;j++)
+                a[(size_t)(mb->nfun*(d+1)+j-1)*m+r]=-v*t[j];
+            b[r]=v;
+        }
+    }
+    if((err=lsq_solve(a, m, n, b, scale))==0)
+        memcpy(coef, b, n*sizeof(double complex));
+    free(a);
+    free(scale);
+    return err;
+}
+
+static void eval(int nfun, int d, const double complex *coef, double x,
+                 double complex *v)
+{
+    double t[MBPE_MAXDEG+1];
+    double complex q=1;
+    int j, k;
+
+    chebyshev(x, d, t);
+    for(j=1;j<=d;j++)
+        q+=coef[nfun*(d+1)+j-1]*t[j];
+    for(k=0;k<nfun;k++) {
+        v[k]=0;
+        for(j=0;j<=d;j++)
+            v[k]+=coef[k*(d+1)+j]*t[j];
+        v[k]/=q;
+    }
+}
+
+/* Highest degree that leaves the fit overdetermined */
+static int fit_degree(int nfun, int ns)
+{
+    int d=(nfun*ns-1-nfun)/(nfun+1);
+
+    if(d>ns-2)
+        d=ns-2;
+    return d>MBPE_MAXDEG ? MBPE_MAXDEG : d;
+}
+
+static int add_sample(qfh_mbpe *mb, double f, qfh_sample_fn fn, void *opaque)
+{
+    int i=mb->nsamples;
+
+    // kept in order of frequency
+    while(i>0 && mb->freq[i-1]>f) {
+        mb->freq[i]=mb->freq[i-1];
+        memcpy(mb->v+i*mb->nfun, mb->v+(i-1)*mb->nfun,
+               mb->nfun*sizeof(double complex));
+        i--;
+    }
+    mb->freq[i]=f;
+    mb->nsamples++;
+    return fn(opaque, f, mb->v+i*mb->nfun);
+}
+
+/* Middle of the widest gap between samples */
+static double widest_gap(const qfh_mbpe *mb)
+{
+    double gap=0, f=mb->f0;
+    int i;
+
+    for(i=1;i<mb->nsamples;i++)
+        if(mb->freq[i]-mb->freq[i-1]>gap) {
+            gap=mb->freq[i]-mb->freq[i-1];
+            f=(mb->freq[i]+mb->freq[i-1])/2;
+        }
+    return f;
+}
+
+/* Samples nfun functions of frequency with fn between flo and fhi MHz,
+ * five samples to start with and then one at a time where the two fits
+ * disagree most, until they agree to tol everywhere (relative to each
+ * value, or to 1% of the largest sample of that function for values
+ * smaller than that) or maxsamples have been taken. Returns 0 on
+ * success, also when the tolerance was not met (mb->error says by how
+ * much), 1 if a sample failed or out of memory. */
+int qfh_mbpe_sweep(qfh_mbpe *mb, int nfun, double flo, double fhi,
+                   double tol, int maxsamples, qfh_sample_fn fn, void *opaque)
+{
+    double complex *ca, *cb, va[8], vb[8];
+    double weight[8], small[8], x, e, worst, fworst=flo;
+    int i, k, g, d, err=0;
+
+    memset(mb, 0, sizeof(*mb));
+    if(nfun<1 || nfun>8 || !(fhi>flo))
+        return 1;
+    if(maxsamples<5)
+        maxsamples=5;
+    mb->nfun=nfun;
+    mb->f0=(flo+fhi)/2;
+    mb->half=(fhi-flo)/2;
+    mb->error=HUGE_VAL;
+    mb->freq=(double*)malloc(maxsamples*sizeof(double));
+    mb->v=(double complex*)malloc((size_t)maxsamples*nfun*sizeof(double complex));
+    // the kept fit, then the two being compared
+    mb->coef=(double complex*)malloc(3*(size_t)(nfun+1)*(MBPE_MAXDEG+1)
+                                     *sizeof(double complex));
+    if(mb->freq==NULL || mb->v==NULL || mb->coef==NULL) {
+        qfh_mbpe_free(mb);
+        return 1;
+    }
+    ca=mb->coef+(size_t)(nfun+1)*(MBPE_MAXDEG+1);
+    cb=ca+(size_t)(nfun+1)*(MBPE_MAXDEG+1);
+    for(i=0;i<5 && !err;i++)
+        err=add_sample(mb, flo+(fhi-flo)*i/4, fn, opaque);
+
+    while(!err) {
+        // each function weighted by its largest sample
+        for(k=0;k<nfun;k++) {
+            small[k]=0;
+            for(i=0;i<mb->nsamples;i++)
+                small[k]=fmax(small[k], cabs(mb->v[i*nfun+k]));
+            weight[k]=small[k]>0 ? 1/small[k] : 1;
+            small[k]*=MBPE_FLOOR;
+        }
+        d=fit_degree(nfun, mb->nsamples);
+        worst=HUGE_VAL;
+        if(d>=1 && fit(mb, d, weight, ca)==0 && fit(mb, d-1, weight, cb)==0) {
+            worst=0;
+            for(g=0;g<=MBPE_GRID;g++) {
+                x=-1+2.0*g/MBPE_GRID;
+                eval(nfun, d, ca, x, va);
+                eval(nfun, d-1, cb, x, vb);
+                for(k=0;k<nfun;k++) {
+                    e=cabs(va[k]-vb[k])/fmax(cabs(va[k]), small[k]);
+                    if(!(e<=worst)) {
+                        worst=e;
+                        fworst=mb->f0+x*mb->half;
+                    }
+                }
+            }
+            mb->degree=d;
+            mb->error=worst;
+            memcpy(mb->coef, ca, (nfun*(d+1)+d)*sizeof(double complex));
+        }
+        if(worst<=tol || mb->nsamples==maxsamples)
+            break;
+        // a sample where there is one already would add nothing
+        for(i=0;i<mb->nsamples;i++)
+            if(fabs(mb->freq[i]-fworst)<mb->half*1e-3)
+                break;
+        if(worst==HUGE_VAL || !isfinite(worst) || i<mb->nsamples)
+            fworst=widest_gap(mb);
+        err=add_sample(mb, fworst, fn, opaque);
+    }
+    if(!err && mb->degree==0)
+        err=1;
+    if(err)
+        qfh_mbpe_free(mb);
+    return err;
+}
+
+/* Values of the fitted functions at freq MHz */
+void qfh_mbpe_eval(const qfh_mbpe *mb, double freq, double complex *v)
+{
+    eval(mb->nfun, mb->degree, mb->coef, (freq-mb->f0)/mb->half, v);
+}
+
+void qfh_mbpe_free(qfh_mbpe *mb)
+{
+    free(mb->freq);
+    free(mb->v);
+    free(mb->coef);
+    mb->freq=NULL;
+    mb->v=NULL;
+    mb->coef=NULL;
+}
@@ -0,0 +1,227 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reading NEC2 output files.
+ *
+ * nec2c writes, for every frequency of the FR card, a FREQUENCY block,
+ * the ANTENNA INPUT PARAMETERS (one line per source), the currents of
+ * every segment, the power budget and, with an RP card, the RADIATION
+ * PATTERNS: a line per direction, 1369 of them for the 37 x 37 grid of
+ * the default deck, which make up most of the file.
+ *
+ * The parser never splits the file into lines. The section headers are
+ * found with memchr() on their last character (vectorized in libc) and
+ * compared in place, so the current tables are skipped without being
+ * read. In the tables it reads the leading numbers of a line with its
+ * own scanner and jumps to the next line with memchr(). The scanner
+ * gathers the digits into an integer and scales it by an exact power of
+ * ten, which rounds once and so gives the same double as strtod() for
+ * the up to 15 digits NEC2 prints; longer numbers go through strtod().
+ */
+
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include "qfh.h"
+
+#define HEADER_LINES 8 // most lines between a section title and its table
+
+static const double pow10_exact[23]={
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* First occurrence of s in [p, end), NULL if there is none */
+static const char *find_text(const char *p, const char *end, const char *s)
+{
+    size_t n=strlen(s);
+    const char *q;
+
+    if(end-p<(long)n)
+        return NULL;
+    for(p+=n-1;p<end && (q=(const char*)memchr(p, s[n-1], end-p))!=NULL;
+        p=q+1)
+        if(memcmp(q-(n-1), s, n-1)==0)
+            return q-(n-1);
+    return NULL;
+}
+
+/* Start of the line after the one p is in, end if it is the last */
+static const char *next_line(const char *p, const char *end)
+{
+    const char *q=(const char*)memchr(p, '\n', end-p);
+
+    return q ? q+1 : end;
+}
+
+/* Reads the number at *pp after any blanks: an optional sign, digits
+ * with an optional point and an optional exponent. Returns 1 with the
+ * value in *v and *pp past the number, 0 if there is none. */
+static int scan_number(const char **pp, const char *end, double *v)
+{
+    const char *p=*pp, *s, *q;
+    unsigned long long m=0;
+    int nd=0, e=0, ex=0, neg=0, eneg=0, any=0, lost=0;
+    char buf[64];
+
+    while(p<end && (*p==' ' || *p=='\t'))
+        p++;
+    s=p;
+    if(p<end && (*p=='-' || *p=='+'))
+        neg=*p++=='-';
+    for(;p<end && *p>='0' && *p<='9';p++) {
+        any=1;
+        if(nd<19) {
+            m=m*10+(unsigned)(*p-'0');
+            nd+=m>0;
+        } else {
+            e++;
+            lost=1;
+        }
+    }
+    if(p<end && *p=='.')
+        for(p++;p<end && *p>='0' && *p<='9';p++) {
+            any=1;
+            if(nd<19) {
+                m=m*10+(unsigned)(*p-'0');
+                nd+=m>0;
+                e--;
+            } else
+                lost=1;
+        }
+    if(!any)
+        return 0;
+    if(p<end && (*p=='E' || *p=='e')) {
+        q=p+1;
+        if(q<end && (*q=='-' || *q=='+'))
+            eneg=*q++=='-';
+        if(q<end && *q>='0' && *q<='9') {
+            for(;q<end && *q>='0' && *q<='9';q++)
+                if(ex<10000)
+                    ex=ex*10+(*q-'0');
+            p=q;
+            e+=eneg ? -ex : ex;
+        }
+    }
+    *pp=p;
+    if(m==0) {
+        *v=neg ? -0.0 : 0.0;
+        return 1;
+    }
+    if(!lost && nd<=15 && e>=-22 && e<=22) {
+        *v=e>=0 ? (double)m*pow10_exact[e] : (double)m/pow10_exact[-e];
+        if(neg)
+            *v=-*v;
+        return 1;
+    }
+    if(p-s>=(long)sizeof(buf))
+        return 0;
+    memcpy(buf, s, p-s);
+    buf[p-s]='\0';
+    *v=strtod(buf, NULL);
+    return 1;
+}
+
+/* Whether the line at p starts with a number, as the rows of the tables
+ * do and their headers do not */
+static int is_row(const char *p, const char *end)
+{
+    while(p<end && (*p==' ' || *p=='\t'))
+        p++;
+    if(p<end && (*p=='-' || *p=='+'))
+        p++;
+    if(p<end && *p=='.')
+        p++;
+    return p<end && *p>='0' && *p<='9';
+}
+
+/* First row of the table whose title is at p, NULL if no row follows
+ * within HEADER_LINES lines */
+static const char *table_start(const char *p, const char *end)
+{
+    int i;
+
+    for(i=0;i<HEADER_LINES && p<end;i++) {
+        p=next_line(p, end);
+        if(is_row(p, end))
+            return p;
+    }
+    return NULL;
+}
+
+/* Parses the len bytes of a NEC2 output file at data into a row per
+ * frequency with input parameters, in *rows (malloc()ed, to be freed by
+ * the caller) and *n. Returns 0 on success, 1 if out of memory. */
+int qfh_necout_parse(const char *data, size_t len, qfh_necout_row **rows,
+                     long *n)
+{
+    const char *end=data+len, *f, *p, *stop, *sec;
+    qfh_necout_row row, *r=NULL, *nr;
+    double v[8];
+    long cap=0;
+    int k, nsrc;
+
+    *rows=NULL;
+    *n=0;
+    for(f=find_text(data, end, "FREQUENCY=");f;f=sec) {
+        p=f+10;
+        sec=find_text(p, end, "FREQUENCY=");
+        stop=sec ? sec : end;
+        if(!scan_number(&p, stop, &row.freq))
+            continue;
+        row.z=0;
+        row.gain=NAN;
+        nsrc=0;
+        // tag, segment, voltage, current, impedance, ...
+        if((sec=find_text(p, stop, "ANTENNA INPUT PARAMETERS"))!=NULL &&
+           (p=table_start(sec, stop))!=NULL)
+            for(;p<stop && is_row(p, stop);p=next_line(p, stop)) {
+                for(k=0;k<8 && scan_number(&p, stop, &v[k]);k++)
+                    ;
+                if(k<8)
+                    break;
+                row.z+=v[6]+I*v[7];
+                nsrc++;
+            }
+        // theta, phi, two gain components and the total gain, ...
+        if(nsrc>0 && (sec=find_text(p, stop, "RADIATION PATTERNS"))!=NULL &&
+           (p=table_start(sec, stop))!=NULL)
+            for(;p<stop && is_row(p, stop);p=next_line(p, stop)) {
+                for(k=0;k<5 && scan_number(&p, stop, &v[k]);k++)
+                    ;
+                if(k<5)
+                    break;
+                if(!(v[4]<=row.gain))
+                    row.gain=v[4];
+            }
+        sec=stop<end ? stop : NULL;
+        if(nsrc==0)
+            continue;
+        row.swr=qfh_swr(row.z, 50);
+        if(*n==cap) {
+            cap=cap ? 2*cap : 64;
+            if((nr=(qfh_necout_row*)realloc(r, cap*sizeof(*r)))==NULL) {
+                free(r);
+                *n=0;
+                return 1;
+            }
+            r=nr;
+        }
+        r[(*n)++]=row;
+    }
+    *rows=r;
+    return 0;
+}
@@ -0,0 +1,299 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Design optimizer.
+ *
+ * Searches turns, length, radius and ratio for a design meeting a
+ * qfh_goal, by differential evolution (DE/rand/1/bin). Every candidate is
+ * sized with qfh_compute_design(), built as a symmetric model and solved
+ * across the band with the built-in solver. The candidates of a
+ * generation are solved on a work stealing pool, one design per task:
+ * their solve times differ with their segment counts when spw is set.
+ *
+ * All random numbers are drawn by the calling thread before the
+ * candidates are handed out, so a given seed finds the same design
+ * whatever the number of threads. With a cache, designs solved before
+ * (by any run with the same band and segmentation) are not solved again.
+ */
+
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include "qfh.h"
+
+#define NPARAM 4 // turns, length, radius, ratio
+#define DE_F 0.7 // differential weight
+#define DE_CR 0.9 // crossover probability
+#define SPREAD_TOL 1e-3 // population spread at which the search stops
+
+/* Scratch space of one pool thread */
+typedef struct {
+    qfh_model m;
+    helix h[2];
+    qfh_result *res;
+} optim_worker;
+
+/* A candidate and what the solver made of it */
+typedef struct {
+    double x[NPARAM];
+    double cost;
+    double swr, axial, gain;
+} optim_point;
+
+typedef struct {
+    const qfh_goal *goal;
+    optim_worker *worker;
+    optim_point *trial;
+} optim_job;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* splitmix64, uniform in [0, 1) */
+static double uniform(unsigned long long *state)
+{
+    unsigned long long z=(*state+=0x9e3779b97f4a7c15ULL);
+
+    z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+    z=(z^(z>>27))*0x94d049bb133111ebULL;
+    z^=z>>31;
+    return (z>>11)*(1.0/9007199254740992.0);
+}
+
+/* Searches 0.3 to 1.5 turns, 0.8 to 1.2 wavelengths, 1 to 30 mm bends
+ * and ratios of 0.2 to 0.9 for an SWR below 2 over 2% of freq */
+void qfh_goal_init(qfh_goal *g, double freq, double diam)
+{
+    static const double lo[NPARAM]={0.3, 0.8, 1, 0.2};
+    static const double hi[NPARAM]={1.5, 1.2, 30, 0.9};
+
+    g->freq=freq;
+    g->band=freq*0.02;
+    g->npoints=5;
+    g->swr=2;
+    g->axial=0;
+    g->gain=-HUGE_VAL;
+    g->diam=diam;
+    memcpy(g->lo, lo, sizeof(lo));
+    memcpy(g->hi, hi, sizeof(hi));
+    g->spw=0;
+    g->population=16;
+    g->generations=20;
+    g->seed=1;
+    g->cache=NULL;
+}
+
+static void point_req(const qfh_goal *g, const double *x, design_req *req)
+{
+    req->freq=g->freq;
+    req->turns=x[0];
+    req->length=x[1];
+    req->radius=x[2];
+    req->diam=g->diam;
+    req->ratio=x[3];
+}
+
+/* Cost of a candidate: its highest SWR over the band, plus 10 per unit
+ * of SWR above the goal and 1 per dB of axial ratio or gain beyond the
+ * goal. Designs that cannot be built or solved cost HUGE_VAL. */
+static void evaluate(void *arg, long task, int worker)
+{
+    optim_job *job=(optim_job*)arg;
+    const qfh_goal *g=job->goal;
+    optim_worker *w=&job->worker[worker];
+    optim_point *pt=&job->trial[task];
+    design_req req;
+    qfh_ctx ctx;
+    qfh_cache_key key;
+    double t0;
+    int f, k;
+
+    pt->cost=pt->swr=pt->axial=HUGE_VAL;
+    pt->gain=-HUGE_VAL;
+    point_req(g, pt->x, &req);
+    if(qfh_check_design(&req, NULL, 0))
+        return;
+    qfh_design_model(&req, w->h, &w->m);
+    // the bends have to fit on the loops
+    for(k=0;k<2;k++)
+        if(2*w->h[k].R>=w->h[k].D || 2*w->h[k].R>=w->h[k].H)
+            return;
+    w->m.fstep=g->npoints>1 ? g->band/(g->npoints-1) : 1;
+    w->m.fstart=g->freq-g->band/2;
+    w->m.fstop=w->m.fstart+(g->npoints-0.5)*w->m.fstep;
+    qfh_init(&ctx, NULL, NULL, NULL);
+    ctx.symmetric=1;
+    if(g->spw>0)
+        qfh_adaptive_segmentation(&w->m, g->spw, &ctx.seg);
+    if(g->cache)
+        qfh_cache_key_make(&key, &req, &ctx, &w->m, 0);
+    if(!g->cache ||
+       qfh_cache_get(g->cache, &key, w->res, g->npoints, NULL)!=g->npoints) {
+        t0=now();
+        if(qfh_build_model(&ctx, &w->m) ||
+           qfh_solve_model(&w->m, 1, 0, w->res))
+            return;
+        if(g->cache)
+            qfh_cache_put(g->cache, &key, &w->m.geom, w->res, g->npoints,
+                          now()-t0);
+    }
+    pt->swr=pt->axial=0;
+    pt->gain=HUGE_VAL;
+    for(f=0;f<g->npoints;f++) {
+        pt->swr=fmax(pt->swr, w->res[f].swr);
+        pt->axial=fmax(pt->axial, w->res[f].axial);
+        pt->gain=fmin(pt->gain, w->res[f].gain);
+    }
+    pt->cost=pt->swr+10*fmax(0, pt->swr-g->swr)+fmax(0, g->gain-pt->gain);
+    if(g->axial>0)
+        pt->cost+=fmax(0, pt->axial-g->axial);
+}
+
+/* Largest extent of the population along any parameter, relative to the
+ * width of its bounds */
+static double spread(const qfh_goal *g, const optim_point *pop, int n)
+{
+    double lo, hi, s=0;
+    int i, k;
+
+    for(k=0;k<NPARAM;k++) {
+        lo=hi=pop[0].x[k];
+        for(i=1;i<n;i++) {
+            lo=fmin(lo, pop[i].x[k]);
+            hi=fmax(hi, pop[i].x[k]);
+        }
+        s=fmax(s, (hi-lo)/(g->hi[k]-g->lo[k]));
+    }
+    return s;
+}
+
+static void update_result(const qfh_goal *g, const optim_point *pop, int n,
+                          qfh_optim_result *r)
+{
+    int i, best=0;
+
+    for(i=1;i<n;i++)
+        if(pop[i].cost<pop[best].cost)
+            best=i;
+    point_req(g, pop[best].x, &r->best);
+    r->cost=pop[best].cost;
+    r->swr=pop[best].swr;
+    r->axial=pop[best].axial;
+    r->gain=pop[best].gain;
+    r->spread=spread(g, pop, n);
+}
+
+/* Runs the search on nthreads threads, calling report (if not NULL)
+ * after the first population and after every generation. The best
+ * design is left in r. Returns 0 on success, 1 if out of memory or the
+ * goal is unusable. */
+int qfh_optimize(const qfh_goal *g, int nthreads, qfh_optim_report report,
+                 void *opaque, qfh_optim_result *r)
+{
+    unsigned long long state=g->seed;
+    qfh_pool pool;
+    optim_job job;
+    optim_point *pop, *trial;
+    double t0=now();
+    int np=g->population, i, k, a, b, c, kr, err=0;
+
+    memset(r, 0, sizeof(*r));
+    if(np<4 || g->npoints<1 || g->band<0)
+        return 1;
+    for(k=0;k<NPARAM;k++)
+        if(!(g->lo[k]<=g->hi[k]))
+            return 1;
+    pop=(optim_point*)calloc(np, sizeof(optim_point));
+    trial=(optim_point*)calloc(np, sizeof(optim_point));
+    job.worker=(optim_worker*)calloc(nthreads, sizeof(optim_worker));
+    if(pop==NULL || trial==NULL || job.worker==NULL)
+        err=1;
+    for(i=0;i<nthreads && !err;i++)
+        if((job.worker[i].res=(qfh_result*)malloc(g->npoints*
+                                   sizeof(qfh_result)))==NULL)
+            err=1;
+    if(err || qfh_pool_init(&pool, nthreads)) {
+        if(job.worker)
+            for(i=0;i<nthreads;i++)
+                free(job.worker[i].res);
+        free(job.worker);
+        free(pop);
+        free(trial);
+        return 1;
+    }
+    job.goal=g;
+    job.trial=trial;
+
+    // first population, uniform within the bounds
+    for(i=0;i<np;i++)
+        for(k=0;k<NPARAM;k++)
+            trial[i].x[k]=g->lo[k]+uniform(&state)*(g->hi[k]-g->lo[k]);
+    qfh_pool_run(&pool, np, evaluate, &job);
+    memcpy(pop, trial, np*sizeof(optim_point));
+    r->evals=np;
+    update_result(g, pop, np, r);
+    r->seconds=now()-t0;
+    if(report)
+        report(opaque, r);
+
+    while(r->generation<g->generations && r->spread>=SPREAD_TOL) {
+        for(i=0;i<np;i++) {
+            do a=(int)(uniform(&state)*np); while(a==i);
+            do b=(int)(uniform(&state)*np); while(b==i || b==a);
+            do c=(int)(uniform(&state)*np); while(c==i || c==a || c==b);
+            kr=(int)(uniform(&state)*NPARAM);
+            for(k=0;k<NPARAM;k++) {
+                if(k!=kr && uniform(&state)>=DE_CR) {
+                    trial[i].x[k]=pop[i].x[k];
+                    continue;
+                }
+                trial[i].x[k]=pop[a].x[k]+DE_F*(pop[b].x[k]-pop[c].x[k]);
+                // out of bounds: halfway between the parent and the bound
+                if(trial[i].x[k]<g->lo[k])
+                    trial[i].x[k]=(pop[i].x[k]+g->lo[k])/2;
+                else if(trial[i].x[k]>g->hi[k])
+                    trial[i].x[k]=(pop[i].x[k]+g->hi[k])/2;
+            }
+        }
+        qfh_pool_run(&pool, np, evaluate, &job);
+        for(i=0;i<np;i++)
+            if(trial[i].cost<=pop[i].cost)
+                pop[i]=trial[i];
+        r->evals+=np;
+        r->generation++;
+        update_result(g, pop, np, r);
+        r->seconds=now()-t0;
+        r->steals=qfh_pool_steals(&pool);
+        if(report)
+            report(opaque, r);
+    }
+
+    qfh_pool_free(&pool);
+    for(i=0;i<nthreads;i++) {
+        qfh_model_free(&job.worker[i].m);
+        free(job.worker[i].res);
+    }
+    free(job.worker);
+    free(pop);
+    free(trial);
+    return 0;
+}
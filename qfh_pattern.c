@@ -0,0 +1,321 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Far field of solved currents.
+ *
+ * The current on each segment is linear between the values of the
+ * basis function halves at its ends and is integrated with the same
+ * 4 point Gauss rule as the zenith gain of the solver. The points and
+ * their weighted current vectors are laid out once as arrays, so that a
+ * direction is a dot product for the phases, qfh_sincos() over the
+ * whole array and a complex multiply-accumulate, 4 points at a time
+ * with AVX2. The scalar version keeps the same 4 partial sums and adds
+ * them in the same order, so both give the same bits. Directions are
+ * shared out between threads.
+ *
+ * Circular polarization follows the IEEE convention with the time
+ * dependence exp(jwt) of the solver: the right hand part of the field
+ * is (E_theta + j E_phi)/sqrt(2).
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<complex.h>
+#include<pthread.h>
+#include "qfh.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include<immintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#define C0 299792458.0
+#define ETA0 376.730313668
+
+/* The deck's usual RP card: theta 0 to 180 by 5, phi 0 to 360 by 10 */
+const qfh_grid qfh_rp_default={37, 37, 0, 0, 5, 10};
+
+static const double gl4x[4] = {
+    0.06943184420297371, 0.33000947820757187,
+    0.66999052179242813, 0.93056815579702629
+};
+static const double gl4w[4] = {
+    0.17392742256872693, 0.32607257743127307,
+    0.32607257743127307, 0.17392742256872693
+};
+
+/* Integration points, a multiple of 4 with zero current padding */
+typedef struct {
+    int n;
+    double *x, *y, *z; // position times k
+    double *jr[3], *ji[3]; // x, y and z of the weighted current
+} far_points;
+
+typedef struct {
+    const far_points *fp;
+    const qfh_grid *grid;
+    double fac; // k^2 eta / (8 pi pin)
+    qfh_farpoint *pts;
+    int thread, nthreads;
+    int err;
+} far_job;
+
+/* Parses a pattern grid: "full" for the usual RP card, "zenith",
+ * "elevation" (theta 0 to 90 by 1 degree at phi 0), "horizon" (phi 0 to
+ * 355 by 5 degrees at theta 90), "none" for no pattern, or the six RP
+ * numbers ntheta,nphi,theta0,phi0,dtheta,dphi. Returns 0 on success. */
+int qfh_grid_parse(qfh_grid *g, const char *spec)
+{
+    static const struct {
+        const char *name;
+        qfh_grid g;
+    } presets[]={
+        {"full", {37, 37, 0, 0, 5, 10}},
+        {"zenith", {1, 1, 0, 0, 0, 0}},
+        {"elevation", {91, 1, 0, 0, 1, 0}},
+        {"horizon", {1, 72, 90, 0, 0, 5}},
+        {"none", {0, 0, 0, 0, 0, 0}},
+    };
+    char end;
+    size_t i;
+
+    for(i=0;i<sizeof(presets)/sizeof(presets[0]);i++)
+        if(strcmp(spec, presets[i].name)==0) {
+            *g=presets[i].g;
+            return 0;
+        }
+    if(sscanf(spec, "%d,%d,%lf,%lf,%lf,%lf%c", &g->ntheta, &g->nphi,
+              &g->theta0, &g->phi0, &g->dtheta, &g->dphi, &end)!=6)
+        return 1;
+    return g->ntheta<1 || g->nphi<1 || g->ntheta>100000 || g->nphi>100000;
+}
+
+static void far_points_free(far_points *fp)
+{
+    free(fp->x);
+    memset(fp, 0, sizeof(*fp));
+}
+
+static int far_points_init(far_points *fp, const qfh_mesh *ms, double k,
+                           const double complex *cur)
+{
+    double complex ia, ib, j;
+    double *p, t, d[3];
+    int s, h, q, c, i;
+
+    fp->n=(4*ms->nseg+3)&~3;
+    if((p=(double*)calloc(9*(size_t)fp->n, sizeof(double)))==NULL)
+        return 1;
+    fp->x=p;
+    fp->y=p+fp->n;
+    fp->z=p+2*fp->n;
+    for(c=0;c<3;c++) {
+        fp->jr[c]=p+(3+2*c)*(size_t)fp->n;
+        fp->ji[c]=p+(4+2*c)*(size_t)fp->n;
+    }
+    for(s=0;s<ms->nseg;s++) {
+        // current at the start and the end of the segment
+        ia=ib=0;
+        for(h=ms->shalf_start[s];h<ms->shalf_start[s+1];h++) {
+            if(ms->hend[ms->shalf[h]])
+                ib+=cur[ms->shalf[h]/2]*ms->hsign[ms->shalf[h]];
+            else
+                ia+=cur[ms->shalf[h]/2]*ms->hsign[ms->shalf[h]];
+        }
+        d[0]=ms->dx[s];
+        d[1]=ms->dy[s];
+        d[2]=ms->dz[s];
+        for(q=0;q<4;q++) {
+            i=4*s+q;
+            t=gl4x[q]*ms->len[s];
+            fp->x[i]=k*(ms->ax[s]+t*d[0]);
+            fp->y[i]=k*(ms->ay[s]+t*d[1]);
+            fp->z[i]=k*(ms->az[s]+t*d[2]);
+            j=gl4w[q]*ms->len[s]*(ia*(1-gl4x[q])+ib*gl4x[q]);
+            for(c=0;c<3;c++) {
+                fp->jr[c][i]=creal(j)*d[c];
+                fp->ji[c][i]=cimag(j)*d[c];
+            }
+        }
+    }
+    return 0;
+}
+
+/* acc[c][l] (real) and acc[c][4+l] (imaginary) sum the points p with
+ * p%4==l of component c */
+static void accumulate(const far_points *fp, const double *cs,
+                       const double *sn, double acc[3][8])
+{
+    int c, p, l;
+
+    memset(acc, 0, 3*sizeof(acc[0]));
+    for(c=0;c<3;c++)
+        for(p=0;p<fp->n;p+=4)
+            for(l=0;l<4;l++) {
+                acc[c][l]+=fp->jr[c][p+l]*cs[p+l]-fp->ji[c][p+l]*sn[p+l];
+                acc[c][4+l]+=fp->jr[c][p+l]*sn[p+l]+fp->ji[c][p+l]*cs[p+l];
+            }
+}
+
+#ifdef HAVE_SSE2
+__attribute__((target("avx2")))
+static void accumulate_avx2(const far_points *fp, const double *cs,
+                            const double *sn, double acc[3][8])
+{
+    __m256d re, im, jr, ji, c4, s4;
+    int c, p;
+
+    for(c=0;c<3;c++) {
+        re=im=_mm256_setzero_pd();
+        for(p=0;p<fp->n;p+=4) {
+            jr=_mm256_loadu_pd(fp->jr[c]+p);
+            ji=_mm256_loadu_pd(fp->ji[c]+p);
+            c4=_mm256_loadu_pd(cs+p);
+            s4=_mm256_loadu_pd(sn+p);
+            re=_mm256_add_pd(re, _mm256_sub_pd(_mm256_mul_pd(jr, c4),
+                                               _mm256_mul_pd(ji, s4)));
+            im=_mm256_add_pd(im, _mm256_add_pd(_mm256_mul_pd(jr, s4),
+                                               _mm256_mul_pd(ji, c4)));
+        }
+        _mm256_storeu_pd(acc[c], re);
+        _mm256_storeu_pd(acc[c]+4, im);
+    }
+}
+#endif
+
+static double db(double x)
+{
+    return 10*log10(x);
+}
+
+static void *far_worker(void *arg)
+{
+    far_job *job=(far_job*)arg;
+    const far_points *fp=job->fp;
+    const qfh_grid *g=job->grid;
+    double *ph, *sn, *cs, acc[3][8], th, phi, st, ct, sp, cp, ux, uy, uz;
+    double complex n[3], et, ep, r, l;
+    long d, nd=(long)g->ntheta*g->nphi;
+    qfh_farpoint *o;
+    int p, c, avx2=0;
+
+#ifdef HAVE_SSE2
+    avx2=__builtin_cpu_supports("avx2");
+#endif
+    if((ph=(double*)malloc(3*(size_t)fp->n*sizeof(double)))==NULL) {
+        job->err=1;
+        return NULL;
+    }
+    sn=ph+fp->n;
+    cs=sn+fp->n;
+    for(d=nd*job->thread/job->nthreads;d<nd*(job->thread+1)/job->nthreads;d++) {
+        // theta varies fastest, as in NEC output
+        th=(g->theta0+(d%g->ntheta)*g->dtheta)*pi/180;
+        phi=(g->phi0+(d/g->ntheta)*g->dphi)*pi/180;
+        st=sin(th);
+        ct=cos(th);
+        sp=sin(phi);
+        cp=cos(phi);
+        ux=st*cp;
+        uy=st*sp;
+        uz=ct;
+        for(p=0;p<fp->n;p++)
+            ph[p]=ux*fp->x[p]+uy*fp->y[p]+uz*fp->z[p];
+        qfh_sincos(ph, sn, cs, fp->n);
+#ifdef HAVE_SSE2
+        if(avx2)
+            accumulate_avx2(fp, cs, sn, acc);
+        else
+#endif
+            accumulate(fp, cs, sn, acc);
+        for(c=0;c<3;c++)
+            n[c]=CMPLX((acc[c][0]+acc[c][1])+(acc[c][2]+acc[c][3]),
+                       (acc[c][4]+acc[c][5])+(acc[c][6]+acc[c][7]));
+        et=ct*cp*n[0]+ct*sp*n[1]-st*n[2];
+        ep=-sp*n[0]+cp*n[1];
+        r=(et+I*ep)/sqrt(2);
+        l=(et-I*ep)/sqrt(2);
+        o=&job->pts[d];
+        o->theta=th*180/pi;
+        o->phi=phi*180/pi;
+        o->gain=db(job->fac*(creal(et*conj(et))+creal(ep*conj(ep))));
+        o->rhcp=db(job->fac*creal(r*conj(r)));
+        o->lhcp=db(job->fac*creal(l*conj(l)));
+        o->axial=cabs(r)==cabs(l) ? INFINITY :
+            20*log10((cabs(r)+cabs(l))/fabs(cabs(r)-cabs(l)));
+    }
+    free(ph);
+    return NULL;
+}
+
+/* Far field of the basis function currents cur of mesh ms at freq MHz,
+ * for an input power of pin watts, in every direction of grid (theta
+ * fastest) into pts, on nthreads threads. Returns 0 on success. */
+int qfh_pattern(const qfh_mesh *ms, double freq, const double complex *cur,
+                double pin, const qfh_grid *grid, int nthreads,
+                qfh_farpoint *pts)
+{
+    far_points fp;
+    far_job *jobs;
+    pthread_t *tid;
+    double k=2*pi*freq*1e6/C0;
+    long nd=(long)grid->ntheta*grid->nphi;
+    int i, err=0;
+
+    if(nd<=0)
+        return 0;
+    if(nthreads>nd)
+        nthreads=(int)nd;
+    if(nthreads<1)
+        nthreads=1;
+    if(far_points_init(&fp, ms, k, cur))
+        return 1;
+    jobs=(far_job*)calloc(nthreads, sizeof(far_job));
+    tid=(pthread_t*)malloc(nthreads*sizeof(pthread_t));
+    if(jobs==NULL || tid==NULL) {
+        free(jobs);
+        free(tid);
+        far_points_free(&fp);
+        return 1;
+    }
+    for(i=0;i<nthreads;i++) {
+        jobs[i].fp=&fp;
+        jobs[i].grid=grid;
+        jobs[i].fac=k*k*ETA0/(8*pi*pin);
+        jobs[i].pts=pts;
+        jobs[i].thread=i;
+        jobs[i].nthreads=nthreads;
+        if(i>0 && pthread_create(&tid[i], NULL, far_worker, &jobs[i]))
+            jobs[i].nthreads=0; // not started, done below
+    }
+    far_worker(&jobs[0]);
+    for(i=1;i<nthreads;i++) {
+        if(jobs[i].nthreads)
+            pthread_join(tid[i], NULL);
+        else {
+            jobs[i].nthreads=nthreads;
+            far_worker(&jobs[i]);
+        }
+        err|=jobs[i].err;
+    }
+    err|=jobs[0].err;
+    free(jobs);
+    free(tid);
+    far_points_free(&fp);
+    return err;
+}
@@ -0,0 +1,198 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Work stealing thread pool.
+ *
+ * The threads are started once and kept for every qfh_pool_run(). A run
+ * hands the tasks 0..n-1 out as one contiguous range per worker. A
+ * worker takes its tasks from the top of its own range; once that is
+ * empty it steals the bottom half of the largest range left. Workers
+ * that drew slow tasks are relieved by the others, and no lock shared
+ * by all the workers is taken per task.
+ */
+
+#include<stdlib.h>
+#include<pthread.h>
+#include "qfh.h"
+
+/* Takes the next task of worker w, stealing if its range is empty.
+ * Returns -1 once no range has any tasks left. Tasks being moved by a
+ * thief are run by that thief, so none are lost when this gives up. */
+static long pool_take(qfh_pool *p, qfh_pool_worker *w)
+{
+    qfh_pool_worker *v;
+    long task=-1, n, most;
+    int i, victim;
+
+    pthread_mutex_lock(&w->lock);
+    if(w->lo<w->hi)
+        task=--w->hi;
+    pthread_mutex_unlock(&w->lock);
+    while(task<0) {
+        victim=-1;
+        most=0;
+        for(i=0;i<p->nthreads;i++) {
+            v=&p->worker[i];
+            pthread_mutex_lock(&v->lock);
+            n=v->hi-v->lo;
+            pthread_mutex_unlock(&v->lock);
+            if(n>most) {
+                most=n;
+                victim=i;
+            }
+        }
+        if(victim<0)
+            return -1;
+        v=&p->worker[victim];
+        pthread_mutex_lock(&v->lock);
+        n=v->hi-v->lo;
+        if(n>0) {
+            task=v->lo;
+            v->lo+=(n+1)/2;
+            n=(n+1)/2;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if(task<0)
+            continue;
+        pthread_mutex_lock(&w->lock);
+        w->lo=task+1;
+        w->hi=task+n;
+        w->steals++;
+        pthread_mutex_unlock(&w->lock);
+    }
+    return task;
+}
+
+static void *pool_thread(void *arg)
+{
+    qfh_pool_worker *w=(qfh_pool_worker*)arg;
+    qfh_pool *p=w->pool;
+    unsigned long seen=0;
+    long task;
+
+    for(;;) {
+        pthread_mutex_lock(&p->lock);
+        while(p->round==seen && !p->quit)
+            pthread_cond_wait(&p->start, &p->lock);
+        if(p->quit) {
+            pthread_mutex_unlock(&p->lock);
+            return NULL;
+        }
+        seen=p->round;
+        pthread_mutex_unlock(&p->lock);
+
+        while((task=pool_take(p, w))>=0)
+            p->fn(p->arg, task, w->id);
+
+        pthread_mutex_lock(&p->lock);
+        if(--p->active==0)
+            pthread_cond_signal(&p->done);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+/* Starts nthreads workers. Returns 0 on success. */
+int qfh_pool_init(qfh_pool *p, int nthreads)
+{
+    int i;
+
+    p->nthreads=0;
+    p->round=0;
+    p->active=0;
+    p->quit=0;
+    p->worker=(qfh_pool_worker*)calloc(nthreads, sizeof(qfh_pool_worker));
+    if(nthreads<1 || p->worker==NULL) {
+        free(p->worker);
+        return 1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for(i=0;i<nthreads;i++) {
+        p->worker[i].pool=p;
+        p->worker[i].id=i;
+        pthread_mutex_init(&p->worker[i].lock, NULL);
+        if(pthread_create(&p->worker[i].tid, NULL, pool_thread,
+                          &p->worker[i])) {
+            pthread_mutex_destroy(&p->worker[i].lock);
+            qfh_pool_free(p);
+            return 1;
+        }
+        p->nthreads++;
+    }
+    return 0;
+}
+
+/* Calls fn(arg, task, worker) for every task from 0 to n-1 and returns
+ * once all of them are done. worker is the number of the thread running
+ * the task, below p->nthreads, for per thread scratch space. */
+void qfh_pool_run(qfh_pool *p, long n, qfh_task_fn fn, void *arg)
+{
+    qfh_pool_worker *w;
+    int i;
+
+    for(i=0;i<p->nthreads;i++) {
+        w=&p->worker[i];
+        pthread_mutex_lock(&w->lock);
+        w->lo=n*i/p->nthreads;
+        w->hi=n*(i+1)/p->nthreads;
+        pthread_mutex_unlock(&w->lock);
+    }
+    pthread_mutex_lock(&p->lock);
+    p->fn=fn;
+    p->arg=arg;
+    p->active=p->nthreads;
+    p->round++;
+    pthread_cond_broadcast(&p->start);
+    while(p->active>0)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Ranges stolen so far, over all the runs */
+long qfh_pool_steals(qfh_pool *p)
+{
+    long n=0;
+    int i;
+
+    for(i=0;i<p->nthreads;i++) {
+        pthread_mutex_lock(&p->worker[i].lock);
+        n+=p->worker[i].steals;
+        pthread_mutex_unlock(&p->worker[i].lock);
+    }
+    return n;
+}
+
+/* Stops the workers and frees the pool */
+void qfh_pool_free(qfh_pool *p)
+{
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit=1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for(i=0;i<p->nthreads;i++) {
+        pthread_join(p->worker[i].tid, NULL);
+        pthread_mutex_destroy(&p->worker[i].lock);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start);
+    pthread_cond_destroy(&p->done);
+    free(p->worker);
+    p->worker=NULL;
+    p->nthreads=0;
+}
@@ -0,0 +1,227 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sine and cosine of whole arrays of angles, for the points of the bends
+ * and helical wires.
+ *
+ * The angle is reduced to r in [-pi/4, pi/4] with a three part pi/2
+ * (Cody and Waite), and sin r and cos r are the fdlibm minimax
+ * polynomials. Both results are within 1 ulp of the correctly rounded
+ * value for |x| < 2^19 (the largest difference to glibc measured by
+ * QFH2nec --bench-geometry is 1 ulp); larger or non-finite angles are
+ * handed to libm.
+ *
+ * The AVX2 and SSE2 versions compute 4 and 2 angles at a time with the
+ * same operations in the same order as the scalar one, without fused
+ * multiply-add, so the results do not depend on the processor.
+ */
+
+#include<math.h>
+#include<stdint.h>
+#include<string.h>
+#include "qfh.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include<immintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+#define LIMIT 524288.0 // 2^19, k*P1 and k*P2 below are exact
+
+static const double invpio2=6.36619772367581382433e-01;
+static const double P1=1.57079632673412561417e+00; // first 33 bits of pi/2
+static const double P2=6.07710050630396597660e-11; // next 33 bits
+static const double P3=2.02226624879595063154e-21; // the rest
+static const double round_magic=6755399441055744.0; // 1.5*2^52
+
+static const double S1=-1.66666666666666324348e-01;
+static const double S2=8.33333333332248946124e-03;
+static const double S3=-1.98412698298579493134e-04;
+static const double S4=2.75573137070700676789e-06;
+static const double S5=-2.50507602534068634195e-08;
+static const double S6=1.58969099521155010221e-10;
+
+static const double C1=4.16666666666666019037e-02;
+static const double C2=-1.38888888888741095749e-03;
+static const double C3=2.48015872894767294178e-05;
+static const double C4=-2.75573143513906633035e-07;
+static const double C5=2.08757232129817482790e-09;
+static const double C6=-1.13596475577881948265e-11;
+
+static void sincos_scalar(const double *x, double *s, double *c, int n)
+{
+    double t, k, r, z, ps, pc, hz, w, rs, rc;
+    uint64_t q;
+    int i;
+
+    for(i=0;i<n;i++) {
+        if(!(fabs(x[i])<LIMIT)) {
+            s[i]=sin(x[i]);
+            c[i]=cos(x[i]);
+            continue;
+        }
+        // nearest k, the low bits of t hold it
+        t=x[i]*invpio2+round_magic;
+        k=t-round_magic;
+        memcpy(&q, &t, sizeof(q));
+        r=((x[i]-k*P1)-k*P2)-k*P3;
+        z=r*r;
+        ps=S2+z*(S3+z*(S4+z*(S5+z*S6)));
+        rs=r+z*r*(S1+z*ps);
+        pc=z*(C1+z*(C2+z*(C3+z*(C4+z*(C5+z*C6)))));
+        hz=0.5*z;
+        w=1.0-hz;
+        rc=w+(((1.0-w)-hz)+z*pc);
+        switch(q&3) {
+            case 0: s[i]=rs; c[i]=rc; break;
+            case 1: s[i]=rc; c[i]=-rs; break;
+            case 2: s[i]=-rs; c[i]=-rc; break;
+            default: s[i]=-rc; c[i]=rs; break;
+        }
+    }
+}
+
+#ifdef HAVE_SSE2
+static void sincos_sse2(const double *x, double *s, double *c, int n)
+{
+    const __m128d sign=_mm_set1_pd(-0.0), lim=_mm_set1_pd(LIMIT);
+    const __m128i one=_mm_set1_epi64x(1);
+    __m128d vx, t, k, r, z, ps, pc, hz, w, rs, rc, swap, vs, vc;
+    __m128i q;
+    int i;
+
+    for(i=0;i+2<=n;i+=2) {
+        vx=_mm_loadu_pd(x+i);
+        if(_mm_movemask_pd(_mm_cmplt_pd(_mm_andnot_pd(sign, vx), lim))!=3) {
+            sincos_scalar(x+i, s+i, c+i, 2);
+            continue;
+        }
+        t=_mm_add_pd(_mm_mul_pd(vx, _mm_set1_pd(invpio2)),
+                     _mm_set1_pd(round_magic));
+        k=_mm_sub_pd(t, _mm_set1_pd(round_magic));
+        q=_mm_castpd_si128(t);
+        r=_mm_sub_pd(vx, _mm_mul_pd(k, _mm_set1_pd(P1)));
+        r=_mm_sub_pd(r, _mm_mul_pd(k, _mm_set1_pd(P2)));
+        r=_mm_sub_pd(r, _mm_mul_pd(k, _mm_set1_pd(P3)));
+        z=_mm_mul_pd(r, r);
+        ps=_mm_add_pd(_mm_set1_pd(S5), _mm_mul_pd(z, _mm_set1_pd(S6)));
+        ps=_mm_add_pd(_mm_set1_pd(S4), _mm_mul_pd(z, ps));
+        ps=_mm_add_pd(_mm_set1_pd(S3), _mm_mul_pd(z, ps));
+        ps=_mm_add_pd(_mm_set1_pd(S2), _mm_mul_pd(z, ps));
+        ps=_mm_add_pd(_mm_set1_pd(S1), _mm_mul_pd(z, ps));
+        rs=_mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(z, r), ps));
+        pc=_mm_add_pd(_mm_set1_pd(C5), _mm_mul_pd(z, _mm_set1_pd(C6)));
+        pc=_mm_add_pd(_mm_set1_pd(C4), _mm_mul_pd(z, pc));
+        pc=_mm_add_pd(_mm_set1_pd(C3), _mm_mul_pd(z, pc));
+        pc=_mm_add_pd(_mm_set1_pd(C2), _mm_mul_pd(z, pc));
+        pc=_mm_mul_pd(z, _mm_add_pd(_mm_set1_pd(C1), _mm_mul_pd(z, pc)));
+        hz=_mm_mul_pd(_mm_set1_pd(0.5), z);
+        w=_mm_sub_pd(_mm_set1_pd(1.0), hz);
+        rc=_mm_sub_pd(_mm_sub_pd(_mm_set1_pd(1.0), w), hz);
+        rc=_mm_add_pd(w, _mm_add_pd(rc, _mm_mul_pd(z, pc)));
+        // odd quadrants swap sine and cosine: all ones where bit 0 is set
+        swap=_mm_castsi128_pd(_mm_srai_epi32(_mm_shuffle_epi32(
+            _mm_slli_epi64(q, 63), _MM_SHUFFLE(3, 3, 1, 1)), 31));
+        vs=_mm_or_pd(_mm_and_pd(swap, rc), _mm_andnot_pd(swap, rs));
+        vc=_mm_or_pd(_mm_and_pd(swap, rs), _mm_andnot_pd(swap, rc));
+        // sine negative in quadrants 2 and 3, cosine in 1 and 2
+        vs=_mm_xor_pd(vs, _mm_and_pd(sign,
+                      _mm_castsi128_pd(_mm_slli_epi64(q, 62))));
+        vc=_mm_xor_pd(vc, _mm_and_pd(sign, _mm_castsi128_pd(
+                      _mm_slli_epi64(_mm_add_epi64(q, one), 62))));
+        _mm_storeu_pd(s+i, vs);
+        _mm_storeu_pd(c+i, vc);
+    }
+    sincos_scalar(x+i, s+i, c+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void sincos_avx2(const double *x, double *s, double *c, int n)
+{
+    const __m256d sign=_mm256_set1_pd(-0.0), lim=_mm256_set1_pd(LIMIT);
+    const __m256i one=_mm256_set1_epi64x(1);
+    __m256d vx, t, k, r, z, ps, pc, hz, w, rs, rc, swap, vs, vc;
+    __m256i q;
+    int i;
+
+    for(i=0;i+4<=n;i+=4) {
+        vx=_mm256_loadu_pd(x+i);
+        if(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, vx), lim,
+                                            _CMP_LT_OQ))!=15) {
+            sincos_scalar(x+i, s+i, c+i, 4);
+            continue;
+        }
+        t=_mm256_add_pd(_mm256_mul_pd(vx, _mm256_set1_pd(invpio2)),
+                        _mm256_set1_pd(round_magic));
+        k=_mm256_sub_pd(t, _mm256_set1_pd(round_magic));
+        q=_mm256_castpd_si256(t);
+        r=_mm256_sub_pd(vx, _mm256_mul_pd(k, _mm256_set1_pd(P1)));
+        r=_mm256_sub_pd(r, _mm256_mul_pd(k, _mm256_set1_pd(P2)));
+        r=_mm256_sub_pd(r, _mm256_mul_pd(k, _mm256_set1_pd(P3)));
+        z=_mm256_mul_pd(r, r);
+        ps=_mm256_add_pd(_mm256_set1_pd(S5), _mm256_mul_pd(z, _mm256_set1_pd(S6)));
+        ps=_mm256_add_pd(_mm256_set1_pd(S4), _mm256_mul_pd(z, ps));
+        ps=_mm256_add_pd(_mm256_set1_pd(S3), _mm256_mul_pd(z, ps));
+        ps=_mm256_add_pd(_mm256_set1_pd(S2), _mm256_mul_pd(z, ps));
+        ps=_mm256_add_pd(_mm256_set1_pd(S1), _mm256_mul_pd(z, ps));
+        rs=_mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(z, r), ps));
+        pc=_mm256_add_pd(_mm256_set1_pd(C5), _mm256_mul_pd(z, _mm256_set1_pd(C6)));
+        pc=_mm256_add_pd(_mm256_set1_pd(C4), _mm256_mul_pd(z, pc));
+        pc=_mm256_add_pd(_mm256_set1_pd(C3), _mm256_mul_pd(z, pc));
+        pc=_mm256_add_pd(_mm256_set1_pd(C2), _mm256_mul_pd(z, pc));
+        pc=_mm256_mul_pd(z, _mm256_add_pd(_mm256_set1_pd(C1),
+                                          _mm256_mul_pd(z, pc)));
+        hz=_mm256_mul_pd(_mm256_set1_pd(0.5), z);
+        w=_mm256_sub_pd(_mm256_set1_pd(1.0), hz);
+        rc=_mm256_sub_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), w), hz);
+        rc=_mm256_add_pd(w, _mm256_add_pd(rc, _mm256_mul_pd(z, pc)));
+        // blendv selects on the sign bit, so bit 0 is moved there
+        swap=_mm256_castsi256_pd(_mm256_slli_epi64(q, 63));
+        vs=_mm256_blendv_pd(rs, rc, swap);
+        vc=_mm256_blendv_pd(rc, rs, swap);
+        vs=_mm256_xor_pd(vs, _mm256_and_pd(sign,
+                         _mm256_castsi256_pd(_mm256_slli_epi64(q, 62))));
+        vc=_mm256_xor_pd(vc, _mm256_and_pd(sign, _mm256_castsi256_pd(
+                         _mm256_slli_epi64(_mm256_add_epi64(q, one), 62))));
+        _mm256_storeu_pd(s+i, vs);
+        _mm256_storeu_pd(c+i, vc);
+    }
+    sincos_scalar(x+i, s+i, c+i, n-i);
+}
+#endif
+
+/* s[i]=sin(x[i]) and c[i]=cos(x[i]) for i<n */
+void qfh_sincos(const double *x, double *s, double *c, int n)
+{
+#ifdef HAVE_SSE2
+    if(__builtin_cpu_supports("avx2"))
+        sincos_avx2(x, s, c, n);
+    else
+        sincos_sse2(x, s, c, n);
+#else
+    sincos_scalar(x, s, c, n);
+#endif
+}
+
+/* Which of the versions above qfh_sincos() uses */
+const char *qfh_sincos_kernel(void)
+{
+#ifdef HAVE_SSE2
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,1681 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Thin-wire method of moments solver.
+ *
+ * The wires of a qfh_geom are split into their NEC segments. The current
+ * is expanded in triangle functions spanning each pair of segments that
+ * meet at a node (k-1 functions at a junction of k segments) and the
+ * mixed potential electric field integral equation is tested with the
+ * same functions (Galerkin). The kernel is the thin-wire reduced kernel
+ * exp(-jkR)/R with R measured to the wire surface; its 1/R part is
+ * integrated analytically for nearby segments.
+ *
+ * Sources (EX 0) are delta gaps and loads (LD 4) series impedances at
+ * segment centres, as in NEC2.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<ctype.h>
+#include<complex.h>
+#include<pthread.h>
+#include "qfh.h"
+
+#define C0 299792458.0
+#define ETA0 376.730313668
+
+/* Gauss-Legendre rules on [0,1] */
+static const double gl2x[2] = { 0.21132486540518712, 0.78867513459481288 };
+static const double gl2w[2] = { 0.5, 0.5 };
+static const double gl4x[4] = {
+    0.06943184420297371, 0.33000947820757187,
+    0.66999052179242813, 0.93056815579702629
+};
+static const double gl4w[4] = {
+    0.17392742256872693, 0.32607257743127307,
+    0.32607257743127307, 0.17392742256872693
+};
+static const double gl8x[8] = {
+    0.01985507175123188, 0.10166676129318664,
+    0.23723379504183550, 0.40828267875217510,
+    0.59171732124782490, 0.76276620495816450,
+    0.89833323870681336, 0.98014492824876812
+};
+static const double gl8w[8] = {
+    0.05061426814518813, 0.11119051722668724,
+    0.15685332293894364, 0.18134189168918099,
+    0.18134189168918099, 0.15685332293894364,
+    0.11119051722668724, 0.05061426814518813
+};
+
+/*
+ * Mesh construction
+ */
+
+typedef struct {
+    double x;
+    int seg;
+    int end;
+} wire_end;
+
+/* A wire end on the axis of the sweep, with its point and the length of
+ * its segment */
+typedef struct {
+    double x;
+    double p[3];
+    double len;
+    int i; // in the ends sorted along x
+} sweep_end;
+
+static int cmp_wire_end(const void *a, const void *b)
+{
+    double d=((const wire_end*)a)->x-((const wire_end*)b)->x;
+    return d<0 ? -1 : d>0;
+}
+
+static int cmp_sweep_end(const void *a, const void *b)
+{
+    double d=((const sweep_end*)a)->x-((const sweep_end*)b)->x;
+    return d<0 ? -1 : d>0;
+}
+
+static int find_root(int *parent, int i)
+{
+    while(parent[i]!=i)
+        i=parent[i]=parent[parent[i]];
+    return i;
+}
+
+static void end_point(const qfh_mesh *ms, int s, int end, double *p)
+{
+    double t=end ? ms->len[s] : 0;
+
+    p[0]=ms->ax[s]+t*ms->dx[s];
+    p[1]=ms->ay[s]+t*ms->dy[s];
+    p[2]=ms->az[s]+t*ms->dz[s];
+}
+
+/* Adds the basis function made of the half flowing into the node on
+ * segment s (at end es) and the half flowing out of it on segment t */
+static void add_basis(qfh_mesh *ms, int s, int es, int t, int et)
+{
+    int b=ms->nbasis++;
+
+    ms->hseg[2*b]=s;
+    ms->hend[2*b]=(signed char)es;
+    ms->hsign[2*b]=(signed char)(es ? 1 : -1);
+    ms->hseg[2*b+1]=t;
+    ms->hend[2*b+1]=(signed char)et;
+    ms->hsign[2*b+1]=(signed char)(et ? -1 : 1);
+}
+
+/* Splits the wires of g into segments and sets up the basis functions.
+ * Wire ends closer than a thousandth of the shorter segment are joined.
+ * Returns 0 on success. */
+int qfh_mesh_build(qfh_mesh *ms, const qfh_geom *g)
+{
+    wire_end *ends;
+    sweep_end *sweep;
+    int *parent, *first, *count;
+    int w, s, i, j, k, n, ns, nmax, r, axis;
+    double px[3], lo[3], hi[3], l, d, tol, tolmax=0;
+    char *p;
+
+    memset(ms, 0, sizeof(*ms));
+    for(n=0,w=0;w<g->n;w++)
+        n+=g->segs[w];
+    ns=n;
+    // at most one basis per segment end
+    nmax=2*ns;
+    if((p=(char*)calloc(1, (size_t)ns*8*sizeof(double)
+                          + (size_t)nmax*2*(sizeof(int)+2)
+                          + (size_t)(ns+1+2*nmax+g->n)*sizeof(int)))==NULL)
+        return 1;
+    ms->arena=p;
+    ms->ax=(double*)p;
+    ms->ay=ms->ax+ns;
+    ms->az=ms->ay+ns;
+    ms->dx=ms->az+ns;
+    ms->dy=ms->dx+ns;
+    ms->dz=ms->dy+ns;
+    ms->len=ms->dz+ns;
+    ms->a=ms->len+ns;
+    ms->hseg=(int*)(ms->a+ns);
+    ms->shalf_start=ms->hseg+2*nmax;
+    ms->shalf=ms->shalf_start+ns+1;
+    ms->wfirst=ms->shalf+2*nmax;
+    ms->hsign=(signed char*)(ms->wfirst+g->n);
+    ms->hend=ms->hsign+2*nmax;
+    ms->nseg=ns;
+
+    for(s=0,w=0;w<g->n;w++) {
+        ms->wfirst[w]=s;
+        px[0]=g->x2[w]-g->x1[w];
+        px[1]=g->y2[w]-g->y1[w];
+        px[2]=g->z2[w]-g->z1[w];
+        l=sqrt(px[0]*px[0]+px[1]*px[1]+px[2]*px[2]);
+        for(i=0;i<g->segs[w];i++,s++) {
+            ms->ax[s]=g->x1[w]+px[0]*i/g->segs[w];
+            ms->ay[s]=g->y1[w]+px[1]*i/g->segs[w];
+            ms->az[s]=g->z1[w]+px[2]*i/g->segs[w];
+            ms->dx[s]=l>0 ? px[0]/l : 0;
+            ms->dy[s]=l>0 ? px[1]/l : 0;
+            ms->dz[s]=l>0 ? px[2]/l : 1;
+            ms->len[s]=l/g->segs[w];
+            ms->a[s]=g->radius[w];
+            if(1e-3*ms->len[s]>tolmax)
+                tolmax=1e-3*ms->len[s];
+        }
+    }
+
+    // joints inside a wire
+    for(w=0;w<g->n;w++)
+        for(i=1;i<g->segs[w];i++)
+            add_basis(ms, ms->wfirst[w]+i-1, 1, ms->wfirst[w]+i, 0);
+
+    // joints between wire ends, found by sweeping the ends sorted along
+    // the axis they spread furthest on; the functions are numbered in
+    // the order of the ends along x
+    ends=(wire_end*)malloc(2*(size_t)g->n*sizeof(wire_end));
+    sweep=(sweep_end*)malloc(2*(size_t)g->n*sizeof(sweep_end));
+    parent=(int*)malloc(2*(size_t)g->n*sizeof(int));
+    first=(int*)malloc(2*(size_t)g->n*sizeof(int));
+    if(ends==NULL || sweep==NULL || parent==NULL || first==NULL) {
+        free(ends);
+        free(sweep);
+        free(parent);
+        free(first);
+        qfh_mesh_free(ms);
+        return 1;
+    }
+    for(w=0;w<g->n;w++) {
+        ends[2*w].seg=ms->wfirst[w];
+        ends[2*w].end=0;
+        ends[2*w].x=g->x1[w];
+        ends[2*w+1].seg=ms->wfirst[w]+g->segs[w]-1;
+        ends[2*w+1].end=1;
+        ends[2*w+1].x=g->x2[w];
+    }
+    n=2*g->n;
+    qsort(ends, n, sizeof(wire_end), cmp_wire_end);
+    for(k=0;k<3;k++) {
+        lo[k]=HUGE_VAL;
+        hi[k]=-HUGE_VAL;
+    }
+    for(i=0;i<n;i++) {
+        end_point(ms, ends[i].seg, ends[i].end, sweep[i].p);
+        sweep[i].len=ms->len[ends[i].seg];
+        sweep[i].i=i;
+        for(k=0;k<3;k++) {
+            lo[k]=fmin(lo[k], sweep[i].p[k]);
+            hi[k]=fmax(hi[k], sweep[i].p[k]);
+        }
+    }
+    axis=0;
+    for(k=1;k<3;k++)
+        if(hi[k]-lo[k]>hi[axis]-lo[axis])
+            axis=k;
+    for(i=0;i<n;i++)
+        sweep[i].x=sweep[i].p[axis];
+    if(axis>0)
+        qsort(sweep, n, sizeof(sweep_end), cmp_sweep_end);
+    for(i=0;i<n;i++)
+        parent[i]=i;
+    for(i=0;i<n;i++) {
+        for(j=i+1;j<n && sweep[j].x-sweep[i].x<=tolmax;j++) {
+            for(d=0,k=0;k<3;k++)
+                d+=(sweep[i].p[k]-sweep[j].p[k])*(sweep[i].p[k]-sweep[j].p[k]);
+            tol=1e-3*fmin(sweep[i].len, sweep[j].len);
+            if(sqrt(d)<=tol)
+                parent[find_root(parent, sweep[j].i)]=
+                    find_root(parent, sweep[i].i);
+        }
+    }
+    // the end on the lowest segment of each group is the reference of
+    // its k-1 functions, so that rotated copies of a structure get
+    // rotated copies of its functions
+    for(i=0;i<n;i++)
+        first[i]=-1;
+    for(i=0;i<n;i++) {
+        r=find_root(parent, i);
+        if(first[r]<0 || ends[i].seg<ends[first[r]].seg ||
+           (ends[i].seg==ends[first[r]].seg && ends[i].end<ends[first[r]].end))
+            first[r]=i;
+    }
+    for(i=0;i<n;i++) {
+        r=find_root(parent, i);
+        if(first[r]!=i)
+            add_basis(ms, ends[first[r]].seg, ends[first[r]].end,
+                      ends[i].seg, ends[i].end);
+    }
+    free(ends);
+    free(sweep);
+    free(parent);
+    free(first);
+
+    // halves on each segment
+    count=ms->shalf_start;
+    for(i=0;i<2*ms->nbasis;i++)
+        count[ms->hseg[i]+1]++;
+    for(s=0;s<ns;s++)
+        count[s+1]+=count[s];
+    for(i=0;i<2*ms->nbasis;i++) {
+        k=ms->hseg[i];
+        ms->shalf[count[k]++]=i;
+    }
+    for(s=ns;s>0;s--)
+        count[s]=count[s-1];
+    count[0]=0;
+    return 0;
+}
+
+void qfh_mesh_free(qfh_mesh *ms)
+{
+    free(ms->arena);
+    memset(ms, 0, sizeof(*ms));
+}
+
+/* Index of segment seg (from 1) of the wires with the given tag, counted
+ * over all of them in order as NEC does, -1 if there is no such segment */
+int qfh_mesh_segment(const qfh_mesh *ms, const qfh_geom *g, int tag, int seg)
+{
+    int w;
+
+    if(seg<1)
+        return -1;
+    for(w=0;w<g->n;w++)
+        if(g->tag[w]==tag) {
+            if(seg<=g->segs[w])
+                return ms->wfirst[w]+seg-1;
+            seg-=g->segs[w];
+        }
+    return -1;
+}
+
+/*
+ * Matrix fill
+ */
+
+/* Integrals of ramp(s)*ramp(t)*exp(-jkR)/R over observation segment i
+ * and source segment j, for the falling (0) and rising (1) ramps, in
+ * metres. Pairs closer than a few segment lengths get eight observation
+ * points and the 1/R part of the kernel integrated exactly, distant ones
+ * only two points on each side. Real and imaginary parts are summed
+ * separately, which is much faster than complex arithmetic in C.
+ * Returns 1 for a near pair. */
+static int pair_moments(const qfh_mesh *ms, int i, int j, double k,
+                        double complex m[2][2])
+{
+    double cx, cy, cz, dist, a2, li=ms->len[i], lj=ms->len[j];
+    double rx, ry, rz, vx, vy, vz, z0, rho2, rho, j0, j1, r, t, sn, cs, h;
+    double s0r, s0i, s1r, s1i, fr, fi, wo, mr[4]={0}, mi[4]={0};
+    const double *ox, *ow, *sx, *sw;
+    int no, nsrc, q, p, near;
+
+    cx=ms->ax[j]+0.5*lj*ms->dx[j]-ms->ax[i]-0.5*li*ms->dx[i];
+    cy=ms->ay[j]+0.5*lj*ms->dy[j]-ms->ay[i]-0.5*li*ms->dy[i];
+    cz=ms->az[j]+0.5*lj*ms->dz[j]-ms->az[i]-0.5*li*ms->dz[i];
+    dist=sqrt(cx*cx+cy*cy+cz*cz);
+    near=i==j || dist<3*fmax(li, lj);
+    if(near) {
+        ox=gl8x;
+        ow=gl8w;
+        no=8;
+        sx=gl4x;
+        sw=gl4w;
+        nsrc=4;
+    } else if(dist<10*fmax(li, lj)) {
+        ox=sx=gl4x;
+        ow=sw=gl4w;
+        no=nsrc=4;
+    } else {
+        ox=sx=gl2x;
+        ow=sw=gl2w;
+        no=nsrc=2;
+    }
+    a2=ms->a[i]*ms->a[j];
+
+    for(q=0;q<no;q++) {
+        rx=ms->ax[i]+ox[q]*li*ms->dx[i];
+        ry=ms->ay[i]+ox[q]*li*ms->dy[i];
+        rz=ms->az[i]+ox[q]*li*ms->dz[i];
+        vx=rx-ms->ax[j];
+        vy=ry-ms->ay[j];
+        vz=rz-ms->az[j];
+        z0=vx*ms->dx[j]+vy*ms->dy[j]+vz*ms->dz[j];
+        rho2=vx*vx+vy*vy+vz*vz-z0*z0;
+        if(rho2<0)
+            rho2=0;
+        rho2+=a2;
+        s0r=s0i=s1r=s1i=0;
+        if(near) {
+            // 1/R exactly, (exp(-jkR)-1)/R numerically
+            rho=sqrt(rho2);
+            j0=asinh((lj-z0)/rho)+asinh(z0/rho);
+            j1=sqrt(rho2+(lj-z0)*(lj-z0))-sqrt(rho2+z0*z0)+z0*j0;
+            s1r=j1/lj;
+            s0r=j0-s1r;
+        }
+        for(p=0;p<nsrc;p++) {
+            t=sx[p]*lj;
+            h=z0-t;
+            r=sqrt(rho2+h*h);
+            if(near) {
+                sn=sin(0.5*k*r);
+                fr=-2*sn*sn;
+                fi=-sin(k*r);
+            } else {
+                fr=cos(k*r);
+                fi=-sin(k*r);
+            }
+            cs=sw[p]*lj/r;
+            fr*=cs;
+            fi*=cs;
+            s0r+=(1-sx[p])*fr;
+            s0i+=(1-sx[p])*fi;
+            s1r+=sx[p]*fr;
+            s1i+=sx[p]*fi;
+        }
+        wo=ow[q]*li;
+        mr[0]+=wo*(1-ox[q])*s0r;
+        mi[0]+=wo*(1-ox[q])*s0i;
+        mr[1]+=wo*(1-ox[q])*s1r;
+        mi[1]+=wo*(1-ox[q])*s1i;
+        mr[2]+=wo*ox[q]*s0r;
+        mi[2]+=wo*ox[q]*s0i;
+        mr[3]+=wo*ox[q]*s1r;
+        mi[3]+=wo*ox[q]*s1i;
+    }
+    m[0][0]=CMPLX(mr[0], mi[0]);
+    m[0][1]=CMPLX(mr[1], mi[1]);
+    m[1][0]=CMPLX(mr[2], mi[2]);
+    m[1][1]=CMPLX(mr[3], mi[3]);
+    return near;
+}
+
+typedef struct {
+    const qfh_mesh *ms;
+    double k;
+    int thread, nthreads;
+    double complex (*mom)[2][2];
+    int half; // for a symmetric mesh, segments per sector
+    int nsec; // and sectors
+    uint64_t pairs, near; // QFH_COUNT_PAIRS and QFH_COUNT_NEAR
+} fill_job;
+
+/* Moments of the segment pairs i<=j, rows dealt out round robin. For a
+ * symmetric mesh only i<half are needed, with j in the sectors g up to
+ * nsec/2, as table g of half x half. Tables 0 and nsec/2 only need
+ * i<=j, see sym_fill(). */
+static void *fill_worker(void *arg)
+{
+    fill_job *job=(fill_job*)arg;
+    const qfh_mesh *ms=job->ms;
+    int i, j, g, n=ms->nseg, h=job->half, near;
+
+    if(h) {
+        for(i=job->thread;i<h;i+=job->nthreads)
+            for(g=0;2*g<=job->nsec;g++)
+                for(j=g==0 || 2*g==job->nsec ? i : 0;j<h;j++) {
+                    near=pair_moments(ms, i, j+g*h, job->k,
+                                      job->mom[((size_t)g*h+i)*h+j]);
+                    QFH_COUNT(job->pairs, 1);
+                    QFH_COUNT(job->near, near);
+                }
+        return NULL;
+    }
+    for(i=job->thread;i<n;i+=job->nthreads)
+        for(j=i;j<n;j++) {
+            near=pair_moments(ms, i, j, job->k, job->mom[(size_t)i*n+j]);
+            QFH_COUNT(job->pairs, 1);
+            QFH_COUNT(job->near, near);
+        }
+    return NULL;
+}
+
+/* Runs fill_worker() on nthreads threads, the first job on this one,
+ * and adds their counters to st unless it is NULL */
+static void run_fill(fill_job *jobs, int nthreads, qfh_stats *st)
+{
+    pthread_t *tid;
+    int i;
+
+    if((tid=(pthread_t*)malloc(nthreads*sizeof(pthread_t)))==NULL)
+        nthreads=1;
+    for(i=0;i<nthreads;i++) {
+        jobs[i].thread=i;
+        jobs[i].nthreads=nthreads;
+        if(i>0 && pthread_create(&tid[i], NULL, fill_worker, &jobs[i]))
+            jobs[i].nthreads=0; // not started, done below
+    }
+    fill_worker(&jobs[0]);
+    for(i=1;i<nthreads;i++) {
+        if(jobs[i].nthreads)
+            pthread_join(tid[i], NULL);
+        else {
+            jobs[i].nthreads=nthreads;
+            fill_worker(&jobs[i]);
+        }
+    }
+    free(tid);
+    for(i=0;i<nthreads && st;i++) {
+        QFH_COUNT(st->count[QFH_COUNT_PAIRS], jobs[i].pairs);
+        QFH_COUNT(st->count[QFH_COUNT_NEAR], jobs[i].near);
+    }
+}
+
+/* Adds the interaction of the halves on observation segment i with the
+ * halves on source segment j. With rowmap, basis function b goes to row
+ * rowmap[b] and is left out if that is negative. */
+static void assemble_pair(const qfh_mesh *ms, double complex *zmat,
+                          const int *rowmap, int i, int j,
+                          double complex m[2][2], double k, int transpose)
+{
+    int hi, hj, a, b, bm, bn, n=ms->nbasis;
+    double dd, si, sj;
+    double complex mt, fac=I*ETA0/(4*pi);
+
+    dd=ms->dx[i]*ms->dx[j]+ms->dy[i]*ms->dy[j]+ms->dz[i]*ms->dz[j];
+    mt=m[0][0]+m[0][1]+m[1][0]+m[1][1];
+    for(hi=ms->shalf_start[i];hi<ms->shalf_start[i+1];hi++) {
+        a=ms->hend[ms->shalf[hi]];
+        si=ms->hsign[ms->shalf[hi]];
+        bm=ms->shalf[hi]/2;
+        if(rowmap && (bm=rowmap[bm])<0)
+            continue;
+        for(hj=ms->shalf_start[j];hj<ms->shalf_start[j+1];hj++) {
+            b=ms->hend[ms->shalf[hj]];
+            sj=ms->hsign[ms->shalf[hj]];
+            bn=ms->shalf[hj]/2;
+            zmat[(size_t)bm*n+bn]+=fac*si*sj*(
+                k*dd*(transpose ? m[b][a] : m[a][b])
+                -(a ? 1 : -1)*(b ? 1 : -1)/(ms->len[i]*ms->len[j])*mt/k);
+        }
+    }
+}
+
+/* qfh_fill(), accounted in st unless it is NULL */
+static void fill_matrix(const qfh_mesh *ms, double freq, int nthreads,
+                        double complex *zmat, qfh_stats *st)
+{
+    fill_job *jobs;
+    double complex (*mom)[2][2];
+    double k=2*pi*freq*1e6/C0;
+    int i, j, n=ms->nseg;
+
+    memset(zmat, 0, (size_t)ms->nbasis*ms->nbasis*sizeof(double complex));
+    if(nthreads<1)
+        nthreads=1;
+    mom=malloc((size_t)n*n*sizeof(*mom));
+    jobs=(fill_job*)calloc(nthreads, sizeof(fill_job));
+    if(mom==NULL || jobs==NULL) {
+        // not enough memory for the moment table: fill directly
+        double complex m[2][2];
+        free(mom);
+        free(jobs);
+        for(i=0;i<n;i++)
+            for(j=i;j<n;j++) {
+                pair_moments(ms, i, j, k, m);
+                assemble_pair(ms, zmat, NULL, i, j, m, k, 0);
+                if(j!=i)
+                    assemble_pair(ms, zmat, NULL, j, i, m, k, 1);
+            }
+        return;
+    }
+    for(i=0;i<nthreads;i++) {
+        jobs[i].ms=ms;
+        jobs[i].k=k;
+        jobs[i].mom=mom;
+    }
+    run_fill(jobs, nthreads, st);
+    for(i=0;i<n;i++)
+        for(j=i;j<n;j++) {
+            assemble_pair(ms, zmat, NULL, i, j, mom[(size_t)i*n+j], k, 0);
+            if(j!=i)
+                assemble_pair(ms, zmat, NULL, j, i, mom[(size_t)i*n+j], k, 1);
+        }
+    free(mom);
+    free(jobs);
+}
+
+/* Fills the nbasis x nbasis interaction matrix (row major) at freq MHz,
+ * computing the segment interactions on nthreads threads */
+void qfh_fill(const qfh_mesh *ms, double freq, int nthreads,
+              double complex *zmat)
+{
+    fill_matrix(ms, freq, nthreads, zmat, NULL);
+}
+
+/* Adds the factorization of an order n system and nrhs solves with it
+ * to the estimated work in st, unless it is NULL */
+static void count_lu(qfh_stats *st, int n, int nrhs)
+{
+    if(st==NULL)
+        return;
+    st->flops+=qfh_lu_flops(n)+8.0*nrhs*n*n;
+    if(n>st->unknowns)
+        st->unknowns=n;
+}
+
+/* Value of the basis function of half h at the centre of its segment,
+ * along the segment direction */
+static double half_centre(const qfh_mesh *ms, int h)
+{
+    return 0.5*ms->hsign[h];
+}
+
+/* Adds a series impedance at the centre of load->seg, to the rows given
+ * by rowmap as in assemble_pair() */
+static void add_load_rows(const qfh_mesh *ms, double complex *zmat,
+                          const int *rowmap, const qfh_port *load)
+{
+    int hi, hj, bm, s=load->seg, n=ms->nbasis;
+
+    for(hi=ms->shalf_start[s];hi<ms->shalf_start[s+1];hi++) {
+        bm=ms->shalf[hi]/2;
+        if(rowmap && (bm=rowmap[bm])<0)
+            continue;
+        for(hj=ms->shalf_start[s];hj<ms->shalf_start[s+1];hj++)
+            zmat[(size_t)bm*n+ms->shalf[hj]/2]+=load->v
+                *half_centre(ms, ms->shalf[hi])*half_centre(ms, ms->shalf[hj]);
+    }
+}
+
+/* Adds a series impedance at the centre of load->seg */
+void qfh_add_load(const qfh_mesh *ms, double complex *zmat,
+                  const qfh_port *load)
+{
+    add_load_rows(ms, zmat, NULL, load);
+}
+
+/* Adds the excitation of a delta gap source to rhs */
+void qfh_port_rhs(const qfh_mesh *ms, const qfh_port *src,
+                  double complex *rhs)
+{
+    int h, s=src->seg;
+
+    for(h=ms->shalf_start[s];h<ms->shalf_start[s+1];h++)
+        rhs[ms->shalf[h]/2]+=src->v*half_centre(ms, ms->shalf[h]);
+}
+
+/* Current at the centre of segment seg */
+double complex qfh_port_current(const qfh_mesh *ms, const double complex *cur,
+                                int seg)
+{
+    double complex i=0;
+    int h;
+
+    for(h=ms->shalf_start[seg];h<ms->shalf_start[seg+1];h++)
+        i+=cur[ms->shalf[h]/2]*half_centre(ms, ms->shalf[h]);
+    return i;
+}
+
+/*
+ * Dense LU factorisation with partial pivoting, right looking and blocked
+ * so that the trailing update works on tiles that stay in cache.
+ */
+
+#define LU_NB 48
+#define LU_JB 256
+
+/* |re|+|im|, good enough to choose pivots */
+static double cabs1(double complex z)
+{
+    return fabs(creal(z))+fabs(cimag(z));
+}
+
+/* y += a*x on n elements, with the complex product written out so that
+ * the compiler does not have to go through its NaN-safe multiply */
+static void axpy(double complex *y, const double complex *x,
+                 double complex a, int n)
+{
+    double *yy=(double*)y, ar=creal(a), ai=cimag(a);
+    const double *xx=(const double*)x;
+    int j;
+
+    for(j=0;j<n;j++) {
+        yy[2*j]+=ar*xx[2*j]-ai*xx[2*j+1];
+        yy[2*j+1]+=ar*xx[2*j+1]+ai*xx[2*j];
+    }
+}
+
+/* Factors the n x n row major matrix a in place. Returns 0 on success,
+ * 1 if it is singular. */
+int qfh_lu_factor(double complex *a, int n, int *piv)
+{
+    int k0, kb, k, i, j, p, j0, j1;
+    double big, v;
+    double complex t, *ri, *rk;
+
+    for(k0=0;k0<n;k0+=LU_NB) {
+        kb=n-k0<LU_NB ? n-k0 : LU_NB;
+        // panel
+        for(k=k0;k<k0+kb;k++) {
+            p=k;
+            big=cabs1(a[(size_t)k*n+k]);
+            for(i=k+1;i<n;i++)
+                if((v=cabs1(a[(size_t)i*n+k]))>big) {
+                    big=v;
+                    p=i;
+                }
+            if(big==0)
+                return 1;
+            piv[k]=p;
+            if(p!=k)
+                for(j=0;j<n;j++) {
+                    t=a[(size_t)k*n+j];
+                    a[(size_t)k*n+j]=a[(size_t)p*n+j];
+                    a[(size_t)p*n+j]=t;
+                }
+            rk=a+(size_t)k*n;
+            t=1/rk[k];
+            for(i=k+1;i<n;i++) {
+                ri=a+(size_t)i*n;
+                ri[k]*=t;
+                axpy(ri+k+1, rk+k+1, -ri[k], k0+kb-k-1);
+            }
+        }
+        // block row of U
+        for(k=k0;k<k0+kb;k++) {
+            rk=a+(size_t)k*n;
+            for(i=k+1;i<k0+kb;i++) {
+                ri=a+(size_t)i*n;
+                axpy(ri+k0+kb, rk+k0+kb, -ri[k], n-k0-kb);
+            }
+        }
+        // trailing update in column tiles
+        for(j0=k0+kb;j0<n;j0+=LU_JB) {
+            j1=j0+LU_JB<n ? j0+LU_JB : n;
+            for(i=k0+kb;i<n;i++) {
+                ri=a+(size_t)i*n;
+                for(k=k0;k<k0+kb;k++) {
+                    rk=a+(size_t)k*n;
+                    axpy(ri+j0, rk+j0, -ri[k], j1-j0);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* Solves a x = b in place with the factors from qfh_lu_factor() */
+void qfh_lu_solve(const double complex *a, int n, const int *piv,
+                  double complex *b)
+{
+    int i, j;
+    double complex t;
+
+    for(i=0;i<n;i++)
+        if(piv[i]!=i) {
+            t=b[i];
+            b[i]=b[piv[i]];
+            b[piv[i]]=t;
+        }
+    for(i=1;i<n;i++) {
+        t=b[i];
+        for(j=0;j<i;j++)
+            t-=a[(size_t)i*n+j]*b[j];
+        b[i]=t;
+    }
+    for(i=n-1;i>=0;i--) {
+        t=b[i];
+        for(j=i+1;j<n;j++)
+            t-=a[(size_t)i*n+j]*b[j];
+        b[i]=t/a[(size_t)i*n+i];
+    }
+}
+
+/*
+ * Rotational symmetry.
+ *
+ * A symmetric mesh is made of k sectors of h segments each, sector g
+ * being sector 0 turned by g/k of a turn about z, so that segment s+h is
+ * segment s turned (and those of the last sector turn into the first).
+ * A symmetric build is laid out that way with k=2, and sym_setup() looks
+ * for more sectors in the same layout. Turning basis function b gives
+ * sgn[b] times function img[b], so the functions fall into orbits of at
+ * most k functions turned into each other; the lowest one of each
+ * represents its orbit.
+ *
+ * The interaction matrix commutes with the turn, it is block circulant.
+ * A discrete Fourier transform over the sectors splits the current into
+ * k modes that do not couple, mode m being the part the turn multiplies
+ * by w^m, w=exp(2 pi i/k). Mode m of an orbit is its representative
+ * plus w^-m times the turned one, w^-2m times that turned again and so
+ * on, so k systems of n/k unknowns are solved instead of one of n, in
+ * 1/k^2 of the LU time. An orbit of L<k functions, such as a function
+ * across the axis that two turns reverse, only takes part in the modes
+ * that come back to it after L turns. Only the rows of the
+ * representatives are filled, from the segment pairs with the
+ * observation segment in sector 0 and, by reciprocity, the source in
+ * sectors 0 to k/2, about 1/(2k) of the pairs of a full fill.
+ */
+
+typedef struct {
+    int k; // sectors
+    int nrow; // orbits, one row each
+    int *rep; // representative of each row
+    int *row; // row of each function, -1 if it does not represent its orbit
+    int *img;
+    signed char *sgn;
+    int *ostart; // orbit of row r is ofun[ostart[r]..ostart[r+1]-1]
+    int *ofun; // functions of the orbits, each the turn of the one before
+    signed char *osgn; // turning the representative j times gives osgn*ofun
+    char *obs; // segments carrying halves of the representatives
+    int **sys; // rows making up the system of each mode
+    int *nsys;
+    double complex *w; // w^q for q=0..k-1
+    double complex *zr, **a, **b;
+    int **piv;
+    void *arena, *msys; // of the above and of the mode systems
+} sym_solver;
+
+static void sym_free(sym_solver *sy)
+{
+    free(sy->arena);
+    free(sy->zr);
+    free(sy->msys);
+    memset(sy, 0, sizeof(*sy));
+}
+
+/* exp(2 pi i q/k), exactly for quarter turns */
+static double complex turn_phase(int q, int k)
+{
+    static const double complex quarter[4]={1, I, -1, -I};
+
+    if(4*q%k==0)
+        return quarter[4*q/k];
+    return cexp(2*pi*I*q/k);
+}
+
+/* Finds the image of every basis function of a mesh made of k turned
+ * sectors and sets up the rows of each mode. Returns 0 on success, 1 if
+ * the mesh is not symmetric in that way or on out of memory. */
+static int sym_init(sym_solver *sy, const qfh_mesh *ms, int k)
+{
+    int b, c, p, m, r, L, q, ts, te, h, n=ms->nbasis, *out, sgn;
+    size_t need, t;
+    char *mem;
+
+    memset(sy, 0, sizeof(*sy));
+    if(k<2 || ms->nseg%k || ms->nseg==0)
+        return 1;
+    h=ms->nseg/k;
+    // the function of each half flowing out of a node, by segment end
+    need=(size_t)(6*n+1+k+2*ms->nseg)*sizeof(int)+k*sizeof(double complex)
+        +(size_t)k*(sizeof(int*)*2+sizeof(double complex*)*2)+3*n+ms->nseg;
+    if((mem=(char*)malloc(need))==NULL)
+        return 1;
+    sy->arena=mem;
+    sy->k=k;
+    sy->w=(double complex*)mem;
+    sy->a=(double complex**)(sy->w+k);
+    sy->b=sy->a+k;
+    sy->sys=(int**)(sy->b+k);
+    sy->piv=sy->sys+k;
+    sy->rep=(int*)(sy->piv+k);
+    sy->row=sy->rep+n;
+    sy->img=sy->row+n;
+    sy->ostart=sy->img+n;
+    sy->ofun=sy->ostart+n+1;
+    sy->nsys=sy->ofun+n;
+    out=sy->nsys+k;
+    sy->sys[0]=out+2*ms->nseg;
+    sy->sgn=(signed char*)(sy->sys[0]+n);
+    sy->osgn=sy->sgn+n;
+    sy->obs=(char*)sy->osgn+n;
+    for(q=0;q<k;q++)
+        sy->w[q]=turn_phase(q, k);
+    for(p=0;p<2*ms->nseg;p++)
+        out[p]=-1;
+    for(b=0;b<n;b++)
+        out[2*ms->hseg[2*b+1]+ms->hend[2*b+1]]=b;
+    for(b=0;b<n;b++) {
+        ts=(ms->hseg[2*b]+h)%ms->nseg;
+        te=(ms->hseg[2*b+1]+h)%ms->nseg;
+        // the turned function has the same halves, or the reversed ones
+        c=out[2*te+ms->hend[2*b+1]];
+        if(c>=0 && ms->hseg[2*c]==ts && ms->hend[2*c]==ms->hend[2*b]) {
+            sy->img[b]=c;
+            sy->sgn[b]=1;
+            continue;
+        }
+        c=out[2*ts+ms->hend[2*b]];
+        if(c>=0 && ms->hseg[2*c]==te && ms->hend[2*c]==ms->hend[2*b+1]) {
+            sy->img[b]=c;
+            sy->sgn[b]=-1;
+            continue;
+        }
+        sym_free(sy);
+        return 1;
+    }
+    // orbits, each ending where the turns come back to its start; k
+    // turns have to give the function itself
+    memset(sy->obs, 0, ms->nseg);
+    for(b=0;b<n;b++)
+        sy->row[b]=-2;
+    for(p=0,b=0;b<n;b++) {
+        if(sy->row[b]!=-2)
+            continue;
+        sy->row[b]=sy->nrow;
+        sy->rep[sy->nrow]=b;
+        sy->ostart[sy->nrow]=p;
+        sy->obs[ms->hseg[2*b]]=sy->obs[ms->hseg[2*b+1]]=1;
+        for(c=b,sgn=1;;c=sy->img[c]) {
+            sy->ofun[p]=c;
+            sy->osgn[p++]=(signed char)sgn;
+            sgn*=sy->sgn[c];
+            if(sy->img[c]==b || sy->row[sy->img[c]]!=-2 ||
+               p-sy->ostart[sy->nrow]==k)
+                break;
+            sy->row[sy->img[c]]=-1;
+        }
+        L=p-sy->ostart[sy->nrow++];
+        if(sy->img[c]!=b || k%L || (sgn<0 && (k/L)%2)) {
+            sym_free(sy);
+            return 1;
+        }
+    }
+    sy->ostart[sy->nrow]=p;
+    // mode m takes the orbits that L turns bring back to themselves
+    // times w^(mL)
+    for(t=0,m=0;m<k;m++) {
+        sy->sys[m]=sy->sys[0]+t;
+        sy->nsys[m]=0;
+        for(r=0;r<sy->nrow;r++) {
+            L=sy->ostart[r+1]-sy->ostart[r];
+            sgn=sy->osgn[sy->ostart[r+1]-1]*sy->sgn[sy->ofun[sy->ostart[r+1]-1]];
+            q=m*L%k;
+            if(sgn>0 ? q==0 : 2*q==k)
+                sy->sys[m][sy->nsys[m]++]=r;
+        }
+        t+=sy->nsys[m];
+    }
+    sy->zr=(double complex*)malloc((size_t)sy->nrow*n*sizeof(double complex));
+    for(t=0,m=0;m<k;m++)
+        t+=((size_t)sy->nsys[m]*sy->nsys[m]+sy->nsys[m])*
+            sizeof(double complex)+sy->nsys[m]*sizeof(int);
+    sy->msys=malloc(t);
+    if(sy->zr==NULL || sy->msys==NULL) {
+        sym_free(sy);
+        return 1;
+    }
+    for(mem=(char*)sy->msys,m=0;m<k;m++) {
+        t=sy->nsys[m];
+        sy->a[m]=(double complex*)mem;
+        sy->b[m]=sy->a[m]+t*t;
+        sy->piv[m]=(int*)(sy->b[m]+t);
+        mem=(char*)(sy->piv[m]+t);
+    }
+    return 0;
+}
+
+/* Whether every segment of the mesh, but those of the last of its k
+ * sectors, turned by angle about z is the segment of the next sector */
+static int sector_turn(const qfh_mesh *ms, int k, double angle)
+{
+    double c=cos(angle), s=sin(angle), tol;
+    int i, j, h=ms->nseg/k;
+
+    for(i=0;i+h<ms->nseg;i++) {
+        j=i+h;
+        tol=1e-6*ms->len[i];
+        if(fabs(c*ms->ax[i]-s*ms->ay[i]-ms->ax[j])>tol ||
+           fabs(s*ms->ax[i]+c*ms->ay[i]-ms->ay[j])>tol ||
+           fabs(ms->az[i]-ms->az[j])>tol ||
+           fabs(c*ms->dx[i]-s*ms->dy[i]-ms->dx[j])>1e-9 ||
+           fabs(s*ms->dx[i]+c*ms->dy[i]-ms->dy[j])>1e-9 ||
+           fabs(ms->dz[i]-ms->dz[j])>1e-9 ||
+           fabs(ms->len[i]-ms->len[j])>tol ||
+           fabs(ms->a[i]-ms->a[j])>1e-9*ms->a[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* Whether the loads come in sets turned into each other */
+static int sym_loads(const sym_solver *sy, const qfh_mesh *ms,
+                     const qfh_port *loads, int nloads)
+{
+    int i, j, s;
+
+    for(i=0;i<nloads;i++) {
+        s=(loads[i].seg+ms->nseg/sy->k)%ms->nseg;
+        for(j=0;j<nloads && (loads[j].seg!=s || loads[j].v!=loads[i].v);j++)
+            ;
+        if(j==nloads)
+            return 0;
+    }
+    return 1;
+}
+
+/* Sets up the solver for the most sectors the mesh has, a multiple of
+ * nsym (2 for a symmetric build, 1 otherwise) found on the geometry, or
+ * nsym itself, with the loads turned into each other. Returns 0 on
+ * success, 1 if the mesh has no symmetry the solver can use. */
+static int sym_setup(sym_solver *sy, const qfh_mesh *ms, int nsym,
+                     const qfh_port *loads, int nloads)
+{
+    int k;
+
+    for(k=ms->nseg;k>nsym;k--)
+        if(k%nsym==0 && ms->nseg%k==0 &&
+           (sector_turn(ms, k, 2*pi/k) || sector_turn(ms, k, -2*pi/k)) &&
+           sym_init(sy, ms, k)==0) {
+            if(sym_loads(sy, ms, loads, nloads))
+                return 0;
+            sym_free(sy);
+        }
+    return nsym>1 ? sym_init(sy, ms, nsym) : 1;
+}
+
+/* Fills the rows of the representatives at freq MHz into sy->zr, with
+ * the given loads. The moments of a pair of segments are those of the
+ * pair turned back to sector 0, and reciprocity gives the sectors past
+ * k/2 and the lower triangles of tables 0 and k/2. Returns 0 on
+ * success. */
+static int sym_fill(sym_solver *sy, const qfh_mesh *ms, double freq,
+                    int nthreads, const qfh_port *loads, int nloads,
+                    qfh_stats *st)
+{
+    fill_job *jobs;
+    double complex (*mom)[2][2], *zr=sy->zr;
+    double k=2*pi*freq*1e6/C0;
+    int i, j, i0, j0, g, tr, n=ms->nbasis, ns=sy->k, h=ms->nseg/ns;
+    size_t t;
+
+    if(nthreads<1)
+        nthreads=1;
+    mom=malloc((size_t)(ns/2+1)*h*h*sizeof(*mom));
+    jobs=(fill_job*)calloc(nthreads, sizeof(fill_job));
+    if(mom==NULL || jobs==NULL) {
+        free(mom);
+        free(jobs);
+        return 1;
+    }
+    for(i=0;i<nthreads;i++) {
+        jobs[i].ms=ms;
+        jobs[i].k=k;
+        jobs[i].half=h;
+        jobs[i].nsec=ns;
+        jobs[i].mom=mom;
+    }
+    run_fill(jobs, nthreads, st);
+
+    memset(zr, 0, (size_t)sy->nrow*n*sizeof(double complex));
+    for(i=0;i<ms->nseg;i++) {
+        if(!sy->obs[i])
+            continue;
+        i0=i%h;
+        for(j=0;j<ms->nseg;j++) {
+            j0=j-(i-i0);
+            if(j0<0)
+                j0+=ms->nseg;
+            g=j0/h;
+            j0%=h;
+            if(g==0 || 2*g==ns) {
+                tr=i0>j0;
+                t=tr ? ((size_t)g*h+j0)*h+i0 : ((size_t)g*h+i0)*h+j0;
+            } else if(2*g<ns) {
+                tr=0;
+                t=((size_t)g*h+i0)*h+j0;
+            } else {
+                tr=1;
+                t=((size_t)(ns-g)*h+j0)*h+i0;
+            }
+            assemble_pair(ms, zr, sy->row, i, j, mom[t], k, tr);
+        }
+    }
+    for(i=0;i<nloads;i++)
+        add_load_rows(ms, zr, sy->row, &loads[i]);
+    free(mom);
+    free(jobs);
+    return 0;
+}
+
+/* Adds c times z to *a, with a real product where c is real */
+static void add_scaled(double complex *a, double complex c, double complex z)
+{
+    if(cimag(c)==0)
+        *a+=creal(c)*z;
+    else
+        *a+=c*z;
+}
+
+/* Sets up and factors the system of every mode from the filled rows.
+ * Mode m of orbit y is sum_j w^-mj R^j y, tested with the
+ * representatives. Returns 0 on success. */
+static int sym_factor(sym_solver *sy, int n, qfh_stats *st)
+{
+    double complex *a, *zx;
+    int m, x, y, j, o, c, ns=sy->k, nm;
+
+    for(m=0;m<ns;m++) {
+        nm=sy->nsys[m];
+        a=sy->a[m];
+        for(x=0;x<nm;x++) {
+            zx=sy->zr+(size_t)sy->sys[m][x]*n;
+            for(y=0;y<nm;y++) {
+                o=sy->ostart[sy->sys[m][y]];
+                c=sy->ofun[o];
+                a[(size_t)x*nm+y]=zx[c];
+                for(j=1;o+j<sy->ostart[sy->sys[m][y]+1];j++)
+                    add_scaled(&a[(size_t)x*nm+y],
+                               sy->w[(ns-m*j%ns)%ns]*sy->osgn[o+j],
+                               zx[sy->ofun[o+j]]);
+            }
+        }
+        if(qfh_lu_factor(a, nm, sy->piv[m]))
+            return 1;
+        count_lu(st, nm, 0);
+    }
+    return 0;
+}
+
+/* Solves the factored modes for the excitation in cur, which receives
+ * the basis function currents. The excitation of mode m at a
+ * representative is the mean over its orbit of w^mj times the turned
+ * excitation. */
+static void sym_solve(sym_solver *sy, int n, double complex *cur,
+                      qfh_stats *st)
+{
+    double complex *v;
+    int m, x, j, o, L, ns=sy->k, nm;
+
+    for(m=0;m<ns;m++) {
+        nm=sy->nsys[m];
+        v=sy->b[m];
+        for(x=0;x<nm;x++) {
+            o=sy->ostart[sy->sys[m][x]];
+            L=sy->ostart[sy->sys[m][x]+1]-o;
+            v[x]=cur[sy->ofun[o]];
+            if(L==1)
+                continue;
+            for(j=1;j<L;j++)
+                add_scaled(&v[x], sy->w[m*j%ns]*sy->osgn[o+j],
+                           cur[sy->ofun[o+j]]);
+            v[x]*=1.0/L;
+        }
+    }
+    for(m=0;m<ns;m++) {
+        qfh_lu_solve(sy->a[m], sy->nsys[m], sy->piv[m], sy->b[m]);
+        if(st)
+            st->flops+=8.0*sy->nsys[m]*sy->nsys[m];
+    }
+    memset(cur, 0, n*sizeof(double complex));
+    for(m=0;m<ns;m++)
+        for(x=0;x<sy->nsys[m];x++) {
+            o=sy->ostart[sy->sys[m][x]];
+            L=sy->ostart[sy->sys[m][x]+1]-o;
+            cur[sy->ofun[o]]+=sy->b[m][x];
+            for(j=1;j<L;j++)
+                add_scaled(&cur[sy->ofun[o+j]],
+                           sy->w[(ns-m*j%ns)%ns]*sy->osgn[o+j], sy->b[m][x]);
+        }
+}
+
+/*
+ * Results
+ */
+
+/* Radiation vector towards +z: its x and y components, which give the
+ * field there */
+static void zenith_vector(const qfh_mesh *ms, double freq,
+                          const double complex *cur, double complex *nx,
+                          double complex *ny)
+{
+    double k=2*pi*freq*1e6/C0;
+    double complex e, amp;
+    double t, ramp;
+    int h, p, s;
+
+    *nx=*ny=0;
+    for(h=0;h<2*ms->nbasis;h++) {
+        s=ms->hseg[h];
+        amp=0;
+        for(p=0;p<4;p++) {
+            ramp=ms->hend[h] ? gl4x[p] : 1-gl4x[p];
+            t=gl4x[p]*ms->len[s];
+            e=cexp(I*k*(ms->az[s]+t*ms->dz[s]));
+            amp+=gl4w[p]*ramp*e;
+        }
+        amp*=cur[h/2]*ms->hsign[h]*ms->len[s];
+        *nx+=amp*ms->dx[s];
+        *ny+=amp*ms->dy[s];
+    }
+}
+
+/* Gain in dBi of a zenith radiation vector for pin watts in */
+static double vector_gain(double freq, double complex nx, double complex ny,
+                          double pin)
+{
+    double k=2*pi*freq*1e6/C0;
+
+    return 10*log10(k*k*ETA0*(creal(nx*conj(nx))+creal(ny*conj(ny)))
+                    /(8*pi*pin));
+}
+
+/* Axial ratio in dB of a zenith radiation vector */
+static double vector_axial(double complex nx, double complex ny)
+{
+    double r=cabs(nx-I*ny), l=cabs(nx+I*ny);
+
+    return r==l ? INFINITY : 20*log10((r+l)/fabs(r-l));
+}
+
+/* Power gain in dBi towards +z for an input power of pin watts */
+double qfh_zenith_gain(const qfh_mesh *ms, double freq,
+                       const double complex *cur, double pin)
+{
+    double complex nx, ny;
+
+    zenith_vector(ms, freq, cur, &nx, &ny);
+    return vector_gain(freq, nx, ny, pin);
+}
+
+/* Axial ratio in dB of the field towards +z, from its two circularly
+ * polarized parts: 0 for circular polarization, infinite for linear */
+double qfh_zenith_axial(const qfh_mesh *ms, double freq,
+                        const double complex *cur)
+{
+    double complex nx, ny;
+
+    zenith_vector(ms, freq, cur, &nx, &ny);
+    return vector_axial(nx, ny);
+}
+
+double qfh_swr(double complex z, double z0)
+{
+    double g=cabs((z-z0)/(z+z0));
+
+    return g<1 ? (1+g)/(1-g) : INFINITY;
+}
+
+/* Number of frequencies of the model sweep, as in its FR card */
+int qfh_nfreq(const qfh_model *m)
+{
+    return (int)((m->fstop-m->fstart)/m->fstep)+1;
+}
+
+/* Adds a port at segment seg (from 1) of the wires tagged tag */
+static int add_port(const qfh_mesh *ms, const qfh_geom *g, qfh_port *ports,
+                    int *n, int tag, double complex v)
+{
+    ports[*n].seg=qfh_mesh_segment(ms, g, tag, 1);
+    ports[*n].v=v;
+    return ports[(*n)++].seg<0;
+}
+
+/* A built model with its feed and terminations, solved one frequency
+ * at a time */
+typedef struct {
+    qfh_mesh ms;
+    qfh_port *srcs, *loads;
+    int nsrc, nloads;
+    int usesym;
+    sym_solver sy;
+    double complex *zmat, *cur, vfeed;
+    double pin; // input power of the last solve
+    int *piv;
+    int nthreads;
+    qfh_stats *stats;
+} model_solver;
+
+static void model_solver_free(model_solver *s)
+{
+    if(s->usesym)
+        sym_free(&s->sy);
+    free(s->srcs);
+    free(s->loads);
+    free(s->zmat);
+    free(s->cur);
+    free(s->piv);
+    qfh_mesh_free(&s->ms);
+}
+
+/* Sets up the ports of m as in its deck. Returns 0 on success. */
+static int model_solver_init(model_solver *s, const qfh_model *m,
+                             int nthreads, int flags)
+{
+    int i, n, err=0, split=m->nsym==2;
+
+    memset(s, 0, sizeof(*s));
+    if(qfh_mesh_build(&s->ms, &m->geom))
+        return 1;
+    n=s->ms.nbasis;
+    s->nthreads=nthreads;
+    s->stats=m->stats;
+    s->srcs=(qfh_port*)malloc(2*m->nhelix*sizeof(qfh_port));
+    s->loads=(qfh_port*)malloc(2*m->nhelix*sizeof(qfh_port));
+    s->cur=(double complex*)malloc(n*sizeof(double complex));
+    if(s->srcs==NULL || s->loads==NULL || s->cur==NULL)
+        err=1;
+    for(i=0;i<m->nhelix && !err;i++) {
+        switch(toupper(m->h[2*i].feed)) {
+            case 'F':
+                err|=add_port(&s->ms, &m->geom, s->srcs, &s->nsrc,
+                              m->h[2*i].feedpoint, split ? 0.5 : 1);
+                if(split)
+                    err|=add_port(&s->ms, &m->geom, s->srcs, &s->nsrc,
+                                  m->h[2*i].feedpoint+m->symtag, -0.5);
+                break;
+            case 'T':
+                err|=add_port(&s->ms, &m->geom, s->loads, &s->nloads,
+                              m->h[2*i].feedpoint, split ? 25 : 50);
+                if(split)
+                    err|=add_port(&s->ms, &m->geom, s->loads, &s->nloads,
+                                  m->h[2*i].feedpoint+m->symtag, 25);
+                break;
+        }
+    }
+    if(s->nsrc==0)
+        err=1;
+    if(!err)
+        s->usesym=!(flags&QFH_SOLVE_NOSYM) &&
+            sym_setup(&s->sy, &s->ms, split ? 2 : 1, s->loads, s->nloads)==0;
+    if(!err && !s->usesym) {
+        s->zmat=(double complex*)malloc((size_t)n*n*sizeof(double complex));
+        s->piv=(int*)malloc(n*sizeof(int));
+        err=s->zmat==NULL || s->piv==NULL;
+    }
+    if(err) {
+        model_solver_free(s);
+        return 1;
+    }
+    // the halves of a split feed wire are in series
+    s->vfeed=split ? 2*s->srcs[0].v : s->srcs[0].v;
+    return 0;
+}
+
+/* Solves at freq MHz into res, and the zenith radiation vector into nx
+ * and ny. Returns 0 on success. */
+static int model_solver_run(model_solver *s, double freq, qfh_result *res,
+                            double complex *nx, double complex *ny)
+{
+    double complex ifeed;
+    double t0;
+    int i, n=s->ms.nbasis;
+
+    res->freq=freq;
+    memset(s->cur, 0, n*sizeof(double complex));
+    for(i=0;i<s->nsrc;i++)
+        qfh_port_rhs(&s->ms, &s->srcs[i], s->cur);
+    if(s->usesym) {
+        t0=qfh_stats_start(s->stats);
+        if(sym_fill(&s->sy, &s->ms, freq, s->nthreads, s->loads, s->nloads,
+                    s->stats))
+            return 1;
+        qfh_stats_stop(s->stats, QFH_PHASE_FILL, t0);
+        t0=qfh_stats_start(s->stats);
+        if(sym_factor(&s->sy, n, s->stats))
+            return 1;
+        qfh_stats_stop(s->stats, QFH_PHASE_FACTOR, t0);
+        t0=qfh_stats_start(s->stats);
+        sym_solve(&s->sy, n, s->cur, s->stats);
+    } else {
+        t0=qfh_stats_start(s->stats);
+        fill_matrix(&s->ms, freq, s->nthreads, s->zmat, s->stats);
+        for(i=0;i<s->nloads;i++)
+            qfh_add_load(&s->ms, s->zmat, &s->loads[i]);
+        qfh_stats_stop(s->stats, QFH_PHASE_FILL, t0);
+        t0=qfh_stats_start(s->stats);
+        if(qfh_lu_factor(s->zmat, n, s->piv))
+            return 1;
+        qfh_stats_stop(s->stats, QFH_PHASE_FACTOR, t0);
+        t0=qfh_stats_start(s->stats);
+        qfh_lu_solve(s->zmat, n, s->piv, s->cur);
+        count_lu(s->stats, n, 1);
+    }
+    ifeed=qfh_port_current(&s->ms, s->cur, s->srcs[0].seg);
+    for(s->pin=0,i=0;i<s->nsrc;i++)
+        s->pin+=0.5*creal(s->srcs[i].v*conj(qfh_port_current(&s->ms, s->cur,
+                                                          s->srcs[i].seg)));
+    zenith_vector(&s->ms, freq, s->cur, nx, ny);
+    res->z=s->vfeed/ifeed;
+    res->swr=qfh_swr(res->z, 50);
+    res->gain=vector_gain(freq, *nx, *ny, s->pin);
+    res->axial=vector_axial(*nx, *ny);
+    qfh_stats_stop(s->stats, QFH_PHASE_SOLVE, t0);
+    return 0;
+}
+
+/* Solves a built model at every frequency of its sweep, with the feed
+ * and terminations of its helices, and stores qfh_nfreq() results in res.
+ * The split feed wire of a symmetric model gets half the voltage on each
+ * half, as in its deck. A rotationally symmetric model is solved by
+ * modes, one system per sector, unless flags has QFH_SOLVE_NOSYM.
+ * Returns 0 on success. */
+int qfh_solve_model(const qfh_model *m, int nthreads, int flags,
+                    qfh_result *res)
+{
+    model_solver s;
+    double complex nx, ny;
+    int f, err=0;
+
+    if(model_solver_init(&s, m, nthreads, flags))
+        return 1;
+    for(f=0;f<qfh_nfreq(m) && !err;f++)
+        err=model_solver_run(&s, m->fstart+f*m->fstep, &res[f], &nx, &ny);
+    model_solver_free(&s);
+    return err;
+}
+
+/* Solves a built model at freq MHz like qfh_solve_model() into res and
+ * hands over its mesh in ms, the basis function currents in *cur (to be
+ * freed by the caller, with qfh_mesh_free() for ms) and the input power
+ * in watts in *pin, as needed by qfh_pattern(). Returns 0 on success. */
+int qfh_solve_currents(const qfh_model *m, double freq, int nthreads,
+                       int flags, qfh_result *res, qfh_mesh *ms,
+                       double complex **cur, double *pin)
+{
+    model_solver s;
+    double complex nx, ny;
+
+    if(model_solver_init(&s, m, nthreads, flags))
+        return 1;
+    if(model_solver_run(&s, freq, res, &nx, &ny)) {
+        model_solver_free(&s);
+        return 1;
+    }
+    *ms=s.ms;
+    *cur=s.cur;
+    *pin=s.pin;
+    memset(&s.ms, 0, sizeof(s.ms));
+    s.cur=NULL;
+    model_solver_free(&s);
+    return 0;
+}
+
+/* Samples of the fast sweep: the impedance and the zenith radiation
+ * vector for a 1 V feed, all close to rational in frequency */
+static int fast_sample(void *opaque, double freq, double complex *v)
+{
+    qfh_result r;
+
+    if(model_solver_run((model_solver*)opaque, freq, &r, &v[1], &v[2]))
+        return 1;
+    v[0]=r.z;
+    return 0;
+}
+
+/* Solves a built model over its sweep like qfh_solve_model(), but only at
+ * the frequencies qfh_mbpe_sweep() asks for (to the relative tolerance
+ * tol, 24 at most) and gives the fitted values at the others. The fit is
+ * left in mb, to be freed by the caller. Returns 0 on success. */
+int qfh_solve_fast(const qfh_model *m, int nthreads, int flags, double tol,
+                   qfh_result *res, qfh_mbpe *mb)
+{
+    model_solver s;
+    double complex v[3], vfeed;
+    double freq, fhi=m->fstart+(qfh_nfreq(m)-1)*m->fstep;
+    int f, err;
+
+    memset(mb, 0, sizeof(*mb));
+    if(model_solver_init(&s, m, nthreads, flags))
+        return 1;
+    vfeed=s.vfeed;
+    if(fhi<=m->fstart) {
+        err=model_solver_run(&s, m->fstart, &res[0], &v[1], &v[2]);
+        model_solver_free(&s);
+        return err;
+    }
+    err=qfh_mbpe_sweep(mb, 3, m->fstart, fhi, tol, 24, fast_sample, &s);
+    model_solver_free(&s);
+    if(err)
+        return 1;
+    for(f=0;f<qfh_nfreq(m);f++) {
+        freq=m->fstart+f*m->fstep;
+        qfh_mbpe_eval(mb, freq, v);
+        res[f].freq=freq;
+        res[f].z=v[0];
+        res[f].swr=qfh_swr(v[0], 50);
+        res[f].gain=vector_gain(freq, v[1], v[2],
+                                0.5*creal(vfeed*conj(vfeed/v[0])));
+        res[f].axial=vector_axial(v[1], v[2]);
+    }
+    return 0;
+}
+
+/*
+ * Termination sweeps.
+ *
+ * A load or a source on the feed wire of a helix only touches the basis
+ * functions at the centre of that wire: with u the excitation of a unit
+ * source there, a load z adds z u u^T to the matrix. With the unloaded
+ * matrix Z factored once and the response w = Z^-1 u of every port kept,
+ * the loaded system is solved by Sherman-Morrison-Woodbury as a system
+ * over the loaded ports only:
+ *
+ *   (Z + U D U^T)^-1 b = x - W (D^-1 + U^T W)^-1 U^T x,   x = Z^-1 b
+ *
+ * where the sources make x a sum of responses and U^T W, U^T x come from
+ * the port currents y. The currents are then a sum of responses too, and
+ * so is the zenith radiation vector, so a case costs a few operations
+ * per port pair instead of a fill and a factorization.
+ *
+ * An open helix is the limit of an infinite load, D^-1 = 0: no current
+ * at the centre of its feed wire. Its wire stays in the geometry, unlike
+ * in the deck of a model built with 'O', which has no feed wire there.
+ */
+
+/* Finds the ports of a built model. Helices built with 'O' have no feed
+ * wire and cannot be given another termination. Returns 0 on success. */
+int qfh_term_init(qfh_term *t, const qfh_model *m)
+{
+    int i, np, k=0, err=0;
+
+    memset(t, 0, sizeof(*t));
+    if(qfh_mesh_build(&t->ms, &m->geom))
+        return 1;
+    t->stats=m->stats;
+    t->nhelix=m->nhelix;
+    t->split=m->nsym==2;
+    np=t->split ? 2 : 1;
+    t->first=(int*)malloc(m->nhelix*sizeof(int));
+    for(i=0;i<m->nhelix;i++)
+        if(toupper(m->h[2*i].feed)!='O')
+            t->nport+=np;
+    t->seg=(int*)malloc((t->nport+1)*2*sizeof(int));
+    if(t->first==NULL || t->seg==NULL) {
+        qfh_term_free(t);
+        return 1;
+    }
+    t->helix=t->seg+t->nport+1;
+    for(i=0;i<m->nhelix;i++) {
+        t->first[i]=-1;
+        if(toupper(m->h[2*i].feed)=='O')
+            continue;
+        t->first[i]=k;
+        t->helix[k]=i;
+        err|=(t->seg[k++]=qfh_mesh_segment(&t->ms, &m->geom,
+                                           m->h[2*i].feedpoint, 1))<0;
+        if(t->split) {
+            t->helix[k]=i;
+            err|=(t->seg[k++]=qfh_mesh_segment(&t->ms, &m->geom,
+                                   m->h[2*i].feedpoint+m->symtag, 1))<0;
+        }
+    }
+    if(err) {
+        qfh_term_free(t);
+        return 1;
+    }
+    // without loads any rotational symmetry of the mesh can be used
+    if((t->sym=malloc(sizeof(sym_solver)))!=NULL &&
+       sym_setup((sym_solver*)t->sym, &t->ms, t->split ? 2 : 1, NULL, 0)) {
+        free(t->sym);
+        t->sym=NULL;
+    }
+    return 0;
+}
+
+/* Fills and factors the unloaded matrix at freq MHz, or the modes of a
+ * symmetric mesh, and finds the response of every port. Returns 0 on
+ * success. */
+int qfh_term_factor(qfh_term *t, double freq, int nthreads)
+{
+    qfh_port u;
+    sym_solver *sy=(sym_solver*)t->sym;
+    size_t n=t->ms.nbasis, np=t->nport, nz=sy ? 0 : n*n;
+    double t0;
+    int p, q;
+
+    if(t->piv==NULL) {
+        t->zmat=(double complex*)malloc((nz+np*n+2*np*np+4*np)
+                                        *sizeof(double complex));
+        t->piv=(int*)malloc((n+2*np+1)*sizeof(int));
+        if(t->zmat==NULL || t->piv==NULL)
+            return 1;
+        t->w=t->zmat+nz;
+        t->y=t->w+np*n;
+        t->nx=t->y+np*np;
+        t->ny=t->nx+np;
+        t->c=t->ny+np;
+        t->a=t->c+np*np+np;
+        t->cpiv=t->piv+n;
+        t->lport=t->cpiv+np+1;
+    }
+    t->freq=0;
+    t0=qfh_stats_start(t->stats);
+    if(sy) {
+        if(sym_fill(sy, &t->ms, freq, nthreads, NULL, 0, t->stats))
+            return 1;
+    } else
+        fill_matrix(&t->ms, freq, nthreads, t->zmat, t->stats);
+    qfh_stats_stop(t->stats, QFH_PHASE_FILL, t0);
+    t0=qfh_stats_start(t->stats);
+    if(sy ? sym_factor(sy, n, t->stats) : qfh_lu_factor(t->zmat, n, t->piv))
+        return 1;
+    qfh_stats_stop(t->stats, QFH_PHASE_FACTOR, t0);
+    t0=qfh_stats_start(t->stats);
+    if(!sy)
+        count_lu(t->stats, n, t->nport);
+    u.v=1;
+    for(p=0;p<t->nport;p++) {
+        u.seg=t->seg[p];
+        memset(t->w+p*n, 0, n*sizeof(double complex));
+        qfh_port_rhs(&t->ms, &u, t->w+p*n);
+        if(sy)
+            sym_solve(sy, n, t->w+p*n, t->stats);
+        else
+            qfh_lu_solve(t->zmat, n, t->piv, t->w+p*n);
+        zenith_vector(&t->ms, freq, t->w+p*n, &t->nx[p], &t->ny[p]);
+    }
+    for(p=0;p<t->nport;p++)
+        for(q=0;q<t->nport;q++)
+            t->y[p*np+q]=qfh_port_current(&t->ms, t->w+q*n, t->seg[p]);
+    t->freq=freq;
+    qfh_stats_stop(t->stats, QFH_PHASE_SOLVE, t0);
+    return 0;
+}
+
+/* Solves the factored model with feeds[i] ('F', 'T', 'O' or 'S', as in
+ * the helix input) on helix i, with the same voltages and loads as
+ * qfh_solve_model(). The result is that of the first fed helix. The
+ * basis function currents are stored in cur unless it is NULL, which is
+ * the only part of a case that depends on the mesh size. Returns 0 on
+ * success, 1 if no helix is fed or one without a feed wire is not open. */
+int qfh_term_solve(qfh_term *t, const char *feeds, qfh_result *res,
+                   double complex *cur)
+{
+    int i, j, p, q, nl=0, np=t->nport, feed=-1, n=t->ms.nbasis;
+    double complex *c=t->c, *a=t->a, ifeed=0, nx=0, ny=0, v;
+    double scale=t->split ? 0.5 : 1, pin=0;
+
+    if(t->freq==0)
+        return 1;
+    // sources go into a, loads are the rows of c
+    for(p=0;p<np;p++) {
+        a[p]=0;
+        switch(toupper(feeds[t->helix[p]])) {
+            case 'F':
+                a[p]=(t->split && p>t->first[t->helix[p]]) ? -scale : scale;
+                if(feed<0)
+                    feed=p;
+                break;
+            case 'T':
+            case 'O':
+                t->lport[nl++]=p;
+                break;
+        }
+    }
+    for(i=0;i<t->nhelix;i++)
+        if(t->first[i]<0 && toupper(feeds[i])!='O')
+            return 1;
+    if(feed<0)
+        return 1;
+    // (D^-1 + U^T W) c = U^T x
+    for(i=0;i<nl;i++) {
+        p=t->lport[i];
+        for(j=0;j<nl;j++)
+            c[i*nl+j]=t->y[p*np+t->lport[j]];
+        if(toupper(feeds[t->helix[p]])=='T')
+            c[i*nl+i]+=1/(50*scale);
+        for(v=0,q=0;q<np;q++)
+            v+=t->y[p*np+q]*a[q];
+        c[nl*nl+i]=v;
+    }
+    if(nl>0) {
+        if(qfh_lu_factor(c, nl, t->cpiv))
+            return 1;
+        qfh_lu_solve(c, nl, t->cpiv, c+nl*nl);
+        for(i=0;i<nl;i++)
+            a[t->lport[i]]-=c[nl*nl+i];
+    }
+    // everything else is a sum of the port responses
+    for(p=0;p<np;p++) {
+        nx+=a[p]*t->nx[p];
+        ny+=a[p]*t->ny[p];
+    }
+    for(p=0;p<np;p++) {
+        if(toupper(feeds[t->helix[p]])!='F')
+            continue;
+        for(v=0,q=0;q<np;q++)
+            v+=t->y[p*np+q]*a[q];
+        if(p==feed)
+            ifeed=v;
+        pin+=0.5*creal(a[p]*conj(v));
+    }
+    res->freq=t->freq;
+    // the halves of a split feed wire are in series
+    res->z=(t->split ? 2*a[feed] : a[feed])/ifeed;
+    res->swr=qfh_swr(res->z, 50);
+    res->gain=vector_gain(t->freq, nx, ny, pin);
+    res->axial=vector_axial(nx, ny);
+    if(cur) {
+        memset(cur, 0, n*sizeof(double complex));
+        for(p=0;p<np;p++)
+            if(a[p]!=0)
+                axpy(cur, t->w+(size_t)p*n, a[p], n);
+    }
+    return 0;
+}
+
+void qfh_term_free(qfh_term *t)
+{
+    if(t->sym) {
+        sym_free((sym_solver*)t->sym);
+        free(t->sym);
+    }
+    qfh_mesh_free(&t->ms);
+    free(t->first);
+    free(t->seg);
+    free(t->zmat);
+    free(t->piv);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,178 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Run statistics: wall time and calls per phase, sizes and the
+ * estimated work of the solver, kept in a qfh_stats that the caller
+ * hangs on a qfh_ctx (building and writing) or a qfh_model (solving).
+ * Nothing is accounted where the pointer is NULL, and a thread only
+ * touches its own qfh_stats; a sweep gives each thread one and merges
+ * them at the end.
+ *
+ * The hot path counters (QFH_COUNT) cost an add in the innermost loops,
+ * so they are compiled in only with -DQFH_COUNTERS.
+ */
+
+#include<stdio.h>
+#include<string.h>
+#include<time.h>
+#include "qfh.h"
+
+static const char *phase_names[QFH_NPHASES]={
+    "parse", "design", "geometry", "check", "emit", "fill", "factor",
+    "solve"
+};
+
+static const char *counter_names[QFH_NCOUNTERS]={
+    "points", "writes", "pairs", "near_pairs"
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+void qfh_stats_init(qfh_stats *s)
+{
+    memset(s, 0, sizeof(*s));
+#ifdef QFH_COUNTERS
+    s->counters=1;
+#endif
+}
+
+/* Start of a phase, to be handed to qfh_stats_stop() */
+double qfh_stats_start(const qfh_stats *s)
+{
+    return s ? now() : 0;
+}
+
+/* Accounts the time since t0 to phase, nothing if s is NULL */
+void qfh_stats_stop(qfh_stats *s, int phase, double t0)
+{
+    if(s==NULL)
+        return;
+    s->seconds[phase]+=now()-t0;
+    s->calls[phase]++;
+}
+
+void qfh_stats_merge(qfh_stats *to, const qfh_stats *from)
+{
+    int i;
+
+    for(i=0;i<QFH_NPHASES;i++) {
+        to->seconds[i]+=from->seconds[i];
+        to->calls[i]+=from->calls[i];
+    }
+    to->tags+=from->tags;
+    to->segments+=from->segments;
+    to->bytes+=from->bytes;
+    if(from->unknowns>to->unknowns)
+        to->unknowns=from->unknowns;
+    to->flops+=from->flops;
+    for(i=0;i<QFH_NCOUNTERS;i++)
+        to->count[i]+=from->count[i];
+}
+
+/* Real floating point operations of the complex LU factorization of
+ * order n: n^3/3 complex multiply-adds of 8 each */
+double qfh_lu_flops(int n)
+{
+    return 8.0/3*(double)n*n*n;
+}
+
+/* Human readable report; wall is the elapsed time of the run, against
+ * which the phases are given as shares */
+void qfh_stats_print(const qfh_stats *s, double wall, FILE *f)
+{
+    double solver=s->seconds[QFH_PHASE_FILL]+s->seconds[QFH_PHASE_FACTOR]+
+        s->seconds[QFH_PHASE_SOLVE];
+    int i;
+
+    fprintf(f, "phase         calls     seconds   share\n");
+    for(i=0;i<QFH_NPHASES;i++)
+        if(s->calls[i])
+            fprintf(f, "%-9s %9ld %11.6f %6.1f%%\n", phase_names[i],
+                    s->calls[i], s->seconds[i],
+                    wall>0 ? 100*s->seconds[i]/wall : 0.0);
+    fprintf(f, "%ld tags, %ld segments, %llu bytes written in %.6f s\n",
+            s->tags, s->segments, (unsigned long long)s->bytes, wall);
+    if(s->unknowns)
+        fprintf(f, "largest system %d unknowns, estimated solver work "
+                "%.3g Gflop, %.2f Gflop/s\n", s->unknowns, s->flops*1e-9,
+                solver>0 ? s->flops*1e-9/solver : 0.0);
+    if(!s->counters) {
+        fprintf(f, "counters not compiled in (build with -DQFH_COUNTERS)\n");
+        return;
+    }
+    fprintf(f, "counters:");
+    for(i=0;i<QFH_NCOUNTERS;i++)
+        fprintf(f, " %s %llu", counter_names[i],
+                (unsigned long long)s->count[i]);
+    fprintf(f, "\n");
+}
+
+/* The same as one JSON object on one line. Returns 0 on success. */
+int qfh_stats_json(const qfh_stats *s, double wall, FILE *f)
+{
+    int i;
+
+    fprintf(f, "{\"wall\": %.9g, \"phases\": {", wall);
+    for(i=0;i<QFH_NPHASES;i++)
+        fprintf(f, "%s\"%s\": {\"calls\": %ld, \"seconds\": %.9g}",
+                i ? ", " : "", phase_names[i], s->calls[i], s->seconds[i]);
+    fprintf(f, "}, \"tags\": %ld, \"segments\": %ld, \"bytes\": %llu, "
+            "\"unknowns\": %d, \"flops\": %.9g, \"counters\": ", s->tags,
+            s->segments, (unsigned long long)s->bytes, s->unknowns,
+            s->flops);
+    if(s->counters) {
+        for(i=0;i<QFH_NCOUNTERS;i++)
+            fprintf(f, "%s\"%s\": %llu", i ? ", " : "{", counter_names[i],
+                    (unsigned long long)s->count[i]);
+        fprintf(f, "}");
+    } else
+        fprintf(f, "null");
+    fprintf(f, "}\n");
+    return ferror(f);
+}
+
+/* Prints the statistics of a run that took wall seconds if print is set,
+ * and writes them as JSON to the file json ("-" for stdout) unless it is
+ * NULL. Returns 1 if the JSON could not be written. */
+int qfh_stats_write(const qfh_stats *st, double wall, int print,
+                    const char *json)
+{
+    FILE *f;
+    int err;
+
+    if(print)
+        qfh_stats_print(st, wall, stdout);
+    if(json==NULL)
+        return 0;
+    if(strcmp(json, "-")==0)
+        return qfh_stats_json(st, wall, stdout);
+    if((f=fopen(json, "w"))==NULL) {
+        printf("Could not open statistics file %s\n",json);
+        return 1;
+    }
+    err=qfh_stats_json(st, wall, f);
+    if(fclose(f) || err) {
+        printf("Error writing statistics file %s\n",json);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Manufacturing tolerance analysis.
+ *
+ * A design is sized once with qfh_compute_design(), then built and
+ * solved again and again with its height, diameter and bending radius
+ * (each loop on its own) and its wire diameter (the same for both
+ * loops) off by random amounts, as hand bent antennas are. Every sample
+ * is built as a symmetric model and solved across the band like the
+ * candidates of the optimizer, and counts towards the yield if its SWR
+ * stays below the goal at every point.
+ *
+ * The samples are drawn a batch at a time by the calling thread and
+ * solved on a work stealing pool, one sample per task; the statistics
+ * are then updated in sample order, so a given seed gives the same
+ * figures whatever the number of threads.
+ */
+
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include "qfh.h"
+
+/* Scratch space of one pool thread */
+typedef struct {
+    qfh_model m;
+    helix h[2];
+    qfh_result *res;
+} tol_worker;
+
+/* A perturbed design and what the solver made of it */
+typedef struct {
+    helix h[2];
+    double swr; // highest over the band, HUGE_VAL if it failed
+    double res; // resonance in MHz, NAN if none in the band
+} tol_sample;
+
+typedef struct {
+    const qfh_tol_spec *spec;
+    tol_worker *worker;
+    tol_sample *sample;
+} tol_job;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* splitmix64, uniform in [0, 1) */
+static double uniform(unsigned long long *state)
+{
+    unsigned long long z=(*state+=0x9e3779b97f4a7c15ULL);
+
+    z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+    z=(z^(z>>27))*0x94d049bb133111ebULL;
+    z^=z>>31;
+    return (z>>11)*(1.0/9007199254740992.0);
+}
+
+/* An error drawn from t, in mm. Normal errors are drawn by Box-Muller
+ * from two uniform numbers whatever the width, so the sequence of the
+ * other dimensions does not depend on it. */
+static double draw(const qfh_tolerance *t, unsigned long long *state)
+{
+    double u=uniform(state), v=uniform(state);
+
+    if(t->dist=='u')
+        return (2*u-1)*t->width;
+    return t->width*sqrt(-2*log1p(-u))*cos(2*pi*v);
+}
+
+/* Errors of 1 mm in the height and diameter of the loops and 0.5 mm in
+ * the bending radius, standard deviations of normal distributions, and
+ * none in the wire, over a 2% band at 5 points at 12 segments per
+ * wavelength */
+void qfh_tol_init(qfh_tol_spec *s, const design_req *req)
+{
+    static const qfh_tolerance dflt[QFH_NTOL]={
+        {'n', 1}, {'n', 1}, {'n', 0.5}, {'n', 0}
+    };
+
+    s->req=*req;
+    s->band=req->freq*0.02;
+    s->npoints=5;
+    s->swr=2;
+    memcpy(s->tol, dflt, sizeof(dflt));
+    s->spw=12;
+    s->samples=1000;
+    s->batch=256;
+    s->seed=1;
+}
+
+/* Parses [normal:|uniform:]mm into t, a bare width being a standard
+ * deviation. Returns 0 on success. */
+int qfh_tolerance_parse(qfh_tolerance *t, const char *spec)
+{
+    char *end;
+
+    t->dist='n';
+    if(strncmp(spec, "normal:", 7)==0)
+        spec+=7;
+    else if(strncmp(spec, "uniform:", 8)==0) {
+        t->dist='u';
+        spec+=8;
+    }
+    t->width=strtod(spec, &end);
+    return end==spec || *end || !(t->width>=0);
+}
+
+/* Frequency at which the reactance crosses zero going up, by linear
+ * interpolation between the points either side, the crossing nearest
+ * to the centre of the band if there are several. NAN if none. */
+static double resonance(const qfh_result *res, int n, double centre)
+{
+    double x0, x1, f, best=NAN;
+    int i;
+
+    for(i=0;i+1<n;i++) {
+        x0=cimag(res[i].z);
+        x1=cimag(res[i+1].z);
+        if(!(x0<=0 && x1>0))
+            continue;
+        f=res[i].freq+(res[i+1].freq-res[i].freq)*(-x0)/(x1-x0);
+        if(isnan(best) || fabs(f-centre)<fabs(best-centre))
+            best=f;
+    }
+    return best;
+}
+
+static void evaluate(void *arg, long task, int worker)
+{
+    tol_job *job=(tol_job*)arg;
+    const qfh_tol_spec *s=job->spec;
+    tol_worker *w=&job->worker[worker];
+    tol_sample *smp=&job->sample[task];
+    qfh_ctx ctx;
+    int f, k;
+
+    smp->swr=HUGE_VAL;
+    smp->res=NAN;
+    for(k=0;k<2;k++) {
+        w->h[k]=smp->h[k];
+        if(!(w->h[k].H>0 && w->h[k].D>0 && w->h[k].wire>0) ||
+           w->h[k].R<0 || 2*w->h[k].R>=w->h[k].D ||
+           2*w->h[k].R>=w->h[k].H)
+            return;
+    }
+    w->m.h=w->h;
+    w->m.nhelix=1;
+    w->m.comment_base=1;
+    w->m.fstep=s->npoints>1 ? s->band/(s->npoints-1) : 1;
+    w->m.fstart=s->req.freq-s->band/2;
+    w->m.fstop=w->m.fstart+(s->npoints-0.5)*w->m.fstep;
+    qfh_init(&ctx, NULL, NULL, NULL);
+    ctx.symmetric=1;
+    if(s->spw>0)
+        qfh_adaptive_segmentation(&w->m, s->spw, &ctx.seg);
+    if(qfh_build_model(&ctx, &w->m) || qfh_solve_model(&w->m, 1, 0, w->res))
+        return;
+    smp->swr=0;
+    for(f=0;f<s->npoints;f++)
+        smp->swr=fmax(smp->swr, w->res[f].swr);
+    smp->res=resonance(w->res, s->npoints, s->req.freq);
+}
+
+/* Draws the dimensions of a sample off those of the nominal design */
+static void perturb(const qfh_tol_spec *s, const helix *nominal,
+                    tol_sample *smp, unsigned long long *state)
+{
+    double dwire=draw(&s->tol[QFH_TOL_WIRE], state)/2;
+    int k;
+
+    for(k=0;k<2;k++) {
+        smp->h[k]=nominal[k];
+        smp->h[k].H+=draw(&s->tol[QFH_TOL_HEIGHT], state);
+        smp->h[k].D+=draw(&s->tol[QFH_TOL_DIAMETER], state);
+        smp->h[k].R+=draw(&s->tol[QFH_TOL_BEND], state);
+        smp->h[k].wire+=dwire;
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x=*(const double*)a, y=*(const double*)b;
+
+    return (x>y)-(x<y);
+}
+
+/* Value below which a fraction p of the n sorted values lie */
+static double percentile(const double *v, long n, double p)
+{
+    double x=p*(n-1);
+    long i=(long)x;
+
+    if(i+1>=n)
+        return v[n-1];
+    return v[i]+(x-i)*(v[i+1]-v[i]);
+}
+
+/* Folds the samples of a batch into r, the resonances found so far
+ * being kept in res and the sum of the worst SWRs in swr_sum */
+static void update_result(const tol_sample *smp, long n, double *res,
+                          double *sorted, double *swr_sum,
+                          const qfh_tol_spec *s, qfh_tol_result *r)
+{
+    double sum=0, sum2=0;
+    long i;
+
+    for(i=0;i<n;i++) {
+        if(isinf(smp[i].swr))
+            r->failed++;
+        else {
+            *swr_sum+=smp[i].swr;
+            if(smp[i].swr<s->swr)
+                r->pass++;
+        }
+        if(!isnan(smp[i].res))
+            res[r->resonant++]=smp[i].res;
+    }
+    r->samples+=n;
+    r->yield=(double)r->pass/r->samples;
+    if(r->samples>r->failed)
+        r->swr_mean=*swr_sum/(r->samples-r->failed);
+    if(r->resonant==0)
+        return;
+    for(i=0;i<r->resonant;i++) {
+        sum+=res[i];
+        sum2+=res[i]*res[i];
+    }
+    r->res_mean=sum/r->resonant;
+    r->res_sd=r->resonant>1 ?
+        sqrt(fmax(0, (sum2-sum*r->res_mean)/(r->resonant-1))) : 0;
+    memcpy(sorted, res, r->resonant*sizeof(double));
+    qsort(sorted, r->resonant, sizeof(double), cmp_double);
+    r->res_lo=sorted[0];
+    r->res_hi=sorted[r->resonant-1];
+    r->res_p5=percentile(sorted, r->resonant, 0.05);
+    r->res_p50=percentile(sorted, r->resonant, 0.5);
+    r->res_p95=percentile(sorted, r->resonant, 0.95);
+}
+
+/* Solves the nominal design, then s->samples perturbed ones in batches
+ * of s->batch on nthreads threads, calling report (if not NULL) after
+ * every batch. Returns 0 on success, 1 if out of memory or the spec is
+ * unusable. */
+int qfh_tol_run(const qfh_tol_spec *s, int nthreads, qfh_tol_report report,
+                void *opaque, qfh_tol_result *r)
+{
+    unsigned long long state=s->seed;
+    helix nominal[2];
+    qfh_pool pool;
+    tol_job job;
+    double *res, *sorted, swr_sum=0, t0=now();
+    long done, n, i;
+    int err=0;
+
+    memset(r, 0, sizeof(*r));
+    r->nominal_res=NAN;
+    if(s->npoints<1 || s->band<0 || s->samples<1 || s->batch<1 ||
+       qfh_check_design(&s->req, NULL, 0))
+        return 1;
+    qfh_compute_design(&s->req, nominal);
+    res=(double*)malloc(s->samples*sizeof(double));
+    sorted=(double*)malloc(s->samples*sizeof(double));
+    job.sample=(tol_sample*)malloc(s->batch*sizeof(tol_sample));
+    job.worker=(tol_worker*)calloc(nthreads, sizeof(tol_worker));
+    if(res==NULL || sorted==NULL || job.sample==NULL || job.worker==NULL)
+        err=1;
+    for(i=0;i<nthreads && !err;i++)
+        if((job.worker[i].res=(qfh_result*)malloc(s->npoints*
+                                   sizeof(qfh_result)))==NULL)
+            err=1;
+    if(err || qfh_pool_init(&pool, nthreads)) {
+        if(job.worker)
+            for(i=0;i<nthreads;i++)
+                free(job.worker[i].res);
+        free(job.worker);
+        free(job.sample);
+        free(sorted);
+        free(res);
+        return 1;
+    }
+    job.spec=s;
+
+    memcpy(job.sample[0].h, nominal, sizeof(nominal));
+    qfh_pool_run(&pool, 1, evaluate, &job);
+    r->nominal_swr=job.sample[0].swr;
+    r->nominal_res=job.sample[0].res;
+
+    for(done=0;done<s->samples;done+=n) {
+        n=s->samples-done<s->batch ? s->samples-done : s->batch;
+        for(i=0;i<n;i++)
+            perturb(s, nominal, &job.sample[i], &state);
+        qfh_pool_run(&pool, n, evaluate, &job);
+        update_result(job.sample, n, res, sorted, &swr_sum, s, r);
+        r->seconds=now()-t0;
+        r->steals=qfh_pool_steals(&pool);
+        if(report)
+            report(opaque, r);
+    }
+
+    qfh_pool_free(&pool);
+    for(i=0;i<nthreads;i++) {
+        qfh_model_free(&job.worker[i].m);
+        free(job.worker[i].res);
+    }
+    free(job.worker);
+    free(job.sample);
+    free(sorted);
+    free(res);
+    return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ *     This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * qfharc: lists the deck archives written by QFH2nec --archive and gets
+ * decks out of them. The archive is mapped into memory, a deck is found
+ * with a binary search of the index and written straight from the
+ * mapping.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include "qfh.h"
+
+/* Prints v with the fewest digits that read back as exactly v */
+static void format_exact(char *s, size_t len, double v)
+{
+    int prec;
+
+    for(prec=6;prec<17;prec++) {
+        snprintf(s, len, "%.*g", prec, v);
+        if(strtod(s, NULL)==v)
+            return;
+    }
+    snprintf(s, len, "%.17g", v);
+}
+
+static void entry_values(const qfh_archive_entry *e, char v[6][32])
+{
+    int k;
+
+    for(k=0;k<6;k++)
+        format_exact(v[k], sizeof(v[k]), e->key[k]);
+}
+
+static int list_main(const qfh_archive_reader *r)
+{
+    char v[6][32];
+    long i;
+
+    printf("# format freq turns length radius diam ratio bytes offset\n");
+    for(i=0;i<r->n;i++) {
+        entry_values(&r->index[i], v);
+        printf("%-8.8s %s %s %s %s %s %s %llu %llu\n", r->index[i].format,
+               v[0], v[1], v[2], v[3], v[4], v[5],
+               (unsigned long long)r->index[i].length,
+               (unsigned long long)r->index[i].offset);
+    }
+    return 0;
+}
+
+/* Looks the design up by its exact values, then by values within 1e-9
+ * of them so that a sweep point like 0.1+2*0.1 is found as 0.3 */
+static int cat_main(const qfh_archive_reader *r, const char *format,
+                    char *argv[])
+{
+    design_req req;
+    const qfh_archive_entry *e;
+    const char *deck;
+    double v[6];
+    size_t len;
+    long i;
+    int k;
+
+    for(k=0;k<6;k++)
+        if(sscanf(argv[k], "%lf", &v[k])!=1) {
+            fprintf(stderr, "Invalid value %s\n", argv[k]);
+            return 1;
+        }
+    req.freq=v[0];
+    req.turns=v[1];
+    req.length=v[2];
+    req.radius=v[3];
+    req.diam=v[4];
+    req.ratio=v[5];
+    if((deck=qfh_archive_find(r, &req, format, &len))==NULL) {
+        for(i=0;i<r->n;i++) {
+            e=&r->index[i];
+            if(strncmp(e->format, format, sizeof(e->format)))
+                continue;
+            for(k=0;k<6;k++)
+                if(fabs(e->key[k]-v[k])>1e-9*fabs(v[k]))
+                    break;
+            if(k==6)
+                break;
+        }
+        if(i==r->n) {
+            fprintf(stderr, "No %s deck of that design in the archive\n",
+                    format);
+            return 1;
+        }
+        deck=qfh_archive_deck(r, i, &len);
+    }
+    if(fwrite(deck, 1, len, stdout)!=len || fflush(stdout)) {
+        perror("stdout");
+        return 1;
+    }
+    return 0;
+}
+
+/* Writes every deck to a file named as QFH2nec would, with all the digits
+ * needed to tell the designs apart */
+static int unpack_main(const qfh_archive_reader *r, const char *dir)
+{
+    const qfh_emitter *fmt;
+    char v[6][32], format[9], filename[4096];
+    const char *deck;
+    size_t len;
+    FILE *f;
+    long i, failed=0;
+
+    for(i=0;i<r->n;i++) {
+        entry_values(&r->index[i], v);
+        memcpy(format, r->index[i].format, 8);
+        format[8]='\0';
+        fmt=qfh_find_emitter(format);
+        snprintf(filename, sizeof(filename), "%s%sQFH %s_%s_%s_%s_%s_%s.%s",
+                 dir ? dir : "", dir ? "/" : "",
+                 v[0], v[1], v[5], v[2], v[3], v[4], fmt ? fmt->ext : format);
+        deck=qfh_archive_deck(r, i, &len);
+        if((f=fopen(filename, "w"))==NULL) {
+            printf("Could not open output file %s\n",filename);
+            failed++;
+            continue;
+        }
+        if(fwrite(deck, 1, len, f)!=len || fclose(f)) {
+            printf("Error writing output file %s\n",filename);
+            failed++;
+        }
+    }
+    printf("Wrote %ld decks\n", r->n-failed);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    qfh_archive_reader r;
+    int ret;
+
+    if(argc<3 || (strcmp(argv[1],"list")==0 && argc!=3) ||
+       (strcmp(argv[1],"cat")==0 && argc!=10) ||
+       (strcmp(argv[1],"unpack")==0 && argc>4)) {
+        printf("Usage:\n");
+        printf("qfharc list <archive>\n");
+        printf("qfharc cat <archive> <format> <frequency> <turns> <length> <radius> <diameter> <ratio>\n");
+        printf("qfharc unpack <archive> [directory]\n");
+        exit(1);
+    }
+    if(strcmp(argv[1],"list") && strcmp(argv[1],"cat") &&
+       strcmp(argv[1],"unpack")) {
+        printf("Unknown command %s\n",argv[1]);
+        exit(1);
+    }
+    if(qfh_archive_map(&r, argv[2])) {
+        fprintf(stderr, "Could not read archive %s\n", argv[2]);
+        exit(1);
+    }
+    if(r.unclosed)
+        fprintf(stderr, "%s was not closed, %ld decks found by scanning it\n",
+                argv[2], r.n);
+    if(strcmp(argv[1],"list")==0)
+        ret=list_main(&r);
+    else if(strcmp(argv[1],"cat")==0)
+        ret=cat_main(&r, argv[3], argv+4);
+    else
+        ret=unpack_main(&r, argc==4 ? argv[3] : NULL);
+    qfh_archive_unmap(&r);
+    return ret;
+}